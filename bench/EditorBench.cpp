@@ -0,0 +1,357 @@
+#include <QApplication>
+#include <QClipboard>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QKeyEvent>
+#include <QStackedWidget>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+#include "MainWindow.h"
+#include "TextEditor.h"
+#include "LiteralSearcher.h"
+#include "ReplaceAll.h"
+
+// Headless benchmark of the editor's hot paths. Every size gets a fresh
+// MainWindow and a synthetic document; the results go out as JSON so that
+// runs can be compared by a script.
+
+// Longest any single case may take before it is reported as timed out
+static const int CaseTimeoutMs = 10 * 60 * 1000;
+
+// Pastes are capped so that the largest documents do not double in size
+static const qint64 MaxPasteSize = 64 * 1024 * 1024;
+
+// Every this many lines of synthetic text holds the word find and replace look for
+static const int NeedleInterval = 100;
+
+static const char *const Words[] = {
+    "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+    "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa"
+};
+
+static qint64 parseSize(const QString &text)
+{
+    QString digits = text.trimmed().toUpper();
+    qint64 unit = 1;
+    if (digits.endsWith('K'))
+        unit = 1024;
+    else if (digits.endsWith('M'))
+        unit = 1024 * 1024;
+    else if (digits.endsWith('G'))
+        unit = 1024 * 1024 * 1024;
+    if (unit > 1)
+        digits.chop(1);
+
+    bool ok;
+    const qint64 value = digits.toLongLong(&ok);
+    return ok && value > 0 ? value * unit : -1;
+}
+
+static QByteArray syntheticText(qint64 size, qint64 *line)
+{
+    QByteArray text;
+    text.reserve(int(qMin<qint64>(size, 1024 * 1024)) + 128);
+    quint32 seed = 12345u + quint32(*line);
+    while (text.size() < size) {
+        if (*line % NeedleInterval == 0)
+            text += "needle ";
+        for (int i = 0; i < 8; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            text += Words[(seed >> 16) % (sizeof(Words) / sizeof(Words[0]))];
+            text += i < 7 ? ' ' : '\n';
+        }
+        ++*line;
+    }
+    text.truncate(int(size));
+    return text;
+}
+
+static bool writeDocument(const QString &fileName, qint64 size)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    qint64 line = 0;
+    for (qint64 written = 0; written < size; ) {
+        const QByteArray chunk = syntheticText(qMin<qint64>(size - written, 1024 * 1024), &line);
+        if (file.write(chunk) != chunk.size())
+            return false;
+        written += chunk.size();
+    }
+    return true;
+}
+
+// Clearing the reference bits also resets the peak the kernel reports
+static void resetPeakRss()
+{
+#ifdef Q_OS_LINUX
+    QFile file("/proc/self/clear_refs");
+    if (file.open(QIODevice::WriteOnly))
+        file.write("5");
+#endif
+}
+
+static qint64 peakRssKb()
+{
+#ifdef Q_OS_LINUX
+    QFile file("/proc/self/status");
+    if (file.open(QIODevice::ReadOnly)) {
+        for (const QByteArray &line : file.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:"))
+                return line.mid(6).trimmed().split(' ').first().toLongLong();
+        }
+    }
+#endif
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+#endif
+    return -1;
+}
+
+static bool waitUntil(const std::function<bool()> &done)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!done()) {
+        if (timer.elapsed() > CaseTimeoutMs)
+            return false;
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    }
+    return true;
+}
+
+// The tab bar's stack also holds pages, so look for the one showing an editor
+static TextEditor *currentEditor(MainWindow *window)
+{
+    for (QStackedWidget *stack : window->findChildren<QStackedWidget *>()) {
+        if (TextEditor *editor = qobject_cast<TextEditor *>(stack->currentWidget()))
+            return editor;
+    }
+    return nullptr;
+}
+
+static QJsonObject latencyStats(std::vector<double> samples)
+{
+    QJsonObject stats;
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) {
+        return samples[std::min(samples.size() - 1, size_t(p * (samples.size() - 1) + 0.5))];
+    };
+    stats["samples"] = int(samples.size());
+    stats["p50Ms"] = percentile(0.50);
+    stats["p90Ms"] = percentile(0.90);
+    stats["p99Ms"] = percentile(0.99);
+    stats["maxMs"] = samples.back();
+    return stats;
+}
+
+static QJsonObject result(const QString &name, qint64 size, qint64 bytes, double seconds, bool ok)
+{
+    QJsonObject object;
+    object["case"] = name;
+    object["documentSize"] = size;
+    object["ok"] = ok;
+    object["seconds"] = seconds;
+    if (bytes > 0 && seconds > 0)
+        object["throughputMBps"] = double(bytes) / (1024 * 1024) / seconds;
+    return object;
+}
+
+static double elapsedMs(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1e6;
+}
+
+static QJsonArray runSize(qint64 size, const QString &fileName, int samples)
+{
+    QJsonArray results;
+    resetPeakRss();
+
+    MainWindow window;
+    window.show();
+    QElapsedTimer timer;
+
+    // Open: the same path as a click in the search results
+    timer.start();
+    QMetaObject::invokeMethod(&window, "openSearchResult", Q_ARG(QString, fileName), Q_ARG(int, 0));
+    bool ok = waitUntil([&]() {
+        TextEditor *editor = currentEditor(&window);
+        return editor && !editor->isReadOnly();
+    });
+    results.append(result("open", size, size, elapsedMs(timer) / 1000, ok));
+    TextEditor *editor = currentEditor(&window);
+    if (!ok || !editor)
+        return results;
+
+    // Find: each call moves on to the next match
+    const LiteralSearcher needle("needle", Qt::CaseSensitive);
+    std::vector<double> latencies;
+    for (int i = 0; i < samples; ++i) {
+        timer.start();
+        editor->findText(needle);
+        latencies.push_back(elapsedMs(timer));
+    }
+    QJsonObject find = result("find", size, 0, 0, true);
+    find["latency"] = latencyStats(latencies);
+    results.append(find);
+
+    // Status bar: what the status timer runs after every cursor move
+    latencies.clear();
+    for (int i = 0; i < samples; ++i) {
+        timer.start();
+        QMetaObject::invokeMethod(&window, "updateStatusBar");
+        latencies.push_back(elapsedMs(timer));
+    }
+    QJsonObject status = result("statusBar", size, 0, 0, true);
+    status["latency"] = latencyStats(latencies);
+    results.append(status);
+
+    // Typing: a key press and everything it posts
+    latencies.clear();
+    editor->setFocus();
+    for (int i = 0; i < samples; ++i) {
+        QKeyEvent press(QEvent::KeyPress, Qt::Key_A, Qt::NoModifier, "a");
+        QKeyEvent release(QEvent::KeyRelease, Qt::Key_A, Qt::NoModifier, "a");
+        timer.start();
+        QApplication::sendEvent(editor, &press);
+        QApplication::sendEvent(editor, &release);
+        QCoreApplication::processEvents();
+        latencies.push_back(elapsedMs(timer));
+    }
+    QJsonObject typing = result("typing", size, 0, 0, true);
+    typing["latency"] = latencyStats(latencies);
+    results.append(typing);
+
+    // Format merge over the whole document, on and off again
+    latencies.clear();
+    editor->selectAll();
+    for (int i = 0; i < 2; ++i) {
+        timer.start();
+        editor->setFontBold(i == 0);
+        QCoreApplication::processEvents();
+        latencies.push_back(elapsedMs(timer));
+    }
+    QJsonObject format = result("formatMerge", size, 0, 0, true);
+    format["latency"] = latencyStats(latencies);
+    results.append(format);
+
+    // Paste at the end, through the clipboard as the Paste action does
+    QTextCursor cursor = editor->textCursor();
+    cursor.movePosition(QTextCursor::End);
+    editor->setTextCursor(cursor);
+    qint64 line = 0;
+    const qint64 pasteSize = qMin(size, MaxPasteSize);
+    QApplication::clipboard()->setText(QString::fromUtf8(syntheticText(pasteSize, &line)));
+    timer.start();
+    QMetaObject::invokeMethod(&window, "paste");
+    ok = waitUntil([&]() { return !editor->isPasting() && !editor->isReadOnly(); });
+    results.append(result("paste", size, pasteSize, elapsedMs(timer) / 1000, ok));
+    QApplication::clipboard()->clear();
+
+    // Replace every needle, kept read-only meanwhile as MainWindow does
+    ReplaceAll replacer;
+    bool replaced = false;
+    QObject::connect(&replacer, &ReplaceAll::finished, [&]() { replaced = true; });
+    editor->setReadOnly(true);
+    timer.start();
+    replacer.start(editor, "needle", "pin", false, Qt::CaseSensitive);
+    ok = waitUntil([&]() { return replaced; });
+    editor->setReadOnly(false);
+    results.append(result("replace", size, size, elapsedMs(timer) / 1000, ok));
+
+    // Save the edited document back over the file
+    timer.start();
+    QMetaObject::invokeMethod(&window, "saveFile");
+    ok = waitUntil([&]() { return !editor->isReadOnly(); });
+    results.append(result("save", size, QFileInfo(fileName).size(), elapsedMs(timer) / 1000, ok));
+
+    QJsonObject memory = result("peakRss", size, 0, 0, true);
+    memory["peakRssKb"] = peakRssKb();
+    results.append(memory);
+    return results;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    app.setApplicationName("editor_bench");
+    app.setOrganizationName("Qt Learning");
+
+    // Settings, journals and caches go to a test location, never the user's
+    QStandardPaths::setTestModeEnabled(true);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks the editor's hot paths and prints JSON.");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption("sizes", "Comma-separated document sizes, e.g. 1K,1M,1G.",
+                                   "sizes", "1K,64K,1M,16M");
+    QCommandLineOption samplesOption("samples", "Samples per latency case.", "count", "200");
+    QCommandLineOption outputOption("output", "Write the JSON to file instead of stdout.", "file");
+    parser.addOption(sizesOption);
+    parser.addOption(samplesOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        qCritical("Cannot create a temporary directory: %s", qPrintable(directory.errorString()));
+        return 1;
+    }
+
+    QJsonArray results;
+    const int samples = qMax(1, parser.value(samplesOption).toInt());
+    for (const QString &text : parser.value(sizesOption).split(',', Qt::SkipEmptyParts)) {
+        const qint64 size = parseSize(text);
+        if (size < 0) {
+            qCritical("Invalid size: %s", qPrintable(text));
+            return 1;
+        }
+
+        const QString fileName = directory.filePath(QString("document-%1.txt").arg(size));
+        if (!writeDocument(fileName, size)) {
+            qCritical("Cannot write %s", qPrintable(fileName));
+            return 1;
+        }
+        for (const QJsonValue &value : runSize(size, fileName, samples))
+            results.append(value);
+        QFile::remove(fileName);
+    }
+
+    QJsonObject report;
+    report["qtVersion"] = QString(qVersion());
+    report["platform"] = QGuiApplication::platformName();
+    report["results"] = results;
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+            qCritical("Cannot write %s", qPrintable(file.fileName()));
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
\ No newline at end of file
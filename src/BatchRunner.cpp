@@ -0,0 +1,313 @@
+#include "BatchRunner.h"
+#include "PieceTable.h"
+#include <QCommandLineParser>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureSynchronizer>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <cstdio>
+#include <cstring>
+
+// Bytes checked for a NUL to tell binary files apart, as Find in Files does
+static const int BinaryProbe = 8192;
+
+static QString countName(bool replacing, bool dryRun)
+{
+    if (!replacing)
+        return QString("matches");
+    return dryRun ? QString("replacements (dry run)") : QString("replacements");
+}
+
+BatchRunner::BatchRunner()
+    : replacing(false)
+    , dryRun(false)
+    , nextFile(0)
+    , cancelled(false)
+    , nextPrinted(0)
+    , out(stdout)
+    , err(stderr)
+{
+}
+
+bool BatchRunner::isRequested(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--batch") == 0)
+            return true;
+    }
+    return false;
+}
+
+int BatchRunner::run(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Finds or replaces a pattern in many files without opening a window.");
+    const QCommandLineOption helpOption(QStringList() << "h" << "help", "Show this help.");
+    const QCommandLineOption batchOption("batch", "Run without a window.");
+    const QCommandLineOption replaceOption("replace", "Replace every match with <text>; \\0 to \\9 insert "
+                                           "the captures of a regular expression.", "text");
+    const QCommandLineOption regexOption("regex", "Treat the pattern as a regular expression.");
+    const QCommandLineOption ignoreCaseOption(QStringList() << "i" << "ignore-case", "Ignore case.");
+    const QCommandLineOption filesFromOption("files-from", "Also process the files listed in <file>, one "
+                                             "per line; - reads the list from standard input.", "file");
+    const QCommandLineOption threadsOption("threads", "Use <n> worker threads.", "n");
+    const QCommandLineOption dryRunOption("dry-run", "Count the replacements without writing any file.");
+    parser.addOptions({helpOption, batchOption, replaceOption, regexOption, ignoreCaseOption,
+                       filesFromOption, threadsOption, dryRunOption});
+    parser.addPositionalArgument("pattern", "Text, or regular expression, to find.");
+    parser.addPositionalArgument("files", "Files, directories (searched recursively) or wildcards such as "
+                                 "src/*.cpp and src/**/*.h.", "[files...]");
+
+    if (!parser.parse(arguments)) {
+        err << parser.errorText() << "\n";
+        return 2;
+    }
+    if (parser.isSet(helpOption)) {
+        out << parser.helpText();
+        return 0;
+    }
+
+    QStringList positional = parser.positionalArguments();
+    if (positional.isEmpty() || positional.first().isEmpty()) {
+        err << "No pattern given; see --batch --help.\n";
+        return 2;
+    }
+
+    const bool regex = parser.isSet(regexOption);
+    const Qt::CaseSensitivity cs = parser.isSet(ignoreCaseOption) ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    replacing = parser.isSet(replaceOption);
+    dryRun = parser.isSet(dryRunOption);
+    pattern = ReplaceAll::compile(positional.takeFirst(), parser.value(replaceOption), regex, cs);
+    if (regex && !pattern.expression.isValid()) {
+        err << "Invalid regular expression: " << pattern.expression.errorString() << "\n";
+        return 2;
+    }
+
+    int threadCount = QThread::idealThreadCount();
+    if (parser.isSet(threadsOption)) {
+        bool ok;
+        threadCount = parser.value(threadsOption).toInt(&ok);
+        if (!ok || threadCount < 1) {
+            err << "Invalid thread count: " << parser.value(threadsOption) << "\n";
+            return 2;
+        }
+    }
+
+    // Every file once, in the order given
+    QStringList fileNames;
+    bool listed = true;
+    for (const QString &argument : qAsConst(positional)) {
+        const QStringList expanded = expandArgument(argument);
+        if (expanded.isEmpty())
+            err << "No files match " << argument << "\n";
+        fileNames += expanded;
+    }
+    if (parser.isSet(filesFromOption)) {
+        QString errorString;
+        listed = readFileList(parser.value(filesFromOption), &fileNames, &errorString);
+        if (!listed)
+            err << "Cannot read " << parser.value(filesFromOption) << ": " << errorString << "\n";
+    }
+    QSet<QString> seen;
+    for (const QString &fileName : qAsConst(fileNames)) {
+        const QString path = QFileInfo(fileName).absoluteFilePath();
+        if (!seen.contains(path)) {
+            seen.insert(path);
+            files.append(fileName);
+        }
+    }
+    err.flush();
+
+    results.fill({0, 0, false, false, QString()}, files.size());
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+    QFutureSynchronizer<void> tasks;
+    for (int i = 0; i < qMin(threadCount, files.size()); ++i)
+        tasks.addFuture(QtConcurrent::run(&pool, [this]() { work(); }));
+    tasks.waitForFinished();
+
+    const qint64 elapsed = qMax<qint64>(1, timer.nsecsElapsed());
+    qint64 bytes = 0;
+    qint64 matches = 0;
+    int matchedFiles = 0;
+    int errors = listed ? 0 : 1;
+    for (const FileResult &result : qAsConst(results)) {
+        bytes += result.bytes;
+        matches += result.matches;
+        if (result.matches > 0)
+            ++matchedFiles;
+        if (!result.error.isEmpty())
+            ++errors;
+    }
+
+    const double seconds = elapsed / 1e9;
+    const double megabytes = bytes / (1024.0 * 1024.0);
+    out << QString("%1 files, %2 with %3 %4, %5 errors; %6 MB in %7 s, %8 MB/s\n")
+           .arg(files.size())
+           .arg(matchedFiles)
+           .arg(matches)
+           .arg(countName(replacing, dryRun))
+           .arg(errors)
+           .arg(megabytes, 0, 'f', 1)
+           .arg(seconds, 0, 'f', 3)
+           .arg(megabytes / seconds, 0, 'f', 1);
+    out.flush();
+
+    if (errors > 0)
+        return 2;
+    return matches > 0 ? 0 : 1;
+}
+
+QStringList BatchRunner::expandArgument(const QString &argument)
+{
+    const QFileInfo info(argument);
+    QString directory = argument;
+    QStringList nameFilters;
+    QDirIterator::IteratorFlags flags = QDirIterator::Subdirectories;
+    if (!info.isDir()) {
+        if (!argument.contains(QRegularExpression("[*?\\[]")))
+            return QStringList() << argument;
+
+        // Only the file name is a wildcard; "**" as the last directory
+        // stands for any depth below the one before it
+        directory = info.path();
+        nameFilters << info.fileName();
+        if (directory == QLatin1String("**") || directory.endsWith(QLatin1String("/**"))) {
+            directory.chop(2);
+            if (directory.size() > 1)
+                directory.chop(1);
+            if (directory.isEmpty())
+                directory = QLatin1String(".");
+        } else {
+            flags = QDirIterator::NoIteratorFlags;
+        }
+    }
+
+    QStringList found;
+    QDirIterator it(directory, nameFilters, QDir::Files, flags);
+    while (it.hasNext())
+        found.append(it.next());
+    found.sort();
+    return found;
+}
+
+bool BatchRunner::readFileList(const QString &listName, QStringList *files, QString *errorString)
+{
+    QFile file(listName);
+    const bool opened = listName == QLatin1String("-") ? file.open(stdin, QIODevice::ReadOnly)
+                                                       : file.open(QIODevice::ReadOnly);
+    if (!opened) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    while (!file.atEnd()) {
+        const QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (!line.isEmpty())
+            files->append(line);
+    }
+    return true;
+}
+
+void BatchRunner::work()
+{
+    // Each worker takes the next file as soon as it is done with one
+    for (int index = nextFile++; index < files.size(); index = nextFile++)
+        finishFile(index, process(files.at(index)));
+}
+
+BatchRunner::FileResult BatchRunner::process(const QString &fileName) const
+{
+    FileResult result = {0, 0, false, true, QString()};
+    PieceTable table;
+    if (!table.mapFile(fileName)) {
+        result.error = table.errorString();
+        return result;
+    }
+    result.bytes = table.size();
+
+    const QByteArray probe = table.read(0, qMin<qint64>(table.size(), BinaryProbe));
+    if (std::memchr(probe.constData(), 0, size_t(probe.size()))) {
+        result.binary = true;
+        return result;
+    }
+
+    // Chunks end on line breaks, like those of Replace All in buffer mode
+    QVector<PieceTable::Replacement> patches;
+    QString lastText;
+    QByteArray lastBytes;
+    qint64 matchedTo = 0;
+    for (qint64 start = 0; start < table.size();) {
+        const qint64 end = ReplaceAll::chunkEnd(table, start);
+        QVector<ReplaceAll::Replacement> found
+                = ReplaceAll::findInBytes(pattern, table, start, end - start, cancelled);
+        ReplaceAll::dropOverlaps(&found, &matchedTo);
+        result.matches += found.size();
+        if (replacing && !dryRun) {
+            for (const ReplaceAll::Replacement &replacement : found) {
+                if (replacement.text != lastText) {
+                    lastText = replacement.text;
+                    lastBytes = lastText.toUtf8();
+                }
+                patches.append({replacement.position, replacement.length, lastBytes});
+            }
+        }
+        start = end;
+    }
+    if (patches.isEmpty())
+        return result;
+
+    // The mapped original stays readable after the new file is renamed over it
+    table.replace(patches);
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        result.error = file.errorString();
+        return result;
+    }
+    bool ok = true;
+    table.forEachChunk(0, table.size(), [&](const char *data, qint64 length) {
+        if (ok)
+            ok = file.write(data, length) == length;
+    });
+    if (!ok || !file.commit())
+        result.error = file.errorString();
+    return result;
+}
+
+void BatchRunner::finishFile(int index, const FileResult &result)
+{
+    QMutexLocker locker(&mutex);
+    results[index] = result;
+
+    // Summaries go out in the order the files were given
+    while (nextPrinted < results.size() && results.at(nextPrinted).done) {
+        printResult(nextPrinted, results.at(nextPrinted));
+        ++nextPrinted;
+    }
+    out.flush();
+    err.flush();
+}
+
+void BatchRunner::printResult(int index, const FileResult &result)
+{
+    const QString &fileName = files.at(index);
+    if (!result.error.isEmpty()) {
+        err << fileName << ": " << result.error << "\n";
+        return;
+    }
+    if (result.binary) {
+        out << fileName << ": binary, skipped\n";
+        return;
+    }
+    out << fileName << ": " << result.matches << " " << countName(replacing, dryRun) << "\n";
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef BATCHRUNNER_H
+#define BATCHRUNNER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMutex>
+#include <QTextStream>
+#include <atomic>
+#include "ReplaceAll.h"
+
+// Find or replace over many files without a window, for scripts and CI
+// jobs. Each file is mapped into a piece table and searched with the
+// Replace All code a few megabytes at a time; replacements are written
+// to a temporary file that is renamed over the original. Worker threads
+// take the next file from a shared queue whenever they finish one, so a
+// few large files do not hold up the rest, and every file's summary is
+// printed in the order given as soon as it and the files before it are
+// done.
+class BatchRunner
+{
+public:
+    BatchRunner();
+
+    // Whether the command line asks for batch mode instead of the window
+    static bool isRequested(int argc, char **argv);
+
+    // Parses the command line, processes the files and returns the exit
+    // status: 0 if anything matched, 1 if nothing did, 2 on errors
+    int run(const QStringList &arguments);
+
+private:
+    struct FileResult
+    {
+        qint64 bytes;
+        qint64 matches;
+        bool binary;
+        bool done;
+        QString error;
+    };
+
+    BatchRunner(const BatchRunner &) = delete;
+    BatchRunner &operator=(const BatchRunner &) = delete;
+
+    static QStringList expandArgument(const QString &argument);
+    static bool readFileList(const QString &listName, QStringList *files, QString *errorString);
+    void work();
+    FileResult process(const QString &fileName) const;
+    void finishFile(int index, const FileResult &result);
+    void printResult(int index, const FileResult &result);
+
+    ReplaceAll::Pattern pattern;
+    bool replacing;
+    bool dryRun;
+    QStringList files;
+    QVector<FileResult> results;
+    std::atomic<int> nextFile;
+    // The search takes a cancel flag; nothing cancels a batch run
+    std::atomic<bool> cancelled;
+
+    // Guards results, nextPrinted and the output streams
+    QMutex mutex;
+    int nextPrinted;
+    QTextStream out;
+    QTextStream err;
+};
+
+#endif // BATCHRUNNER_H
\ No newline at end of file
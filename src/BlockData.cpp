@@ -0,0 +1,23 @@
+#include "BlockData.h"
+#include "DocumentMetrics.h"
+
+BlockData::BlockData()
+    : wordCount(0)
+{
+}
+
+BlockData::~BlockData()
+{
+    if (metrics)
+        metrics->words -= wordCount;
+}
+
+BlockData *BlockData::of(QTextBlock block)
+{
+    BlockData *data = static_cast<BlockData *>(block.userData());
+    if (!data) {
+        data = new BlockData;
+        block.setUserData(data);
+    }
+    return data;
+}
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef BLOCKDATA_H
+#define BLOCKDATA_H
+
+#include <QTextBlockUserData>
+#include <QTextBlock>
+#include <QPointer>
+
+class DocumentMetrics;
+
+// State cached per QTextBlock. The document deletes it together with the
+// block, which lets owners account for blocks that disappear.
+class BlockData : public QTextBlockUserData
+{
+public:
+    BlockData();
+    ~BlockData() override;
+
+    // Returns the block's data, attaching a fresh one if it has none
+    static BlockData *of(QTextBlock block);
+
+    int wordCount;
+    QPointer<DocumentMetrics> metrics;
+};
+
+#endif // BLOCKDATA_H
\ No newline at end of file
@@ -0,0 +1,420 @@
+#include "DocumentManager.h"
+#include "TextEditor.h"
+#include "EditJournal.h"
+#include "PieceTable.h"
+#include <QStackedWidget>
+#include <QScrollBar>
+#include <QTextDocument>
+#include <QTextCursor>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QStandardPaths>
+#include <QtConcurrent>
+
+static const quint32 SpillMagic = 0x5350494C; // "SPIL"
+static const quint32 SpillVersion = 3;
+
+// Rough cost of a QTextDocument: its UTF-16 text plus the fragment and
+// layout data kept for every block
+static const qint64 BytesPerCharacter = 2;
+static const qint64 BytesPerBlock = 200;
+
+struct DocumentManager::SpillState
+{
+    bool buffer;
+    bool modified;
+    int anchor;
+    int position;
+    int scroll;
+    qint64 line;
+    QString text;
+    QVector<QTextLayout::FormatRange> formats;
+    QByteArray history;
+    QSharedPointer<PieceTable> table;
+};
+
+static QString cacheTemplate()
+{
+    const QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    QDir().mkpath(directory);
+    return directory + QLatin1String("/documents-XXXXXX");
+}
+
+DocumentManager::DocumentManager(QStackedWidget *stack, QObject *parent)
+    : QObject(parent)
+    , stack(stack)
+    , current(-1)
+    , nextId(0)
+    , useCounter(0)
+    , budget(0)
+    , cacheDir(cacheTemplate())
+{
+}
+
+DocumentManager::~DocumentManager()
+{
+    // Writes post back to this object, and the cache directory goes with it
+    for (Document &document : documents)
+        document.write.waitForFinished();
+}
+
+int DocumentManager::indexOf(const QString &fileName) const
+{
+    if (fileName.isEmpty())
+        return -1;
+
+    const QFileInfo info(fileName);
+    for (int i = 0; i < documents.size(); ++i) {
+        if (!documents.at(i).fileName.isEmpty() && QFileInfo(documents.at(i).fileName) == info)
+            return i;
+    }
+    return -1;
+}
+
+int DocumentManager::add()
+{
+    Document document;
+    document.id = nextId++;
+    document.editor = createEditor();
+    document.journal = new EditJournal(document.editor, this);
+    document.lastUsed = ++useCounter;
+    document.modified = false;
+    document.byteOrderMark = false;
+    documents.append(document);
+    return documents.size() - 1;
+}
+
+void DocumentManager::remove(int index)
+{
+    Document document = documents.takeAt(index);
+    document.write.waitForFinished();
+    document.journal->discard();
+    delete document.journal;
+    delete document.editor;
+    QFile::remove(spillFileName(document.id));
+
+    if (current == index)
+        current = -1;
+    else if (current > index)
+        --current;
+}
+
+bool DocumentManager::setCurrent(int index)
+{
+    const bool restored = documents.at(index).editor || restore(index);
+    current = index;
+    documents[index].lastUsed = ++useCounter;
+    stack->setCurrentWidget(documents.at(index).editor);
+
+    // Switching is when the previous document becomes a candidate
+    enforceBudget();
+    return restored;
+}
+
+TextEditor *DocumentManager::editor(int index) const
+{
+    return documents.at(index).editor;
+}
+
+EditJournal *DocumentManager::journal(int index) const
+{
+    return documents.at(index).journal;
+}
+
+QString DocumentManager::fileName(int index) const
+{
+    return documents.at(index).fileName;
+}
+
+void DocumentManager::setFileName(int index, const QString &fileName)
+{
+    documents[index].fileName = fileName;
+}
+
+QByteArray DocumentManager::codecName(int index) const
+{
+    return documents.at(index).codecName;
+}
+
+bool DocumentManager::hasByteOrderMark(int index) const
+{
+    return documents.at(index).byteOrderMark;
+}
+
+void DocumentManager::setEncoding(int index, const QByteArray &codecName, bool byteOrderMark)
+{
+    documents[index].codecName = codecName;
+    documents[index].byteOrderMark = byteOrderMark;
+}
+
+bool DocumentManager::isModified(int index) const
+{
+    const Document &document = documents.at(index);
+    return document.editor ? document.editor->isModified() : document.modified;
+}
+
+void DocumentManager::setMemoryBudget(qint64 bytes)
+{
+    budget = bytes;
+    enforceBudget();
+}
+
+void DocumentManager::enforceBudget()
+{
+    if (budget <= 0)
+        return;
+
+    qint64 total = 0;
+    for (const Document &document : documents) {
+        if (document.editor)
+            total += memoryUsage(document.editor);
+    }
+
+    // The current document, and any being loaded or saved, always stays
+    while (total > budget) {
+        int oldest = -1;
+        for (int i = 0; i < documents.size(); ++i) {
+            const Document &document = documents.at(i);
+            if (i == current || !document.editor || document.editor->isReadOnly())
+                continue;
+            if (oldest < 0 || document.lastUsed < documents.at(oldest).lastUsed)
+                oldest = i;
+        }
+        if (oldest < 0)
+            break;
+        total -= memoryUsage(documents.at(oldest).editor);
+        spill(oldest);
+    }
+}
+
+qint64 DocumentManager::memoryUsage(const TextEditor *editor)
+{
+    const QTextDocument *document = editor->document();
+    const qint64 text = qint64(document->characterCount()) * BytesPerCharacter
+            + qint64(document->blockCount()) * BytesPerBlock
+            + editor->editHistory()->memoryUsage();
+    return editor->hasBuffer() ? text + editor->pieceTable()->memoryUsage() : text;
+}
+
+TextEditor *DocumentManager::createEditor()
+{
+    TextEditor *editor = new TextEditor;
+    stack->addWidget(editor);
+    emit editorCreated(editor);
+    return editor;
+}
+
+void DocumentManager::spill(int index)
+{
+    Document &document = documents[index];
+    TextEditor *editor = document.editor;
+
+    // The journal already holds everything up to now and rests until the
+    // document is back
+    document.journal->flush();
+    document.journal->setEditor(nullptr);
+
+    QSharedPointer<SpillState> state(new SpillState);
+    state->buffer = editor->hasBuffer();
+    state->modified = editor->isModified();
+    state->anchor = 0;
+    state->position = 0;
+    state->scroll = 0;
+    state->line = 0;
+    if (state->buffer) {
+        state->line = editor->cursorLine();
+        state->table.reset(editor->takeBuffer());
+        document.pinned.reset(new PieceTable(state->table->pinOriginal()));
+    } else {
+        const QTextCursor cursor = editor->textCursor();
+        state->anchor = cursor.anchor();
+        state->position = cursor.position();
+        state->scroll = editor->verticalScrollBar()->value();
+        state->text = editor->toPlainText();
+        state->formats = editor->formatRanges();
+
+        // Spilled history text is read back here, as the arena goes with
+        // the editor
+        QDataStream out(&state->history, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_15);
+        editor->editHistory()->save(out);
+    }
+
+    // The editor takes the document's metrics and highlighter with it
+    document.modified = state->modified;
+    document.state = state;
+    document.editor = nullptr;
+    delete editor;
+
+    const QString fileName = spillFileName(document.id);
+    document.write = QtConcurrent::run([this, fileName, state]() {
+        const QString errorString = writeState(fileName, *state);
+        QMetaObject::invokeMethod(this, [this, state, errorString]() {
+            spillWritten(state, errorString);
+        }, Qt::QueuedConnection);
+        return errorString;
+    });
+}
+
+void DocumentManager::spillWritten(const QSharedPointer<SpillState> &state, const QString &errorString)
+{
+    // Only the latest spill of a document that is still spilled matters
+    for (Document &document : documents) {
+        if (document.state != state)
+            continue;
+        if (errorString.isEmpty())
+            document.state.reset();
+        else
+            emit spillFailed(document.fileName, errorString);
+        return;
+    }
+}
+
+bool DocumentManager::restore(int index)
+{
+    Document &document = documents[index];
+    document.write.waitForFinished();
+
+    // A state still in memory (its write may have failed) needs no reading
+    QSharedPointer<SpillState> state = document.state;
+    bool restored = true;
+    if (!state) {
+        state.reset(new SpillState);
+        restored = readState(spillFileName(document.id), state.data(), document.pinned.data(), &errorText);
+    }
+    document.state.reset();
+    document.pinned.reset();
+    QFile::remove(spillFileName(document.id));
+
+    TextEditor *editor = createEditor();
+    document.editor = editor;
+    if (!restored) {
+        // The journal no longer matches; dropping it unlocked leaves any
+        // unsaved edits to crash recovery at the next start
+        delete document.journal;
+        document.journal = new EditJournal(editor, this);
+        document.fileName.clear();
+        document.modified = false;
+        return false;
+    }
+
+    if (state->buffer) {
+        editor->openBuffer(new PieceTable(std::move(*state->table)));
+        if (state->modified)
+            editor->setModified(true);
+        editor->goToLine(state->line);
+    } else {
+        editor->editHistory()->setEnabled(false);
+        editor->setPlainText(state->text);
+        editor->editHistory()->setEnabled(true);
+        editor->setFormatRanges(state->formats);
+
+        // A history that cannot be read back only costs the undo steps
+        QDataStream in(state->history);
+        in.setVersion(QDataStream::Qt_5_15);
+        editor->editHistory()->restore(in);
+
+        const int end = editor->document()->characterCount() - 1;
+        QTextCursor cursor(editor->document());
+        cursor.setPosition(qBound(0, state->anchor, end));
+        cursor.setPosition(qBound(0, state->position, end), QTextCursor::KeepAnchor);
+        editor->setTextCursor(cursor);
+        editor->verticalScrollBar()->setValue(state->scroll);
+        editor->setModified(state->modified);
+    }
+    document.journal->setEditor(editor);
+    return true;
+}
+
+QString DocumentManager::spillFileName(quint64 id) const
+{
+    return cacheDir.filePath(QString("%1.spill").arg(id));
+}
+
+QString DocumentManager::writeState(const QString &fileName, const SpillState &state)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return file.errorString();
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << SpillMagic << SpillVersion << state.buffer << state.modified
+        << qint32(state.anchor) << qint32(state.position) << qint32(state.scroll) << state.line;
+
+    // Text compresses well, and a fast level keeps spilling cheap
+    if (state.buffer) {
+        state.table->save(out);
+    } else {
+        out << qCompress(state.text.toUtf8(), 1);
+        out << qint32(state.formats.size());
+        for (const QTextLayout::FormatRange &range : state.formats)
+            out << qint32(range.start) << qint32(range.length) << QTextFormat(range.format);
+        out << qCompress(state.history, 1);
+    }
+
+    if (out.status() != QDataStream::Ok || !file.commit())
+        return file.errorString();
+    return QString();
+}
+
+bool DocumentManager::readState(const QString &fileName, SpillState *state, const PieceTable *pinned,
+                                QString *errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *errorString = file.errorString();
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_15);
+    quint32 magic, version;
+    qint32 anchor, position, scroll;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != SpillMagic || version != SpillVersion) {
+        *errorString = "Not a document cache file";
+        return false;
+    }
+    in >> state->buffer >> state->modified >> anchor >> position >> scroll >> state->line;
+    state->anchor = anchor;
+    state->position = position;
+    state->scroll = scroll;
+
+    if (state->buffer) {
+        state->table.reset(new PieceTable);
+        if (!state->table->restore(in, pinned)) {
+            *errorString = state->table->errorString();
+            return false;
+        }
+    } else {
+        QByteArray compressed;
+        in >> compressed;
+        state->text = QString::fromUtf8(qUncompress(compressed));
+
+        qint32 count;
+        in >> count;
+        for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+            qint32 start, length;
+            QTextFormat format;
+            in >> start >> length >> format;
+            QTextLayout::FormatRange range;
+            range.start = start;
+            range.length = length;
+            range.format = format.toCharFormat();
+            state->formats.append(range);
+        }
+
+        in >> compressed;
+        state->history = qUncompress(compressed);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        *errorString = "The document cache file is incomplete";
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,108 @@
+#ifndef DOCUMENTMANAGER_H
+#define DOCUMENTMANAGER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QFuture>
+#include <QSharedPointer>
+#include <QTemporaryDir>
+
+class QStackedWidget;
+class PieceTable;
+class TextEditor;
+class EditJournal;
+
+// The open documents, each with its own editor page in a stack. When the
+// editors together use more than the memory budget, the least recently
+// used inactive ones are spilled: their text or piece table, each with its
+// undo history, cursor and modified state are written to a cache file on a
+// worker thread and the editor is deleted. A spilled document gets a new
+// editor and is read back when it becomes current again.
+class DocumentManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DocumentManager(QStackedWidget *stack, QObject *parent = nullptr);
+    ~DocumentManager();
+
+    int count() const { return documents.size(); }
+    int currentIndex() const { return current; }
+    int indexOf(const QString &fileName) const;
+
+    // Adds an empty untitled document and returns its index
+    int add();
+    void remove(int index);
+
+    // Brings the document back from the cache if needed and shows it;
+    // returns false (leaving it empty) if the cache could not be read
+    bool setCurrent(int index);
+    QString errorString() const { return errorText; }
+
+    // editor() is nullptr while the document is spilled; the journal
+    // belongs to the document and survives spilling
+    TextEditor *editor(int index) const;
+    EditJournal *journal(int index) const;
+    QString fileName(int index) const;
+    void setFileName(int index, const QString &fileName);
+    bool isModified(int index) const;
+    // What the file was decoded from, so a save writes it back the same
+    // way; an empty codec name means the locale's codec
+    QByteArray codecName(int index) const;
+    bool hasByteOrderMark(int index) const;
+    void setEncoding(int index, const QByteArray &codecName, bool byteOrderMark);
+
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const { return budget; }
+    void enforceBudget();
+    static qint64 memoryUsage(const TextEditor *editor);
+
+signals:
+    // A new editor page was created, for a new document or a restored one
+    void editorCreated(TextEditor *editor);
+    void spillFailed(const QString &fileName, const QString &errorString);
+
+private:
+    struct SpillState;
+
+    struct Document
+    {
+        quint64 id;
+        QString fileName;
+        TextEditor *editor;
+        EditJournal *journal;
+        quint64 lastUsed;
+        bool modified;
+        QByteArray codecName;
+        bool byteOrderMark;
+
+        // Kept in memory until its cache file is completely written
+        QSharedPointer<SpillState> state;
+        QFuture<QString> write;
+
+        // The mapped file a spilled piece table was opened from stays open,
+        // so the table comes back even if the file is changed meanwhile
+        QSharedPointer<PieceTable> pinned;
+    };
+
+    TextEditor *createEditor();
+    void spill(int index);
+    bool restore(int index);
+    void spillWritten(const QSharedPointer<SpillState> &state, const QString &errorString);
+    QString spillFileName(quint64 id) const;
+    static QString writeState(const QString &fileName, const SpillState &state);
+    static bool readState(const QString &fileName, SpillState *state, const PieceTable *pinned,
+                          QString *errorString);
+
+    QStackedWidget *stack;
+    QVector<Document> documents;
+    int current;
+    quint64 nextId;
+    quint64 useCounter;
+    qint64 budget;
+    QTemporaryDir cacheDir;
+    QString errorText;
+};
+
+#endif // DOCUMENTMANAGER_H
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "DocumentMetrics.h"
+#include "BlockData.h"
+#include <QTextDocument>
+#include <QElapsedTimer>
+#include <QTimer>
+
+// Longest a slice of recounting may keep the GUI thread busy
+static const qint64 SliceMs = 8;
+
+DocumentMetrics::DocumentMetrics(QTextDocument *document)
+    : QObject(document)
+    , document(document)
+    , words(0)
+    , pendingFirst(-1)
+    , pendingTail(0)
+    , scheduled(false)
+{
+    countBlocks(document->begin(), document->lastBlock());
+    connect(document, &QTextDocument::contentsChange, this, &DocumentMetrics::contentsChange);
+}
+
+qint64 DocumentMetrics::characterCount() const
+{
+    // The document always ends in a paragraph separator that is not text
+    return document->characterCount() - 1;
+}
+
+int DocumentMetrics::lineCount() const
+{
+    return document->blockCount();
+}
+
+void DocumentMetrics::contentsChange(int position, int charsRemoved, int charsAdded)
+{
+    Q_UNUSED(charsRemoved);
+
+    // Blocks removed by the edit already subtracted their words when their
+    // data was deleted; recount only the blocks covering the new text. The
+    // reported range can run past the end when the whole text is replaced.
+    // Pending ranges are merged, which may recount a few blocks twice.
+    const int end = qMin(position + charsAdded, document->characterCount() - 1);
+    const int first = document->findBlock(position).blockNumber();
+    const int tail = document->blockCount() - 1 - document->findBlock(end).blockNumber();
+    pendingTail = pendingFirst < 0 ? tail : qMin(pendingTail, tail);
+    pendingFirst = pendingFirst < 0 ? first : qMin(pendingFirst, first);
+    countPending();
+}
+
+void DocumentMetrics::countPending()
+{
+    if (pendingFirst < 0)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    const int last = document->blockCount() - 1 - pendingTail;
+    QTextBlock block = document->findBlockByNumber(pendingFirst);
+    int counted = 0;
+    for (; block.isValid() && block.blockNumber() <= last; block = block.next()) {
+        // The clock is only read every so many blocks
+        if (++counted % 64 == 0 && timer.hasExpired(SliceMs))
+            break;
+        countBlock(block);
+    }
+
+    if (block.isValid() && block.blockNumber() <= last) {
+        pendingFirst = block.blockNumber();
+        if (!scheduled) {
+            scheduled = true;
+            QTimer::singleShot(0, this, [this] {
+                scheduled = false;
+                countPending();
+            });
+        }
+    } else {
+        pendingFirst = -1;
+    }
+    emit changed();
+}
+
+void DocumentMetrics::countBlocks(QTextBlock first, const QTextBlock &last)
+{
+    if (!first.isValid())
+        return;
+
+    for (QTextBlock block = first; block.isValid(); block = block.next()) {
+        countBlock(block);
+        if (block == last)
+            break;
+    }
+}
+
+void DocumentMetrics::countBlock(const QTextBlock &block)
+{
+    BlockData *data = BlockData::of(block);
+    const int count = countWords(block.text());
+    words += count - (data->metrics == this ? data->wordCount : 0);
+    data->wordCount = count;
+    data->metrics = this;
+}
+
+int DocumentMetrics::countWords(const QString &text)
+{
+    int count = 0;
+    bool inWord = false;
+    const QChar *data = text.constData();
+    const int length = text.size();
+    for (int i = 0; i < length; ++i) {
+        const bool space = data[i].isSpace();
+        if (!space && !inWord)
+            ++count;
+        inWord = !space;
+    }
+    return count;
+}
\ No newline at end of file
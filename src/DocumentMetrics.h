@@ -0,0 +1,50 @@
+#ifndef DOCUMENTMETRICS_H
+#define DOCUMENTMETRICS_H
+
+#include <QObject>
+#include <QTextBlock>
+
+class QTextDocument;
+
+// Keeps character, word and line counts of a document current from its
+// contentsChange() deltas. Word counts are cached per block, so an edit
+// only recounts the blocks it touched; an edit touching many of them (a
+// large paste) is recounted a slice at a time in later event loop passes.
+class DocumentMetrics : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Becomes a child of the document and lives as long as it does
+    explicit DocumentMetrics(QTextDocument *document);
+
+    qint64 characterCount() const;
+    qint64 wordCount() const { return words; }
+    int lineCount() const;
+
+private slots:
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+
+private:
+    friend class BlockData;
+
+    void countPending();
+    void countBlocks(QTextBlock first, const QTextBlock &last);
+    void countBlock(const QTextBlock &block);
+    static int countWords(const QString &text);
+
+    QTextDocument *document;
+    qint64 words;
+
+    // Blocks still to recount, from pendingFirst to pendingTail blocks
+    // before the last; numbers from the end stay put when earlier text
+    // changes. pendingFirst is -1 when nothing is pending.
+    int pendingFirst;
+    int pendingTail;
+    bool scheduled;
+
+signals:
+    void changed();
+};
+
+#endif // DOCUMENTMETRICS_H
\ No newline at end of file
@@ -0,0 +1,685 @@
+#include "EditHistory.h"
+#include "FormatRunStore.h"
+#include <QDataStream>
+#include <QTextDocument>
+#include <QTextCursor>
+#include <QTextBlock>
+#include <QtConcurrent>
+
+// Characters copied on each side of a prepared range, so that edits
+// reaching a little past it (a word deleted at once) are still recorded
+static const int CaptureContext = 1024;
+
+// Payloads longer than this, in characters, go to the arena right away
+static const int SpillThreshold = 128 * 1024;
+
+// Payload bytes kept in memory before the oldest are moved to the arena
+static const qint64 MemoryLimit = 8 * 1024 * 1024;
+
+// Longest run of keystrokes merged into one entry
+static const int MaxMergeLength = 4096;
+
+// Appends ranges moved by offset; a range that continues the last one
+// with the same format extends it instead
+static void appendFormats(QVector<QTextLayout::FormatRange> *formats,
+                          const QVector<QTextLayout::FormatRange> &ranges, int offset)
+{
+    for (QTextLayout::FormatRange range : ranges) {
+        range.start += offset;
+        if (!formats->isEmpty()) {
+            QTextLayout::FormatRange &last = formats->last();
+            if (last.start + last.length == range.start && last.format == range.format) {
+                last.length += range.length;
+                continue;
+            }
+        }
+        formats->append(range);
+    }
+}
+
+// Text as a QTextCursor inserts it: every kind of line break becomes one
+// paragraph separator, which documentText() turns into "\n"
+static QString plainText(QString text)
+{
+    return text.replace(QLatin1String("\r\n"), QLatin1String("\n"))
+            .replace(QLatin1Char('\r'), QLatin1Char('\n'))
+            .replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+}
+
+// The parts of ranges within [start, start + length), relative to start
+static QVector<QTextLayout::FormatRange> sliceFormats(const QVector<QTextLayout::FormatRange> &ranges,
+                                                      int start, int length)
+{
+    QVector<QTextLayout::FormatRange> slice;
+    for (QTextLayout::FormatRange range : ranges) {
+        const int from = qMax(range.start, start);
+        const int to = qMin(range.start + range.length, start + length);
+        if (from >= to)
+            continue;
+        range.start = from - start;
+        range.length = to - from;
+        slice.append(range);
+    }
+    return slice;
+}
+
+EditHistory::EditHistory(QTextDocument *document)
+    : QObject(document)
+    , document(document)
+    , formatRuns(nullptr)
+    , enabled(true)
+    , applying(false)
+    , bulk(false)
+    , cleanIndex(0)
+    , firstResident(0)
+    , capturing(false)
+    , captureTyping(false)
+    , captureAtEnd(false)
+    , captureStart(0)
+    , memoryBytes(0)
+    , arenaSize(0)
+    , writing(false)
+    , arenaFailed(false)
+{
+    // Two histories would keep every edit twice
+    document->setUndoRedoEnabled(false);
+    connect(document, &QTextDocument::contentsChange, this, &EditHistory::contentsChange);
+}
+
+EditHistory::~EditHistory()
+{
+    if (writing)
+        arenaWrite.waitForFinished();
+}
+
+void EditHistory::setEnabled(bool enable)
+{
+    enabled = enable;
+    if (!enabled) {
+        release();
+        cancelBulk();
+        clear();
+    }
+}
+
+void EditHistory::prepare(int start, int end, bool typing)
+{
+    if (!enabled)
+        return;
+
+    const int last = document->characterCount() - 1;
+    const int from = qMax(0, qMin(start, end) - CaptureContext);
+    const int to = qMin(last, qMax(start, end) + CaptureContext);
+    capture = documentText(from, to);
+    captureFormats = documentFormats(from, to);
+    captureStart = from;
+    captureAtEnd = to == last;
+    captureTyping = typing;
+    capturing = true;
+}
+
+void EditHistory::release()
+{
+    capturing = false;
+    captureTyping = false;
+    capture.clear();
+    captureFormats.clear();
+}
+
+void EditHistory::beginBulk(int start, int end)
+{
+    if (!enabled)
+        return;
+
+    // Only the replaced selection is copied now; it is small next to the
+    // text that replaces it
+    bulkRemoved = resident(documentText(start, end), documentFormats(start, end));
+    if (formatRuns)
+        bulkRemoved.runs = formatRuns->ranges(start, end);
+    bulk = true;
+}
+
+void EditHistory::endBulk(int position, int length, const QString &text, const QTextCharFormat &format)
+{
+    if (!bulk)
+        return;
+    bulk = false;
+    const Payload removed = bulkRemoved;
+    bulkRemoved = Payload();
+    if (arenaFailed)
+        clear();
+
+    // Inserted text all takes the format of the cursor it went in at
+    QVector<QTextLayout::FormatRange> formats;
+    if (length > 0) {
+        QTextLayout::FormatRange range;
+        range.start = 0;
+        range.length = length;
+        range.format = format;
+        formats.append(range);
+    }
+    Payload inserted = resident(QString(), formats);
+    inserted.length = length;
+
+    dropRedo();
+    Entry entry;
+    entry.position = position;
+    entry.removed = store(removed);
+    entry.typing = false;
+    entry.restyled = -1;
+    if (length <= SpillThreshold) {
+        inserted.text = plainText(text);
+        entry.inserted = store(inserted);
+        undoStack.append(entry);
+        spillOldest();
+        return;
+    }
+
+    // Older entries are spilled first, so the write started last has the
+    // arena to itself until the next edit needs it
+    spillOldest();
+    spillLater(&inserted, text);
+    entry.inserted = inserted;
+    undoStack.append(entry);
+}
+
+void EditHistory::cancelBulk()
+{
+    bulk = false;
+    bulkRemoved = Payload();
+}
+
+int EditHistory::undo()
+{
+    return step(false);
+}
+
+int EditHistory::redo()
+{
+    return step(true);
+}
+
+void EditHistory::clear()
+{
+    finishWrite();
+    arenaFailed = false;
+    undoStack.clear();
+    redoStack.clear();
+    cleanIndex = -1;
+    firstResident = 0;
+    memoryBytes = 0;
+
+    if (arena.isOpen())
+        arena.resize(0);
+    arenaSize = 0;
+}
+
+void EditHistory::setClean()
+{
+    cleanIndex = undoStack.size();
+}
+
+void EditHistory::contentsChange(int position, int charsRemoved, int charsAdded)
+{
+    if (applying || bulk || !enabled)
+        return;
+
+    // Without the old text only an insertion can be undone; one at the end
+    // may count the final paragraph separator as replaced
+    if (!capturing) {
+        if (charsRemoved == 1 && charsAdded > 1 && position + charsAdded == document->characterCount()) {
+            --charsRemoved;
+            --charsAdded;
+        }
+        if (charsRemoved == 0 && charsAdded > 0) {
+            record(position, resident(QString(), QVector<QTextLayout::FormatRange>()),
+                   resident(documentText(position, position + charsAdded),
+                            documentFormats(position, position + charsAdded)));
+        } else if (charsRemoved > 0) {
+            clear();
+        }
+        return;
+    }
+
+    // A change reaching the end may count the final paragraph separator
+    const int captureEnd = captureStart + capture.size();
+    if (captureAtEnd && position + charsRemoved == captureEnd + 1 && charsAdded > 0) {
+        --charsRemoved;
+        --charsAdded;
+    }
+    if (position < captureStart || position + charsRemoved > captureEnd) {
+        release();
+        clear();
+        return;
+    }
+
+    const int at = position - captureStart;
+    Payload removed = resident(capture.mid(at, charsRemoved), sliceFormats(captureFormats, at, charsRemoved));
+    if (formatRuns)
+        removed.runs = formatRuns->ranges(position, position + charsRemoved);
+    const Payload inserted = resident(documentText(position, position + charsAdded),
+                                      documentFormats(position, position + charsAdded));
+
+    QVector<QTextLayout::FormatRange> formats = sliceFormats(captureFormats, 0, at);
+    appendFormats(&formats, inserted.formats, at);
+    appendFormats(&formats, sliceFormats(captureFormats, at + charsRemoved, capture.size() - at - charsRemoved),
+                  at + charsAdded);
+    captureFormats = formats;
+    capture.replace(at, charsRemoved, inserted.text);
+
+    // Layout passes report the text they touch without changing it
+    if (removed.text == inserted.text && removed.formats == inserted.formats)
+        return;
+    record(position, removed, inserted);
+}
+
+QString EditHistory::documentText(int start, int end) const
+{
+    QTextCursor cursor(document);
+    cursor.setPosition(qMin(start, document->characterCount() - 1));
+    cursor.setPosition(qMin(end, document->characterCount() - 1), QTextCursor::KeepAnchor);
+    return cursor.selectedText().replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+}
+
+QVector<QTextLayout::FormatRange> EditHistory::documentFormats(int start, int end) const
+{
+    // Paragraph separators fall between the ranges
+    QVector<QTextLayout::FormatRange> formats;
+    for (QTextBlock block = document->findBlock(start); block.isValid() && block.position() < end;
+         block = block.next()) {
+        for (QTextBlock::iterator it = block.begin(); !it.atEnd(); ++it) {
+            const QTextFragment fragment = it.fragment();
+            if (fragment.position() >= end)
+                break;
+            QTextLayout::FormatRange range;
+            range.start = qMax(fragment.position(), start);
+            range.length = qMin(fragment.position() + fragment.length(), end) - range.start;
+            range.format = fragment.charFormat();
+            if (range.length > 0)
+                appendFormats(&formats, QVector<QTextLayout::FormatRange>() << range, -start);
+        }
+    }
+    return formats;
+}
+
+EditHistory::Payload EditHistory::resident(const QString &text, const QVector<QTextLayout::FormatRange> &formats)
+{
+    Payload payload;
+    payload.text = text;
+    payload.offset = -1;
+    payload.length = text.size();
+    payload.formats = formats;
+    return payload;
+}
+
+void EditHistory::record(int position, const Payload &removed, const Payload &inserted)
+{
+    if (arenaFailed)
+        clear();
+    dropRedo();
+    if (merge(position, removed, inserted))
+        return;
+
+    Entry entry;
+    entry.position = position;
+    entry.removed = store(removed);
+    entry.inserted = store(inserted);
+    entry.restyled = -1;
+
+    // Runs of typing or of deleting single characters may grow this entry
+    const bool typed = removed.length == 0 && inserted.length == 1 && inserted.text.at(0) != QLatin1Char('\n');
+    const bool deleted = inserted.length == 0 && removed.length == 1;
+    entry.typing = captureTyping && (typed || deleted);
+    undoStack.append(entry);
+    spillOldest();
+}
+
+void EditHistory::recordRuns(int start, int end, const QVector<QTextLayout::FormatRange> &before)
+{
+    if (!enabled || !formatRuns || start >= end)
+        return;
+    const QVector<QTextLayout::FormatRange> after = formatRuns->ranges(start, end);
+    if (after == before)
+        return;
+
+    if (arenaFailed)
+        clear();
+    dropRedo();
+    Entry entry;
+    entry.position = start;
+    entry.removed = resident(QString(), QVector<QTextLayout::FormatRange>());
+    entry.removed.runs = before;
+    entry.inserted = resident(QString(), QVector<QTextLayout::FormatRange>());
+    entry.inserted.runs = after;
+    entry.typing = false;
+    entry.restyled = end - start;
+    undoStack.append(entry);
+    document->setModified(true);
+}
+
+void EditHistory::dropRedo()
+{
+    for (const Entry &entry : qAsConst(redoStack)) {
+        discard(entry.removed);
+        discard(entry.inserted);
+    }
+    redoStack.clear();
+    if (cleanIndex > undoStack.size())
+        cleanIndex = -1;
+}
+
+bool EditHistory::merge(int position, const Payload &removed, const Payload &inserted)
+{
+    // Merging into an entry from before the last save would lose the clean point
+    if (!captureTyping || undoStack.size() <= qMax(cleanIndex, 0))
+        return false;
+
+    Entry &top = undoStack.last();
+    if (!top.typing || top.removed.offset >= 0 || top.inserted.offset >= 0)
+        return false;
+
+    if (removed.length == 0 && inserted.length == 1 && inserted.text.at(0) != QLatin1Char('\n')) {
+        if (top.inserted.length == 0 || top.inserted.length >= MaxMergeLength
+                || position != top.position + top.inserted.length)
+            return false;
+        top.inserted.text += inserted.text;
+        appendFormats(&top.inserted.formats, inserted.formats, top.inserted.length);
+        ++top.inserted.length;
+        memoryBytes += sizeof(QChar);
+        return true;
+    }
+
+    if (inserted.length == 0 && removed.length == 1) {
+        if (top.inserted.length != 0 || top.removed.length >= MaxMergeLength)
+            return false;
+        if (position + 1 == top.position) {
+            // Backspace
+            QVector<QTextLayout::FormatRange> formats = removed.formats;
+            appendFormats(&formats, top.removed.formats, 1);
+            top.removed.formats = formats;
+            QVector<QTextLayout::FormatRange> runs = removed.runs;
+            appendFormats(&runs, top.removed.runs, 1);
+            top.removed.runs = runs;
+            top.removed.text.prepend(removed.text);
+            top.position = position;
+        } else if (position == top.position) {
+            // Delete
+            appendFormats(&top.removed.formats, removed.formats, top.removed.length);
+            appendFormats(&top.removed.runs, removed.runs, top.removed.length);
+            top.removed.text += removed.text;
+        } else {
+            return false;
+        }
+        ++top.removed.length;
+        memoryBytes += sizeof(QChar);
+        return true;
+    }
+    return false;
+}
+
+int EditHistory::step(bool forward)
+{
+    QVector<Entry> &from = forward ? redoStack : undoStack;
+    QVector<Entry> &to = forward ? undoStack : redoStack;
+    if (from.isEmpty())
+        return -1;
+
+    Entry entry = from.takeLast();
+    int end;
+    if (entry.restyled >= 0) {
+        // Only the runs beside the document change
+        if (formatRuns)
+            formatRuns->assign(entry.position, entry.position + entry.restyled,
+                               forward ? entry.inserted.runs : entry.removed.runs);
+        end = entry.position + entry.restyled;
+    } else {
+        QString removed;
+        QString inserted;
+        if (!load(entry.removed, &removed) || !load(entry.inserted, &inserted)) {
+            clear();
+            return -1;
+        }
+
+        const QString &oldText = forward ? removed : inserted;
+        const QString &newText = forward ? inserted : removed;
+        const QVector<QTextLayout::FormatRange> &newFormats = forward ? entry.inserted.formats
+                                                                      : entry.removed.formats;
+        QTextCursor cursor(document);
+        cursor.setPosition(entry.position);
+        cursor.setPosition(entry.position + oldText.size(), QTextCursor::KeepAnchor);
+        applying = true;
+        cursor.beginEditBlock();
+        cursor.insertText(newText);
+        for (const QTextLayout::FormatRange &range : newFormats) {
+            cursor.setPosition(entry.position + range.start);
+            cursor.setPosition(entry.position + range.start + range.length, QTextCursor::KeepAnchor);
+            cursor.setCharFormat(range.format);
+        }
+        cursor.endEditBlock();
+        applying = false;
+
+        // Text put back took the runs of its neighbour; removed text gets
+        // its own again
+        if (formatRuns && !forward)
+            formatRuns->assign(entry.position, entry.position + newText.size(), entry.removed.runs);
+        end = entry.position + newText.size();
+    }
+
+    // A step taken back is finished; new typing starts an entry of its own
+    entry.typing = false;
+    to.append(entry);
+    firstResident = qMin(firstResident, undoStack.size());
+
+    document->setModified(undoStack.size() != cleanIndex);
+    return end;
+}
+
+EditHistory::Payload EditHistory::store(Payload payload)
+{
+    memoryBytes += qint64(payload.length) * sizeof(QChar);
+
+    if (payload.length > SpillThreshold)
+        spill(&payload);
+    return payload;
+}
+
+bool EditHistory::load(const Payload &payload, QString *text)
+{
+    if (payload.offset < 0) {
+        *text = payload.text;
+        return true;
+    }
+
+    finishWrite();
+    if (arenaFailed)
+        return false;
+    const qint64 bytes = qint64(payload.length) * sizeof(QChar);
+    text->resize(payload.length);
+    return arena.seek(payload.offset)
+            && arena.read(reinterpret_cast<char *>(text->data()), bytes) == bytes;
+}
+
+bool EditHistory::spill(Payload *payload)
+{
+    if (payload->offset >= 0 || payload->length == 0)
+        return true;
+    finishWrite();
+    if (arenaFailed || (!arena.isOpen() && !arena.open()))
+        return false;
+
+    // Written as raw UTF-16; the file never outlives this process
+    const qint64 bytes = qint64(payload->length) * sizeof(QChar);
+    if (!arena.seek(arenaSize)
+            || arena.write(reinterpret_cast<const char *>(payload->text.constData()), bytes) != bytes) {
+        arena.resize(arenaSize);
+        return false;
+    }
+
+    payload->offset = arenaSize;
+    payload->text = QString();
+    arenaSize += bytes;
+    memoryBytes -= bytes;
+    return true;
+}
+
+void EditHistory::spillLater(Payload *payload, const QString &text)
+{
+    // The range is taken now; text is only converted and written on the
+    // worker, and the payload reads as lost if that fails
+    finishWrite();
+    if (arenaFailed || (!arena.isOpen() && !arena.open())) {
+        payload->text = plainText(text);
+        memoryBytes += qint64(payload->length) * sizeof(QChar);
+        return;
+    }
+
+    const qint64 offset = arenaSize;
+    const qint64 bytes = qint64(payload->length) * sizeof(QChar);
+    payload->offset = offset;
+    arenaSize += bytes;
+
+    QTemporaryFile *file = &arena;
+    writing = true;
+    arenaWrite = QtConcurrent::run([file, offset, bytes, text]() {
+        const QString plain = plainText(text);
+        return qint64(plain.size()) * qint64(sizeof(QChar)) == bytes && file->seek(offset)
+                && file->write(reinterpret_cast<const char *>(plain.constData()), bytes) == bytes;
+    });
+}
+
+void EditHistory::finishWrite()
+{
+    if (!writing)
+        return;
+    writing = false;
+    if (!arenaWrite.result())
+        arenaFailed = true;
+}
+
+void EditHistory::spillOldest()
+{
+    // A failed write leaves the rest in memory rather than losing them
+    while (memoryBytes > MemoryLimit && firstResident < undoStack.size()) {
+        Entry &entry = undoStack[firstResident];
+        if (!spill(&entry.removed) || !spill(&entry.inserted))
+            return;
+        ++firstResident;
+    }
+}
+
+void EditHistory::discard(const Payload &payload)
+{
+    // Arena space is only reclaimed when the history is cleared
+    if (payload.offset < 0)
+        memoryBytes -= qint64(payload.text.size()) * sizeof(QChar);
+}
+
+void EditHistory::save(QDataStream &out)
+{
+    // Written to a buffer first, so that a failed read of the arena
+    // leaves an empty history rather than half of one
+    QByteArray bytes;
+    {
+        QDataStream stream(&bytes, QIODevice::WriteOnly);
+        stream.setVersion(out.version());
+        if (saveEntries(stream, undoStack) && saveEntries(stream, redoStack))
+            stream << qint32(cleanIndex);
+        else
+            bytes.clear();
+    }
+    out << bytes;
+}
+
+bool EditHistory::restore(QDataStream &in)
+{
+    QByteArray bytes;
+    in >> bytes;
+    clear();
+    if (in.status() != QDataStream::Ok)
+        return false;
+    if (bytes.isEmpty())
+        return true;
+
+    QDataStream stream(bytes);
+    stream.setVersion(in.version());
+    qint32 clean = -1;
+    if (!restoreEntries(stream, &undoStack) || !restoreEntries(stream, &redoStack)) {
+        clear();
+        return false;
+    }
+    stream >> clean;
+    if (stream.status() != QDataStream::Ok || clean > undoStack.size()) {
+        clear();
+        return false;
+    }
+    cleanIndex = clean;
+    spillOldest();
+    return true;
+}
+
+bool EditHistory::saveEntries(QDataStream &out, const QVector<Entry> &entries)
+{
+    out << qint32(entries.size());
+    for (const Entry &entry : entries) {
+        QString removed;
+        QString inserted;
+        if (!load(entry.removed, &removed) || !load(entry.inserted, &inserted))
+            return false;
+        out << qint32(entry.position) << qint32(entry.restyled) << removed << inserted;
+        saveFormats(out, entry.removed.formats);
+        saveFormats(out, entry.removed.runs);
+        saveFormats(out, entry.inserted.formats);
+        saveFormats(out, entry.inserted.runs);
+    }
+    return out.status() == QDataStream::Ok;
+}
+
+bool EditHistory::restoreEntries(QDataStream &in, QVector<Entry> *entries)
+{
+    qint32 count;
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        qint32 position, restyled;
+        QString removedText, insertedText;
+        in >> position >> restyled >> removedText >> insertedText;
+        Payload removed = resident(removedText, QVector<QTextLayout::FormatRange>());
+        Payload inserted = resident(insertedText, QVector<QTextLayout::FormatRange>());
+        if (!restoreFormats(in, &removed.formats) || !restoreFormats(in, &removed.runs)
+                || !restoreFormats(in, &inserted.formats) || !restoreFormats(in, &inserted.runs))
+            return false;
+
+        // Large payloads go straight back to the arena
+        Entry entry;
+        entry.position = position;
+        entry.removed = store(removed);
+        entry.inserted = store(inserted);
+        entry.typing = false;
+        entry.restyled = restyled;
+        entries->append(entry);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+void EditHistory::saveFormats(QDataStream &out, const QVector<QTextLayout::FormatRange> &formats)
+{
+    out << qint32(formats.size());
+    for (const QTextLayout::FormatRange &range : formats)
+        out << qint32(range.start) << qint32(range.length) << QTextFormat(range.format);
+}
+
+bool EditHistory::restoreFormats(QDataStream &in, QVector<QTextLayout::FormatRange> *formats)
+{
+    qint32 count;
+    in >> count;
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        qint32 start, length;
+        QTextFormat format;
+        in >> start >> length >> format;
+        QTextLayout::FormatRange range;
+        range.start = start;
+        range.length = length;
+        range.format = format.toCharFormat();
+        formats->append(range);
+    }
+    return in.status() == QDataStream::Ok;
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#ifndef EDITHISTORY_H
+#define EDITHISTORY_H
+
+#include <QObject>
+#include <QString>
+#include <QFuture>
+#include <QTemporaryFile>
+#include <QTextCharFormat>
+#include <QTextLayout>
+#include <QVector>
+
+class QTextDocument;
+class QDataStream;
+class FormatRunStore;
+
+// Undo history for a QTextDocument that replaces the document's own stack.
+// Each entry keeps the text an edit removed and the text it inserted, with
+// their character formats, so steps can be replayed in either direction;
+// a change to formats alone is a step as well. Keystrokes that extend the
+// previous one are merged into a single entry, and once the payloads held
+// in memory pass a limit the oldest move to a temporary file, which keeps
+// the history deep without keeping it resident.
+//
+// The removed text is no longer in the document by the time contentsChange
+// reports an edit, so editing code calls prepare() with the range it is
+// about to touch first. An edit nobody prepared for is still recorded if
+// it only inserted text; any other clears the history.
+class EditHistory : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Becomes a child of the document and turns its own undo stack off
+    explicit EditHistory(QTextDocument *document);
+    ~EditHistory();
+
+    // Disabled history records nothing and forgets what it had
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+
+    // Copies [start, end) with some context around it until release();
+    // typing marks single character edits that may merge with the last one
+    void prepare(int start, int end, bool typing = false);
+    void release();
+    bool isPrepared() const { return capturing; }
+
+    // Format runs kept beside the document. The runs of removed text are
+    // read in contentsChange(), before the store's own update, so the
+    // store must be connected to the document after the history; inserted
+    // text gets the same runs again from FormatRunStore::update() on redo.
+    void setFormatRuns(FormatRunStore *runs) { formatRuns = runs; }
+    // The runs of [start, end) were before and have just been changed
+    void recordRuns(int start, int end, const QVector<QTextLayout::FormatRange> &before);
+
+    // For an edit too large to follow as it happens, such as a chunked
+    // paste: the document is not watched from beginBulk() on, and endBulk()
+    // records the whole edit as one step from the text the caller already
+    // holds, instead of copying it back out of the document. Text this
+    // large goes to the arena on a worker thread.
+    void beginBulk(int start, int end);
+    void endBulk(int position, int length, const QString &text, const QTextCharFormat &format);
+    void cancelBulk();
+
+    bool canUndo() const { return !undoStack.isEmpty(); }
+    bool canRedo() const { return !redoStack.isEmpty(); }
+
+    // Return where the cursor belongs after the step, or -1 if there was none
+    int undo();
+    int redo();
+    void clear();
+
+    // The document is unmodified whenever the history is back at this point
+    void setClean();
+
+    // Bytes of payload held in memory; spilled payloads are not counted
+    qint64 memoryUsage() const { return memoryBytes; }
+
+    // The whole history, spilled text included, for a new history over
+    // the same text to take over; nothing is saved if the arena cannot be
+    // read back, and restore() leaves the history empty if it fails
+    void save(QDataStream &out);
+    bool restore(QDataStream &in);
+
+private slots:
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+
+private:
+    // Text held either in memory or, once spilled, as a range of the arena.
+    // The formats, relative to the start of the text, are never spilled;
+    // there is a range per change of format, not per character.
+    struct Payload
+    {
+        QString text;
+        qint64 offset;
+        int length;
+        QVector<QTextLayout::FormatRange> formats;
+        QVector<QTextLayout::FormatRange> runs;
+    };
+
+    // restyled is the length of the span whose format runs alone changed,
+    // or -1 for an edit of the text
+    struct Entry
+    {
+        int position;
+        Payload removed;
+        Payload inserted;
+        bool typing;
+        int restyled;
+    };
+
+    QString documentText(int start, int end) const;
+    QVector<QTextLayout::FormatRange> documentFormats(int start, int end) const;
+    static Payload resident(const QString &text, const QVector<QTextLayout::FormatRange> &formats);
+    void record(int position, const Payload &removed, const Payload &inserted);
+    void dropRedo();
+    bool merge(int position, const Payload &removed, const Payload &inserted);
+    int step(bool forward);
+    Payload store(Payload payload);
+    bool load(const Payload &payload, QString *text);
+    bool spill(Payload *payload);
+    void spillLater(Payload *payload, const QString &text);
+    void finishWrite();
+    void spillOldest();
+    void discard(const Payload &payload);
+    bool saveEntries(QDataStream &out, const QVector<Entry> &entries);
+    bool restoreEntries(QDataStream &in, QVector<Entry> *entries);
+    static void saveFormats(QDataStream &out, const QVector<QTextLayout::FormatRange> &formats);
+    static bool restoreFormats(QDataStream &in, QVector<QTextLayout::FormatRange> *formats);
+
+    QTextDocument *document;
+    FormatRunStore *formatRuns;
+    bool enabled;
+    bool applying;
+    bool bulk;
+    Payload bulkRemoved;
+
+    QVector<Entry> undoStack;
+    QVector<Entry> redoStack;
+    int cleanIndex;
+
+    // Entries below this one in the undo stack have been spilled
+    int firstResident;
+
+    // Text of [captureStart, captureStart + capture.size()) as of the last
+    // change; captureAtEnd means the range reaches the end of the document
+    bool capturing;
+    bool captureTyping;
+    bool captureAtEnd;
+    int captureStart;
+    QString capture;
+    QVector<QTextLayout::FormatRange> captureFormats;
+
+    qint64 memoryBytes;
+    QTemporaryFile arena;
+    qint64 arenaSize;
+
+    // At most one write runs in the background; nothing else touches the
+    // arena until it is finished. A failed one makes every spilled payload
+    // suspect, so the history is cleared at the next edit.
+    QFuture<bool> arenaWrite;
+    bool writing;
+    bool arenaFailed;
+};
+
+#endif // EDITHISTORY_H
\ No newline at end of file
@@ -0,0 +1,326 @@
+#include "EditJournal.h"
+#include "TextEditor.h"
+#include "PieceTable.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QSharedPointer>
+#include <QStandardPaths>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QUuid>
+#include <QtConcurrent>
+#include <climits>
+
+static const quint32 JournalMagic = 0x454A4E4C; // "EJNL"
+static const quint32 JournalVersion = 1;
+
+// A journal is compacted once it is larger than this and twice the document
+static const qint64 CompactThreshold = 4 * 1024 * 1024;
+
+// Largest block handed to a single QIODevice::write()
+static const qint64 WriteBlock = 64 * 1024 * 1024;
+
+static void writeRecordHead(QDataStream &out, qint64 position, qint64 removed, qint64 length)
+{
+    out << position << removed << length;
+}
+
+static bool appendToFile(const QString &fileName, const QByteArray &bytes)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+        return false;
+    return file.write(bytes) == bytes.size() && file.flush();
+}
+
+EditJournal::EditJournal(TextEditor *editor, QObject *parent)
+    : QObject(parent)
+    , editor(editor)
+    , active(false)
+    , snapshotPending(false)
+    , baseSize(0)
+    , baseModified(0)
+    , unit(Characters)
+    , journalSize(0)
+    , spanChanged(false)
+    , spanStart(0)
+    , spanTail(0)
+    , spanBaseSize(0)
+{
+    // One thread keeps the records in order
+    writer.setMaxThreadCount(1);
+    connect(editor->document(), &QTextDocument::contentsChange, this, &EditJournal::contentsChange);
+}
+
+EditJournal::~EditJournal()
+{
+    writer.waitForDone();
+}
+
+void EditJournal::setEditor(TextEditor *editor)
+{
+    if (this->editor)
+        disconnect(this->editor->document(), nullptr, this, nullptr);
+    this->editor = editor;
+    if (!editor)
+        return;
+
+    connect(editor->document(), &QTextDocument::contentsChange, this, &EditJournal::contentsChange);
+    if (editor->hasBuffer())
+        editor->pieceTable()->resetChangedSpan();
+    resetSpan();
+}
+
+QString EditJournal::journalDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QLatin1String("/journal");
+}
+
+QString EditJournal::lockFileName(const QString &journalFileName)
+{
+    return journalFileName + QLatin1String(".lock");
+}
+
+bool EditJournal::readHeader(QDataStream &in, Header *header)
+{
+    quint32 magic, version;
+    quint8 unit;
+    in.setVersion(QDataStream::Qt_5_15);
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != JournalMagic || version != JournalVersion)
+        return false;
+    in >> unit >> header->fileName >> header->baseSize >> header->baseModified;
+    header->unit = Unit(unit);
+    return in.status() == QDataStream::Ok && unit <= Bytes;
+}
+
+bool EditJournal::readRecord(QDataStream &in, qint64 *position, qint64 *removed, QByteArray *data)
+{
+    qint64 length;
+    in >> *position >> *removed >> length;
+    if (in.status() != QDataStream::Ok || length < 0 || length > INT_MAX)
+        return false;
+    data->resize(int(length));
+    return in.readRawData(data->data(), int(length)) == length;
+}
+
+void EditJournal::start(const QString &fileName)
+{
+    discard();
+
+    const QFileInfo info(fileName);
+    baseFileName = fileName.isEmpty() ? QString() : info.absoluteFilePath();
+    baseSize = fileName.isEmpty() ? 0 : info.size();
+    baseModified = fileName.isEmpty() ? 0 : info.lastModified().toMSecsSinceEpoch();
+    path = journalDirectory() + QLatin1Char('/')
+            + QUuid::createUuid().toString(QUuid::WithoutBraces) + QLatin1String(".journal");
+    journalSize = 0;
+    begin();
+
+    // Edits made before journaling started are not known one by one
+    snapshotPending = fileName.isEmpty() || editor->isModified();
+}
+
+void EditJournal::resume(const QString &journalFileName, const Header &header, qint64 length)
+{
+    discard();
+
+    baseFileName = header.fileName;
+    baseSize = header.baseSize;
+    baseModified = header.baseModified;
+    path = journalFileName;
+    begin();
+
+    // A record cut short by the crash would hide everything appended after it
+    QFile file(path);
+    if (file.size() > length)
+        file.resize(length);
+    journalSize = length;
+}
+
+void EditJournal::begin()
+{
+    active = true;
+    snapshotPending = false;
+    unit = editor->hasBuffer() ? Bytes : Characters;
+    if (editor->hasBuffer())
+        editor->pieceTable()->resetChangedSpan();
+    resetSpan();
+
+    QDir().mkpath(journalDirectory());
+    lock.reset(new QLockFile(lockFileName(path)));
+    lock->tryLock(0);
+}
+
+void EditJournal::discard()
+{
+    if (!active)
+        return;
+
+    active = false;
+    snapshotPending = false;
+
+    // The lock goes only after the journal, once queued writes are done
+    const QString fileName = path;
+    const bool written = journalSize > 0;
+    QSharedPointer<QLockFile> lock = this->lock;
+    this->lock.reset();
+    QtConcurrent::run(&writer, [fileName, written, lock]() {
+        if (written)
+            QFile::remove(fileName);
+        lock->unlock();
+    });
+    path.clear();
+    journalSize = 0;
+}
+
+void EditJournal::flush()
+{
+    // Nothing is written while a load, save or Replace All owns the document
+    if (!active || !editor || editor->isReadOnly())
+        return;
+
+    if (snapshotPending) {
+        compact();
+        return;
+    }
+
+    qint64 size;
+    if (editor->hasBuffer()) {
+        editor->commitWindow();
+        PieceTable *table = editor->pieceTable();
+        if (!table->hasChangedSpan())
+            return;
+
+        // A span this large costs as much as a snapshot, which also
+        // shrinks the journal
+        const PieceTable::Edit span = table->changedSpan();
+        size = table->size();
+        if (span.inserted > size / 2) {
+            compact();
+            return;
+        }
+        append(span.position, span.removed, table->read(span.position, span.inserted));
+        table->resetChangedSpan();
+    } else {
+        if (!spanChanged)
+            return;
+
+        size = editor->document()->characterCount() - 1;
+        const qint64 end = size - spanTail;
+        append(spanStart, spanBaseSize - spanTail - spanStart,
+               documentText(int(spanStart), int(end)).toUtf8());
+        resetSpan();
+    }
+
+    if (journalSize > qMax(CompactThreshold, 2 * size))
+        compact();
+}
+
+void EditJournal::contentsChange(int position, int charsRemoved, int charsAdded)
+{
+    // Window reloads in buffer mode are not edits; the piece table tracks those
+    if (!active || editor->hasBuffer())
+        return;
+
+    // The reported range can include the final paragraph separator, which
+    // is not text; clamping only widens the span
+    Q_UNUSED(charsRemoved);
+    const qint64 size = editor->document()->characterCount() - 1;
+    const qint64 start = qMin<qint64>(position, size);
+    const qint64 tail = qMax<qint64>(0, size - position - charsAdded);
+    spanStart = spanChanged ? qMin(spanStart, start) : start;
+    spanTail = spanChanged ? qMin(spanTail, tail) : tail;
+    spanChanged = true;
+}
+
+void EditJournal::append(qint64 position, qint64 removed, const QByteArray &data)
+{
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_15);
+    if (journalSize == 0)
+        writeHeader(out);
+    writeRecordHead(out, position, removed, data.size());
+    out.writeRawData(data.constData(), data.size());
+    journalSize += bytes.size();
+
+    const QString fileName = path;
+    QtConcurrent::run(&writer, [fileName, bytes]() {
+        QDir().mkpath(QFileInfo(fileName).path());
+        appendToFile(fileName, bytes);
+    });
+}
+
+void EditJournal::compact()
+{
+    // The snapshot replaces the journal in one rename; later appends queue
+    // behind it on the writer thread
+    snapshotPending = false;
+    QByteArray head;
+    QDataStream out(&head, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_15);
+    writeHeader(out);
+
+    QSharedPointer<const PieceTable> table;
+    QByteArray text;
+    qint64 length;
+    if (editor->hasBuffer()) {
+        editor->commitWindow();
+        table.reset(new PieceTable(editor->pieceTable()->snapshot()));
+        editor->pieceTable()->resetChangedSpan();
+        length = table->size();
+    } else {
+        text = documentText(0, editor->document()->characterCount() - 1).toUtf8();
+        resetSpan();
+        length = text.size();
+    }
+    writeRecordHead(out, 0, -1, length);
+    journalSize = head.size() + length;
+
+    const QString fileName = path;
+    QtConcurrent::run(&writer, [fileName, head, table, text]() {
+        QDir().mkpath(QFileInfo(fileName).path());
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly))
+            return;
+        file.write(head);
+        if (table) {
+            table->forEachChunk(0, table->size(), [&file](const char *data, qint64 count) {
+                for (qint64 done = 0; done < count; done += WriteBlock)
+                    file.write(data + done, qMin(WriteBlock, count - done));
+            });
+        } else {
+            file.write(text);
+        }
+        file.commit();
+    });
+}
+
+void EditJournal::writeHeader(QDataStream &out) const
+{
+    out << JournalMagic << JournalVersion << quint8(unit) << baseFileName << baseSize << baseModified;
+}
+
+QString EditJournal::documentText(int start, int end) const
+{
+    QTextCursor cursor(editor->document());
+    cursor.setPosition(start);
+    cursor.setPosition(end, QTextCursor::KeepAnchor);
+    QString text = cursor.selectedText();
+    text.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    return text;
+}
+
+void EditJournal::resetSpan()
+{
+    spanChanged = false;
+    spanStart = 0;
+    spanTail = 0;
+    spanBaseSize = editor->hasBuffer() ? 0 : editor->document()->characterCount() - 1;
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QThreadPool>
+#include <QSharedPointer>
+
+class TextEditor;
+class QDataStream;
+class QLockFile;
+
+// Append-only autosave journal. Each flush appends one record replacing
+// the span of the document changed since the previous flush, so a flush
+// costs as much as the edits, not the document. Records are written in
+// order on a single writer thread. Once the journal outgrows the document
+// it is rewritten as one full snapshot.
+//
+// Layout: a header (magic, version, unit, file name, size and modification
+// time of the file on disk), then records of position, removed length and
+// data length (qint64 each) followed by the UTF-8 or raw data. A negative
+// removed length replaces the whole content.
+class EditJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Positions count UTF-16 units of a QTextDocument or bytes of a piece table
+    enum Unit { Characters, Bytes };
+
+    struct Header
+    {
+        Unit unit;
+        QString fileName;
+        qint64 baseSize;
+        qint64 baseModified;
+    };
+
+    explicit EditJournal(TextEditor *editor, QObject *parent = nullptr);
+    ~EditJournal();
+
+    // Moves the journal to an editor holding the same content it had when
+    // last flushed, e.g. a document read back from the spill cache. While
+    // the editor is nullptr nothing is written.
+    void setEditor(TextEditor *editor);
+
+    // Journals the document against fileName as it is on disk now; an
+    // untitled or already modified document starts with a full snapshot.
+    // Any previous journal is removed.
+    void start(const QString &fileName);
+    void discard();
+
+    // Continues a journal left behind by a crash, after its records were
+    // replayed into the editor; length is where its last complete record ends
+    void resume(const QString &journalFileName, const Header &header, qint64 length);
+    bool isActive() const { return active; }
+    QString journalFileName() const { return path; }
+
+    // Journals are locked by the process writing them
+    static QString journalDirectory();
+    static QString lockFileName(const QString &journalFileName);
+    static bool readHeader(QDataStream &in, Header *header);
+    static bool readRecord(QDataStream &in, qint64 *position, qint64 *removed, QByteArray *data);
+
+public slots:
+    void flush();
+
+private slots:
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+
+private:
+    void append(qint64 position, qint64 removed, const QByteArray &data);
+    void compact();
+    void writeHeader(QDataStream &out) const;
+    QString documentText(int start, int end) const;
+    void begin();
+    void resetSpan();
+
+    TextEditor *editor;
+    bool active;
+    bool snapshotPending;
+    QString path;
+    QString baseFileName;
+    qint64 baseSize;
+    qint64 baseModified;
+    Unit unit;
+    qint64 journalSize;
+    QSharedPointer<QLockFile> lock;
+
+    // Changed span of a QTextDocument, kept like PieceTable::changedSpan()
+    bool spanChanged;
+    qint64 spanStart;
+    qint64 spanTail;
+    qint64 spanBaseSize;
+
+    QThreadPool writer;
+};
+
+#endif // EDITJOURNAL_H
\ No newline at end of file
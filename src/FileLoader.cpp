@@ -0,0 +1,136 @@
+#include "FileLoader.h"
+#include <QFile>
+#include "TextDecoder.h"
+#include <QtConcurrent>
+
+// Bytes read and decoded per chunk
+static const qint64 ChunkSize = 256 * 1024;
+
+// Chunks that may wait in the event queue before the reader pauses
+static const int MaxQueuedChunks = 4;
+
+FileLoader::FileLoader(QObject *parent)
+    : QObject(parent)
+    , byteOrderMark(false)
+    , running(false)
+    , credits(MaxQueuedChunks)
+    , currentGeneration(0)
+{
+}
+
+FileLoader::~FileLoader()
+{
+    cancel();
+}
+
+void FileLoader::start(const QString &fileName)
+{
+    cancel();
+
+    path = fileName;
+    running = true;
+    credits.acquire(credits.available());
+    credits.release(MaxQueuedChunks);
+
+    const quint64 generation = ++currentGeneration;
+    future = QtConcurrent::run([this, generation]() { run(generation); });
+}
+
+void FileLoader::cancel()
+{
+    // Bumping the generation stops the reader and drops its queued chunks
+    ++currentGeneration;
+    future.waitForFinished();
+    running = false;
+}
+
+void FileLoader::run(quint64 generation)
+{
+    QFile file(path);
+
+    // Line breaks are normalized by the decoder, which also sees a "\r\n"
+    // split across two chunks
+    if (!file.open(QIODevice::ReadOnly)) {
+        const QString error = file.errorString();
+        QMetaObject::invokeMethod(this, [this, generation, error]() {
+            if (generation != currentGeneration)
+                return;
+            running = false;
+            emit failed(error);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    const qint64 total = file.size();
+    QScopedPointer<TextDecoder> decoder(new TextDecoder);
+    QString error;
+    QString fallback;
+    for (;;) {
+        const QByteArray bytes = file.read(ChunkSize);
+        if (file.error() != QFileDevice::NoError)
+            break;
+
+        // The first chunk decides the encoding; invalid input ends the
+        // load, unless UTF-8 was only a guess and the 8-bit codec may do
+        QString text;
+        const bool decoded = bytes.isEmpty() ? decoder->finish()
+                                             : decoder->decode(bytes.constData(), bytes.size(), &text);
+        if (!decoded) {
+            if (!decoder->canFallBack() || !file.seek(0)) {
+                error = decoder->errorString();
+                break;
+            }
+            fallback = decoder->errorString();
+            decoder.reset(new TextDecoder(true));
+            QMetaObject::invokeMethod(this, [this, generation]() {
+                if (generation != currentGeneration)
+                    return;
+                emit restarted();
+            }, Qt::QueuedConnection);
+            continue;
+        }
+        if (bytes.isEmpty())
+            break;
+        const qint64 position = file.pos();
+
+        if (!waitForCredit(generation))
+            return;
+
+        QMetaObject::invokeMethod(this, [this, generation, text, position, total]() {
+            if (generation != currentGeneration)
+                return;
+            emit chunkLoaded(text);
+            emit progress(position, total);
+            credits.release();
+        }, Qt::QueuedConnection);
+    }
+
+    if (error.isEmpty() && file.error() != QFileDevice::NoError)
+        error = file.errorString();
+    const QString encodingName = decoder->encodingName();
+    const QByteArray codecName = decoder->codecName();
+    const bool bom = decoder->hasByteOrderMark();
+    QMetaObject::invokeMethod(this, [this, generation, error, encodingName, codecName, bom, fallback]() {
+        if (generation != currentGeneration)
+            return;
+        running = false;
+        encoding = encodingName;
+        codec = codecName;
+        byteOrderMark = bom;
+        warning = fallback;
+        if (error.isEmpty())
+            emit finished();
+        else
+            emit failed(error);
+    }, Qt::QueuedConnection);
+}
+
+bool FileLoader::waitForCredit(quint64 generation)
+{
+    // Don't let decoded text pile up faster than the editor can take it
+    while (!credits.tryAcquire(1, 50)) {
+        if (generation != currentGeneration)
+            return false;
+    }
+    return generation == currentGeneration;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef FILELOADER_H
+#define FILELOADER_H
+
+#include <QObject>
+#include <QString>
+#include <QFuture>
+#include <QSemaphore>
+#include <atomic>
+
+// Reads and decodes a file on a worker thread and hands the text to the
+// GUI thread in chunks, so the editor can append it piece by piece
+class FileLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileLoader(QObject *parent = nullptr);
+    ~FileLoader();
+
+    void start(const QString &fileName);
+    void cancel();
+    bool isRunning() const { return running; }
+    QString fileName() const { return path; }
+    // What the last finished load was decoded as
+    QString encodingName() const { return encoding; }
+    // Why the last finished load was not decoded as it was detected, if it wasn't
+    QString warningString() const { return warning; }
+    // What FileSaver should encode the text with to write the file back
+    QByteArray codecName() const { return codec; }
+    bool hasByteOrderMark() const { return byteOrderMark; }
+
+signals:
+    // The chunks loaded so far are void; loading starts over from the top
+    void restarted();
+    void chunkLoaded(const QString &text);
+    void progress(qint64 bytesRead, qint64 totalBytes);
+    void finished();
+    void failed(const QString &errorString);
+
+private:
+    void run(quint64 generation);
+    bool waitForCredit(quint64 generation);
+
+    QString path;
+    QString encoding;
+    QString warning;
+    QByteArray codec;
+    bool byteOrderMark;
+    bool running;
+    QFuture<void> future;
+    QSemaphore credits;
+    std::atomic<quint64> currentGeneration;
+};
+
+#endif // FILELOADER_H
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include "FileSaver.h"
+#include "PieceTable.h"
+#include <QTextDocument>
+#include <QSaveFile>
+#include <QEventLoop>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QtConcurrent>
+
+// Characters encoded per slice on the GUI thread
+static const int ChunkChars = 1024 * 1024;
+
+// Longest a slice may keep the GUI thread busy
+static const qint64 SliceMs = 8;
+
+// Encoded chunks that may wait for the writer
+static const int MaxQueuedChunks = 4;
+
+// Bytes written between progress reports
+static const qint64 ProgressStep = 1024 * 1024;
+
+FileSaver::FileSaver(QObject *parent)
+    : QObject(parent)
+    , totalSize(0)
+    , running(false)
+    , succeeded(false)
+    , source(nullptr)
+    , textMode(true)
+    , producerDone(false)
+    , aborted(false)
+{
+}
+
+FileSaver::~FileSaver()
+{
+    {
+        QMutexLocker locker(&mutex);
+        aborted = true;
+        chunkReady.wakeAll();
+    }
+    future.waitForFinished();
+}
+
+void FileSaver::save(QTextDocument *document, const QString &fileName,
+                     const QByteArray &codecName, bool byteOrderMark)
+{
+    begin(fileName, document->characterCount());
+    source = document;
+    nextBlock = document->begin();
+
+    // A file goes back in the encoding it was loaded from; new text is
+    // encoded like QTextStream would, so the output matches earlier saves
+    QTextCodec *codec = codecName.isEmpty() ? nullptr : QTextCodec::codecForName(codecName);
+    if (!codec)
+        codec = QTextCodec::codecForLocale();
+    encoder.reset(codec->makeEncoder(byteOrderMark ? QTextCodec::DefaultConversion
+                                                   : QTextCodec::IgnoreHeader));
+    // Text mode line breaks would cut into the units of UTF-16 and the like
+    textMode = codec->fromUnicode(QString("\n")) == "\n";
+
+    future = QtConcurrent::run([this]() { writeQueued(); });
+    QTimer::singleShot(0, this, &FileSaver::feedBlocks);
+}
+
+void FileSaver::save(const PieceTable &table, const QString &fileName)
+{
+    begin(fileName, table.size());
+
+    // The snapshot keeps the pieces stable even if the table changes meanwhile
+    const PieceTable snapshot = table.snapshot();
+    future = QtConcurrent::run([this, snapshot]() { writeTable(snapshot); });
+}
+
+bool FileSaver::waitForFinished()
+{
+    // The GUI thread feeds the writer, so keep the event loop running
+    if (running) {
+        QEventLoop loop;
+        connect(this, &FileSaver::finished, &loop, &QEventLoop::quit);
+        connect(this, &FileSaver::failed, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    return succeeded;
+}
+
+void FileSaver::begin(const QString &fileName, qint64 total)
+{
+    future.waitForFinished();
+
+    path = fileName;
+    totalSize = total;
+    running = true;
+    succeeded = false;
+    source = nullptr;
+    queue.clear();
+    producerDone = false;
+    aborted = false;
+}
+
+void FileSaver::feedBlocks()
+{
+    if (!source)
+        return;
+
+    {
+        QMutexLocker locker(&mutex);
+        if (aborted) {
+            source = nullptr;
+            return;
+        }
+        // Let the writer catch up before encoding more
+        if (queue.size() >= MaxQueuedChunks) {
+            QTimer::singleShot(5, this, &FileSaver::feedBlocks);
+            return;
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QString text;
+    while (nextBlock.isValid() && text.size() < ChunkChars && !timer.hasExpired(SliceMs)) {
+        text += nextBlock.text();
+        nextBlock = nextBlock.next();
+        if (nextBlock.isValid())
+            text += QLatin1Char('\n');
+    }
+
+    // Same substitutions as QTextDocument::toPlainText()
+    text.replace(QChar::Nbsp, QLatin1Char(' '));
+    text.replace(QChar::LineSeparator, QLatin1Char('\n'));
+
+    const bool done = !nextBlock.isValid();
+    const QByteArray bytes = encoder->fromUnicode(text);
+    {
+        QMutexLocker locker(&mutex);
+        queue.enqueue(bytes);
+        producerDone = done;
+        chunkReady.wakeOne();
+    }
+
+    if (done)
+        source = nullptr;
+    else
+        QTimer::singleShot(0, this, &FileSaver::feedBlocks);
+}
+
+void FileSaver::writeQueued()
+{
+    QSaveFile file(path);
+    QIODevice::OpenMode mode = QIODevice::WriteOnly;
+    if (textMode)
+        mode |= QIODevice::Text;
+    if (!file.open(mode)) {
+        fail(file.errorString());
+        return;
+    }
+
+    qint64 written = 0;
+    forever {
+        QByteArray chunk;
+        {
+            QMutexLocker locker(&mutex);
+            while (queue.isEmpty() && !producerDone && !aborted)
+                chunkReady.wait(&mutex);
+            if (aborted) {
+                file.cancelWriting();
+                return;
+            }
+            if (queue.isEmpty())
+                break;
+            chunk = queue.dequeue();
+        }
+
+        if (file.write(chunk) != chunk.size()) {
+            fail(file.errorString());
+            return;
+        }
+        written += chunk.size();
+        report(written);
+    }
+
+    commit(file);
+}
+
+void FileSaver::writeTable(const PieceTable &table)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        fail(file.errorString());
+        return;
+    }
+
+    // An edited table can have many tiny pieces; report progress in steps
+    qint64 written = 0;
+    qint64 reported = 0;
+    bool ok = true;
+    table.forEachChunk(0, table.size(), [&](const char *data, qint64 length) {
+        if (!ok)
+            return;
+        ok = file.write(data, length) == length;
+        written += length;
+        if (written - reported >= ProgressStep) {
+            report(written);
+            reported = written;
+        }
+    });
+
+    if (!ok) {
+        fail(file.errorString());
+        return;
+    }
+    commit(file);
+}
+
+void FileSaver::commit(QSaveFile &file)
+{
+    // commit() flushes, syncs the temporary file to disk and only then
+    // renames it over the target, so a crash never leaves a truncated file
+    if (!file.commit()) {
+        fail(file.errorString());
+        return;
+    }
+
+    QMetaObject::invokeMethod(this, [this]() {
+        running = false;
+        succeeded = true;
+        emit finished();
+    }, Qt::QueuedConnection);
+}
+
+void FileSaver::report(qint64 written)
+{
+    const qint64 total = totalSize;
+    QMetaObject::invokeMethod(this, [this, written, total]() {
+        emit progress(written, total);
+    }, Qt::QueuedConnection);
+}
+
+void FileSaver::fail(const QString &errorString)
+{
+    {
+        QMutexLocker locker(&mutex);
+        aborted = true;
+    }
+
+    QMetaObject::invokeMethod(this, [this, errorString]() {
+        running = false;
+        succeeded = false;
+        emit failed(errorString);
+    }, Qt::QueuedConnection);
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef FILESAVER_H
+#define FILESAVER_H
+
+#include <QObject>
+#include <QString>
+#include <QFuture>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QByteArray>
+#include <QTextBlock>
+#include <QTextCodec>
+#include <QScopedPointer>
+
+class QTextDocument;
+class QSaveFile;
+class PieceTable;
+
+// Writes a document to a temporary file on a worker thread and renames
+// it over the target once everything is on disk. QTextDocument blocks
+// are encoded on the GUI thread in small time slices and queued for the
+// writer, so the full text is never held in memory at once.
+class FileSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileSaver(QObject *parent = nullptr);
+    ~FileSaver();
+
+    // The text is encoded with the named codec, or the locale's when there
+    // is none, with a byte order mark only if asked for
+    void save(QTextDocument *document, const QString &fileName,
+              const QByteArray &codecName = QByteArray(), bool byteOrderMark = false);
+    void save(const PieceTable &table, const QString &fileName);
+    bool waitForFinished();
+    bool isRunning() const { return running; }
+    QString fileName() const { return path; }
+
+signals:
+    void progress(qint64 written, qint64 total);
+    void finished();
+    void failed(const QString &errorString);
+
+private slots:
+    void feedBlocks();
+
+private:
+    void begin(const QString &fileName, qint64 total);
+    void writeQueued();
+    void writeTable(const PieceTable &table);
+    void commit(QSaveFile &file);
+    void report(qint64 written);
+    void fail(const QString &errorString);
+
+    QString path;
+    qint64 totalSize;
+    bool running;
+    bool succeeded;
+    QFuture<void> future;
+
+    // GUI thread side of the queue
+    QTextDocument *source;
+    QTextBlock nextBlock;
+    QScopedPointer<QTextEncoder> encoder;
+    bool textMode;
+
+    QMutex mutex;
+    QWaitCondition chunkReady;
+    QQueue<QByteArray> queue;
+    bool producerDone;
+    bool aborted;
+};
+
+#endif // FILESAVER_H
\ No newline at end of file
@@ -0,0 +1,254 @@
+#include "FileSearch.h"
+#include "TrigramIndex.h"
+#include "PieceTable.h"
+#include "ReplaceAll.h"
+#include <QFile>
+#include <QtConcurrent>
+#include <cstring>
+
+// Candidate files handed to one task
+static const int FilesPerBatch = 16;
+
+// The search stops once this many matches were reported
+static const int MaxMatches = 10000;
+
+// Matches reported for a single file at most
+static const int MaxMatchesPerFile = 1000;
+
+// Files larger than this are mapped and searched a chunk at a time; the
+// index does not narrow them down either
+static const qint64 MaxFileSize = 16 * 1024 * 1024;
+
+// Bytes checked for a NUL to tell binary files apart
+static const int BinaryProbe = 8192;
+
+// Longest part of a matching line kept for display
+static const int MaxLineText = 200;
+
+// Literals usable against the index. Only ASCII letters are folded there,
+// so a case-insensitive literal is cut at every other non-ASCII character.
+static QList<QByteArray> indexLiterals(const QString &pattern, bool regex, Qt::CaseSensitivity cs)
+{
+    QList<QByteArray> literals = regex ? TrigramIndex::requiredLiterals(pattern)
+                                       : QList<QByteArray>() << pattern.toUtf8();
+    if (regex && pattern.contains(QLatin1String("(?i")))
+        cs = Qt::CaseInsensitive;
+    if (cs == Qt::CaseSensitive)
+        return literals;
+
+    QList<QByteArray> ascii;
+    for (const QByteArray &literal : qAsConst(literals)) {
+        QByteArray run;
+        for (char byte : literal) {
+            if (uchar(byte) < 0x80) {
+                run += byte;
+            } else {
+                if (run.size() >= 3)
+                    ascii.append(run);
+                run.clear();
+            }
+        }
+        if (run.size() >= 3)
+            ascii.append(run);
+    }
+    return ascii;
+}
+
+static void addMatch(QVector<FileSearch::Match> *found, const QString &fileName, const QString &text,
+                     int at, int length, int *line, int *lineStart, int *scanned)
+{
+    // Lines are counted incrementally since matches come in order
+    for (int i = *scanned; i < at; ++i) {
+        if (text.at(i) == QLatin1Char('\n')) {
+            ++*line;
+            *lineStart = i + 1;
+        }
+    }
+    *scanned = at;
+
+    int lineEnd = text.indexOf(QLatin1Char('\n'), at);
+    if (lineEnd < 0)
+        lineEnd = text.size();
+    const int column = at - *lineStart;
+    const int from = column > MaxLineText / 2 ? at - MaxLineText / 2 : *lineStart;
+    found->append({fileName, *line, column, length,
+                   text.mid(from, qMin(lineEnd - from, MaxLineText))});
+}
+
+// Matches in text, whose first line is line firstLine of the file
+static void searchText(QVector<FileSearch::Match> *found, const QString &fileName, const QString &text,
+                       int firstLine, const LiteralSearcher &literal, const QRegularExpression &expression,
+                       bool regex)
+{
+    int line = firstLine;
+    int lineStart = 0;
+    int scanned = 0;
+    if (!regex) {
+        const int length = literal.length();
+        qint64 at = literal.indexIn(text.constData(), text.size());
+        while (at >= 0 && found->size() < MaxMatchesPerFile) {
+            addMatch(found, fileName, text, int(at), length, &line, &lineStart, &scanned);
+            at = literal.indexIn(text.constData(), text.size(), at + length);
+        }
+        return;
+    }
+
+    QRegularExpressionMatchIterator matches = expression.globalMatch(text);
+    while (matches.hasNext() && found->size() < MaxMatchesPerFile) {
+        const QRegularExpressionMatch match = matches.next();
+        addMatch(found, fileName, text, match.capturedStart(), match.capturedLength(),
+                 &line, &lineStart, &scanned);
+    }
+}
+
+// Large files are mapped and decoded a few megabytes at a time, cut at
+// line breaks, so they are never held in memory whole
+static void searchLargeFile(QVector<FileSearch::Match> *found, const QString &fileName,
+                            const LiteralSearcher &literal, const QRegularExpression &expression, bool regex)
+{
+    PieceTable table;
+    if (!table.mapFile(fileName))
+        return;
+    const QByteArray probe = table.read(0, qMin<qint64>(table.size(), BinaryProbe));
+    if (std::memchr(probe.constData(), 0, size_t(probe.size())))
+        return;
+
+    int line = 0;
+    for (qint64 start = 0; start < table.size() && found->size() < MaxMatchesPerFile;) {
+        const qint64 end = ReplaceAll::chunkEnd(table, start);
+        const QByteArray bytes = table.read(start, end - start);
+        searchText(found, fileName, QString::fromUtf8(bytes), line, literal, expression, regex);
+        line += bytes.count('\n');
+        start = end;
+    }
+}
+
+static QVector<FileSearch::Match> searchFile(const QString &fileName, const LiteralSearcher &literal,
+                                             const QRegularExpression &expression, bool regex)
+{
+    QVector<FileSearch::Match> found;
+    QFile file(fileName);
+    if (file.size() > MaxFileSize) {
+        searchLargeFile(&found, fileName, literal, expression, regex);
+        return found;
+    }
+    if (!file.open(QIODevice::ReadOnly))
+        return found;
+    const QByteArray data = file.readAll();
+    if (std::memchr(data.constData(), 0, size_t(qMin(data.size(), BinaryProbe))))
+        return found;
+
+    searchText(&found, fileName, QString::fromUtf8(data), 0, literal, expression, regex);
+    return found;
+}
+
+FileSearch::FileSearch(TrigramIndex *index, QObject *parent)
+    : QObject(parent)
+    , index(index)
+    , regex(false)
+    , running(false)
+    , generation(0)
+    , pendingBatches(0)
+    , filesTotal(0)
+    , filesDone(0)
+    , matchCount(0)
+{
+}
+
+FileSearch::~FileSearch()
+{
+    cancel();
+    tasks.waitForFinished();
+}
+
+void FileSearch::start(const QString &pattern, bool regex, Qt::CaseSensitivity cs)
+{
+    cancel();
+    tasks.waitForFinished();
+    tasks.clearFutures();
+
+    this->regex = regex;
+    if (regex) {
+        QRegularExpression::PatternOptions options = QRegularExpression::MultilineOption;
+        if (cs == Qt::CaseInsensitive)
+            options |= QRegularExpression::CaseInsensitiveOption;
+        expression = QRegularExpression(pattern, options);
+        expression.optimize();
+        literal = LiteralSearcher();
+    } else {
+        literal = LiteralSearcher(pattern, cs);
+        expression = QRegularExpression();
+    }
+
+    ++generation;
+    cancelled.reset(new std::atomic<bool>(false));
+    running = true;
+    filesDone = 0;
+    matchCount = 0;
+    pendingBatches = 0;
+
+    // Looking the candidates up takes milliseconds; reading them is the
+    // part that goes to the thread pool
+    const QStringList files = pattern.isEmpty() || (regex && !expression.isValid())
+            ? QStringList() : index->candidates(indexLiterals(pattern, regex, cs));
+    filesTotal = files.size();
+    emit progress(0, filesTotal);
+
+    for (int first = 0; first < files.size(); first += FilesPerBatch) {
+        const QStringList batch = files.mid(first, FilesPerBatch);
+        const quint64 job = generation;
+        const LiteralSearcher literal = this->literal;
+        const QRegularExpression expression = this->expression;
+        const QSharedPointer<std::atomic<bool>> cancelled = this->cancelled;
+        ++pendingBatches;
+        tasks.addFuture(QtConcurrent::run([=]() {
+            QVector<Match> found;
+            for (const QString &fileName : batch) {
+                if (*cancelled)
+                    return;
+                found += searchFile(fileName, literal, expression, regex);
+            }
+            QMetaObject::invokeMethod(this, [=]() {
+                batchDone(job, batch.size(), found);
+            }, Qt::QueuedConnection);
+        }));
+    }
+
+    if (pendingBatches == 0) {
+        running = false;
+        emit finished(0, false);
+    }
+}
+
+void FileSearch::cancel()
+{
+    if (!running)
+        return;
+
+    *cancelled = true;
+    ++generation;
+    running = false;
+}
+
+void FileSearch::batchDone(quint64 job, int fileCount, const QVector<Match> &found)
+{
+    if (job != generation || !running)
+        return;
+
+    --pendingBatches;
+    filesDone += fileCount;
+    const bool truncated = matchCount + found.size() >= MaxMatches;
+    const QVector<Match> reported = truncated ? found.mid(0, MaxMatches - matchCount) : found;
+    matchCount += reported.size();
+    if (!reported.isEmpty())
+        emit matchesFound(reported);
+    emit progress(filesDone, filesTotal);
+
+    if (truncated) {
+        cancel();
+        emit finished(matchCount, true);
+    } else if (pendingBatches == 0) {
+        running = false;
+        emit finished(matchCount, false);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#ifndef FILESEARCH_H
+#define FILESEARCH_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QRegularExpression>
+#include <QSharedPointer>
+#include <QFutureSynchronizer>
+#include <atomic>
+#include "LiteralSearcher.h"
+
+class TrigramIndex;
+
+// Searches the workspace for a literal or regular expression pattern. The
+// trigram index narrows the files down; the candidates are then read and
+// checked on the thread pool, and matches are reported as they are found.
+class FileSearch : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Line and column are zero-based; text is the matching line
+    struct Match
+    {
+        QString fileName;
+        int line;
+        int column;
+        int length;
+        QString text;
+    };
+
+    explicit FileSearch(TrigramIndex *index, QObject *parent = nullptr);
+    ~FileSearch();
+
+    void start(const QString &pattern, bool regex, Qt::CaseSensitivity cs);
+    void cancel();
+    bool isRunning() const { return running; }
+
+signals:
+    void matchesFound(const QVector<FileSearch::Match> &matches);
+    void progress(int filesDone, int filesTotal);
+    void finished(int matchCount, bool truncated);
+
+private:
+    void batchDone(quint64 job, int fileCount, const QVector<Match> &found);
+
+    TrigramIndex *index;
+    LiteralSearcher literal;
+    QRegularExpression expression;
+    bool regex;
+    bool running;
+    quint64 generation;
+    QSharedPointer<std::atomic<bool>> cancelled;
+
+    int pendingBatches;
+    int filesTotal;
+    int filesDone;
+    int matchCount;
+    QFutureSynchronizer<void> tasks;
+};
+
+#endif // FILESEARCH_H
\ No newline at end of file
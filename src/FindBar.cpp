@@ -0,0 +1,234 @@
+#include "FindBar.h"
+#include "TextEditor.h"
+#include "ReplaceAll.h"
+#include <QApplication>
+#include <QKeyEvent>
+#include <QTextCursor>
+
+FindBar::FindBar(TextEditor *editor, QWidget *parent)
+    : QWidget(parent)
+    , editor(editor)
+{
+    setupUI();
+}
+
+void FindBar::setEditor(TextEditor *editor)
+{
+    this->editor = editor;
+    patternChanged();
+}
+
+void FindBar::setupUI()
+{
+    QVBoxLayout *mainLayout = new QVBoxLayout(this);
+    mainLayout->setContentsMargins(4, 2, 4, 2);
+    mainLayout->setSpacing(2);
+
+    // Find row
+    findLineEdit = new QLineEdit;
+    findLineEdit->setPlaceholderText("Find");
+    findLineEdit->setClearButtonEnabled(true);
+    connect(findLineEdit, &QLineEdit::textChanged, this, &FindBar::patternChanged);
+    connect(findLineEdit, &QLineEdit::returnPressed, this, &FindBar::returnPressed);
+
+    previousButton = new QToolButton;
+    previousButton->setText("Previous");
+    previousButton->setAutoRaise(true);
+    connect(previousButton, &QToolButton::clicked, this, &FindBar::findPrevious);
+
+    nextButton = new QToolButton;
+    nextButton->setText("Next");
+    nextButton->setAutoRaise(true);
+    connect(nextButton, &QToolButton::clicked, this, &FindBar::findNext);
+
+    matchCaseCheckBox = new QCheckBox("Match case");
+    connect(matchCaseCheckBox, &QCheckBox::toggled, this, &FindBar::patternChanged);
+
+    regexCheckBox = new QCheckBox("Regular expression");
+    connect(regexCheckBox, &QCheckBox::toggled, this, &FindBar::patternChanged);
+
+    statusLabel = new QLabel;
+
+    closeButton = new QToolButton;
+    closeButton->setText("Close");
+    closeButton->setAutoRaise(true);
+    connect(closeButton, &QToolButton::clicked, this, &QWidget::hide);
+
+    QHBoxLayout *findLayout = new QHBoxLayout;
+    findLayout->addWidget(findLineEdit, 1);
+    findLayout->addWidget(previousButton);
+    findLayout->addWidget(nextButton);
+    findLayout->addWidget(matchCaseCheckBox);
+    findLayout->addWidget(regexCheckBox);
+    findLayout->addWidget(statusLabel);
+    findLayout->addStretch();
+    findLayout->addWidget(closeButton);
+
+    // Replace row
+    replaceLineEdit = new QLineEdit;
+    replaceLineEdit->setPlaceholderText("Replace");
+
+    replaceButton = new QToolButton;
+    replaceButton->setText("Replace");
+    replaceButton->setAutoRaise(true);
+    connect(replaceButton, &QToolButton::clicked, this, &FindBar::replaceNext);
+
+    replaceAllButton = new QToolButton;
+    replaceAllButton->setText("Replace All");
+    replaceAllButton->setAutoRaise(true);
+    connect(replaceAllButton, &QToolButton::clicked, this, &FindBar::replaceAllClicked);
+
+    replaceRow = new QWidget;
+    QHBoxLayout *replaceLayout = new QHBoxLayout(replaceRow);
+    replaceLayout->setContentsMargins(0, 0, 0, 0);
+    replaceLayout->addWidget(replaceLineEdit, 1);
+    replaceLayout->addWidget(replaceButton);
+    replaceLayout->addWidget(replaceAllButton);
+    replaceLayout->addStretch();
+    replaceRow->hide();
+
+    mainLayout->addLayout(findLayout);
+    mainLayout->addWidget(replaceRow);
+}
+
+Qt::CaseSensitivity FindBar::caseSensitivity() const
+{
+    return matchCaseCheckBox->isChecked() ? Qt::CaseSensitive : Qt::CaseInsensitive;
+}
+
+LiteralSearcher FindBar::searcher() const
+{
+    return LiteralSearcher(findLineEdit->text(), caseSensitivity());
+}
+
+QRegularExpression FindBar::expression() const
+{
+    QRegularExpression::PatternOptions options = QRegularExpression::MultilineOption;
+    if (caseSensitivity() == Qt::CaseInsensitive)
+        options |= QRegularExpression::CaseInsensitiveOption;
+    return QRegularExpression(findLineEdit->text(), options);
+}
+
+void FindBar::showFind()
+{
+    // Start from the selection when it is a single line of text
+    const QString selected = editor->textCursor().selectedText();
+    if (!selected.isEmpty() && !selected.contains(QChar::ParagraphSeparator))
+        findLineEdit->setText(selected);
+
+    replaceRow->hide();
+    show();
+    findLineEdit->setFocus();
+    findLineEdit->selectAll();
+    patternChanged();
+}
+
+void FindBar::showReplace()
+{
+    showFind();
+    replaceRow->show();
+}
+
+void FindBar::findNext()
+{
+    find(false);
+}
+
+void FindBar::findPrevious()
+{
+    find(true);
+}
+
+void FindBar::replaceNext()
+{
+    if (editor->isReadOnly())
+        return;
+
+    // Replace the selection only if it is a match, then move on
+    QTextCursor cursor = editor->textCursor();
+    const QString selected = cursor.selectedText();
+    editor->editHistory()->prepare(cursor.selectionStart(), cursor.selectionEnd());
+    if (!selected.isEmpty()) {
+        if (isRegex()) {
+            const QRegularExpression anchored(QRegularExpression::anchoredPattern(pattern()),
+                                              expression().patternOptions());
+            const QRegularExpressionMatch match = anchored.match(selected);
+            if (match.hasMatch())
+                cursor.insertText(ReplaceAll::expandReplacement(replacement(), match));
+        } else if (selected.compare(pattern(), caseSensitivity()) == 0) {
+            cursor.insertText(replacement());
+        }
+    }
+    editor->editHistory()->release();
+    find(false);
+}
+
+void FindBar::keyPressEvent(QKeyEvent *event)
+{
+    if (event->key() == Qt::Key_Escape) {
+        hide();
+        editor->setFocus();
+        return;
+    }
+    QWidget::keyPressEvent(event);
+}
+
+void FindBar::hideEvent(QHideEvent *event)
+{
+    editor->setSearchHighlight(LiteralSearcher());
+    QWidget::hideEvent(event);
+}
+
+void FindBar::patternChanged()
+{
+    statusLabel->clear();
+    if (!isVisible())
+        return;
+
+    if (!isRegex()) {
+        editor->setSearchHighlight(searcher());
+        return;
+    }
+
+    const QRegularExpression pattern = expression();
+    if (!pattern.isValid())
+        statusLabel->setText("Invalid expression");
+    editor->setSearchHighlight(pattern);
+}
+
+void FindBar::returnPressed()
+{
+    find(QApplication::keyboardModifiers() & Qt::ShiftModifier);
+}
+
+void FindBar::replaceAllClicked()
+{
+    if (pattern().isEmpty())
+        return;
+    if (isRegex() && !expression().isValid()) {
+        statusLabel->setText("Invalid expression");
+        return;
+    }
+    emit replaceAllRequested();
+}
+
+void FindBar::find(bool backward)
+{
+    if (pattern().isEmpty()) {
+        showFind();
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    bool found;
+    if (isRegex())
+        found = editor->findText(expression(), backward);
+    else
+        found = editor->findText(searcher(), backward);
+    QApplication::restoreOverrideCursor();
+
+    if (isRegex() && !expression().isValid())
+        statusLabel->setText("Invalid expression");
+    else
+        statusLabel->setText(found ? QString() : QString("Not found"));
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef FINDBAR_H
+#define FINDBAR_H
+
+#include <QWidget>
+#include <QLineEdit>
+#include <QCheckBox>
+#include <QToolButton>
+#include <QLabel>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QRegularExpression>
+#include "LiteralSearcher.h"
+
+class TextEditor;
+
+// Search and replace strip shown below the editor
+class FindBar : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FindBar(TextEditor *editor, QWidget *parent = nullptr);
+
+    // The previous editor may already be gone and is not touched
+    void setEditor(TextEditor *editor);
+
+    QString pattern() const { return findLineEdit->text(); }
+    QString replacement() const { return replaceLineEdit->text(); }
+    bool isRegex() const { return regexCheckBox->isChecked(); }
+    Qt::CaseSensitivity caseSensitivity() const;
+    LiteralSearcher searcher() const;
+    QRegularExpression expression() const;
+
+public slots:
+    void showFind();
+    void showReplace();
+    void findNext();
+    void findPrevious();
+    void replaceNext();
+
+protected:
+    void keyPressEvent(QKeyEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private slots:
+    void patternChanged();
+    void returnPressed();
+    void replaceAllClicked();
+
+private:
+    void setupUI();
+    void find(bool backward);
+
+    TextEditor *editor;
+    QLineEdit *findLineEdit;
+    QCheckBox *matchCaseCheckBox;
+    QCheckBox *regexCheckBox;
+    QToolButton *previousButton;
+    QToolButton *nextButton;
+    QToolButton *closeButton;
+    QLabel *statusLabel;
+
+    QWidget *replaceRow;
+    QLineEdit *replaceLineEdit;
+    QToolButton *replaceButton;
+    QToolButton *replaceAllButton;
+
+signals:
+    void replaceAllRequested();
+};
+
+#endif // FINDBAR_H
\ No newline at end of file
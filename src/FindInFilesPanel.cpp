@@ -0,0 +1,137 @@
+#include "FindInFilesPanel.h"
+#include "TrigramIndex.h"
+#include <QDir>
+
+// Item data roles for the result tree
+static const int FileRole = Qt::UserRole;
+static const int LineRole = Qt::UserRole + 1;
+
+FindInFilesPanel::FindInFilesPanel(TrigramIndex *index, QWidget *parent)
+    : QWidget(parent)
+    , index(index)
+{
+    fileSearch = new FileSearch(index, this);
+    connect(fileSearch, &FileSearch::matchesFound, this, &FindInFilesPanel::addMatches);
+    connect(fileSearch, &FileSearch::progress, this, &FindInFilesPanel::searchProgress);
+    connect(fileSearch, &FileSearch::finished, this, &FindInFilesPanel::searchFinished);
+    connect(index, &TrigramIndex::progress, this, &FindInFilesPanel::indexProgress);
+    connect(index, &TrigramIndex::updated, this, &FindInFilesPanel::indexUpdated);
+
+    setupUI();
+}
+
+void FindInFilesPanel::setupUI()
+{
+    QVBoxLayout *mainLayout = new QVBoxLayout(this);
+    mainLayout->setContentsMargins(0, 0, 0, 0);
+    mainLayout->setSpacing(2);
+
+    queryLineEdit = new QLineEdit;
+    queryLineEdit->setPlaceholderText("Find in files");
+    queryLineEdit->setClearButtonEnabled(true);
+    connect(queryLineEdit, &QLineEdit::returnPressed, this, &FindInFilesPanel::search);
+
+    matchCaseCheckBox = new QCheckBox("Match case");
+    regexCheckBox = new QCheckBox("Regex");
+
+    QHBoxLayout *optionsLayout = new QHBoxLayout;
+    optionsLayout->addWidget(matchCaseCheckBox);
+    optionsLayout->addWidget(regexCheckBox);
+    optionsLayout->addStretch();
+
+    statusLabel = new QLabel("No folder open");
+    statusLabel->setWordWrap(true);
+
+    resultTree = new QTreeWidget;
+    resultTree->setHeaderHidden(true);
+    resultTree->setUniformRowHeights(true);
+    resultTree->setRootIsDecorated(true);
+    connect(resultTree, &QTreeWidget::itemActivated, this, &FindInFilesPanel::itemActivated);
+
+    mainLayout->addWidget(queryLineEdit);
+    mainLayout->addLayout(optionsLayout);
+    mainLayout->addWidget(statusLabel);
+    mainLayout->addWidget(resultTree, 1);
+}
+
+void FindInFilesPanel::search()
+{
+    resultTree->clear();
+    fileItems.clear();
+    if (index->root().isEmpty() || queryLineEdit->text().isEmpty()) {
+        fileSearch->cancel();
+        return;
+    }
+
+    const bool regex = regexCheckBox->isChecked();
+    if (regex && !QRegularExpression(queryLineEdit->text()).isValid()) {
+        statusLabel->setText("Invalid regular expression");
+        return;
+    }
+
+    fileSearch->start(queryLineEdit->text(), regex,
+                      matchCaseCheckBox->isChecked() ? Qt::CaseSensitive : Qt::CaseInsensitive);
+}
+
+void FindInFilesPanel::cancel()
+{
+    if (!fileSearch->isRunning())
+        return;
+
+    fileSearch->cancel();
+    statusLabel->setText("Search cancelled");
+}
+
+void FindInFilesPanel::addMatches(const QVector<FileSearch::Match> &matches)
+{
+    // Matches of one file arrive together, so items are added in bulk
+    const QDir root(index->root());
+    resultTree->setUpdatesEnabled(false);
+    for (const FileSearch::Match &match : matches) {
+        QTreeWidgetItem *&fileItem = fileItems[match.fileName];
+        if (!fileItem) {
+            fileItem = new QTreeWidgetItem(resultTree);
+            fileItem->setText(0, root.relativeFilePath(match.fileName));
+            fileItem->setData(0, FileRole, match.fileName);
+            fileItem->setData(0, LineRole, -1);
+            fileItem->setExpanded(true);
+        }
+
+        QTreeWidgetItem *item = new QTreeWidgetItem(fileItem);
+        item->setText(0, QString("%1: %2").arg(match.line + 1).arg(match.text.trimmed()));
+        item->setData(0, FileRole, match.fileName);
+        item->setData(0, LineRole, match.line);
+    }
+    resultTree->setUpdatesEnabled(true);
+}
+
+void FindInFilesPanel::searchProgress(int filesDone, int filesTotal)
+{
+    statusLabel->setText(QString("Searching %1 of %2 files...").arg(filesDone).arg(filesTotal));
+}
+
+void FindInFilesPanel::searchFinished(int matchCount, bool truncated)
+{
+    QString text = QString("%1 matches in %2 files").arg(matchCount).arg(fileItems.size());
+    if (truncated)
+        text += " (stopped early)";
+    statusLabel->setText(text);
+}
+
+void FindInFilesPanel::indexProgress(int filesDone, int filesTotal)
+{
+    if (!fileSearch->isRunning())
+        statusLabel->setText(QString("Indexing %1 of %2 files...").arg(filesDone).arg(filesTotal));
+}
+
+void FindInFilesPanel::indexUpdated(int fileCount)
+{
+    if (!fileSearch->isRunning())
+        statusLabel->setText(QString("%1 files indexed").arg(fileCount));
+}
+
+void FindInFilesPanel::itemActivated(QTreeWidgetItem *item)
+{
+    const int line = item->data(0, LineRole).toInt();
+    emit openRequested(item->data(0, FileRole).toString(), qMax(line, 0));
+}
\ No newline at end of file
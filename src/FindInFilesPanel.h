@@ -0,0 +1,53 @@
+#ifndef FINDINFILESPANEL_H
+#define FINDINFILESPANEL_H
+
+#include <QWidget>
+#include <QLineEdit>
+#include <QCheckBox>
+#include <QLabel>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QHash>
+#include "FileSearch.h"
+
+class TrigramIndex;
+
+// Sidebar page searching every file of the workspace; results are grouped
+// by file and filled in while the search runs
+class FindInFilesPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FindInFilesPanel(TrigramIndex *index, QWidget *parent = nullptr);
+
+public slots:
+    void search();
+    void cancel();
+
+private slots:
+    void addMatches(const QVector<FileSearch::Match> &matches);
+    void searchProgress(int filesDone, int filesTotal);
+    void searchFinished(int matchCount, bool truncated);
+    void indexProgress(int filesDone, int filesTotal);
+    void indexUpdated(int fileCount);
+    void itemActivated(QTreeWidgetItem *item);
+
+private:
+    void setupUI();
+
+    TrigramIndex *index;
+    FileSearch *fileSearch;
+    QLineEdit *queryLineEdit;
+    QCheckBox *matchCaseCheckBox;
+    QCheckBox *regexCheckBox;
+    QLabel *statusLabel;
+    QTreeWidget *resultTree;
+    QHash<QString, QTreeWidgetItem *> fileItems;
+
+signals:
+    void openRequested(const QString &fileName, int line);
+};
+
+#endif // FINDINFILESPANEL_H
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include "FormatRunStore.h"
+#include <QHash>
+
+// Distinct formats kept before the ones no run uses any more are dropped
+static const int MaxFormats = 256;
+
+FormatRunStore::FormatRunStore()
+    : root(nullptr)
+    , seed(0x9e3779b9u)
+    , formatted(false)
+{
+    formats.append(QTextCharFormat());
+}
+
+FormatRunStore::~FormatRunStore()
+{
+    destroy(root);
+}
+
+void FormatRunStore::reset(int length)
+{
+    destroy(root);
+    formats.clear();
+    formats.append(QTextCharFormat());
+    formatted = false;
+    root = length > 0 ? createNode(length, 0) : nullptr;
+}
+
+int FormatRunStore::length() const
+{
+    return totalOf(root);
+}
+
+int FormatRunStore::runCount() const
+{
+    return runsOf(root);
+}
+
+void FormatRunStore::update(int position, int removed, int added)
+{
+    position = qBound(0, position, length());
+    removed = qBound(0, removed, length() - position);
+
+    Node *before;
+    Node *middle;
+    Node *after;
+    split(root, position, &before, &middle);
+    split(middle, removed, &middle, &after);
+    destroy(middle);
+
+    // Typing at the start of the document continues the first run instead
+    int format = 0;
+    if (const Node *last = rightmost(before))
+        format = last->format;
+    else if (const Node *first = leftmost(after))
+        format = first->format;
+
+    Node *inserted = added > 0 ? createNode(added, format) : nullptr;
+    root = join(join(before, inserted), after);
+}
+
+void FormatRunStore::merge(int start, int end, const QTextCharFormat &format)
+{
+    start = qBound(0, start, length());
+    end = qBound(start, end, length());
+    if (start == end || format.properties().isEmpty())
+        return;
+
+    Node *before;
+    Node *middle;
+    Node *after;
+    split(root, start, &before, &middle);
+    split(middle, end - start, &middle, &after);
+
+    // Runs sharing a format still share one afterwards, so each format is
+    // merged once; neighbours that end up equal become one run
+    QVector<Node *> runs;
+    collect(middle, &runs);
+    QHash<int, int> merged;
+    Node *result = nullptr;
+    Node *last = nullptr;
+    for (Node *run : qAsConst(runs)) {
+        auto found = merged.constFind(run->format);
+        if (found == merged.constEnd()) {
+            QTextCharFormat combined = formats.at(run->format);
+            combined.merge(format);
+            found = merged.insert(run->format, intern(combined));
+        }
+        if (last && last->format == found.value()) {
+            last->length += run->length;
+            delete run;
+            continue;
+        }
+        if (last) {
+            refresh(last);
+            result = meld(result, last);
+        }
+        last = run;
+        last->format = found.value();
+        last->left = nullptr;
+        last->right = nullptr;
+    }
+    if (last) {
+        refresh(last);
+        result = meld(result, last);
+    }
+
+    root = join(join(before, result), after);
+    formatted = true;
+    if (formats.size() > MaxFormats)
+        compact();
+}
+
+void FormatRunStore::assign(int start, int end, const QVector<QTextLayout::FormatRange> &ranges)
+{
+    start = qBound(0, start, length());
+    end = qBound(start, end, length());
+    if (start == end)
+        return;
+
+    Node *before;
+    Node *middle;
+    Node *after;
+    split(root, start, &before, &middle);
+    split(middle, end - start, &middle, &after);
+    destroy(middle);
+
+    Node *result = nullptr;
+    int done = 0;
+    auto append = [&](int length, int format) {
+        if (length > 0)
+            result = join(result, createNode(length, format));
+    };
+    for (const QTextLayout::FormatRange &range : ranges) {
+        const int from = qBound(done, range.start, end - start);
+        const int to = qBound(from, range.start + range.length, end - start);
+        QTextCharFormat format = range.format;
+        format.clearProperty(RunProperty);
+        append(from - done, 0);
+        append(to - from, intern(format));
+        done = to;
+    }
+    append(end - start - done, 0);
+
+    root = join(join(before, result), after);
+    formatted = formatted || !ranges.isEmpty();
+    if (formats.size() > MaxFormats)
+        compact();
+}
+
+QTextCharFormat FormatRunStore::formatAt(int position) const
+{
+    const Node *node = root;
+    while (node) {
+        const int leftTotal = totalOf(node->left);
+        if (position < leftTotal) {
+            node = node->left;
+        } else if (position < leftTotal + node->length) {
+            return formats.at(node->format);
+        } else {
+            position -= leftTotal + node->length;
+            node = node->right;
+        }
+    }
+    return QTextCharFormat();
+}
+
+QVector<QTextLayout::FormatRange> FormatRunStore::ranges(int start, int end) const
+{
+    QVector<QTextLayout::FormatRange> result;
+    if (formatted && start < end)
+        appendRanges(root, 0, start, end, &result);
+    return result;
+}
+
+void FormatRunStore::appendRanges(const Node *node, int offset, int start, int end,
+                                  QVector<QTextLayout::FormatRange> *ranges) const
+{
+    if (!node)
+        return;
+
+    const int nodeStart = offset + totalOf(node->left);
+    const int nodeEnd = nodeStart + node->length;
+    if (start < nodeStart)
+        appendRanges(node->left, offset, start, end, ranges);
+    if (node->format != 0 && nodeStart < end && nodeEnd > start) {
+        const int from = qMax(nodeStart, start);
+        QTextLayout::FormatRange range;
+        range.start = from - start;
+        range.length = qMin(nodeEnd, end) - from;
+        range.format = formats.at(node->format);
+        range.format.setProperty(RunProperty, true);
+        ranges->append(range);
+    }
+    if (nodeEnd < end)
+        appendRanges(node->right, nodeEnd, start, end, ranges);
+}
+
+FormatRunStore::Node *FormatRunStore::createNode(int length, int format)
+{
+    // xorshift32; the priorities only need to look random to keep the
+    // tree balanced
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    Node *node = new Node;
+    node->length = length;
+    node->format = format;
+    node->priority = seed;
+    node->left = nullptr;
+    node->right = nullptr;
+    refresh(node);
+    return node;
+}
+
+void FormatRunStore::destroy(Node *node)
+{
+    if (!node)
+        return;
+    destroy(node->left);
+    destroy(node->right);
+    delete node;
+}
+
+void FormatRunStore::refresh(Node *node)
+{
+    node->total = node->length + totalOf(node->left) + totalOf(node->right);
+    node->runs = 1 + runsOf(node->left) + runsOf(node->right);
+}
+
+// Splits into the first position characters and the rest; a run that
+// straddles the cut becomes two
+void FormatRunStore::split(Node *node, int position, Node **left, Node **right)
+{
+    if (!node) {
+        *left = nullptr;
+        *right = nullptr;
+        return;
+    }
+
+    const int leftTotal = totalOf(node->left);
+    if (position <= leftTotal) {
+        split(node->left, position, left, &node->left);
+        refresh(node);
+        *right = node;
+    } else if (position >= leftTotal + node->length) {
+        split(node->right, position - leftTotal - node->length, &node->right, right);
+        refresh(node);
+        *left = node;
+    } else {
+        // The tail keeps the priority of the node it came from, which is
+        // still above that of the right subtree it takes over
+        Node *tail = createNode(leftTotal + node->length - position, node->format);
+        tail->priority = node->priority;
+        tail->right = node->right;
+        node->right = nullptr;
+        node->length = position - leftTotal;
+        refresh(node);
+        refresh(tail);
+        *left = node;
+        *right = tail;
+    }
+}
+
+FormatRunStore::Node *FormatRunStore::meld(Node *left, Node *right)
+{
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+
+    if (left->priority > right->priority) {
+        left->right = meld(left->right, right);
+        refresh(left);
+        return left;
+    }
+    right->left = meld(left, right->left);
+    refresh(right);
+    return right;
+}
+
+// Like meld(), but the runs meeting at the seam become one if their
+// formats are equal
+FormatRunStore::Node *FormatRunStore::join(Node *left, Node *right)
+{
+    if (!left || !right)
+        return meld(left, right);
+
+    const Node *last = rightmost(left);
+    const Node *first = leftmost(right);
+    if (last->format != first->format)
+        return meld(left, right);
+
+    Node *tail;
+    Node *head;
+    split(left, left->total - last->length, &left, &tail);
+    split(right, first->length, &head, &right);
+    tail->length += head->length;
+    delete head;
+    refresh(tail);
+    return meld(meld(left, tail), right);
+}
+
+const FormatRunStore::Node *FormatRunStore::leftmost(const Node *node)
+{
+    while (node && node->left)
+        node = node->left;
+    return node;
+}
+
+const FormatRunStore::Node *FormatRunStore::rightmost(const Node *node)
+{
+    while (node && node->right)
+        node = node->right;
+    return node;
+}
+
+void FormatRunStore::collect(Node *node, QVector<Node *> *runs)
+{
+    if (!node)
+        return;
+    collect(node->left, runs);
+    runs->append(node);
+    collect(node->right, runs);
+}
+
+int FormatRunStore::intern(const QTextCharFormat &format)
+{
+    const int index = formats.indexOf(format);
+    if (index >= 0)
+        return index;
+    formats.append(format);
+    return formats.size() - 1;
+}
+
+void FormatRunStore::compact()
+{
+    QVector<Node *> runs;
+    collect(root, &runs);
+
+    QVector<int> remap(formats.size(), -1);
+    QVector<QTextCharFormat> kept;
+    kept.append(formats.at(0));
+    remap[0] = 0;
+    for (Node *run : qAsConst(runs)) {
+        int &index = remap[run->format];
+        if (index < 0) {
+            index = kept.size();
+            kept.append(formats.at(run->format));
+        }
+        run->format = index;
+    }
+    formats = kept;
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef FORMATRUNSTORE_H
+#define FORMATRUNSTORE_H
+
+#include <QTextCharFormat>
+#include <QTextLayout>
+#include <QTextFormat>
+#include <QVector>
+
+// Character formats over a document, kept as runs of equal formats in a
+// treap ordered by position. Nodes store run lengths instead of offsets,
+// so an edit or a format change only splits and joins the tree at its two
+// ends: O(log n) per run boundary, however much text lies in between.
+// Neighbouring runs with the same format are always merged into one.
+class FormatRunStore
+{
+public:
+    // Set on every format ranges() returns, to tell them apart from the
+    // other formats of a layout
+    enum { RunProperty = QTextFormat::UserProperty + 1 };
+
+    FormatRunStore();
+    ~FormatRunStore();
+
+    // Starts over with length unformatted characters
+    void reset(int length);
+    int length() const;
+    int runCount() const;
+    bool hasFormats() const { return formatted; }
+
+    // [position, position + removed) was replaced by added characters;
+    // inserted text takes the format of the character before it
+    void update(int position, int removed, int added);
+
+    // Merges format into every run overlapping [start, end)
+    void merge(int start, int end, const QTextCharFormat &format);
+
+    // Makes [start, end) exactly the given runs, relative to start, as
+    // ranges() returned them; the rest of the span is unformatted
+    void assign(int start, int end, const QVector<QTextLayout::FormatRange> &ranges);
+
+    QTextCharFormat formatAt(int position) const;
+
+    // Formatted runs overlapping [start, end), relative to start
+    QVector<QTextLayout::FormatRange> ranges(int start, int end) const;
+
+private:
+    struct Node
+    {
+        int length;
+        int format;
+        quint32 priority;
+        int total;
+        int runs;
+        Node *left;
+        Node *right;
+    };
+
+    FormatRunStore(const FormatRunStore &) = delete;
+    FormatRunStore &operator=(const FormatRunStore &) = delete;
+
+    Node *createNode(int length, int format);
+    static void destroy(Node *node);
+    static int totalOf(const Node *node) { return node ? node->total : 0; }
+    static int runsOf(const Node *node) { return node ? node->runs : 0; }
+    static void refresh(Node *node);
+    void split(Node *node, int position, Node **left, Node **right);
+    static Node *meld(Node *left, Node *right);
+    Node *join(Node *left, Node *right);
+    static const Node *leftmost(const Node *node);
+    static const Node *rightmost(const Node *node);
+    static void collect(Node *node, QVector<Node *> *runs);
+    void appendRanges(const Node *node, int offset, int start, int end,
+                      QVector<QTextLayout::FormatRange> *ranges) const;
+    int intern(const QTextCharFormat &format);
+    void compact();
+
+    Node *root;
+    quint32 seed;
+    bool formatted;
+
+    // Index 0 is the empty format of unformatted text
+    QVector<QTextCharFormat> formats;
+};
+
+#endif // FORMATRUNSTORE_H
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "LatencyMonitor.h"
+#include <QTextStream>
+#include <QKeySequence>
+#include <QtMath>
+#include <QtAlgorithms>
+
+// Values below twice this are counted exactly; above, each power of two
+// is split into this many buckets
+static const int SubBuckets = 64;
+static const int SubBucketBits = 6;
+
+// Latencies above this, in microseconds, are counted as this
+static const qint64 MaxLatency = 60 * 1000 * 1000;
+
+// Slowest events kept for the report
+static const int SlowestEvents = 16;
+
+// Key presses waiting for a paint; more than this means no paint is coming
+static const int MaxPending = 256;
+
+LatencyMonitor::LatencyMonitor(QObject *parent)
+    : QObject(parent)
+    , total(0)
+    , maxLatency(0)
+{
+    clock.start();
+    buckets.resize(bucketOf(MaxLatency) + 1);
+}
+
+QStringList PendingWork::describe() const
+{
+    QStringList work;
+    if (pasteDone >= 0)
+        work << QString("paste: %1 of %2 characters").arg(pasteDone).arg(pasteTotal);
+    if (indexing)
+        work << QString("line index build");
+    if (highlightBlocks > 0)
+        work << QString("syntax highlighting: %1 blocks").arg(highlightBlocks);
+    if (searchHighlights > 0)
+        work << QString("search highlights: %1").arg(searchHighlights);
+    if (formatRuns > 0)
+        work << QString("format runs: %1").arg(formatRuns);
+    work << QString("document: %1 blocks, %2 characters").arg(blocks).arg(characters);
+    if (bufferBytes >= 0)
+        work << QString("buffer: %1 bytes, %2 pieces").arg(bufferBytes).arg(bufferPieces);
+    return work;
+}
+
+void LatencyMonitor::keyPressed(qint64 start, int key, Qt::KeyboardModifiers modifiers,
+                                const QString &text, const PendingWork &pendingWork)
+{
+    if (pending.size() < MaxPending)
+        pending.append({start, key, modifiers, text, pendingWork});
+}
+
+void LatencyMonitor::painted()
+{
+    if (pending.isEmpty())
+        return;
+
+    const qint64 now = timestamp();
+    for (const Pending &key : qAsConst(pending))
+        record(key, (now - key.start) / 1000);
+    pending.clear();
+}
+
+void LatencyMonitor::record(const Pending &key, qint64 latency)
+{
+    latency = qBound<qint64>(0, latency, MaxLatency);
+    ++buckets[bucketOf(latency)];
+    ++total;
+    maxLatency = qMax(maxLatency, latency);
+
+    // Kept sorted, slowest first
+    if (slowest.size() == SlowestEvents && latency <= slowest.last().latency)
+        return;
+    int i = slowest.size();
+    while (i > 0 && slowest.at(i - 1).latency < latency)
+        --i;
+    slowest.insert(i, {latency, QDateTime::currentDateTime(), formatKey(key), key.work.describe()});
+    if (slowest.size() > SlowestEvents)
+        slowest.removeLast();
+}
+
+qint64 LatencyMonitor::percentile(double fraction) const
+{
+    if (total == 0)
+        return 0;
+
+    const qint64 target = qMax<qint64>(1, qCeil(fraction * total));
+    qint64 seen = 0;
+    for (int i = 0; i < buckets.size(); ++i) {
+        seen += buckets.at(i);
+        if (seen >= target)
+            return qMin(bucketLimit(i), maxLatency);
+    }
+    return maxLatency;
+}
+
+void LatencyMonitor::reset()
+{
+    pending.clear();
+    buckets.fill(0);
+    total = 0;
+    maxLatency = 0;
+    slowest.clear();
+}
+
+QString LatencyMonitor::summary() const
+{
+    if (total == 0)
+        return QString("Latency: no keys yet");
+    return QString("Latency p50 %1, p99 %2, max %3")
+            .arg(formatLatency(percentile(0.5)))
+            .arg(formatLatency(percentile(0.99)))
+            .arg(formatLatency(maxLatency));
+}
+
+QString LatencyMonitor::report() const
+{
+    QString text;
+    QTextStream out(&text);
+    out << "Key-to-paint latency, " << total << " events\n"
+        << "p50 " << formatLatency(percentile(0.5))
+        << ", p90 " << formatLatency(percentile(0.9))
+        << ", p99 " << formatLatency(percentile(0.99))
+        << ", p99.9 " << formatLatency(percentile(0.999))
+        << ", max " << formatLatency(maxLatency) << "\n\n";
+
+    out << "Histogram (bucket upper bound: events)\n";
+    for (int i = 0; i < buckets.size(); ++i) {
+        if (buckets.at(i) > 0)
+            out << "  " << formatLatency(bucketLimit(i)) << ": " << buckets.at(i) << "\n";
+    }
+
+    out << "\nSlowest events\n";
+    for (const Event &event : slowest) {
+        out << "  " << formatLatency(event.latency) << "  "
+            << event.time.toString(Qt::ISODateWithMs) << "  key " << event.key << "\n";
+        for (const QString &work : event.work)
+            out << "      " << work << "\n";
+    }
+    return text;
+}
+
+int LatencyMonitor::bucketOf(qint64 value)
+{
+    if (value < 2 * SubBuckets)
+        return int(value);
+
+    // The top SubBucketBits + 1 bits select the bucket
+    const int shift = 63 - qCountLeadingZeroBits(quint64(value)) - SubBucketBits;
+    return 2 * SubBuckets + (shift - 1) * SubBuckets + int((value >> shift) - SubBuckets);
+}
+
+qint64 LatencyMonitor::bucketLimit(int bucket)
+{
+    if (bucket < 2 * SubBuckets)
+        return bucket;
+
+    const int index = bucket - 2 * SubBuckets;
+    const int shift = index / SubBuckets + 1;
+    const qint64 sub = index % SubBuckets + SubBuckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+QString LatencyMonitor::formatKey(const Pending &pending)
+{
+    if (pending.text.isEmpty() || !pending.text.at(0).isPrint())
+        return QKeySequence(pending.key | int(pending.modifiers)).toString();
+    return QString("'%1'").arg(pending.text);
+}
+
+QString LatencyMonitor::formatLatency(qint64 microseconds)
+{
+    if (microseconds < 1000)
+        return QString("%1 us").arg(microseconds);
+    return QString("%1 ms").arg(microseconds / 1000.0, 0, 'f', 1);
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#ifndef LATENCYMONITOR_H
+#define LATENCYMONITOR_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+
+// Times key presses until the paint that makes them visible. Latencies go
+// into an HDR-style histogram: exact below 128 microseconds, and 64
+// buckets per power of two above, so every value is kept to within about
+// 1.5% whatever its size, in a fixed amount of memory. The slowest events
+// are kept with the work that was pending when their key was pressed.
+
+// Counters of what an editor still has queued or running when a key is
+// pressed; taken on every key, so only the slowest events are ever turned
+// into text
+struct PendingWork
+{
+    int pasteDone = -1;
+    int pasteTotal = 0;
+    bool indexing = false;
+    int highlightBlocks = 0;
+    int searchHighlights = 0;
+    int formatRuns = 0;
+    int blocks = 0;
+    int characters = 0;
+    qint64 bufferBytes = -1;
+    int bufferPieces = 0;
+
+    QStringList describe() const;
+};
+
+class LatencyMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LatencyMonitor(QObject *parent = nullptr);
+
+    // Nanoseconds on the monitor's clock, to pass to keyPressed()
+    qint64 timestamp() const { return clock.nsecsElapsed(); }
+
+    // A key pressed at start changed what is on screen
+    void keyPressed(qint64 start, int key, Qt::KeyboardModifiers modifiers,
+                    const QString &text, const PendingWork &pendingWork);
+
+    // Every key pressed before a finished paint is now visible
+    void painted();
+
+    qint64 count() const { return total; }
+    // Microseconds; the value at or below which the fraction of events fall
+    qint64 percentile(double fraction) const;
+    qint64 maximum() const { return maxLatency; }
+    void reset();
+
+    // "p50 ... p99 ... max ..." for the status bar
+    QString summary() const;
+    // The histogram and the slowest events, as plain text
+    QString report() const;
+
+private:
+    struct Pending
+    {
+        qint64 start;
+        int key;
+        Qt::KeyboardModifiers modifiers;
+        QString text;
+        PendingWork work;
+    };
+
+    struct Event
+    {
+        qint64 latency;
+        QDateTime time;
+        QString key;
+        QStringList work;
+    };
+
+    void record(const Pending &pending, qint64 latency);
+    static int bucketOf(qint64 value);
+    static qint64 bucketLimit(int bucket);
+    static QString formatLatency(qint64 microseconds);
+    static QString formatKey(const Pending &pending);
+
+    QElapsedTimer clock;
+    QVector<Pending> pending;
+    QVector<quint64> buckets;
+    qint64 total;
+    qint64 maxLatency;
+    QVector<Event> slowest;
+};
+
+#endif // LATENCYMONITOR_H
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include "LineIndex.h"
+#include "PieceTable.h"
+#include <algorithm>
+#include <cstring>
+
+// Store the offset of every Stride-th line start
+static const qint64 Stride = 64;
+
+// Check for cancellation after scanning this many bytes
+static const qint64 ScanBlock = 4 * 1024 * 1024;
+
+LineIndex::LineIndex()
+    : lines(0)
+{
+}
+
+LineIndex LineIndex::build(const PieceTable &table, const std::atomic<bool> *cancelled)
+{
+    LineIndex index;
+    index.checkpoints.push_back({0, 0});
+
+    qint64 line = 0;
+    qint64 offset = 0;
+    bool stopped = false;
+    table.forEachChunk(0, table.size(), [&](const char *data, qint64 length) {
+        for (qint64 done = 0; done < length && !stopped; done += ScanBlock) {
+            if (cancelled && cancelled->load(std::memory_order_relaxed)) {
+                stopped = true;
+                break;
+            }
+
+            const char *p = data + done;
+            const char *end = p + qMin(ScanBlock, length - done);
+            while ((p = static_cast<const char *>(std::memchr(p, '\n', size_t(end - p))))) {
+                ++p;
+                ++line;
+                if (line % Stride == 0)
+                    index.checkpoints.push_back({line, offset + (p - data)});
+            }
+        }
+        offset += length;
+    });
+
+    if (stopped)
+        return LineIndex();
+    index.lines = line + 1;
+    return index;
+}
+
+qint64 LineIndex::countNewlines(const PieceTable &table, qint64 pos, qint64 length)
+{
+    qint64 count = 0;
+    table.forEachChunk(pos, length, [&count](const char *data, qint64 size) {
+        count += std::count(data, data + size, '\n');
+    });
+    return count;
+}
+
+qint64 LineIndex::lineOffset(const PieceTable &table, qint64 line) const
+{
+    if (checkpoints.empty())
+        return 0;
+
+    line = qBound<qint64>(0, line, lines - 1);
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), line,
+                               [](qint64 value, const Checkpoint &checkpoint) {
+                                   return value < checkpoint.line;
+                               });
+    --it;
+
+    qint64 offset = it->offset;
+    for (qint64 current = it->line; current < line; ++current) {
+        const qint64 newline = table.indexOf('\n', offset, table.size() - offset);
+        if (newline < 0)
+            break;
+        offset = newline + 1;
+    }
+    return offset;
+}
+
+qint64 LineIndex::lineAt(const PieceTable &table, qint64 offset) const
+{
+    if (checkpoints.empty())
+        return 0;
+
+    offset = qBound<qint64>(0, offset, table.size());
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), offset,
+                               [](qint64 value, const Checkpoint &checkpoint) {
+                                   return value < checkpoint.offset;
+                               });
+    --it;
+    return it->line + countNewlines(table, it->offset, offset - it->offset);
+}
+
+void LineIndex::update(const PieceTable &table, qint64 position, qint64 oldLength,
+                       qint64 oldNewlines, qint64 newLength)
+{
+    if (checkpoints.empty())
+        return;
+
+    const qint64 end = position + oldLength;
+    const qint64 lineDelta = countNewlines(table, position, newLength) - oldNewlines;
+    const qint64 byteDelta = newLength - oldLength;
+
+    auto afterOffset = [](qint64 value, const Checkpoint &checkpoint) {
+        return value < checkpoint.offset;
+    };
+    auto first = std::upper_bound(checkpoints.begin(), checkpoints.end(), position, afterOffset);
+    auto last = std::upper_bound(first, checkpoints.end(), end, afterOffset);
+
+    // Checkpoints past the edit only move; the ones inside it are gone
+    for (auto it = last; it != checkpoints.end(); ++it) {
+        it->line += lineDelta;
+        it->offset += byteDelta;
+    }
+    first = checkpoints.erase(first, last);
+
+    // Recreate checkpoints for the replacement text
+    const Checkpoint &base = *(first - 1);
+    qint64 line = base.line + countNewlines(table, base.offset, position - base.offset);
+    qint64 scanned = position;
+    std::vector<Checkpoint> inserted;
+    table.forEachChunk(position, newLength, [&](const char *data, qint64 length) {
+        const char *p = data;
+        const char *stop = data + length;
+        while ((p = static_cast<const char *>(std::memchr(p, '\n', size_t(stop - p))))) {
+            ++p;
+            ++line;
+            if (line % Stride == 0)
+                inserted.push_back({line, scanned + (p - data)});
+        }
+        scanned += length;
+    });
+    checkpoints.insert(first, inserted.begin(), inserted.end());
+    lines += lineDelta;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <vector>
+
+class PieceTable;
+
+// Sparse map from line numbers to byte offsets in a PieceTable. Only every
+// Stride-th line start is stored; the lines in between are found by
+// scanning forward from the nearest checkpoint.
+class LineIndex
+{
+public:
+    LineIndex();
+
+    // Scans the whole table; meant to run on a worker thread over a
+    // PieceTable::snapshot()
+    static LineIndex build(const PieceTable &table, const std::atomic<bool> *cancelled = nullptr);
+    static qint64 countNewlines(const PieceTable &table, qint64 pos, qint64 length);
+
+    bool isEmpty() const { return checkpoints.empty(); }
+    qint64 lineCount() const { return lines; }
+    qint64 lineOffset(const PieceTable &table, qint64 line) const;
+    qint64 lineAt(const PieceTable &table, qint64 offset) const;
+
+    // Call after [position, position + oldLength) was replaced by newLength
+    // bytes; oldNewlines is the number of line breaks the old range held
+    void update(const PieceTable &table, qint64 position, qint64 oldLength,
+                qint64 oldNewlines, qint64 newLength);
+
+private:
+    struct Checkpoint
+    {
+        qint64 line;
+        qint64 offset;
+    };
+
+    std::vector<Checkpoint> checkpoints;
+    qint64 lines;
+};
+
+#endif // LINEINDEX_H
\ No newline at end of file
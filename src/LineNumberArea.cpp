@@ -0,0 +1,18 @@
+#include "LineNumberArea.h"
+#include "TextEditor.h"
+
+LineNumberArea::LineNumberArea(TextEditor *editor)
+    : QWidget(editor)
+    , editor(editor)
+{
+}
+
+QSize LineNumberArea::sizeHint() const
+{
+    return QSize(editor->lineNumberAreaWidth(), 0);
+}
+
+void LineNumberArea::paintEvent(QPaintEvent *event)
+{
+    editor->paintLineNumbers(event);
+}
\ No newline at end of file
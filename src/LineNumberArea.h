@@ -0,0 +1,25 @@
+#ifndef LINENUMBERAREA_H
+#define LINENUMBERAREA_H
+
+#include <QWidget>
+
+class TextEditor;
+
+// Gutter to the left of the editor's viewport; the editor does the painting
+class LineNumberArea : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit LineNumberArea(TextEditor *editor);
+
+    QSize sizeHint() const override;
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+
+private:
+    TextEditor *editor;
+};
+
+#endif // LINENUMBERAREA_H
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "LiteralSearcher.h"
+#include "PieceTable.h"
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+#include <QtAlgorithms>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LITERALSEARCHER_SSE2
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LITERALSEARCHER_AVX2
+#endif
+
+// Bytes read per step when searching a piece table backwards
+static const qint64 BackwardWindow = 4 * 1024 * 1024;
+
+static inline ushort foldUnit(ushort unit)
+{
+    return ushort(QChar::toCaseFolded(uint(unit)));
+}
+
+static inline uchar foldUnit(uchar unit)
+{
+    return unit >= 'A' && unit <= 'Z' ? uchar(unit + ('a' - 'A')) : unit;
+}
+
+// The units that fold to a folded unit, itself first; returns how many.
+// The verifier compares folded units, so a filter on anything narrower,
+// such as the upper case, would miss e.g. KELVIN SIGN for "k".
+static int foldClass(ushort unit, ushort *members)
+{
+    // Built once from every unit that folding changes
+    static const QHash<ushort, QVector<ushort>> classes = [] {
+        QHash<ushort, QVector<ushort>> built;
+        for (uint unit = 0; unit <= 0xFFFF; ++unit) {
+            const ushort folded = foldUnit(ushort(unit));
+            if (folded != unit)
+                built[folded].append(ushort(unit));
+        }
+        return built;
+    }();
+
+    int count = 0;
+    members[count++] = unit;
+    for (ushort member : classes.value(unit)) {
+        Q_ASSERT(count < LiteralSearcher::MaxVariants);
+        if (count < LiteralSearcher::MaxVariants)
+            members[count++] = member;
+    }
+    return count;
+}
+
+static int foldClass(uchar unit, uchar *members)
+{
+    members[0] = unit;
+    if (unit < 'a' || unit > 'z')
+        return 1;
+    members[1] = uchar(unit - ('a' - 'A'));
+    return 2;
+}
+
+template <typename Char, typename Source>
+static void prepare(LiteralSearcher::Needle<Char> &needle, const Source *data, int length, bool fold)
+{
+    needle.fold = fold;
+    needle.variants = 1;
+    needle.units.resize(size_t(length));
+    for (int i = 0; i < length; ++i)
+        needle.units[size_t(i)] = fold ? foldUnit(Char(data[i])) : Char(data[i]);
+    if (length == 0)
+        return;
+
+    // Every unit folding to the outer units passes the vector filter; the
+    // shorter class is padded with its last unit
+    int firstCount = 1;
+    int lastCount = 1;
+    needle.first[0] = needle.units.front();
+    needle.last[0] = needle.units.back();
+    if (fold) {
+        firstCount = foldClass(needle.first[0], needle.first);
+        lastCount = foldClass(needle.last[0], needle.last);
+    }
+    needle.variants = qMax(firstCount, lastCount);
+    for (int i = firstCount; i < needle.variants; ++i)
+        needle.first[i] = needle.first[firstCount - 1];
+    for (int i = lastCount; i < needle.variants; ++i)
+        needle.last[i] = needle.last[lastCount - 1];
+
+    // Horspool shifts, keyed on the low byte of each unit
+    for (int &shift : needle.skip)
+        shift = length;
+    for (int i = 0; i < length - 1; ++i)
+        needle.skip[needle.units[size_t(i)] & 0xFF] = length - 1 - i;
+}
+
+template <typename Char>
+static inline bool matchesAt(const LiteralSearcher::Needle<Char> &needle, const Char *data)
+{
+    const size_t length = needle.units.size();
+    if (!needle.fold)
+        return std::memcmp(data, needle.units.data(), length * sizeof(Char)) == 0;
+
+    for (size_t i = 0; i < length; ++i) {
+        if (foldUnit(data[i]) != needle.units[i])
+            return false;
+    }
+    return true;
+}
+
+template <typename Char>
+static inline bool outerUnitsMatch(const LiteralSearcher::Needle<Char> &needle, const Char *data)
+{
+    const Char first = data[0];
+    const Char last = data[needle.units.size() - 1];
+    bool firstMatches = false;
+    bool lastMatches = false;
+    for (int i = 0; i < needle.variants; ++i) {
+        firstMatches |= first == needle.first[i];
+        lastMatches |= last == needle.last[i];
+    }
+    return firstMatches && lastMatches;
+}
+
+// Bit mask of the positions in [data, data + lanes) whose first and last
+// units match; bit i * sizeof(Char) stands for position i
+#ifdef LITERALSEARCHER_SSE2
+template <typename Char>
+static inline quint32 sse2Candidates(const LiteralSearcher::Needle<Char> &needle, const Char *data)
+{
+    const __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    const __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + needle.units.size() - 1));
+    __m128i first = _mm_setzero_si128();
+    __m128i last = _mm_setzero_si128();
+    for (int i = 0; i < needle.variants; ++i) {
+        if (sizeof(Char) == 1) {
+            first = _mm_or_si128(first, _mm_cmpeq_epi8(head, _mm_set1_epi8(char(needle.first[i]))));
+            last = _mm_or_si128(last, _mm_cmpeq_epi8(tail, _mm_set1_epi8(char(needle.last[i]))));
+        } else {
+            first = _mm_or_si128(first, _mm_cmpeq_epi16(head, _mm_set1_epi16(short(needle.first[i]))));
+            last = _mm_or_si128(last, _mm_cmpeq_epi16(tail, _mm_set1_epi16(short(needle.last[i]))));
+        }
+    }
+    const quint32 mask = quint32(_mm_movemask_epi8(_mm_and_si128(first, last)));
+    return sizeof(Char) == 1 ? mask : mask & 0x5555u;
+}
+#endif
+
+#ifdef LITERALSEARCHER_AVX2
+template <typename Char>
+__attribute__((target("avx2")))
+static quint32 avx2Candidates(const LiteralSearcher::Needle<Char> &needle, const Char *data)
+{
+    const __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+    const __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + needle.units.size() - 1));
+    __m256i first = _mm256_setzero_si256();
+    __m256i last = _mm256_setzero_si256();
+    for (int i = 0; i < needle.variants; ++i) {
+        if (sizeof(Char) == 1) {
+            first = _mm256_or_si256(first, _mm256_cmpeq_epi8(head, _mm256_set1_epi8(char(needle.first[i]))));
+            last = _mm256_or_si256(last, _mm256_cmpeq_epi8(tail, _mm256_set1_epi8(char(needle.last[i]))));
+        } else {
+            first = _mm256_or_si256(first, _mm256_cmpeq_epi16(head, _mm256_set1_epi16(short(needle.first[i]))));
+            last = _mm256_or_si256(last, _mm256_cmpeq_epi16(tail, _mm256_set1_epi16(short(needle.last[i]))));
+        }
+    }
+    const quint32 mask = quint32(_mm256_movemask_epi8(_mm256_and_si256(first, last)));
+    return sizeof(Char) == 1 ? mask : mask & 0x55555555u;
+}
+
+static bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+template <typename Char, typename Candidates>
+static qint64 vectorForward(const LiteralSearcher::Needle<Char> &needle, const Char *data,
+                            qint64 lastStart, qint64 *from, int bytes, Candidates candidates)
+{
+    const int lanes = bytes / int(sizeof(Char));
+    qint64 i = *from;
+    for (; i + lanes - 1 <= lastStart; i += lanes) {
+        quint32 mask = candidates(needle, data + i);
+        while (mask) {
+            const qint64 position = i + qCountTrailingZeroBits(mask) / sizeof(Char);
+            if (matchesAt(needle, data + position))
+                return position;
+            mask &= mask - 1;
+        }
+    }
+    *from = i;
+    return -1;
+}
+
+template <typename Char, typename Candidates>
+static qint64 vectorBackward(const LiteralSearcher::Needle<Char> &needle, const Char *data,
+                             qint64 *from, int bytes, Candidates candidates)
+{
+    const int lanes = bytes / int(sizeof(Char));
+    qint64 i = *from - lanes + 1;
+    for (; i >= 0; i -= lanes) {
+        quint32 mask = candidates(needle, data + i);
+        while (mask) {
+            const int bit = 31 - int(qCountLeadingZeroBits(mask));
+            const qint64 position = i + bit / int(sizeof(Char));
+            if (matchesAt(needle, data + position))
+                return position;
+            mask &= ~(quint32(1) << bit);
+        }
+    }
+    *from = i + lanes - 1;
+    return -1;
+}
+
+template <typename Char>
+static qint64 searchForward(const LiteralSearcher::Needle<Char> &needle, const Char *data,
+                            qint64 length, qint64 from)
+{
+    const qint64 size = qint64(needle.units.size());
+    const qint64 lastStart = length - size;
+    if (size == 0 || from > lastStart)
+        return -1;
+    qint64 i = qMax<qint64>(0, from);
+
+#ifdef LITERALSEARCHER_AVX2
+    if (hasAvx2()) {
+        const qint64 found = vectorForward(needle, data, lastStart, &i, 32,
+                                           avx2Candidates<Char>);
+        if (found >= 0)
+            return found;
+    }
+#endif
+#ifdef LITERALSEARCHER_SSE2
+    const qint64 found = vectorForward(needle, data, lastStart, &i, 16,
+                                       [](const LiteralSearcher::Needle<Char> &n, const Char *d) {
+        return sse2Candidates(n, d);
+    });
+    if (found >= 0)
+        return found;
+    for (; i <= lastStart; ++i) {
+        if (outerUnitsMatch(needle, data + i) && matchesAt(needle, data + i))
+            return i;
+    }
+#else
+    // Horspool: shift by how far the unit under the needle's end is from
+    // its last occurrence in the needle
+    while (i <= lastStart) {
+        const Char unit = needle.fold ? foldUnit(data[i + size - 1]) : data[i + size - 1];
+        if (unit == needle.units[size - 1] && matchesAt(needle, data + i))
+            return i;
+        i += needle.skip[unit & 0xFF];
+    }
+#endif
+    return -1;
+}
+
+template <typename Char>
+static qint64 searchBackward(const LiteralSearcher::Needle<Char> &needle, const Char *data,
+                             qint64 length, qint64 from)
+{
+    const qint64 size = qint64(needle.units.size());
+    qint64 i = qMin(from, length - size);
+    if (size == 0 || i < 0)
+        return -1;
+
+#ifdef LITERALSEARCHER_AVX2
+    if (hasAvx2()) {
+        const qint64 found = vectorBackward(needle, data, &i, 32, avx2Candidates<Char>);
+        if (found >= 0)
+            return found;
+    }
+#endif
+#ifdef LITERALSEARCHER_SSE2
+    const qint64 found = vectorBackward(needle, data, &i, 16,
+                                        [](const LiteralSearcher::Needle<Char> &n, const Char *d) {
+        return sse2Candidates(n, d);
+    });
+    if (found >= 0)
+        return found;
+#endif
+    for (; i >= 0; --i) {
+        if (outerUnitsMatch(needle, data + i) && matchesAt(needle, data + i))
+            return i;
+    }
+    return -1;
+}
+
+LiteralSearcher::LiteralSearcher()
+    : cs(Qt::CaseSensitive)
+{
+    prepare(utf16, static_cast<const ushort *>(nullptr), 0, false);
+    prepare(utf8, static_cast<const uchar *>(nullptr), 0, false);
+}
+
+LiteralSearcher::LiteralSearcher(const QString &pattern, Qt::CaseSensitivity cs)
+    : text(pattern)
+    , cs(cs)
+{
+    const bool fold = cs == Qt::CaseInsensitive;
+    const QByteArray bytes = pattern.toUtf8();
+    prepare(utf16, pattern.utf16(), pattern.size(), fold);
+    prepare(utf8, reinterpret_cast<const uchar *>(bytes.constData()), bytes.size(), fold);
+}
+
+qint64 LiteralSearcher::indexIn(const QChar *data, qint64 length, qint64 from) const
+{
+    return searchForward(utf16, reinterpret_cast<const ushort *>(data), length, from);
+}
+
+qint64 LiteralSearcher::indexIn(const char *data, qint64 length, qint64 from) const
+{
+    return searchForward(utf8, reinterpret_cast<const uchar *>(data), length, from);
+}
+
+qint64 LiteralSearcher::indexIn(const PieceTable &table, qint64 from) const
+{
+    const qint64 size = byteLength();
+    if (size == 0)
+        return -1;
+    from = qBound<qint64>(0, from, table.size());
+
+    // Chunks are searched in place. The last size - 1 bytes of what was
+    // seen so far are kept back, since a match starting there may only
+    // complete in the next chunk.
+    qint64 found = -1;
+    qint64 chunkStart = from;
+    QByteArray pending;
+    table.forEachChunk(from, table.size() - from, [&](const char *data, qint64 count) {
+        if (found >= 0)
+            return;
+
+        if (!pending.isEmpty()) {
+            const QByteArray joined = pending + QByteArray(data, int(qMin(count, size - 1)));
+            const qint64 hit = indexIn(joined.constData(), joined.size());
+            if (hit >= 0) {
+                found = chunkStart - pending.size() + hit;
+                return;
+            }
+        }
+
+        const qint64 hit = indexIn(data, count);
+        if (hit >= 0) {
+            found = chunkStart + hit;
+            return;
+        }
+
+        if (count >= size - 1)
+            pending = QByteArray(data + count - (size - 1), int(size - 1));
+        else
+            pending = (pending + QByteArray(data, int(count))).right(int(size - 1));
+        chunkStart += count;
+    });
+    return found;
+}
+
+qint64 LiteralSearcher::lastIndexIn(const QChar *data, qint64 length, qint64 from) const
+{
+    return searchBackward(utf16, reinterpret_cast<const ushort *>(data), length, from);
+}
+
+qint64 LiteralSearcher::lastIndexIn(const char *data, qint64 length, qint64 from) const
+{
+    return searchBackward(utf8, reinterpret_cast<const uchar *>(data), length, from);
+}
+
+qint64 LiteralSearcher::lastIndexIn(const PieceTable &table, qint64 from) const
+{
+    const qint64 size = byteLength();
+    if (size == 0 || from < 0)
+        return -1;
+
+    // Step back through overlapping windows; a match has to end by from + size
+    qint64 end = qMin(from + size, table.size());
+    while (end >= size) {
+        const qint64 start = qMax<qint64>(0, end - BackwardWindow);
+        const QByteArray window = table.read(start, end - start);
+        const qint64 hit = lastIndexIn(window.constData(), window.size(), window.size() - size);
+        if (hit >= 0)
+            return start + hit;
+        if (start == 0)
+            break;
+        end = start + size - 1;
+    }
+    return -1;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef LITERALSEARCHER_H
+#define LITERALSEARCHER_H
+
+#include <QString>
+#include <QChar>
+#include <vector>
+
+class PieceTable;
+
+// Plain-text substring search over UTF-16 strings and UTF-8 piece tables.
+// Candidates are found by comparing the needle's first and last unit with
+// many positions at once (SSE2 or AVX2 when available) and then verified;
+// other targets fall back to Boyer-Moore-Horspool.
+class LiteralSearcher
+{
+public:
+    LiteralSearcher();
+    LiteralSearcher(const QString &pattern, Qt::CaseSensitivity cs);
+
+    QString pattern() const { return text; }
+    Qt::CaseSensitivity caseSensitivity() const { return cs; }
+    bool isEmpty() const { return text.isEmpty(); }
+    int length() const { return int(utf16.units.size()); }
+    int byteLength() const { return int(utf8.units.size()); }
+
+    // Index of the first match starting at or after from, or -1
+    qint64 indexIn(const QChar *data, qint64 length, qint64 from = 0) const;
+    qint64 indexIn(const char *data, qint64 length, qint64 from = 0) const;
+    qint64 indexIn(const PieceTable &table, qint64 from = 0) const;
+
+    // Index of the last match starting at or before from, or -1
+    qint64 lastIndexIn(const QChar *data, qint64 length, qint64 from) const;
+    qint64 lastIndexIn(const char *data, qint64 length, qint64 from) const;
+    qint64 lastIndexIn(const PieceTable &table, qint64 from) const;
+
+    // Units of a case-folding class a vector filter compares with
+    static const int MaxVariants = 4;
+
+    // Encoded needle; units are case-folded when matching case-insensitively.
+    // UTF-8 text only folds ASCII letters. first and last hold every unit
+    // that folds to the outer units, the first variants of them distinct.
+    template <typename Char>
+    struct Needle
+    {
+        std::vector<Char> units;
+        Char first[MaxVariants];
+        Char last[MaxVariants];
+        int variants;
+        int skip[256];
+        bool fold;
+    };
+
+private:
+    QString text;
+    Qt::CaseSensitivity cs;
+    Needle<ushort> utf16;
+    Needle<uchar> utf8;
+};
+
+#endif // LITERALSEARCHER_H
\ No newline at end of file
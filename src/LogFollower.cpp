@@ -0,0 +1,168 @@
+#include "LogFollower.h"
+#include "TextDecoder.h"
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QtConcurrent>
+
+// How often the file is checked when no change notification arrives
+static const int PollInterval = 1000;
+
+// Most bytes read and handed over at a time; a larger backlog follows in
+// further batches straight away
+static const qint64 MaxBatchBytes = 1024 * 1024;
+
+// Bytes read per call
+static const qint64 ChunkSize = 64 * 1024;
+
+// Leading bytes compared to notice that the file was replaced
+static const int HeadBytes = 256;
+
+LogFollower::LogFollower(QObject *parent)
+    : QObject(parent)
+    , following(false)
+    , reading(false)
+    , pollAgain(false)
+    , watcher(nullptr)
+    , pollTimer(nullptr)
+    , currentGeneration(0)
+    , tail(-1)
+    , offset(0)
+{
+    watcher = new QFileSystemWatcher(this);
+    connect(watcher, &QFileSystemWatcher::fileChanged, this, &LogFollower::poll);
+
+    pollTimer = new QTimer(this);
+    pollTimer->setInterval(PollInterval);
+    connect(pollTimer, &QTimer::timeout, this, &LogFollower::poll);
+}
+
+LogFollower::~LogFollower()
+{
+    stop();
+}
+
+void LogFollower::start(const QString &fileName, qint64 tailBytes)
+{
+    stop();
+
+    path = fileName;
+    tail = qMax<qint64>(0, tailBytes);
+    offset = 0;
+    head.clear();
+    decoder.reset(new TextDecoder);
+    decoder->setLenient(true);
+    following = true;
+
+    pollTimer->start();
+    poll();
+}
+
+void LogFollower::stop()
+{
+    // Bumping the generation drops the result of a read still running
+    ++currentGeneration;
+    future.waitForFinished();
+    following = false;
+    reading = false;
+    pollAgain = false;
+    pollTimer->stop();
+    if (!watcher->files().isEmpty())
+        watcher->removePaths(watcher->files());
+}
+
+void LogFollower::poll()
+{
+    if (!following)
+        return;
+    if (reading) {
+        pollAgain = true;
+        return;
+    }
+
+    // A rotated file is no longer watched once its name is taken by the new one
+    if (watcher->files().isEmpty() && QFile::exists(path))
+        watcher->addPath(path);
+
+    reading = true;
+    const quint64 generation = currentGeneration;
+    future = QtConcurrent::run([this, generation]() { read(generation); });
+}
+
+void LogFollower::read(quint64 generation)
+{
+    QFile file(path);
+    QString text;
+    QString error;
+    bool restart = false;
+    bool more = false;
+
+    // A file being rotated may be missing for a moment
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (file.exists())
+            error = file.errorString();
+    } else {
+        const qint64 size = file.size();
+        if (tail >= 0) {
+            // Skip the partial line the tail starts in
+            offset = qMax<qint64>(0, size - tail);
+            if (offset > 0 && file.seek(offset - 1)) {
+                while (offset < size) {
+                    const QByteArray bytes = file.read(ChunkSize);
+                    if (bytes.isEmpty())
+                        break;
+                    const int newline = bytes.indexOf('\n');
+                    if (newline >= 0) {
+                        offset += newline;
+                        break;
+                    }
+                    offset += bytes.size();
+                }
+                offset = qMin(offset, size);
+            }
+            tail = -1;
+        } else if (size < offset || (!head.isEmpty() && file.read(head.size()) != head)) {
+            restart = true;
+            offset = 0;
+            head.clear();
+            decoder.reset(new TextDecoder);
+            decoder->setLenient(true);
+        }
+
+        if (head.size() < HeadBytes && size > head.size() && file.seek(0))
+            head = file.read(HeadBytes);
+
+        const qint64 end = qMin(size, offset + MaxBatchBytes);
+        if (offset < end && file.seek(offset)) {
+            while (offset < end) {
+                const QByteArray bytes = file.read(qMin(ChunkSize, end - offset));
+                if (bytes.isEmpty())
+                    break;
+                decoder->decode(bytes.constData(), bytes.size(), &text);
+                offset += bytes.size();
+            }
+        }
+        if (error.isEmpty() && file.error() != QFileDevice::NoError)
+            error = file.errorString();
+        more = offset < size;
+    }
+
+    QMetaObject::invokeMethod(this, [this, generation, text, error, restart, more]() {
+        if (generation != currentGeneration)
+            return;
+        reading = false;
+        if (!error.isEmpty()) {
+            emit failed(error);
+            return;
+        }
+
+        if (restart)
+            emit restarted();
+        if (!text.isEmpty())
+            emit appended(text);
+        if ((more || pollAgain) && following) {
+            pollAgain = false;
+            poll();
+        }
+    }, Qt::QueuedConnection);
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef LOGFOLLOWER_H
+#define LOGFOLLOWER_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QFuture>
+#include <QScopedPointer>
+#include <atomic>
+
+class QFileSystemWatcher;
+class QTimer;
+class TextDecoder;
+
+// Watches a file that only grows, such as a log, and reads just the bytes
+// appended since the last read on a worker thread. New text reaches the
+// GUI thread in batches; a file that gets shorter or starts with other
+// bytes than before was truncated or rotated, and is read again from its
+// start. Change notifications are backed by polling, since a rotated file
+// drops out of the watcher and network file systems send none at all.
+// Bytes that are not valid in the file's encoding show as replacement
+// characters; a log with a stray bad byte is still worth following.
+class LogFollower : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LogFollower(QObject *parent = nullptr);
+    ~LogFollower();
+
+    // Starts with the whole lines in the last tailBytes of the file
+    void start(const QString &fileName, qint64 tailBytes);
+    void stop();
+    bool isFollowing() const { return following; }
+    QString fileName() const { return path; }
+
+signals:
+    void appended(const QString &text);
+    // What follows starts at the beginning of the file
+    void restarted();
+    // The file could not be opened or read. Polling goes on, so a file
+    // that becomes readable again is picked up unless following stops.
+    void failed(const QString &errorString);
+
+private:
+    void poll();
+    void read(quint64 generation);
+
+    QString path;
+    bool following;
+    bool reading;
+    bool pollAgain;
+    QFileSystemWatcher *watcher;
+    QTimer *pollTimer;
+    QFuture<void> future;
+    std::atomic<quint64> currentGeneration;
+
+    // Only the worker touches these while a read is running. tail is -1
+    // after the first read; head holds the first bytes of the file, to
+    // tell a rotated file from the one being followed.
+    qint64 tail;
+    qint64 offset;
+    QByteArray head;
+    QScopedPointer<TextDecoder> decoder;
+};
+
+#endif // LOGFOLLOWER_H
\ No newline at end of file
@@ -2,23 +2,153 @@
 #include "TextEditor.h"
 #include "AboutDialog.h"
 #include "PreferencesDialog.h"
+#include "PieceTable.h"
+#include "FileLoader.h"
+#include "FileSaver.h"
+#include "DocumentMetrics.h"
+#include "FindBar.h"
+#include "ReplaceAll.h"
+#include "TrigramIndex.h"
+#include "FindInFilesPanel.h"
+#include "EditJournal.h"
+#include "SyntaxHighlighter.h"
+#include "DocumentManager.h"
+#include "LatencyMonitor.h"
+#include "LogFollower.h"
+#include "StartupTrace.h"
+#include "SettingsStore.h"
+#include "TextDecoder.h"
 #include <QApplication>
 #include <QFileDialog>
-#include <QTextStream>
 #include <QMessageBox>
 #include <QCloseEvent>
-#include <QSettings>
 #include <QStandardPaths>
+#include <QInputDialog>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QSignalBlocker>
+#include <QDateTime>
+#include <climits>
+#include <cstring>
+
+// Files at least this large are edited through a piece table
+static const qint64 LargeFileThreshold = 16 * 1024 * 1024;
+
+// Smaller files with a line longer than this, in bytes, are too; only its
+// window cuts long lines into segments that lay out quickly
+static const qint64 LongLineThreshold = 64 * 1024;
+
+// Bytes at the start of a smaller file checked for such a line; a long
+// line further on is left to the document
+static const qint64 LongLineProbeSize = 4 * LongLineThreshold;
+
+// Bytes at the start of a mapped file checked for its encoding
+static const qint64 EncodingProbeSize = 64 * 1024;
+
+// Status bar updates are coalesced to at most one per frame
+static const int StatusBarInterval = 16;
+
+// File changes seen in the workspace are sent to the index in batches
+static const int WorkspaceIndexDelay = 500;
+
+// How often the latency label is refreshed while shown
+static const int LatencyLabelInterval = 1000;
+
+// A followed file starts with the lines in this many bytes at its end
+static const qint64 FollowTailBytes = 4 * 1024 * 1024;
+
+// Lines kept while following a file; older ones are dropped from the top
+static const int FollowMaxLines = 100000;
+
+static bool hasLongLine(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    // Read on the GUI thread, so only a bounded prefix
+    const QByteArray bytes = file.read(LongLineProbeSize);
+    const char *data = bytes.constData();
+    const char *end = data + bytes.size();
+    while (data < end) {
+        const void *newline = std::memchr(data, '\n', size_t(end - data));
+        const char *stop = newline ? static_cast<const char *>(newline) : end;
+        if (stop - data > LongLineThreshold)
+            return true;
+        data = stop + 1;
+    }
+    return false;
+}
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , textEditor(nullptr)
+    , documentTabs(nullptr)
+    , editorStack(nullptr)
+    , findBar(nullptr)
     , splitter(nullptr)
-    , fileListWidget(nullptr)
+    , sidebar(nullptr)
+    , workspaceView(nullptr)
+    , workspaceModel(nullptr)
+    , findInFilesPanel(nullptr)
+    , documents(nullptr)
+    , fileLoader(nullptr)
+    , fileSaver(nullptr)
+    , replacer(nullptr)
+    , metrics(nullptr)
+    , highlighter(nullptr)
+    , workspaceIndex(nullptr)
+    , journal(nullptr)
+    , latencyMonitor(nullptr)
+    , follower(nullptr)
+    , pendingLine(-1)
     , settings(nullptr)
+    , firstPaintSeen(false)
 {
-    // Initialize settings
-    settings = new QSettings(this);
+    // Settings are read once; the preferences apply as soon as they change
+    {
+        StartupTrace::Scope trace("loadSettings");
+        settings = new SettingsStore(this);
+    }
+    connect(settings, &SettingsStore::preferencesChanged, this, &MainWindow::applyPreferences);
+
+    // Every editor times its key presses to the paint that shows them
+    latencyMonitor = new LatencyMonitor(this);
+
+    // Files are read on a worker thread and appended in chunks
+    fileLoader = new FileLoader(this);
+    connect(fileLoader, &FileLoader::restarted, this, &MainWindow::loadRestarted);
+    connect(fileLoader, &FileLoader::chunkLoaded, this, &MainWindow::loadChunk);
+    connect(fileLoader, &FileLoader::progress, this, &MainWindow::showProgress);
+    connect(fileLoader, &FileLoader::finished, this, &MainWindow::loadFinished);
+    connect(fileLoader, &FileLoader::failed, this, &MainWindow::loadFailed);
+
+    // Following a log reads only what was appended since the last look
+    follower = new LogFollower(this);
+    connect(follower, &LogFollower::appended, this, &MainWindow::followAppended);
+    connect(follower, &LogFollower::restarted, this, &MainWindow::followRestarted);
+    connect(follower, &LogFollower::failed, this, &MainWindow::followFailed);
+
+    // Saves are written to a temporary file on a worker thread
+    fileSaver = new FileSaver(this);
+    connect(fileSaver, &FileSaver::progress, this, &MainWindow::showProgress);
+    connect(fileSaver, &FileSaver::finished, this, &MainWindow::saveFinished);
+    connect(fileSaver, &FileSaver::failed, this, &MainWindow::saveFailed);
+
+    // Replace All searches on the thread pool and edits once at the end
+    replacer = new ReplaceAll(this);
+    connect(replacer, &ReplaceAll::progress, this, &MainWindow::showProgress);
+    connect(replacer, &ReplaceAll::finished, this, &MainWindow::replaceFinished);
+    connect(replacer, &ReplaceAll::failed, this, &MainWindow::replaceFailed);
+
+    // Find in Files looks candidates up in an index kept current in the background
+    workspaceIndex = new TrigramIndex(this);
+
+    workspaceIndexTimer = new QTimer(this);
+    workspaceIndexTimer->setSingleShot(true);
+    workspaceIndexTimer->setInterval(WorkspaceIndexDelay);
+    connect(workspaceIndexTimer, &QTimer::timeout, this, &MainWindow::updateWorkspaceIndex);
     
     // Create UI components
     createCentralWidget();
@@ -26,16 +156,24 @@ MainWindow::MainWindow(QWidget *parent)
     createMenus();
     createToolBars();
     createStatusBar();
-    
-    // Connect text editor signals
-    connect(textEditor, &TextEditor::textChanged, this, &MainWindow::documentModified);
-    connect(textEditor, &TextEditor::cursorPositionChanged, this, &MainWindow::updateStatusBar);
+
+    // Autosave appends the edits since the last tick to each document's journal
+    autoSaveTimer = new QTimer(this);
+    connect(autoSaveTimer, &QTimer::timeout, this, &MainWindow::autoSave);
+
+    // Start with one untitled document
+    {
+        StartupTrace::Scope trace("addDocument");
+        activateDocument(addDocument());
+    }
     
     // Set window properties
     setWindowTitle("Qt Learning Application");
     setMinimumSize(800, 600);
     
-    // Read settings
+    // Only the geometry is needed before the window is shown; the
+    // preferences, the workspace and the welcome text follow the first
+    // paint in finishStartup()
     readSettings();
     
     // Update status bar
@@ -44,30 +182,74 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    // Journals are only needed when the application did not exit cleanly
+    for (int i = 0; i < documents->count(); ++i)
+        documents->journal(i)->discard();
     writeSettings();
 }
 
 void MainWindow::createCentralWidget()
 {
+    StartupTrace::Scope trace("createCentralWidget");
+
     // Create splitter for main layout
     splitter = new QSplitter(Qt::Horizontal, this);
     
-    // Create file list widget
-    fileListWidget = new QListWidget;
-    fileListWidget->setMaximumWidth(200);
-    fileListWidget->setMinimumWidth(150);
-    
-    // Add some sample items to the file list
-    fileListWidget->addItem("Welcome.txt");
-    fileListWidget->addItem("Example.txt");
-    fileListWidget->addItem("Notes.txt");
+    // Create the workspace tree. Directories are read on the model's own
+    // thread when first expanded and watched from then on, so changes
+    // arrive as row updates
+    workspaceModel = new QFileSystemModel(this);
+    workspaceModel->setFilter(QDir::AllEntries | QDir::AllDirs | QDir::NoDotAndDotDot);
+    workspaceModel->setReadOnly(true);
+    connect(workspaceModel, &QFileSystemModel::rowsInserted, this, &MainWindow::workspaceRowsChanged);
+    connect(workspaceModel, &QFileSystemModel::rowsAboutToBeRemoved, this, &MainWindow::workspaceRowsChanged);
+    connect(workspaceModel, &QFileSystemModel::dataChanged, this, &MainWindow::workspaceDataChanged);
+
+    workspaceView = new QTreeView;
+    workspaceView->setHeaderHidden(true);
+    workspaceView->setUniformRowHeights(true);
+    connect(workspaceView, &QTreeView::activated, this, &MainWindow::openWorkspaceFile);
+
+    // Create the sidebar with the workspace files and Find in Files
+    findInFilesPanel = new FindInFilesPanel(workspaceIndex);
+    connect(findInFilesPanel, &FindInFilesPanel::openRequested, this, &MainWindow::openSearchResult);
+
+    sidebar = new QTabWidget;
+    sidebar->setMaximumWidth(300);
+    sidebar->setMinimumWidth(150);
+    sidebar->addTab(workspaceView, "Files");
+    sidebar->addTab(findInFilesPanel, "Search");
     
-    // Create text editor
-    textEditor = new TextEditor;
+    // Every open document has an editor page; the tabs switch between
+    // them and the find bar follows whichever is current
+    editorStack = new QStackedWidget;
+    documents = new DocumentManager(editorStack, this);
+    connect(documents, &DocumentManager::editorCreated, this, &MainWindow::setupEditor);
+    connect(documents, &DocumentManager::spillFailed, this, &MainWindow::spillFailed);
+
+    documentTabs = new QTabBar;
+    documentTabs->setDocumentMode(true);
+    documentTabs->setTabsClosable(true);
+    documentTabs->setExpanding(false);
+    documentTabs->setElideMode(Qt::ElideMiddle);
+    connect(documentTabs, &QTabBar::currentChanged, this, &MainWindow::switchDocument);
+    connect(documentTabs, &QTabBar::tabCloseRequested, this, &MainWindow::closeDocument);
+
+    findBar = new FindBar(nullptr);
+    findBar->hide();
+    connect(findBar, &FindBar::replaceAllRequested, this, &MainWindow::replaceAll);
+
+    QWidget *editorPane = new QWidget;
+    QVBoxLayout *editorLayout = new QVBoxLayout(editorPane);
+    editorLayout->setContentsMargins(0, 0, 0, 0);
+    editorLayout->setSpacing(0);
+    editorLayout->addWidget(documentTabs);
+    editorLayout->addWidget(editorStack);
+    editorLayout->addWidget(findBar);
     
     // Add widgets to splitter
-    splitter->addWidget(fileListWidget);
-    splitter->addWidget(textEditor);
+    splitter->addWidget(sidebar);
+    splitter->addWidget(editorPane);
     
     // Set splitter proportions
     splitter->setStretchFactor(0, 0);
@@ -78,6 +260,8 @@ void MainWindow::createCentralWidget()
 
 void MainWindow::createActions()
 {
+    StartupTrace::Scope trace("createActions");
+
     // File actions
     newAction = new QAction(QIcon(":/icons/new.png"), "&New", this);
     newAction->setShortcuts(QKeySequence::New);
@@ -89,6 +273,10 @@ void MainWindow::createActions()
     openAction->setStatusTip("Open an existing file");
     connect(openAction, &QAction::triggered, this, &MainWindow::openFile);
 
+    openFolderAction = new QAction("Open &Folder...", this);
+    openFolderAction->setStatusTip("Open a folder as the workspace");
+    connect(openFolderAction, &QAction::triggered, this, &MainWindow::openFolder);
+
     saveAction = new QAction(QIcon(":/icons/save.png"), "&Save", this);
     saveAction->setShortcuts(QKeySequence::Save);
     saveAction->setStatusTip("Save the document to disk");
@@ -99,6 +287,11 @@ void MainWindow::createActions()
     saveAsAction->setStatusTip("Save the document under a new name");
     connect(saveAsAction, &QAction::triggered, this, &MainWindow::saveAsFile);
 
+    closeAction = new QAction("&Close", this);
+    closeAction->setShortcuts(QKeySequence::Close);
+    closeAction->setStatusTip("Close the document");
+    connect(closeAction, &QAction::triggered, this, &MainWindow::closeFile);
+
     exitAction = new QAction("E&xit", this);
     exitAction->setShortcuts(QKeySequence::Quit);
     exitAction->setStatusTip("Exit the application");
@@ -108,48 +301,74 @@ void MainWindow::createActions()
     undoAction = new QAction(QIcon(":/icons/undo.png"), "&Undo", this);
     undoAction->setShortcuts(QKeySequence::Undo);
     undoAction->setStatusTip("Undo the last operation");
-    connect(undoAction, &QAction::triggered, textEditor, &QTextEdit::undo);
+    connect(undoAction, &QAction::triggered, this, &MainWindow::undo);
 
     redoAction = new QAction(QIcon(":/icons/redo.png"), "&Redo", this);
     redoAction->setShortcuts(QKeySequence::Redo);
     redoAction->setStatusTip("Redo the last operation");
-    connect(redoAction, &QAction::triggered, textEditor, &QTextEdit::redo);
+    connect(redoAction, &QAction::triggered, this, &MainWindow::redo);
 
     cutAction = new QAction(QIcon(":/icons/cut.png"), "Cu&t", this);
     cutAction->setShortcuts(QKeySequence::Cut);
     cutAction->setStatusTip("Cut the current selection's contents to the clipboard");
-    connect(cutAction, &QAction::triggered, textEditor, &QTextEdit::cut);
+    connect(cutAction, &QAction::triggered, this, &MainWindow::cut);
 
     copyAction = new QAction(QIcon(":/icons/copy.png"), "&Copy", this);
     copyAction->setShortcuts(QKeySequence::Copy);
     copyAction->setStatusTip("Copy the current selection's contents to the clipboard");
-    connect(copyAction, &QAction::triggered, textEditor, &QTextEdit::copy);
+    connect(copyAction, &QAction::triggered, this, &MainWindow::copy);
 
     pasteAction = new QAction(QIcon(":/icons/paste.png"), "&Paste", this);
     pasteAction->setShortcuts(QKeySequence::Paste);
     pasteAction->setStatusTip("Paste the clipboard's contents into the current selection");
-    connect(pasteAction, &QAction::triggered, textEditor, &QTextEdit::paste);
+    connect(pasteAction, &QAction::triggered, this, &MainWindow::paste);
 
     selectAllAction = new QAction("Select &All", this);
     selectAllAction->setShortcuts(QKeySequence::SelectAll);
     selectAllAction->setStatusTip("Select all text");
-    connect(selectAllAction, &QAction::triggered, textEditor, &QTextEdit::selectAll);
+    connect(selectAllAction, &QAction::triggered, this, &MainWindow::selectAll);
 
     findAction = new QAction("&Find...", this);
     findAction->setShortcuts(QKeySequence::Find);
     findAction->setStatusTip("Find text");
     connect(findAction, &QAction::triggered, this, &MainWindow::find);
 
+    findNextAction = new QAction("Find &Next", this);
+    findNextAction->setShortcuts(QKeySequence::FindNext);
+    findNextAction->setStatusTip("Find the next occurrence");
+    connect(findNextAction, &QAction::triggered, this, &MainWindow::findNext);
+
+    findPreviousAction = new QAction("Find Pre&vious", this);
+    findPreviousAction->setShortcuts(QKeySequence::FindPrevious);
+    findPreviousAction->setStatusTip("Find the previous occurrence");
+    connect(findPreviousAction, &QAction::triggered, this, &MainWindow::findPrevious);
+
     replaceAction = new QAction("&Replace...", this);
     replaceAction->setShortcuts(QKeySequence::Replace);
     replaceAction->setStatusTip("Replace text");
     connect(replaceAction, &QAction::triggered, this, &MainWindow::replace);
 
+    goToLineAction = new QAction("&Go to Line...", this);
+    goToLineAction->setShortcut(QKeySequence(Qt::CTRL + Qt::Key_G));
+    goToLineAction->setStatusTip("Move the cursor to a line number");
+    connect(goToLineAction, &QAction::triggered, this, &MainWindow::goToLine);
+
     // View actions
+    followAction = new QAction("F&ollow File", this);
+    followAction->setCheckable(true);
+    followAction->setStatusTip("Show lines as they are appended to the file, read-only");
+    connect(followAction, &QAction::toggled, this, &MainWindow::toggleFollow);
+
     preferencesAction = new QAction("&Preferences...", this);
     preferencesAction->setStatusTip("Configure application preferences");
     connect(preferencesAction, &QAction::triggered, this, &MainWindow::showPreferences);
 
+    cancelAction = new QAction("&Cancel", this);
+    cancelAction->setShortcut(QKeySequence(Qt::Key_Escape));
+    cancelAction->setStatusTip("Stop loading the file or replacing text");
+    cancelAction->setEnabled(false);
+    connect(cancelAction, &QAction::triggered, this, &MainWindow::cancelOperation);
+
     // Help actions
     aboutAction = new QAction("&About", this);
     aboutAction->setStatusTip("Show the application's About box");
@@ -158,16 +377,25 @@ void MainWindow::createActions()
     aboutQtAction = new QAction("About &Qt", this);
     aboutQtAction->setStatusTip("Show the Qt library's About box");
     connect(aboutQtAction, &QAction::triggered, this, &MainWindow::showAboutQt);
+
+    latencyReportAction = new QAction("Dump &Latency Report", this);
+    latencyReportAction->setStatusTip("Write the key-to-paint latency histogram and the slowest key presses to a file");
+    connect(latencyReportAction, &QAction::triggered, this, &MainWindow::dumpLatencyReport);
 }
 
 void MainWindow::createMenus()
 {
+    StartupTrace::Scope trace("createMenus");
+
     // File menu
     fileMenu = menuBar()->addMenu("&File");
     fileMenu->addAction(newAction);
     fileMenu->addAction(openAction);
+    fileMenu->addAction(openFolderAction);
     fileMenu->addAction(saveAction);
     fileMenu->addAction(saveAsAction);
+    fileMenu->addAction(closeAction);
+    fileMenu->addAction(cancelAction);
     fileMenu->addSeparator();
     fileMenu->addAction(exitAction);
 
@@ -182,20 +410,29 @@ void MainWindow::createMenus()
     editMenu->addAction(selectAllAction);
     editMenu->addSeparator();
     editMenu->addAction(findAction);
+    editMenu->addAction(findNextAction);
+    editMenu->addAction(findPreviousAction);
     editMenu->addAction(replaceAction);
+    editMenu->addAction(goToLineAction);
 
     // View menu
     viewMenu = menuBar()->addMenu("&View");
+    viewMenu->addAction(followAction);
+    viewMenu->addSeparator();
     viewMenu->addAction(preferencesAction);
 
     // Help menu
     helpMenu = menuBar()->addMenu("&Help");
     helpMenu->addAction(aboutAction);
     helpMenu->addAction(aboutQtAction);
+    helpMenu->addSeparator();
+    helpMenu->addAction(latencyReportAction);
 }
 
 void MainWindow::createToolBars()
 {
+    StartupTrace::Scope trace("createToolBars");
+
     // File toolbar
     fileToolBar = addToolBar("File");
     fileToolBar->addAction(newAction);
@@ -214,6 +451,8 @@ void MainWindow::createToolBars()
 
 void MainWindow::createStatusBar()
 {
+    StartupTrace::Scope trace("createStatusBar");
+
     locationLabel = new QLabel("Line 1, Column 1");
     locationLabel->setAlignment(Qt::AlignHCenter);
     locationLabel->setMinimumSize(locationLabel->sizeHint());
@@ -222,61 +461,526 @@ void MainWindow::createStatusBar()
     sizeLabel->setAlignment(Qt::AlignHCenter);
     sizeLabel->setMinimumSize(sizeLabel->sizeHint());
 
+    latencyLabel = new QLabel;
+    latencyLabel->setAlignment(Qt::AlignHCenter);
+    latencyLabel->hide();
+
+    latencyTimer = new QTimer(this);
+    latencyTimer->setInterval(LatencyLabelInterval);
+    connect(latencyTimer, &QTimer::timeout, this, &MainWindow::updateLatencyLabel);
+
+    progressBar = new QProgressBar;
+    progressBar->setRange(0, 100);
+    progressBar->setMaximumWidth(150);
+    progressBar->hide();
+
+    cancelButton = new QToolButton;
+    cancelButton->setDefaultAction(cancelAction);
+    cancelButton->setAutoRaise(true);
+    cancelButton->hide();
+
+    statusTimer = new QTimer(this);
+    statusTimer->setSingleShot(true);
+    statusTimer->setInterval(StatusBarInterval);
+    connect(statusTimer, &QTimer::timeout, this, &MainWindow::updateStatusBar);
+
     statusBar()->addWidget(locationLabel);
+    statusBar()->addPermanentWidget(progressBar);
+    statusBar()->addPermanentWidget(cancelButton);
     statusBar()->addPermanentWidget(sizeLabel);
+    statusBar()->addPermanentWidget(latencyLabel);
     statusBar()->showMessage("Ready", 2000);
 }
 
 void MainWindow::newFile()
 {
-    if (saveChanges()) {
+    cancelLoading();
+    if (!isBlankDocument())
+        activateDocument(addDocument());
+}
+
+void MainWindow::openFile()
+{
+    QString fileName = QFileDialog::getOpenFileName(this,
+                                                    "Open File",
+                                                    QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation),
+                                                    "Text Files (*.txt);;All Files (*)");
+    if (!fileName.isEmpty())
+        loadFile(fileName);
+}
+
+void MainWindow::closeFile()
+{
+    closeDocument(documents->currentIndex());
+}
+
+void MainWindow::openFolder()
+{
+    QString root = QFileDialog::getExistingDirectory(this,
+                                                     "Open Folder",
+                                                     workspaceRoot.isEmpty()
+                                                     ? QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation)
+                                                     : workspaceRoot);
+    if (!root.isEmpty())
+        setWorkspace(root);
+}
+
+void MainWindow::setWorkspace(const QString &root)
+{
+    workspaceRoot = QDir(root).absolutePath();
+    settings->setValue("workspace/root", workspaceRoot);
+    sidebar->setTabText(0, QDir(workspaceRoot).dirName());
+
+    // The tree stays empty until there is a workspace to show
+    if (!workspaceView->model()) {
+        workspaceView->setModel(workspaceModel);
+        for (int column = 1; column < workspaceModel->columnCount(); ++column)
+            workspaceView->hideColumn(column);
+    }
+    workspaceView->setRootIndex(workspaceModel->setRootPath(workspaceRoot));
+    changedWorkspaceFiles.clear();
+
+    // The saved index is loaded and brought up to date in the background
+    findInFilesPanel->cancel();
+    workspaceIndex->setRoot(workspaceRoot);
+}
+
+void MainWindow::openWorkspaceFile(const QModelIndex &index)
+{
+    if (workspaceModel->isDir(index))
+        return;
+
+    const QString fileName = workspaceModel->filePath(index);
+    if (fileName != currentFile)
+        loadFile(fileName);
+}
+
+void MainWindow::workspaceRowsChanged(const QModelIndex &parent, int first, int last)
+{
+    // Only directories that were expanded are watched; the index covers
+    // the rest with its own scan when the workspace is opened. A directory
+    // row is queued too, so that removing it drops the files under it.
+    for (int row = first; row <= last; ++row) {
+        const QModelIndex index = workspaceModel->index(row, 0, parent);
+        changedWorkspaceFiles.insert(workspaceModel->filePath(index));
+    }
+    if (!changedWorkspaceFiles.isEmpty() && !workspaceIndexTimer->isActive())
+        workspaceIndexTimer->start();
+}
+
+void MainWindow::workspaceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    // A directory's own data changing says nothing about its files
+    for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+        const QModelIndex index = workspaceModel->index(row, 0, topLeft.parent());
+        if (!workspaceModel->isDir(index))
+            changedWorkspaceFiles.insert(workspaceModel->filePath(index));
+    }
+    if (!changedWorkspaceFiles.isEmpty() && !workspaceIndexTimer->isActive())
+        workspaceIndexTimer->start();
+}
+
+void MainWindow::updateWorkspaceIndex()
+{
+    workspaceIndex->refresh(changedWorkspaceFiles.values());
+    changedWorkspaceFiles.clear();
+}
+
+void MainWindow::openSearchResult(const QString &fileName, int line)
+{
+    if (fileName != currentFile || fileLoader->isRunning())
+        loadFile(fileName);
+
+    // The jump happens once the file is in
+    if (fileLoader->isRunning()) {
+        pendingLine = line;
+        return;
+    }
+    textEditor->goToLine(line);
+    textEditor->setFocus();
+}
+
+void MainWindow::loadFile(const QString &fileName)
+{
+    cancelOperation();
+    pendingLine = -1;
+
+    // An open file is only brought to the front, and an untouched untitled
+    // document is used instead of adding another
+    const int open = documents->indexOf(fileName);
+    if (open >= 0) {
+        activateDocument(open);
+        return;
+    }
+    if (!isBlankDocument())
+        activateDocument(addDocument());
+    readFile(fileName);
+}
+
+void MainWindow::readFile(const QString &fileName)
+{
+    if (QFileInfo(fileName).size() >= LargeFileThreshold || hasLongLine(fileName))
+        openLargeFile(fileName);
+    else
+        startLoading(fileName);
+}
+
+int MainWindow::addDocument()
+{
+    // Only the first document of a session gets the sample text; the rest
+    // start empty, which is what lets a load reuse an untouched one
+    const int index = documents->add();
+    const QSignalBlocker blocker(documentTabs);
+    documentTabs->insertTab(index, "untitled.txt");
+    return index;
+}
+
+void MainWindow::activateDocument(int index)
+{
+    // A save in progress still reads the current document, and a load or
+    // replace would edit it
+    if (fileSaver->isRunning())
+        fileSaver->waitForFinished();
+    cancelOperation();
+    detachEditor();
+
+    const QString shownName = documents->fileName(index);
+    const bool restored = documents->setCurrent(index);
+    textEditor = documents->editor(index);
+    metrics = textEditor->document()->findChild<DocumentMetrics *>();
+    highlighter = textEditor->document()->findChild<SyntaxHighlighter *>();
+    journal = documents->journal(index);
+    currentFile = documents->fileName(index);
+    findBar->setEditor(textEditor);
+
+    connect(textEditor, &TextEditor::textChanged, this, &MainWindow::documentModified);
+    connect(textEditor, &TextEditor::cursorPositionChanged, this, &MainWindow::scheduleStatusBarUpdate);
+    connect(textEditor, &TextEditor::lineIndexReady, this, &MainWindow::lineIndexReady);
+    connect(textEditor, &TextEditor::pasteStarted, this, &MainWindow::pasteStarted);
+    connect(textEditor, &TextEditor::pasteProgress, this, &MainWindow::showProgress);
+    connect(textEditor, &TextEditor::pasteFinished, this, &MainWindow::pasteFinished);
+    connect(metrics, &DocumentMetrics::changed, this, &MainWindow::scheduleStatusBarUpdate);
+
+    // A document read back from the cache has a new editor
+    highlighter->setLanguage(SyntaxLanguage::forFileName(currentFile));
+    if (autoSaveTimer->isActive() && !journal->isActive())
+        journal->start(currentFile);
+
+    {
+        const QSignalBlocker blocker(documentTabs);
+        documentTabs->setCurrentIndex(index);
+    }
+    updateDocumentTab(index);
+    setWindowFilePath(currentFile.isEmpty() ? QString("untitled.txt") : currentFile);
+    setWindowModified(textEditor->isModified());
+
+    // Keep the workspace tree on the file being edited
+    if (workspaceView->model() && currentFile.startsWith(workspaceRoot + QLatin1Char('/')))
+        workspaceView->setCurrentIndex(workspaceModel->index(currentFile));
+
+    textEditor->setFocus();
+    updateStatusBar();
+
+    if (!restored) {
+        QMessageBox::warning(this, "Qt Learning Application",
+                            QString("Cannot restore %1 from the document cache:\n%2.")
+                            .arg(shownName.isEmpty() ? QString("untitled.txt") : shownName)
+                            .arg(documents->errorString()));
+    }
+}
+
+void MainWindow::detachEditor()
+{
+    if (!textEditor)
+        return;
+
+    disconnect(textEditor, nullptr, this, nullptr);
+    disconnect(metrics, nullptr, this, nullptr);
+    textEditor = nullptr;
+    metrics = nullptr;
+    highlighter = nullptr;
+    journal = nullptr;
+}
+
+void MainWindow::switchDocument(int index)
+{
+    if (index >= 0 && index != documents->currentIndex())
+        activateDocument(index);
+}
+
+void MainWindow::closeDocument(int index)
+{
+    // Unsaved changes are offered for saving with the document in view
+    if (documents->isModified(index)) {
+        activateDocument(index);
+        if (!saveChanges())
+            return;
+    }
+
+    const bool wasCurrent = index == documents->currentIndex();
+    if (wasCurrent) {
+        cancelOperation();
+        detachEditor();
+    }
+    documents->remove(index);
+    {
+        const QSignalBlocker blocker(documentTabs);
+        documentTabs->removeTab(index);
+    }
+
+    if (documents->count() == 0)
+        addDocument();
+    if (wasCurrent)
+        activateDocument(qMin(index, documents->count() - 1));
+}
+
+void MainWindow::updateDocumentTab(int index)
+{
+    const QString fileName = documents->fileName(index);
+    QString text = fileName.isEmpty() ? QString("untitled.txt") : strippedName(fileName);
+    if (documents->isModified(index))
+        text += QLatin1Char('*');
+    if (documentTabs->tabText(index) != text)
+        documentTabs->setTabText(index, text);
+    documentTabs->setTabToolTip(index, fileName);
+}
+
+bool MainWindow::isBlankDocument() const
+{
+    return currentFile.isEmpty() && !textEditor->hasBuffer() && !textEditor->isModified()
+            && textEditor->document()->isEmpty();
+}
+
+void MainWindow::setupEditor(TextEditor *editor)
+{
+    // Counts follow the document's edits instead of rescanning it; both
+    // helpers are children of the document and go away with the editor
+    new DocumentMetrics(editor->document());
+    new SyntaxHighlighter(editor->document());
+    editor->setPreferences(settings->preferences());
+    editor->setLatencyMonitor(latencyMonitor);
+
+    // The first window of a buffer is checked before the file name is set
+    connect(editor, &TextEditor::invalidText, this, [this, editor]() {
+        bufferLocked(editor);
+    }, Qt::QueuedConnection);
+}
+
+void MainWindow::bufferLocked(TextEditor *editor)
+{
+    QString fileName;
+    for (int i = 0; i < documents->count(); ++i) {
+        if (documents->editor(i) == editor)
+            fileName = documents->fileName(i);
+    }
+    QMessageBox::warning(this, "Qt Learning Application",
+                        QString("File %1 is not valid UTF-8 and is too large to be converted; "
+                                "it is opened read-only.")
+                        .arg(fileName.isEmpty() ? QString("untitled.txt") : strippedName(fileName)));
+}
+
+void MainWindow::autoSave()
+{
+    // Spilled documents have no edits to write
+    for (int i = 0; i < documents->count(); ++i)
+        documents->journal(i)->flush();
+}
+
+void MainWindow::spillFailed(const QString &fileName, const QString &errorString)
+{
+    // The document simply stays in memory
+    statusBar()->showMessage(QString("Cannot cache %1: %2")
+                             .arg(fileName.isEmpty() ? QString("untitled.txt") : strippedName(fileName))
+                             .arg(errorString), 5000);
+}
+
+void MainWindow::startLoading(const QString &fileName)
+{
+    textEditor->closeBuffer();
+    textEditor->clear();
+    setCurrentFile("");
+    documents->setEncoding(documents->currentIndex(), QByteArray(), false);
+
+    // Appended chunks should not become undo steps, and nothing may be
+    // edited or saved until the whole file is in
+    textEditor->editHistory()->setEnabled(false);
+    journal->discard();
+    setDocumentBusy(true);
+    cancelButton->show();
+    cancelAction->setEnabled(true);
+    statusBar()->showMessage(QString("Loading %1...").arg(strippedName(fileName)));
+
+    fileLoader->start(fileName);
+}
+
+void MainWindow::endLoading()
+{
+    textEditor->editHistory()->setEnabled(true);
+    setDocumentBusy(false);
+    cancelButton->hide();
+    cancelAction->setEnabled(false);
+}
+
+void MainWindow::setDocumentBusy(bool busy)
+{
+    textEditor->setReadOnly(busy || textEditor->isBufferLocked());
+    documentTabs->setEnabled(!busy);
+    closeAction->setEnabled(!busy);
+    saveAction->setEnabled(!busy);
+    saveAsAction->setEnabled(!busy);
+
+    progressBar->setValue(0);
+    progressBar->setVisible(busy);
+}
+
+void MainWindow::loadRestarted()
+{
+    textEditor->clear();
+}
+
+void MainWindow::loadChunk(const QString &text)
+{
+    QTextCursor cursor(textEditor->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(text);
+}
+
+void MainWindow::loadFinished()
+{
+    endLoading();
+    setCurrentFile(fileLoader->fileName());
+    documents->setEncoding(documents->currentIndex(), fileLoader->codecName(), fileLoader->hasByteOrderMark());
+    if (pendingLine >= 0) {
+        textEditor->goToLine(pendingLine);
+        pendingLine = -1;
+    }
+    documents->enforceBudget();
+    updateStatusBar();
+    if (fileLoader->warningString().isEmpty()) {
+        statusBar()->showMessage(QString("File loaded as %1").arg(fileLoader->encodingName()), 2000);
+    } else {
+        QMessageBox::warning(this, "Qt Learning Application",
+                            QString("File %1 was loaded as %2:\n%3.")
+                            .arg(fileLoader->fileName())
+                            .arg(fileLoader->encodingName())
+                            .arg(fileLoader->warningString()));
+    }
+}
+
+void MainWindow::loadFailed(const QString &errorString)
+{
+    endLoading();
+    textEditor->clear();
+    setCurrentFile("");
+    QMessageBox::warning(this, "Qt Learning Application",
+                        QString("Cannot read file %1:\n%2.")
+                        .arg(fileLoader->fileName())
+                        .arg(errorString));
+}
+
+void MainWindow::cancelLoading()
+{
+    if (!fileLoader->isRunning())
+        return;
+
+    fileLoader->cancel();
+    endLoading();
+    textEditor->clear();
+    setCurrentFile("");
+    statusBar()->showMessage("Loading cancelled", 2000);
+}
+
+bool MainWindow::recoverSession(SessionRecovery::Session session)
+{
+    cancelLoading();
+    if (!isBlankDocument())
+        activateDocument(addDocument());
+    QString errorString;
+    bool replayed;
+    if (session.header.unit == EditJournal::Bytes) {
+        PieceTable *table = new PieceTable;
+        replayed = SessionRecovery::replay(&session, table, &errorString);
+        if (replayed)
+            textEditor->openBuffer(table);
+        else
+            delete table;
+    } else {
+        textEditor->closeBuffer();
+        textEditor->clear();
+        textEditor->editHistory()->setEnabled(false);
+        replayed = SessionRecovery::replay(&session, textEditor->document(), &errorString);
+        textEditor->editHistory()->setEnabled(true);
+    }
+
+    if (!replayed) {
         textEditor->clear();
         setCurrentFile("");
+        QMessageBox::warning(this, "Qt Learning Application",
+                            QString("Cannot recover %1:\n%2.")
+                            .arg(session.header.fileName.isEmpty() ? QString("the document")
+                                                                   : session.header.fileName)
+                            .arg(errorString));
+        return false;
     }
+
+    // The file on disk still lacks the recovered edits
+    setCurrentFile(session.header.fileName);
+    textEditor->setModified(true);
+    setWindowModified(true);
+
+    // Keep appending to the same journal, so a second crash loses nothing.
+    // Recovery runs before the first paint, when the autosave timer has
+    // not been started yet, so ask the preference instead.
+    if (settings->preferences().autoSave)
+        journal->resume(session.journalFileName, session.header, session.length);
+    else
+        SessionRecovery::remove(session);
+    statusBar()->showMessage("Unsaved changes recovered", 2000);
+    return true;
 }
 
-void MainWindow::openFile()
+void MainWindow::openLargeFile(const QString &fileName)
 {
-    if (saveChanges()) {
-        QString fileName = QFileDialog::getOpenFileName(this,
-                                                        "Open File",
-                                                        QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation),
-                                                        "Text Files (*.txt);;All Files (*)");
-        if (!fileName.isEmpty()) {
-            QFile file(fileName);
-            if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-                QTextStream in(&file);
-                textEditor->setPlainText(in.readAll());
-                setCurrentFile(fileName);
-                statusBar()->showMessage("File loaded", 2000);
-            } else {
-                QMessageBox::warning(this, "Qt Learning Application",
-                                    QString("Cannot read file %1:\n%2.")
-                                    .arg(fileName)
-                                    .arg(file.errorString()));
-            }
-        }
+    // Map the file instead of reading it; the editor decodes only what is shown
+    PieceTable *table = new PieceTable;
+    if (!table->mapFile(fileName)) {
+        QMessageBox::warning(this, "Qt Learning Application",
+                            QString("Cannot read file %1:\n%2.")
+                            .arg(fileName)
+                            .arg(table->errorString()));
+        delete table;
+        return;
+    }
+
+    // Windows of a mapped file are decoded as UTF-8, so a file that starts
+    // out as anything else is only shown the way UTF-8 would show it, and
+    // may not be edited. Invalid bytes further in lock the buffer when the
+    // window holding them is decoded.
+    TextDecoder decoder;
+    QString head;
+    const QByteArray probe = table->read(0, qMin<qint64>(table->size(), EncodingProbeSize));
+    const bool utf8 = decoder.decode(probe.constData(), probe.size(), &head)
+            && decoder.encodingName().startsWith(QLatin1String("UTF-8"));
+
+    textEditor->openBuffer(table, !utf8);
+    setCurrentFile(fileName);
+    documents->enforceBudget();
+    statusBar()->showMessage("Indexing lines...");
+    if (!utf8) {
+        QMessageBox::warning(this, "Qt Learning Application",
+                            QString("File %1 is too large to be converted from %2; it is shown as UTF-8 "
+                                    "and opened read-only.")
+                            .arg(fileName)
+                            .arg(decoder.encodingName()));
     }
 }
 
 void MainWindow::saveFile()
 {
-    if (currentFile.isEmpty()) {
+    if (currentFile.isEmpty())
         saveAsFile();
-    } else {
-        QFile file(currentFile);
-        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&file);
-            out << textEditor->toPlainText();
-            textEditor->document()->setModified(false);
-            statusBar()->showMessage("File saved", 2000);
-        } else {
-            QMessageBox::warning(this, "Qt Learning Application",
-                                QString("Cannot write file %1:\n%2.")
-                                .arg(currentFile)
-                                .arg(file.errorString()));
-        }
-    }
+    else
+        writeFile(currentFile);
 }
 
 void MainWindow::saveAsFile()
@@ -285,26 +989,52 @@ void MainWindow::saveAsFile()
                                                     "Save File",
                                                     QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation),
                                                     "Text Files (*.txt);;All Files (*)");
-    if (!fileName.isEmpty()) {
-        QFile file(fileName);
-        if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&file);
-            out << textEditor->toPlainText();
-            setCurrentFile(fileName);
-            textEditor->document()->setModified(false);
-            statusBar()->showMessage("File saved", 2000);
-        } else {
-            QMessageBox::warning(this, "Qt Learning Application",
-                                QString("Cannot write file %1:\n%2.")
-                                .arg(fileName)
-                                .arg(file.errorString()));
-        }
-    }
+    if (!fileName.isEmpty())
+        writeFile(fileName);
+}
+
+void MainWindow::writeFile(const QString &fileName)
+{
+    // The document is read block by block while it is written, so keep
+    // it unchanged until the save completes
+    textEditor->commitWindow();
+    setDocumentBusy(true);
+    statusBar()->showMessage(QString("Saving %1...").arg(strippedName(fileName)));
+
+    if (textEditor->hasBuffer())
+        fileSaver->save(*textEditor->pieceTable(), fileName);
+    else
+        fileSaver->save(textEditor->document(), fileName, documents->codecName(documents->currentIndex()),
+                        documents->hasByteOrderMark(documents->currentIndex()));
+}
+
+void MainWindow::showProgress(qint64 done, qint64 total)
+{
+    if (total > 0)
+        progressBar->setValue(int(qMin<qint64>(done * 100 / total, 100)));
+}
+
+void MainWindow::saveFinished()
+{
+    setDocumentBusy(false);
+    setCurrentFile(fileSaver->fileName());
+    workspaceIndex->refresh(QStringList() << currentFile);
+    statusBar()->showMessage("File saved", 2000);
+}
+
+void MainWindow::saveFailed(const QString &errorString)
+{
+    setDocumentBusy(false);
+    statusBar()->clearMessage();
+    QMessageBox::warning(this, "Qt Learning Application",
+                        QString("Cannot write file %1:\n%2.")
+                        .arg(fileSaver->fileName())
+                        .arg(errorString));
 }
 
 void MainWindow::exit()
 {
-    if (saveChanges()) {
+    if (saveAllChanges()) {
         qApp->quit();
     }
 }
@@ -334,6 +1064,22 @@ void MainWindow::paste()
     textEditor->paste();
 }
 
+void MainWindow::pasteStarted()
+{
+    setDocumentBusy(true);
+    cancelButton->show();
+    cancelAction->setEnabled(true);
+    statusBar()->showMessage("Pasting...");
+}
+
+void MainWindow::pasteFinished()
+{
+    setDocumentBusy(false);
+    cancelButton->hide();
+    cancelAction->setEnabled(false);
+    statusBar()->clearMessage();
+}
+
 void MainWindow::selectAll()
 {
     textEditor->selectAll();
@@ -341,22 +1087,273 @@ void MainWindow::selectAll()
 
 void MainWindow::find()
 {
-    // Placeholder for find dialog
-    QMessageBox::information(this, "Find", "Find functionality would be implemented here.");
+    findBar->showFind();
+}
+
+void MainWindow::findNext()
+{
+    findBar->findNext();
+}
+
+void MainWindow::findPrevious()
+{
+    findBar->findPrevious();
 }
 
 void MainWindow::replace()
 {
-    // Placeholder for replace dialog
-    QMessageBox::information(this, "Replace", "Replace functionality would be implemented here.");
+    findBar->showReplace();
+}
+
+void MainWindow::replaceAll()
+{
+    if (replacer->isRunning() || fileLoader->isRunning() || fileSaver->isRunning()
+            || follower->isFollowing() || textEditor->isBufferLocked())
+        return;
+
+    setDocumentBusy(true);
+    cancelButton->show();
+    cancelAction->setEnabled(true);
+    statusBar()->showMessage("Replacing...");
+
+    replacer->start(textEditor, findBar->pattern(), findBar->replacement(),
+                    findBar->isRegex(), findBar->caseSensitivity());
+}
+
+void MainWindow::replaceFinished(qint64 replacements)
+{
+    setDocumentBusy(false);
+    cancelButton->hide();
+    cancelAction->setEnabled(false);
+    statusBar()->showMessage(QString("Replaced %1 occurrences").arg(replacements), 2000);
+}
+
+void MainWindow::replaceFailed(const QString &errorString)
+{
+    setDocumentBusy(false);
+    cancelButton->hide();
+    cancelAction->setEnabled(false);
+    statusBar()->showMessage(QString("Nothing replaced: %1").arg(errorString), 5000);
+}
+
+void MainWindow::cancelReplace()
+{
+    if (!replacer->isRunning())
+        return;
+
+    replacer->cancel();
+    setDocumentBusy(false);
+    cancelButton->hide();
+    cancelAction->setEnabled(false);
+    statusBar()->showMessage("Replace cancelled", 2000);
+}
+
+void MainWindow::cancelOperation()
+{
+    cancelLoading();
+    cancelReplace();
+    if (textEditor)
+        textEditor->cancelPaste();
+
+    // The document is being left or replaced, so the file is not read
+    // again; the last lines shown stay, but untitled, so that saving them
+    // cannot cut the file down to its tail
+    if (stopFollowing())
+        setCurrentFile("");
+}
+
+void MainWindow::toggleFollow(bool follow)
+{
+    if (!follow) {
+        const QString fileName = currentFile;
+        if (stopFollowing())
+            reopenFollowed(fileName);
+        return;
+    }
+
+    // The followed text replaces the document, so unsaved changes go first
+    cancelOperation();
+    if (currentFile.isEmpty() || !saveChanges()) {
+        const QSignalBlocker blocker(followAction);
+        followAction->setChecked(false);
+        if (currentFile.isEmpty())
+            statusBar()->showMessage("Only a file on disk can be followed", 2000);
+        return;
+    }
+
+    textEditor->closeBuffer();
+    textEditor->editHistory()->setEnabled(false);
+    textEditor->clear();
+    textEditor->setReadOnly(true);
+    textEditor->document()->setMaximumBlockCount(FollowMaxLines);
+    textEditor->document()->setModified(false);
+    journal->discard();
+    saveAction->setEnabled(false);
+    saveAsAction->setEnabled(false);
+
+    follower->start(currentFile, FollowTailBytes);
+    statusBar()->showMessage(QString("Following %1").arg(strippedName(currentFile)));
+}
+
+bool MainWindow::stopFollowing()
+{
+    if (!follower->isFollowing())
+        return false;
+
+    follower->stop();
+    {
+        const QSignalBlocker blocker(followAction);
+        followAction->setChecked(false);
+    }
+    textEditor->document()->setMaximumBlockCount(0);
+    textEditor->setReadOnly(false);
+    textEditor->editHistory()->setEnabled(true);
+    saveAction->setEnabled(true);
+    saveAsAction->setEnabled(true);
+    return true;
+}
+
+void MainWindow::reopenFollowed(const QString &fileName)
+{
+    // Only the last lines were kept; the whole file comes back for editing,
+    // and the document is left empty if it cannot be read
+    textEditor->clear();
+    setCurrentFile("");
+    readFile(fileName);
+}
+
+void MainWindow::followAppended(const QString &text)
+{
+    // The view keeps up with the file only while it is at the end
+    QScrollBar *bar = textEditor->verticalScrollBar();
+    const bool atEnd = bar->value() == bar->maximum();
+
+    QTextCursor cursor(textEditor->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(text);
+    textEditor->document()->setModified(false);
+    if (atEnd)
+        textEditor->moveCursor(QTextCursor::End);
+}
+
+void MainWindow::followRestarted()
+{
+    textEditor->clear();
+    textEditor->document()->setMaximumBlockCount(FollowMaxLines);
+    textEditor->document()->setModified(false);
+    statusBar()->showMessage(QString("%1 was truncated or replaced; following it from the start")
+                             .arg(strippedName(currentFile)), 5000);
+}
+
+void MainWindow::followFailed(const QString &errorString)
+{
+    const QString fileName = currentFile;
+    stopFollowing();
+    QMessageBox::warning(this, "Qt Learning Application",
+                        QString("Cannot follow file %1:\n%2.")
+                        .arg(fileName)
+                        .arg(errorString));
+
+    // A file that is gone keeps the lines already shown, untitled
+    if (QFileInfo::exists(fileName))
+        reopenFollowed(fileName);
+    else
+        setCurrentFile("");
+}
+
+void MainWindow::goToLine()
+{
+    const qint64 lines = textEditor->lineCount();
+    bool ok;
+    int line = QInputDialog::getInt(this, "Go to Line", "Line number:",
+                                    int(textEditor->cursorLine() + 1), 1,
+                                    lines > 0 ? int(qMin<qint64>(lines, INT_MAX)) : INT_MAX, 1, &ok);
+    if (!ok)
+        return;
+
+    textEditor->goToLine(line - 1);
+    if (!textEditor->isLineIndexReady() && textEditor->hasBuffer())
+        statusBar()->showMessage("Indexing lines; jumping when done...");
+}
+
+void MainWindow::lineIndexReady(qint64 lines)
+{
+    statusBar()->showMessage(QString("Indexed %1 lines").arg(lines), 2000);
+    updateStatusBar();
 }
 
 void MainWindow::showPreferences()
 {
-    PreferencesDialog dialog(this);
+    PreferencesDialog dialog(settings, this);
     dialog.exec();
 }
 
+void MainWindow::applyPreferences()
+{
+    const Preferences &preferences = settings->preferences();
+
+    // Spilled documents get theirs in setupEditor() when they are back
+    for (int i = 0; i < documents->count(); ++i) {
+        if (TextEditor *editor = documents->editor(i))
+            editor->setPreferences(preferences);
+    }
+
+    statusBar()->setVisible(preferences.showStatusBar);
+    fileToolBar->setVisible(preferences.showToolBar);
+    editToolBar->setVisible(preferences.showToolBar);
+
+    latencyLabel->setVisible(preferences.showLatency);
+    if (preferences.showLatency) {
+        updateLatencyLabel();
+        latencyTimer->start();
+    } else {
+        latencyTimer->stop();
+    }
+
+    documents->setMemoryBudget(qint64(qMax(preferences.memoryBudget, 64)) * 1024 * 1024);
+    autoSaveTimer->setInterval(qMax(preferences.autoSaveInterval, 1) * 60 * 1000);
+
+    if (!preferences.autoSave) {
+        autoSaveTimer->stop();
+        for (int i = 0; i < documents->count(); ++i)
+            documents->journal(i)->discard();
+    } else if (!autoSaveTimer->isActive()) {
+        // Spilled documents start theirs when they are back
+        autoSaveTimer->start();
+        for (int i = 0; i < documents->count(); ++i) {
+            EditJournal *documentJournal = documents->journal(i);
+            const bool loading = i == documents->currentIndex() && fileLoader->isRunning();
+            if (documents->editor(i) && !documentJournal->isActive() && !loading)
+                documentJournal->start(documents->fileName(i));
+        }
+    }
+}
+
+void MainWindow::updateLatencyLabel()
+{
+    latencyLabel->setText(latencyMonitor->summary());
+}
+
+void MainWindow::dumpLatencyReport()
+{
+    // Kept next to the journals, where a report from the field can be found
+    const QString directory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    const QString fileName = QDir(directory).filePath(
+            QString("latency-%1.txt").arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss")));
+
+    QFile file(fileName);
+    if (!QDir().mkpath(directory) || !file.open(QIODevice::WriteOnly | QIODevice::Text)
+            || file.write(latencyMonitor->report().toUtf8()) < 0) {
+        QMessageBox::warning(this, "Qt Learning Application",
+                            QString("Cannot write file %1:\n%2.")
+                            .arg(QDir::toNativeSeparators(fileName))
+                            .arg(file.errorString()));
+        return;
+    }
+    statusBar()->showMessage(QString("Latency report written to %1")
+                             .arg(QDir::toNativeSeparators(fileName)), 5000);
+}
+
 void MainWindow::showAbout()
 {
     AboutDialog dialog(this);
@@ -370,24 +1367,42 @@ void MainWindow::showAboutQt()
 
 void MainWindow::documentModified()
 {
-    setWindowModified(textEditor->document()->isModified());
-    updateStatusBar();
+    // Chunks arriving during a load or while following are not user edits
+    if (fileLoader->isRunning() || follower->isFollowing())
+        return;
+
+    setWindowModified(textEditor->isModified());
+    updateDocumentTab(documents->currentIndex());
+    scheduleStatusBarUpdate();
 }
 
 void MainWindow::updateStatusBar()
 {
-    QTextCursor cursor = textEditor->textCursor();
-    int line = cursor.blockNumber() + 1;
-    int column = cursor.columnNumber() + 1;
+    qint64 line = textEditor->cursorLine() + 1;
+    int column = textEditor->cursorColumn() + 1;
     locationLabel->setText(QString("Line %1, Column %2").arg(line).arg(column));
     
-    int characters = textEditor->toPlainText().length();
-    sizeLabel->setText(QString("%1 characters").arg(characters));
+    if (textEditor->hasBuffer()) {
+        sizeLabel->setText(QString("%1 bytes").arg(textEditor->pieceTable()->size()));
+        return;
+    }
+
+    sizeLabel->setText(QString("%1 lines, %2 words, %3 characters")
+                       .arg(metrics->lineCount())
+                       .arg(metrics->wordCount())
+                       .arg(metrics->characterCount()));
+}
+
+void MainWindow::scheduleStatusBarUpdate()
+{
+    if (!statusTimer->isActive())
+        statusTimer->start();
 }
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
-    if (saveChanges()) {
+    if (saveAllChanges()) {
+        cancelLoading();
         writeSettings();
         event->accept();
     } else {
@@ -395,8 +1410,50 @@ void MainWindow::closeEvent(QCloseEvent *event)
     }
 }
 
+void MainWindow::paintEvent(QPaintEvent *event)
+{
+    QMainWindow::paintEvent(event);
+
+    // Queued so that it runs once the whole frame is on screen
+    if (!firstPaintSeen) {
+        firstPaintSeen = true;
+        QTimer::singleShot(0, this, &MainWindow::finishStartup);
+    }
+}
+
+void MainWindow::finishStartup()
+{
+    StartupTrace::instant("firstPaint");
+    {
+        StartupTrace::Scope trace("deferredStartup");
+
+        // Unless a recovered session went into it, the first document
+        // gets the sample text
+        if (isBlankDocument()) {
+            StartupTrace::Scope welcomeTrace("welcomeText");
+            textEditor->showWelcomeText();
+        }
+
+        {
+            StartupTrace::Scope preferencesTrace("applyPreferences");
+            applyPreferences();
+        }
+
+        // The saved index is loaded and the tree read in the background
+        const QString root = settings->value("workspace/root").toString();
+        if (!root.isEmpty() && QFileInfo(root).isDir()) {
+            StartupTrace::Scope workspaceTrace("setWorkspace");
+            setWorkspace(root);
+        }
+        updateStatusBar();
+    }
+    StartupTrace::finish();
+}
+
 void MainWindow::readSettings()
 {
+    StartupTrace::Scope trace("readSettings");
+
     QByteArray geometry = settings->value("geometry").toByteArray();
     if (geometry.isEmpty()) {
         resize(1000, 700);
@@ -419,26 +1476,61 @@ void MainWindow::writeSettings()
 
 bool MainWindow::saveChanges()
 {
-    if (textEditor->document()->isModified()) {
+    // A half-loaded file has nothing worth saving
+    if (fileLoader->isRunning())
+        return true;
+
+    // Let a save in progress finish before the document goes away; a
+    // replace has not changed anything yet and is simply dropped
+    if (fileSaver->isRunning())
+        fileSaver->waitForFinished();
+    cancelReplace();
+
+    if (textEditor->isModified()) {
         QMessageBox::StandardButton ret;
         ret = QMessageBox::warning(this, "Qt Learning Application",
                                  "The document has been modified.\n"
                                  "Do you want to save your changes?",
                                  QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
-        if (ret == QMessageBox::Save)
-            return saveFile(), true;
-        else if (ret == QMessageBox::Cancel)
+        if (ret == QMessageBox::Save) {
+            saveFile();
+            fileSaver->waitForFinished();
+            return !textEditor->isModified();
+        } else if (ret == QMessageBox::Cancel)
             return false;
     }
     return true;
 }
 
+bool MainWindow::saveAllChanges()
+{
+    if (!saveChanges())
+        return false;
+
+    for (int i = 0; i < documents->count(); ++i) {
+        if (i != documents->currentIndex() && documents->isModified(i)) {
+            activateDocument(i);
+            if (!saveChanges())
+                return false;
+        }
+    }
+    return true;
+}
+
 void MainWindow::setCurrentFile(const QString &fileName)
 {
     currentFile = fileName;
-    textEditor->document()->setModified(false);
+    textEditor->setModified(false);
     setWindowModified(false);
 
+    // A new journal starts from the file as it is on disk now
+    if (autoSaveTimer->isActive())
+        journal->start(currentFile);
+
+    highlighter->setLanguage(SyntaxLanguage::forFileName(currentFile));
+    documents->setFileName(documents->currentIndex(), currentFile);
+    updateDocumentTab(documents->currentIndex());
+
     QString shownName = currentFile;
     if (currentFile.isEmpty())
         shownName = "untitled.txt";
@@ -11,14 +11,35 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QCloseEvent>
-#include <QSettings>
 #include <QSplitter>
-#include <QListWidget>
+#include <QTreeView>
+#include <QFileSystemModel>
+#include <QSet>
+#include <QTabWidget>
+#include <QTabBar>
+#include <QStackedWidget>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QWidget>
+#include <QProgressBar>
+#include <QToolButton>
+#include <QTimer>
+#include "SessionRecovery.h"
 
 class TextEditor;
+class FileLoader;
+class FileSaver;
+class DocumentMetrics;
+class FindBar;
+class ReplaceAll;
+class SyntaxHighlighter;
+class TrigramIndex;
+class FindInFilesPanel;
+class EditJournal;
+class DocumentManager;
+class LatencyMonitor;
+class LogFollower;
+class SettingsStore;
 class AboutDialog;
 class PreferencesDialog;
 
@@ -30,12 +51,18 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    // Rebuilds the document a crashed session was editing
+    bool recoverSession(SessionRecovery::Session session);
+
 protected:
     void closeEvent(QCloseEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
 
 private slots:
     void newFile();
     void openFile();
+    void closeFile();
+    void openFolder();
     void saveFile();
     void saveAsFile();
     void exit();
@@ -44,14 +71,52 @@ private slots:
     void cut();
     void copy();
     void paste();
+    void pasteStarted();
+    void pasteFinished();
     void selectAll();
     void find();
+    void findNext();
+    void findPrevious();
     void replace();
+    void goToLine();
     void showPreferences();
     void showAbout();
     void showAboutQt();
     void documentModified();
     void updateStatusBar();
+    void scheduleStatusBarUpdate();
+    void lineIndexReady(qint64 lines);
+    void loadRestarted();
+    void loadChunk(const QString &text);
+    void loadFinished();
+    void loadFailed(const QString &errorString);
+    void cancelLoading();
+    void saveFinished();
+    void saveFailed(const QString &errorString);
+    void replaceAll();
+    void replaceFinished(qint64 replacements);
+    void replaceFailed(const QString &errorString);
+    void cancelReplace();
+    void cancelOperation();
+    void showProgress(qint64 done, qint64 total);
+    void openWorkspaceFile(const QModelIndex &index);
+    void workspaceRowsChanged(const QModelIndex &parent, int first, int last);
+    void workspaceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void updateWorkspaceIndex();
+    void openSearchResult(const QString &fileName, int line);
+    void switchDocument(int index);
+    void closeDocument(int index);
+    void setupEditor(TextEditor *editor);
+    void autoSave();
+    void spillFailed(const QString &fileName, const QString &errorString);
+    void bufferLocked(TextEditor *editor);
+    void updateLatencyLabel();
+    void dumpLatencyReport();
+    void finishStartup();
+    void toggleFollow(bool follow);
+    void followAppended(const QString &text);
+    void followRestarted();
+    void followFailed(const QString &errorString);
 
 private:
     void createActions();
@@ -59,16 +124,39 @@ private:
     void createToolBars();
     void createStatusBar();
     void createCentralWidget();
+    void loadFile(const QString &fileName);
+    int addDocument();
+    void activateDocument(int index);
+    void detachEditor();
+    void updateDocumentTab(int index);
+    bool isBlankDocument() const;
+    bool saveAllChanges();
+    void readFile(const QString &fileName);
+    void openLargeFile(const QString &fileName);
+    void startLoading(const QString &fileName);
+    void endLoading();
+    void setDocumentBusy(bool busy);
+    void setWorkspace(const QString &root);
+    bool stopFollowing();
+    void reopenFollowed(const QString &fileName);
+    void applyPreferences();
     void readSettings();
     void writeSettings();
     bool saveChanges();
+    void writeFile(const QString &fileName);
     void setCurrentFile(const QString &fileName);
     QString strippedName(const QString &fullFileName);
 
-    // UI Components
+    // UI Components; textEditor is the current document's editor
     TextEditor *textEditor;
+    QTabBar *documentTabs;
+    QStackedWidget *editorStack;
+    FindBar *findBar;
     QSplitter *splitter;
-    QListWidget *fileListWidget;
+    QTabWidget *sidebar;
+    QTreeView *workspaceView;
+    QFileSystemModel *workspaceModel;
+    FindInFilesPanel *findInFilesPanel;
     
     // Menus
     QMenu *fileMenu;
@@ -83,10 +171,18 @@ private:
     // Status bar
     QLabel *locationLabel;
     QLabel *sizeLabel;
+    QLabel *latencyLabel;
+    QProgressBar *progressBar;
+    QToolButton *cancelButton;
+    QTimer *statusTimer;
+    QTimer *autoSaveTimer;
+    QTimer *latencyTimer;
     
     // Actions
     QAction *newAction;
     QAction *openAction;
+    QAction *openFolderAction;
+    QAction *closeAction;
     QAction *saveAction;
     QAction *saveAsAction;
     QAction *exitAction;
@@ -97,13 +193,36 @@ private:
     QAction *pasteAction;
     QAction *selectAllAction;
     QAction *findAction;
+    QAction *findNextAction;
+    QAction *findPreviousAction;
     QAction *replaceAction;
+    QAction *goToLineAction;
+    QAction *followAction;
+    QAction *cancelAction;
     QAction *preferencesAction;
     QAction *aboutAction;
     QAction *aboutQtAction;
+    QAction *latencyReportAction;
     
+    DocumentManager *documents;
+    FileLoader *fileLoader;
+    FileSaver *fileSaver;
+    ReplaceAll *replacer;
+    DocumentMetrics *metrics;
+    SyntaxHighlighter *highlighter;
+    TrigramIndex *workspaceIndex;
+    EditJournal *journal;
+    LatencyMonitor *latencyMonitor;
+    LogFollower *follower;
     QString currentFile;
-    QSettings *settings;
+    QString workspaceRoot;
+    QSet<QString> changedWorkspaceFiles;
+    QTimer *workspaceIndexTimer;
+    qint64 pendingLine;
+    SettingsStore *settings;
+
+    // What does not show in the first frame waits until it is painted
+    bool firstPaintSeen;
 };
 
 #endif // MAINWINDOW_H
\ No newline at end of file
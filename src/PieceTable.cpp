@@ -0,0 +1,518 @@
+#include "PieceTable.h"
+#include <QDateTime>
+#include <QFileInfo>
+#include <climits>
+
+PieceTable::PieceTable()
+    : original(nullptr)
+    , originalSize(0)
+    , totalSize(0)
+    , cleanIndex(0)
+    , changeCount(0)
+    , spanChanged(false)
+    , spanStart(0)
+    , spanTail(0)
+    , spanBaseSize(0)
+{
+}
+
+PieceTable::PieceTable(const QByteArray &original)
+    : PieceTable()
+{
+    load(original);
+}
+
+void PieceTable::load(const QByteArray &data)
+{
+    load(data.constData(), data.size());
+    originalOwner = data;
+    original = originalOwner.constData();
+}
+
+void PieceTable::load(const char *data, qint64 size)
+{
+    clear();
+    original = data;
+    originalSize = size;
+    if (originalSize > 0)
+        pieces.push_back({Original, 0, originalSize});
+    totalSize = originalSize;
+    resetChangedSpan();
+}
+
+bool PieceTable::mapFile(const QString &fileName)
+{
+    QSharedPointer<QFile> file(new QFile(fileName));
+    if (!file->open(QIODevice::ReadOnly)) {
+        errorText = file->errorString();
+        return false;
+    }
+
+    // Mapping an empty file fails, and there is nothing to map anyway
+    const qint64 fileSize = file->size();
+    if (fileSize == 0) {
+        clear();
+        return true;
+    }
+
+    uchar *data = file->map(0, fileSize);
+    if (!data) {
+        errorText = file->errorString();
+        return false;
+    }
+
+    // The mapping stays valid for as long as the file stays open
+    load(reinterpret_cast<const char *>(data), fileSize);
+    mapping = file;
+    return true;
+}
+
+PieceTable PieceTable::snapshot() const
+{
+    PieceTable copy;
+    copy.mapping = mapping;
+    copy.originalOwner = originalOwner;
+    copy.original = original;
+    copy.originalSize = originalSize;
+    copy.added = added;
+    copy.pieces = pieces;
+    copy.totalSize = totalSize;
+    copy.changeCount = changeCount;
+    return copy;
+}
+
+void PieceTable::save(QDataStream &out) const
+{
+    const bool mapped = !mapping.isNull();
+    out << mapped;
+    if (mapped) {
+        const QFileInfo info(mapping->fileName());
+        out << info.absoluteFilePath() << originalSize << info.lastModified().toMSecsSinceEpoch();
+    } else {
+        out << originalSize;
+        out.writeRawData(original, int(originalSize));
+    }
+
+    out << added;
+    savePieces(out, pieces);
+    saveChanges(out, undoStack);
+    saveChanges(out, redoStack);
+    out << qint32(cleanIndex);
+}
+
+bool PieceTable::restore(QDataStream &in, const PieceTable *pinned)
+{
+    clear();
+    bool mapped;
+    in >> mapped;
+    if (mapped) {
+        QString fileName;
+        qint64 size, modified;
+        in >> fileName >> size >> modified;
+        const QFileInfo info(fileName);
+        if (in.status() == QDataStream::Ok && pinned && pinned->mapping && pinned->originalSize == size
+                && QFileInfo(pinned->mapping->fileName()).absoluteFilePath() == fileName) {
+            mapping = pinned->mapping;
+            original = pinned->original;
+            originalSize = pinned->originalSize;
+        } else if (in.status() == QDataStream::Ok) {
+            if (info.size() != size || info.lastModified().toMSecsSinceEpoch() != modified) {
+                errorText = QString("%1 was changed on disk").arg(fileName);
+                return false;
+            }
+            if (!mapFile(fileName))
+                return false;
+        }
+    } else {
+        qint64 size;
+        in >> size;
+        if (in.status() == QDataStream::Ok && size >= 0 && size <= INT_MAX) {
+            QByteArray data(int(size), Qt::Uninitialized);
+            if (in.readRawData(data.data(), data.size()) == data.size())
+                load(data);
+            else
+                in.setStatus(QDataStream::ReadPastEnd);
+        }
+    }
+
+    in >> added;
+    const bool complete = in.status() == QDataStream::Ok && restorePieces(in, &pieces)
+            && restoreChanges(in, &undoStack) && restoreChanges(in, &redoStack);
+    qint32 clean = 0;
+    in >> clean;
+    if (!complete || in.status() != QDataStream::Ok) {
+        clear();
+        errorText = "The saved document is incomplete";
+        return false;
+    }
+
+    cleanIndex = clean;
+    totalSize = spanLength(pieces);
+    ++changeCount;
+    resetChangedSpan();
+    return true;
+}
+
+PieceTable PieceTable::pinOriginal() const
+{
+    PieceTable pin;
+    if (mapping) {
+        pin.mapping = mapping;
+        pin.original = original;
+        pin.originalSize = originalSize;
+    }
+    return pin;
+}
+
+qint64 PieceTable::memoryUsage() const
+{
+    qint64 changes = 0;
+    for (const QVector<Change> *stack : {&undoStack, &redoStack}) {
+        for (const Change &change : *stack)
+            changes += qint64(sizeof(Change) + (change.removed.size() + change.inserted.size()) * sizeof(Piece));
+    }
+    return originalOwner.capacity() + added.capacity() + qint64(pieces.capacity() * sizeof(Piece)) + changes;
+}
+
+void PieceTable::clear()
+{
+    mapping.reset();
+    originalOwner.clear();
+    original = nullptr;
+    originalSize = 0;
+    added.clear();
+    pieces.clear();
+    totalSize = 0;
+    undoStack.clear();
+    redoStack.clear();
+    cleanIndex = 0;
+    ++changeCount;
+    resetChangedSpan();
+}
+
+QByteArray PieceTable::read(qint64 pos, qint64 length) const
+{
+    pos = qBound<qint64>(0, pos, totalSize);
+    length = qBound<qint64>(0, length, totalSize - pos);
+
+    QByteArray result;
+    result.reserve(int(length));
+    forEachChunk(pos, length, [&result](const char *data, qint64 count) {
+        result.append(data, int(count));
+    });
+    return result;
+}
+
+qint64 PieceTable::indexOf(char ch, qint64 from, qint64 limit) const
+{
+    from = qBound<qint64>(0, from, totalSize);
+    const qint64 length = qMin(limit, totalSize - from);
+
+    qint64 found = -1;
+    qint64 scanned = from;
+    forEachChunk(from, length, [&](const char *data, qint64 count) {
+        if (found >= 0)
+            return;
+        const void *hit = std::memchr(data, ch, size_t(count));
+        if (hit)
+            found = scanned + (static_cast<const char *>(hit) - data);
+        scanned += count;
+    });
+    return found;
+}
+
+qint64 PieceTable::lastIndexOf(char ch, qint64 from, qint64 limit) const
+{
+    from = qBound<qint64>(0, from, totalSize);
+    const qint64 start = qMax<qint64>(0, from - limit);
+
+    // Chunks arrive front to back, so remember the last hit seen
+    qint64 found = -1;
+    qint64 scanned = start;
+    forEachChunk(start, from - start, [&](const char *data, qint64 count) {
+        for (qint64 i = count - 1; i >= 0; --i) {
+            if (data[i] == ch) {
+                found = scanned + i;
+                break;
+            }
+        }
+        scanned += count;
+    });
+    return found;
+}
+
+void PieceTable::insert(qint64 pos, const QByteArray &data)
+{
+    replace(pos, 0, data);
+}
+
+void PieceTable::remove(qint64 pos, qint64 length)
+{
+    replace(pos, length, QByteArray());
+}
+
+void PieceTable::replace(qint64 pos, qint64 length, const QByteArray &data)
+{
+    Q_ASSERT(pos >= 0 && length >= 0 && pos + length <= totalSize);
+    if (length == 0 && data.isEmpty())
+        return;
+
+    // Find the piece containing pos
+    const int count = int(pieces.size());
+    int index = 0;
+    qint64 pieceStart = 0;
+    while (index < count && pieceStart + pieces[index].length <= pos) {
+        pieceStart += pieces[index].length;
+        ++index;
+    }
+
+    Change change;
+    change.index = index;
+    change.position = pieceStart;
+
+    // Keep the part of the first piece that precedes the edit
+    const bool splitFirst = index < count && pos > pieceStart;
+    if (splitFirst) {
+        const Piece &piece = pieces[index];
+        change.inserted.push_back({piece.source, piece.start, pos - pieceStart});
+    }
+
+    if (!data.isEmpty()) {
+        change.inserted.push_back({Added, added.size(), data.size()});
+        added.append(data);
+    }
+
+    // Collect every piece overlapping the removed range
+    const qint64 end = pos + length;
+    int stop = index;
+    qint64 stopStart = pieceStart;
+    while (stop < count && (stopStart < end || (stop == index && splitFirst))) {
+        change.removed.push_back(pieces[stop]);
+        stopStart += pieces[stop].length;
+        ++stop;
+    }
+
+    // Keep the part of the last piece that follows the edit
+    if (stopStart > end) {
+        const Piece &piece = pieces[stop - 1];
+        const qint64 keep = stopStart - end;
+        change.inserted.push_back({piece.source, piece.start + piece.length - keep, keep});
+    }
+
+    apply(change, true);
+    push(change);
+}
+
+void PieceTable::replace(const QVector<Replacement> &replacements)
+{
+    if (replacements.isEmpty())
+        return;
+
+    // The whole piece list is swapped in one change; pieces are rebuilt in
+    // a single pass over the old list
+    Change change;
+    change.index = 0;
+    change.position = 0;
+    change.removed = pieces;
+    std::vector<Piece> &result = change.inserted;
+
+    auto append = [&result](const Piece &piece) {
+        if (piece.length == 0)
+            return;
+        if (!result.empty()) {
+            Piece &last = result.back();
+            if (last.source == piece.source && last.start + last.length == piece.start) {
+                last.length += piece.length;
+                return;
+            }
+        }
+        result.push_back(piece);
+    };
+
+    size_t index = 0;
+    qint64 pieceStart = 0;
+    auto copy = [&](qint64 pos, qint64 end) {
+        while (pos < end) {
+            while (pieceStart + pieces[index].length <= pos) {
+                pieceStart += pieces[index].length;
+                ++index;
+            }
+            const Piece &piece = pieces[index];
+            const qint64 from = pos - pieceStart;
+            const qint64 to = qMin(end, pieceStart + piece.length) - pieceStart;
+            append({piece.source, piece.start + from, to - from});
+            pos = pieceStart + to;
+        }
+    };
+
+    // Repeated replacement text is stored once and shared by its pieces
+    qint64 copied = 0;
+    Piece lastData = {Added, 0, 0};
+    const QByteArray *lastBytes = nullptr;
+    for (const Replacement &replacement : replacements) {
+        Q_ASSERT(replacement.position >= copied && replacement.position + replacement.length <= totalSize);
+        copy(copied, replacement.position);
+        if (!replacement.data.isEmpty()) {
+            if (!lastBytes || *lastBytes != replacement.data) {
+                lastData = {Added, added.size(), replacement.data.size()};
+                added.append(replacement.data);
+                lastBytes = &replacement.data;
+            }
+            append(lastData);
+        }
+        copied = replacement.position + replacement.length;
+    }
+    copy(copied, totalSize);
+
+    apply(change, true);
+    push(change);
+}
+
+PieceTable::Edit PieceTable::nextUndo() const
+{
+    if (undoStack.isEmpty())
+        return {0, 0, 0};
+    const Change &change = undoStack.last();
+    return {change.position, spanLength(change.inserted), spanLength(change.removed)};
+}
+
+PieceTable::Edit PieceTable::nextRedo() const
+{
+    if (redoStack.isEmpty())
+        return {0, 0, 0};
+    const Change &change = redoStack.last();
+    return {change.position, spanLength(change.removed), spanLength(change.inserted)};
+}
+
+bool PieceTable::undo()
+{
+    if (undoStack.isEmpty())
+        return false;
+
+    Change change = undoStack.takeLast();
+    apply(change, false);
+    redoStack.append(change);
+    return true;
+}
+
+bool PieceTable::redo()
+{
+    if (redoStack.isEmpty())
+        return false;
+
+    Change change = redoStack.takeLast();
+    apply(change, true);
+    undoStack.append(change);
+    return true;
+}
+
+void PieceTable::setModified(bool modified)
+{
+    cleanIndex = modified ? -1 : undoStack.size();
+}
+
+PieceTable::Edit PieceTable::changedSpan() const
+{
+    if (!spanChanged)
+        return {0, 0, 0};
+    return {spanStart, spanBaseSize - spanTail - spanStart, totalSize - spanTail - spanStart};
+}
+
+void PieceTable::resetChangedSpan()
+{
+    spanChanged = false;
+    spanStart = 0;
+    spanTail = 0;
+    spanBaseSize = totalSize;
+}
+
+const char *PieceTable::pieceData(const Piece &piece) const
+{
+    if (piece.source == Original)
+        return original + piece.start;
+    return added.constData() + piece.start;
+}
+
+void PieceTable::apply(const Change &change, bool forward)
+{
+    const std::vector<Piece> &before = forward ? change.removed : change.inserted;
+    const std::vector<Piece> &after = forward ? change.inserted : change.removed;
+
+    const qint64 removed = spanLength(before);
+    const qint64 tail = totalSize - change.position - removed;
+    spanStart = spanChanged ? qMin(spanStart, change.position) : change.position;
+    spanTail = spanChanged ? qMin(spanTail, tail) : tail;
+    spanChanged = true;
+
+    auto first = pieces.begin() + change.index;
+    pieces.erase(first, first + before.size());
+    pieces.insert(pieces.begin() + change.index, after.begin(), after.end());
+    totalSize += spanLength(after) - removed;
+    ++changeCount;
+}
+
+void PieceTable::push(const Change &change)
+{
+    // A clean state that only existed in the redo history is unreachable now
+    if (cleanIndex > undoStack.size())
+        cleanIndex = -1;
+    undoStack.append(change);
+    redoStack.clear();
+}
+
+void PieceTable::savePieces(QDataStream &out, const std::vector<Piece> &span)
+{
+    out << quint32(span.size());
+    for (const Piece &piece : span)
+        out << quint8(piece.source) << piece.start << piece.length;
+}
+
+bool PieceTable::restorePieces(QDataStream &in, std::vector<Piece> *span)
+{
+    quint32 count;
+    in >> count;
+    span->clear();
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        quint8 source;
+        Piece piece;
+        in >> source >> piece.start >> piece.length;
+        piece.source = source == Original ? Original : Added;
+        span->push_back(piece);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+void PieceTable::saveChanges(QDataStream &out, const QVector<Change> &changes)
+{
+    out << qint32(changes.size());
+    for (const Change &change : changes) {
+        out << qint32(change.index) << change.position;
+        savePieces(out, change.removed);
+        savePieces(out, change.inserted);
+    }
+}
+
+bool PieceTable::restoreChanges(QDataStream &in, QVector<Change> *changes)
+{
+    qint32 count;
+    in >> count;
+    changes->clear();
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        qint32 index;
+        Change change;
+        in >> index >> change.position;
+        change.index = index;
+        if (!restorePieces(in, &change.removed) || !restorePieces(in, &change.inserted))
+            return false;
+        changes->append(change);
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+qint64 PieceTable::spanLength(const std::vector<Piece> &span)
+{
+    qint64 length = 0;
+    for (const Piece &piece : span)
+        length += piece.length;
+    return length;
+}
\ No newline at end of file
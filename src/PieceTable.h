@@ -0,0 +1,168 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include <cstring>
+#include <vector>
+
+// Byte-oriented piece table. The original buffer is never modified; every
+// insertion is appended to the add buffer and the document is described by
+// a list of pieces pointing into either buffer. Edits and undo/redo only
+// touch the piece list, so their cost depends on the edit, not the file.
+class PieceTable
+{
+public:
+    PieceTable();
+    explicit PieceTable(const QByteArray &original);
+
+    void load(const QByteArray &original);
+    void load(const char *data, qint64 size);
+    bool mapFile(const QString &fileName);
+    QString errorString() const { return errorText; }
+    void clear();
+
+    // Copy of the current content without the undo history, safe to read
+    // from another thread while this table keeps changing
+    PieceTable snapshot() const;
+    quint64 revision() const { return changeCount; }
+
+    // Writes the content and the undo history; a mapped original is stored
+    // as a reference to its file, which must be unchanged when restoring
+    // unless the mapping is still pinned
+    void save(QDataStream &out) const;
+    bool restore(QDataStream &in, const PieceTable *pinned = nullptr);
+
+    // A table with nothing but this one's mapped original (empty if it is
+    // not mapped). While it lives the mapping stays open, and restore()
+    // takes the original from it even if the file was changed on disk.
+    PieceTable pinOriginal() const;
+
+    // Heap bytes held by the table; mapped file pages are not counted
+    qint64 memoryUsage() const;
+
+    qint64 size() const { return totalSize; }
+    bool isEmpty() const { return totalSize == 0; }
+    int pieceCount() const { return int(pieces.size()); }
+
+    QByteArray read(qint64 pos, qint64 length) const;
+    qint64 indexOf(char ch, qint64 from, qint64 limit) const;
+    qint64 lastIndexOf(char ch, qint64 from, qint64 limit) const;
+
+    void insert(qint64 pos, const QByteArray &data);
+    void remove(qint64 pos, qint64 length);
+    void replace(qint64 pos, qint64 length, const QByteArray &data);
+
+    // Applies many non-overlapping replacements, sorted by position and
+    // given in current coordinates, as a single undo step
+    struct Replacement
+    {
+        qint64 position;
+        qint64 length;
+        QByteArray data;
+    };
+    void replace(const QVector<Replacement> &replacements);
+
+    // Byte range an undo or redo step will replace
+    struct Edit
+    {
+        qint64 position;
+        qint64 removed;
+        qint64 inserted;
+    };
+
+    bool canUndo() const { return !undoStack.isEmpty(); }
+    bool canRedo() const { return !redoStack.isEmpty(); }
+    Edit nextUndo() const;
+    Edit nextRedo() const;
+    bool undo();
+    bool redo();
+
+    bool isModified() const { return cleanIndex != undoStack.size(); }
+    void setModified(bool modified);
+
+    // Smallest byte range covering every change (including undo and redo)
+    // since the last resetChangedSpan(); removed is its length back then
+    bool hasChangedSpan() const { return spanChanged; }
+    Edit changedSpan() const;
+    void resetChangedSpan();
+
+    // Calls function(const char *data, qint64 length) for each contiguous
+    // run of bytes in [pos, pos + length) without copying them
+    template <typename Function>
+    void forEachChunk(qint64 pos, qint64 length, Function function) const;
+
+private:
+    enum Source { Original, Added };
+
+    struct Piece
+    {
+        Source source;
+        qint64 start;
+        qint64 length;
+    };
+
+    struct Change
+    {
+        int index;
+        qint64 position;
+        std::vector<Piece> removed;
+        std::vector<Piece> inserted;
+    };
+
+    const char *pieceData(const Piece &piece) const;
+    void apply(const Change &change, bool forward);
+    void push(const Change &change);
+    static qint64 spanLength(const std::vector<Piece> &span);
+    static void savePieces(QDataStream &out, const std::vector<Piece> &span);
+    static bool restorePieces(QDataStream &in, std::vector<Piece> *span);
+    static void saveChanges(QDataStream &out, const QVector<Change> &changes);
+    static bool restoreChanges(QDataStream &in, QVector<Change> *changes);
+
+    // The original bytes may live outside any QByteArray (e.g. a file
+    // mapping), since QByteArray cannot hold more than 2 GB
+    QSharedPointer<QFile> mapping;
+    QByteArray originalOwner;
+    const char *original;
+    qint64 originalSize;
+    QByteArray added;
+    std::vector<Piece> pieces;
+    qint64 totalSize;
+
+    QVector<Change> undoStack;
+    QVector<Change> redoStack;
+    int cleanIndex;
+    quint64 changeCount;
+    QString errorText;
+
+    // The span is kept as its start and its distance from the end, which
+    // edits elsewhere in the table do not move
+    bool spanChanged;
+    qint64 spanStart;
+    qint64 spanTail;
+    qint64 spanBaseSize;
+};
+
+template <typename Function>
+void PieceTable::forEachChunk(qint64 pos, qint64 length, Function function) const
+{
+    qint64 pieceStart = 0;
+    const qint64 end = pos + length;
+    for (const Piece &piece : pieces) {
+        const qint64 pieceEnd = pieceStart + piece.length;
+        if (pieceEnd > pos && pieceStart < end) {
+            const qint64 from = qMax(pos, pieceStart) - pieceStart;
+            const qint64 to = qMin(end, pieceEnd) - pieceStart;
+            function(pieceData(piece) + from, to - from);
+        }
+        if (pieceEnd >= end)
+            break;
+        pieceStart = pieceEnd;
+    }
+}
+
+#endif // PIECETABLE_H
\ No newline at end of file
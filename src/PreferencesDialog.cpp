@@ -2,9 +2,9 @@
 #include <QApplication>
 #include <QMessageBox>
 
-PreferencesDialog::PreferencesDialog(QWidget *parent)
+PreferencesDialog::PreferencesDialog(SettingsStore *settings, QWidget *parent)
     : QDialog(parent)
-    , settings(new QSettings(this))
+    , settings(settings)
     , backgroundColor(Qt::white)
     , textColor(Qt::black)
 {
@@ -38,6 +38,14 @@ void PreferencesDialog::setupUI()
     autoSaveIntervalSpinBox->setValue(5);
     generalLayout->addRow("Auto-save interval:", autoSaveIntervalSpinBox);
     
+    memoryBudgetSpinBox = new QSpinBox;
+    memoryBudgetSpinBox->setRange(64, 65536);
+    memoryBudgetSpinBox->setSingleStep(64);
+    memoryBudgetSpinBox->setSuffix(" MB");
+    memoryBudgetSpinBox->setValue(1024);
+    memoryBudgetSpinBox->setToolTip("Inactive documents beyond this are kept on disk until shown again");
+    generalLayout->addRow("Memory for open documents:", memoryBudgetSpinBox);
+    
     showStatusBarCheckBox = new QCheckBox("Show status bar");
     showStatusBarCheckBox->setChecked(true);
     generalLayout->addRow(showStatusBarCheckBox);
@@ -92,6 +100,9 @@ void PreferencesDialog::setupUI()
     
     lineNumbersCheckBox = new QCheckBox("Show line numbers");
     optionsLayout->addRow(lineNumbersCheckBox);
+
+    showLatencyCheckBox = new QCheckBox("Show typing latency in the status bar");
+    optionsLayout->addRow(showLatencyCheckBox);
     
     tabSizeSpinBox = new QSpinBox;
     tabSizeSpinBox->setRange(2, 8);
@@ -110,6 +121,7 @@ void PreferencesDialog::setupUI()
     applyButton = new QPushButton("Apply");
     resetButton = new QPushButton("Reset");
     
+    connect(okButton, &QPushButton::clicked, this, &PreferencesDialog::saveSettings);
     connect(okButton, &QPushButton::clicked, this, &QDialog::accept);
     connect(cancelButton, &QPushButton::clicked, this, &QDialog::reject);
     connect(applyButton, &QPushButton::clicked, this, &PreferencesDialog::applySettings);
@@ -154,9 +166,8 @@ void PreferencesDialog::selectTextColor()
 
 void PreferencesDialog::applySettings()
 {
+    // Takes effect right away; the dialog stays open to try more
     saveSettings();
-    QMessageBox::information(this, "Preferences", "Settings applied successfully!\n"
-                            "Some changes may require restarting the application.");
 }
 
 void PreferencesDialog::resetSettings()
@@ -169,6 +180,7 @@ void PreferencesDialog::resetSettings()
         authorLineEdit->clear();
         autoSaveCheckBox->setChecked(false);
         autoSaveIntervalSpinBox->setValue(5);
+        memoryBudgetSpinBox->setValue(1024);
         showStatusBarCheckBox->setChecked(true);
         showToolBarCheckBox->setChecked(true);
         
@@ -181,6 +193,7 @@ void PreferencesDialog::resetSettings()
         
         wordWrapCheckBox->setChecked(true);
         lineNumbersCheckBox->setChecked(false);
+        showLatencyCheckBox->setChecked(false);
         tabSizeSpinBox->setValue(4);
         
         QMessageBox::information(this, "Reset Settings", "Settings have been reset to default values.");
@@ -189,20 +202,22 @@ void PreferencesDialog::resetSettings()
 
 void PreferencesDialog::loadSettings()
 {
+    const Preferences &preferences = settings->preferences();
+
     // Load general settings
-    authorLineEdit->setText(settings->value("general/author", "").toString());
-    autoSaveCheckBox->setChecked(settings->value("general/autoSave", false).toBool());
-    autoSaveIntervalSpinBox->setValue(settings->value("general/autoSaveInterval", 5).toInt());
-    showStatusBarCheckBox->setChecked(settings->value("general/showStatusBar", true).toBool());
-    showToolBarCheckBox->setChecked(settings->value("general/showToolBar", true).toBool());
+    authorLineEdit->setText(preferences.author);
+    autoSaveCheckBox->setChecked(preferences.autoSave);
+    autoSaveIntervalSpinBox->setValue(preferences.autoSaveInterval);
+    memoryBudgetSpinBox->setValue(preferences.memoryBudget);
+    showStatusBarCheckBox->setChecked(preferences.showStatusBar);
+    showToolBarCheckBox->setChecked(preferences.showToolBar);
     
     // Load editor settings
-    QString fontFamily = settings->value("editor/fontFamily", "Arial").toString();
-    fontComboBox->setCurrentFont(QFont(fontFamily));
-    fontSizeSpinBox->setValue(settings->value("editor/fontSize", 11).toInt());
+    fontComboBox->setCurrentFont(QFont(preferences.fontFamily));
+    fontSizeSpinBox->setValue(preferences.fontSize);
     
-    backgroundColor = settings->value("editor/backgroundColor", QColor(Qt::white)).value<QColor>();
-    textColor = settings->value("editor/textColor", QColor(Qt::black)).value<QColor>();
+    backgroundColor = preferences.backgroundColor;
+    textColor = preferences.textColor;
     
     backgroundColorButton->setStyleSheet(
         QString("QPushButton { background-color: %1; border: 1px solid gray; padding: 5px; }")
@@ -211,28 +226,34 @@ void PreferencesDialog::loadSettings()
         QString("QPushButton { background-color: %1; border: 1px solid gray; padding: 5px; }")
         .arg(textColor.name()));
     
-    wordWrapCheckBox->setChecked(settings->value("editor/wordWrap", true).toBool());
-    lineNumbersCheckBox->setChecked(settings->value("editor/lineNumbers", false).toBool());
-    tabSizeSpinBox->setValue(settings->value("editor/tabSize", 4).toInt());
+    wordWrapCheckBox->setChecked(preferences.wordWrap);
+    lineNumbersCheckBox->setChecked(preferences.lineNumbers);
+    showLatencyCheckBox->setChecked(preferences.showLatency);
+    tabSizeSpinBox->setValue(preferences.tabSize);
 }
 
 void PreferencesDialog::saveSettings()
 {
+    Preferences preferences;
+
     // Save general settings
-    settings->setValue("general/author", authorLineEdit->text());
-    settings->setValue("general/autoSave", autoSaveCheckBox->isChecked());
-    settings->setValue("general/autoSaveInterval", autoSaveIntervalSpinBox->value());
-    settings->setValue("general/showStatusBar", showStatusBarCheckBox->isChecked());
-    settings->setValue("general/showToolBar", showToolBarCheckBox->isChecked());
+    preferences.author = authorLineEdit->text();
+    preferences.autoSave = autoSaveCheckBox->isChecked();
+    preferences.autoSaveInterval = autoSaveIntervalSpinBox->value();
+    preferences.memoryBudget = memoryBudgetSpinBox->value();
+    preferences.showStatusBar = showStatusBarCheckBox->isChecked();
+    preferences.showToolBar = showToolBarCheckBox->isChecked();
     
     // Save editor settings
-    settings->setValue("editor/fontFamily", fontComboBox->currentFont().family());
-    settings->setValue("editor/fontSize", fontSizeSpinBox->value());
-    settings->setValue("editor/backgroundColor", backgroundColor);
-    settings->setValue("editor/textColor", textColor);
-    settings->setValue("editor/wordWrap", wordWrapCheckBox->isChecked());
-    settings->setValue("editor/lineNumbers", lineNumbersCheckBox->isChecked());
-    settings->setValue("editor/tabSize", tabSizeSpinBox->value());
-    
-    settings->sync();
+    preferences.fontFamily = fontComboBox->currentFont().family();
+    preferences.fontSize = fontSizeSpinBox->value();
+    preferences.backgroundColor = backgroundColor;
+    preferences.textColor = textColor;
+    preferences.wordWrap = wordWrapCheckBox->isChecked();
+    preferences.lineNumbers = lineNumbersCheckBox->isChecked();
+    preferences.showLatency = showLatencyCheckBox->isChecked();
+    preferences.tabSize = tabSizeSpinBox->value();
+    
+    // Everything listening applies it now; the file is written shortly
+    settings->setPreferences(preferences);
 }
\ No newline at end of file
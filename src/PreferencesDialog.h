@@ -16,14 +16,14 @@
 #include <QGroupBox>
 #include <QFontComboBox>
 #include <QColorDialog>
-#include <QSettings>
+#include "SettingsStore.h"
 
 class PreferencesDialog : public QDialog
 {
     Q_OBJECT
 
 public:
-    explicit PreferencesDialog(QWidget *parent = nullptr);
+    explicit PreferencesDialog(SettingsStore *settings, QWidget *parent = nullptr);
 
 private slots:
     void selectBackgroundColor();
@@ -44,6 +44,7 @@ private:
     QLineEdit *authorLineEdit;
     QCheckBox *autoSaveCheckBox;
     QSpinBox *autoSaveIntervalSpinBox;
+    QSpinBox *memoryBudgetSpinBox;
     QCheckBox *showStatusBarCheckBox;
     QCheckBox *showToolBarCheckBox;
     
@@ -55,6 +56,7 @@ private:
     QPushButton *textColorButton;
     QCheckBox *wordWrapCheckBox;
     QCheckBox *lineNumbersCheckBox;
+    QCheckBox *showLatencyCheckBox;
     QSpinBox *tabSizeSpinBox;
     
     // Buttons
@@ -63,7 +65,7 @@ private:
     QPushButton *applyButton;
     QPushButton *resetButton;
     
-    QSettings *settings;
+    SettingsStore *settings;
     QColor backgroundColor;
     QColor textColor;
 };
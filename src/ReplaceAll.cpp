@@ -0,0 +1,426 @@
+#include "ReplaceAll.h"
+#include "TextEditor.h"
+#include <QTextDocument>
+#include <QTextCursor>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QThread>
+#include <QtConcurrent>
+
+// Characters gathered from a QTextDocument into one chunk
+static const int DocumentChunkChars = 256 * 1024;
+
+// Bytes of a piece table per chunk, before extending to a line break
+static const qint64 BufferChunkBytes = 4 * 1024 * 1024;
+
+// How far a chunk may extend to end on a line break
+static const qint64 MaxLineScan = 64 * 1024;
+
+// How far a match may run past the end of its chunk, in bytes of a piece
+// table or characters of a document; longer ones are only found if they
+// fit in one chunk
+static const qint64 MatchOverlap = 64 * 1024;
+
+// Longest a slice of chunk extraction may keep the GUI thread busy
+static const qint64 SliceMs = 8;
+
+static qint64 utf8Length(const QChar *data, qint64 length)
+{
+    qint64 bytes = 0;
+    for (qint64 i = 0; i < length; ++i) {
+        const ushort unit = data[i].unicode();
+        if (unit < 0x80)
+            bytes += 1;
+        else if (unit < 0x800)
+            bytes += 2;
+        else if (QChar::isHighSurrogate(unit))
+            bytes += 4;
+        else if (!QChar::isLowSurrogate(unit))
+            bytes += 3;
+    }
+    return bytes;
+}
+
+// Matches in text that start before limit; the text past limit belongs to
+// the next chunk and is only there for matches running into it
+static QVector<ReplaceAll::Replacement> findInText(const ReplaceAll::Pattern &pattern, const QString &text,
+                                                   qint64 base, qint64 limit, const std::atomic<bool> &cancelled)
+{
+    QVector<ReplaceAll::Replacement> found;
+    if (!pattern.regex) {
+        const int length = pattern.literal.length();
+        qint64 at = pattern.literal.indexIn(text.constData(), text.size());
+        while (at >= 0 && at < limit && !cancelled) {
+            found.append({base + at, length, pattern.replacement});
+            at = pattern.literal.indexIn(text.constData(), text.size(), at + length);
+        }
+        return found;
+    }
+
+    QRegularExpressionMatchIterator matches = pattern.expression.globalMatch(text);
+    while (matches.hasNext() && !cancelled) {
+        const QRegularExpressionMatch match = matches.next();
+        if (match.capturedStart() >= limit)
+            break;
+        found.append({base + match.capturedStart(), match.capturedLength(),
+                      ReplaceAll::expandReplacement(pattern.replacement, match)});
+    }
+    return found;
+}
+
+// A break after end: the next line break not too far on, or else the
+// nearest character boundary
+static qint64 breakAfter(const PieceTable &table, qint64 start, qint64 end)
+{
+    if (end < table.size()) {
+        const qint64 newline = table.indexOf('\n', end, MaxLineScan);
+        if (newline >= 0) {
+            end = newline + 1;
+        } else {
+            while (end > start + 1 && (table.read(end, 1).at(0) & 0xC0) == 0x80)
+                --end;
+        }
+    }
+    return end;
+}
+
+QVector<ReplaceAll::Replacement> ReplaceAll::findInBytes(const Pattern &pattern, const PieceTable &table, qint64 start,
+                                                         qint64 length, const std::atomic<bool> &cancelled)
+{
+    // Matches start in the range but may end a little past it
+    if (!pattern.regex) {
+        QVector<ReplaceAll::Replacement> found;
+        const int size = pattern.literal.byteLength();
+        const QByteArray bytes = table.read(start, qMin(table.size() - start, length + qMax(size - 1, 0)));
+        qint64 at = pattern.literal.indexIn(bytes.constData(), bytes.size());
+        while (at >= 0 && at < length && !cancelled) {
+            found.append({start + at, size, pattern.replacement});
+            at = pattern.literal.indexIn(bytes.constData(), bytes.size(), at + size);
+        }
+        return found;
+    }
+
+    const qint64 end = start + length < table.size()
+            ? breakAfter(table, start + length, qMin(table.size(), start + length + MatchOverlap))
+            : start + length;
+    QByteArray bytes = table.read(start, end - start);
+
+    // Leave the final line break out so "$" does not also match after it
+    if (bytes.endsWith('\n'))
+        bytes.chop(1);
+
+    // Match the decoded text and map hits back to byte offsets. Text that
+    // is not valid UTF-8 is matched as Latin-1 so the offsets stay exact.
+    QString text = QString::fromUtf8(bytes);
+    const bool utf8 = text.toUtf8() == bytes;
+    if (!utf8)
+        text = QString::fromLatin1(bytes);
+    qint64 limit = text.size() + 1;
+    if (end > start + length)
+        limit = utf8 ? text.size() - QString::fromUtf8(bytes.mid(int(length))).size() : length;
+
+    QVector<ReplaceAll::Replacement> found = findInText(pattern, text, 0, limit, cancelled);
+    qint64 position = 0;
+    qint64 offset = 0;
+    for (ReplaceAll::Replacement &replacement : found) {
+        if (utf8) {
+            offset += utf8Length(text.constData() + position, replacement.position - position);
+            position = replacement.position;
+            replacement.length = utf8Length(text.constData() + position, replacement.length);
+            replacement.position = start + offset;
+        } else {
+            replacement.position += start;
+        }
+    }
+    return found;
+}
+
+ReplaceAll::ReplaceAll(QObject *parent)
+    : QObject(parent)
+    , editor(nullptr)
+    , running(false)
+    , generation(0)
+    , nextOffset(0)
+    , chunkCount(0)
+    , pendingChunks(0)
+    , extracted(false)
+    , totalSize(0)
+    , doneSize(0)
+{
+}
+
+ReplaceAll::~ReplaceAll()
+{
+    cancel();
+    tasks.waitForFinished();
+}
+
+void ReplaceAll::start(TextEditor *editor, const QString &text, const QString &replacement,
+                       bool regex, Qt::CaseSensitivity cs)
+{
+    // Tasks of a cancelled run stop at their next match
+    cancel();
+    tasks.waitForFinished();
+    tasks.clearFutures();
+
+    this->editor = editor;
+    pattern = compile(text, replacement, regex, cs);
+
+    ++generation;
+    cancelled.reset(new std::atomic<bool>(false));
+    running = true;
+    chunkCount = 0;
+    pendingChunks = 0;
+    extracted = false;
+    doneSize = 0;
+    results.clear();
+
+    // Buffer mode searches a snapshot of the table on the workers directly
+    if (editor->hasBuffer()) {
+        editor->commitWindow();
+        snapshot.reset(new PieceTable(editor->pieceTable()->snapshot()));
+        nextOffset = 0;
+        nextBlock = QTextBlock();
+        totalSize = snapshot->size();
+    } else {
+        snapshot.reset();
+        nextBlock = editor->document()->begin();
+        totalSize = editor->document()->characterCount();
+    }
+
+    QTimer::singleShot(0, this, &ReplaceAll::feedChunks);
+}
+
+void ReplaceAll::cancel()
+{
+    if (!running)
+        return;
+
+    *cancelled = true;
+    ++generation;
+    running = false;
+    results.clear();
+    snapshot.reset();
+    nextBlock = QTextBlock();
+}
+
+ReplaceAll::Pattern ReplaceAll::compile(const QString &text, const QString &replacement,
+                                       bool regex, Qt::CaseSensitivity cs)
+{
+    Pattern pattern;
+    pattern.regex = regex;
+    pattern.replacement = replacement;
+    if (regex) {
+        QRegularExpression::PatternOptions options = QRegularExpression::MultilineOption;
+        if (cs == Qt::CaseInsensitive)
+            options |= QRegularExpression::CaseInsensitiveOption;
+        pattern.expression = QRegularExpression(text, options);
+        pattern.expression.optimize();
+    } else {
+        pattern.literal = LiteralSearcher(text, cs);
+    }
+    return pattern;
+}
+
+qint64 ReplaceAll::chunkEnd(const PieceTable &table, qint64 start)
+{
+    return breakAfter(table, start, qMin(table.size(), start + BufferChunkBytes));
+}
+
+void ReplaceAll::dropOverlaps(QVector<Replacement> *found, qint64 *matchedTo)
+{
+    // A match running into the next chunk may be followed there by one
+    // that starts inside it
+    int kept = 0;
+    for (const Replacement &replacement : qAsConst(*found)) {
+        if (replacement.position < *matchedTo)
+            continue;
+        (*found)[kept++] = replacement;
+        *matchedTo = replacement.position + replacement.length;
+    }
+    found->resize(kept);
+}
+
+QString ReplaceAll::expandReplacement(const QString &replacement, const QRegularExpressionMatch &match)
+{
+    if (!replacement.contains(QLatin1Char('\\')))
+        return replacement;
+
+    // \0 to \9 insert captures, \n and \t control characters, \\ a backslash
+    QString result;
+    result.reserve(replacement.size());
+    for (int i = 0; i < replacement.size(); ++i) {
+        const QChar ch = replacement.at(i);
+        if (ch == QLatin1Char('\\') && i + 1 < replacement.size()) {
+            const QChar next = replacement.at(++i);
+            if (next.isDigit())
+                result += match.captured(next.digitValue());
+            else if (next == QLatin1Char('n'))
+                result += QLatin1Char('\n');
+            else if (next == QLatin1Char('t'))
+                result += QLatin1Char('\t');
+            else
+                result += next;
+            continue;
+        }
+        result += ch;
+    }
+    return result;
+}
+
+void ReplaceAll::feedChunks()
+{
+    if (!running || extracted)
+        return;
+
+    // Keep every worker busy without holding the whole text in chunks
+    const int maxPending = 2 * QThread::idealThreadCount();
+    QElapsedTimer timer;
+    timer.start();
+    while (pendingChunks < maxPending && !timer.hasExpired(SliceMs)) {
+        if (snapshot) {
+            if (nextOffset >= snapshot->size()) {
+                extracted = true;
+                break;
+            }
+
+            const qint64 end = chunkEnd(*snapshot, nextOffset);
+            submit(chunkCount++, nextOffset, end - nextOffset, QString());
+            nextOffset = end;
+        } else {
+            if (!nextBlock.isValid()) {
+                extracted = true;
+                break;
+            }
+
+            const qint64 start = nextBlock.position();
+            QString text;
+            while (nextBlock.isValid() && text.size() < DocumentChunkChars) {
+                if (nextBlock.position() != start)
+                    text += QLatin1Char('\n');
+                text += nextBlock.text();
+                nextBlock = nextBlock.next();
+            }
+
+            // The blocks after it only hold the ends of matches starting in it
+            const int owned = text.size();
+            for (QTextBlock block = nextBlock; block.isValid() && text.size() - owned < MatchOverlap;
+                 block = block.next())
+                text += QLatin1Char('\n') + block.text().left(int(MatchOverlap) - (text.size() - owned));
+            submit(chunkCount++, start, owned + 1, text);
+        }
+    }
+
+    if (extracted) {
+        if (pendingChunks == 0)
+            finish();
+    } else if (pendingChunks < maxPending) {
+        QTimer::singleShot(0, this, &ReplaceAll::feedChunks);
+    }
+}
+
+void ReplaceAll::submit(int index, qint64 start, qint64 length, const QString &text)
+{
+    ++pendingChunks;
+    results.append(QVector<Replacement>());
+
+    const quint64 job = generation;
+    const Pattern pattern = this->pattern;
+    const QSharedPointer<std::atomic<bool>> cancelled = this->cancelled;
+    const QSharedPointer<const PieceTable> table = snapshot;
+    tasks.addFuture(QtConcurrent::run([=]() {
+        const QVector<Replacement> found = table ? findInBytes(pattern, *table, start, length, *cancelled)
+                                                 : findInText(pattern, text, start, length, *cancelled);
+        if (*cancelled)
+            return;
+        QMetaObject::invokeMethod(this, [=]() {
+            chunkDone(job, index, length, found);
+        }, Qt::QueuedConnection);
+    }));
+}
+
+void ReplaceAll::chunkDone(quint64 job, int index, qint64 length, const QVector<Replacement> &found)
+{
+    if (job != generation || !running)
+        return;
+
+    --pendingChunks;
+    results[index] = found;
+    doneSize += length;
+    emit progress(doneSize, totalSize);
+
+    if (!extracted)
+        feedChunks();
+    else if (pendingChunks == 0)
+        finish();
+}
+
+void ReplaceAll::finish()
+{
+    running = false;
+
+    qint64 count = 0;
+    qint64 matchedTo = 0;
+    for (QVector<Replacement> &chunk : results) {
+        dropOverlaps(&chunk, &matchedTo);
+        count += chunk.size();
+    }
+
+    if (count > 0 && snapshot) {
+        // Nothing may have touched the table while it was searched
+        PieceTable *table = editor->pieceTable();
+        if (table && table->revision() == snapshot->revision()) {
+            QVector<PieceTable::Replacement> patches;
+            patches.reserve(int(count));
+            QString lastText;
+            QByteArray lastBytes;
+            for (const QVector<Replacement> &chunk : results) {
+                for (const Replacement &replacement : chunk) {
+                    if (replacement.text != lastText) {
+                        lastText = replacement.text;
+                        lastBytes = lastText.toUtf8();
+                    }
+                    patches.append({replacement.position, replacement.length, lastBytes});
+                }
+            }
+            table->replace(patches);
+            editor->reloadBuffer();
+        } else {
+            results.clear();
+            snapshot.reset();
+            emit failed("The file changed while it was searched");
+            return;
+        }
+    } else if (count > 0) {
+        // The edit history copies the span of the replacements beforehand
+        int first = editor->document()->characterCount();
+        int last = 0;
+        for (const QVector<Replacement> &chunk : qAsConst(results)) {
+            if (!chunk.isEmpty()) {
+                first = qMin(first, int(chunk.first().position));
+                last = qMax(last, int(chunk.last().position + chunk.last().length));
+            }
+        }
+        editor->editHistory()->prepare(first, last);
+
+        // Back to front, so earlier positions stay valid; one edit block
+        // means one layout pass and one undo step
+        QTextCursor cursor(editor->document());
+        cursor.beginEditBlock();
+        for (int i = results.size() - 1; i >= 0; --i) {
+            const QVector<Replacement> &chunk = results.at(i);
+            for (int j = chunk.size() - 1; j >= 0; --j) {
+                const Replacement &replacement = chunk.at(j);
+                cursor.setPosition(int(replacement.position));
+                cursor.setPosition(int(replacement.position + replacement.length), QTextCursor::KeepAnchor);
+                cursor.insertText(replacement.text);
+            }
+        }
+        cursor.endEditBlock();
+        editor->editHistory()->release();
+    }
+
+    results.clear();
+    snapshot.reset();
+    emit finished(count);
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#ifndef REPLACEALL_H
+#define REPLACEALL_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QRegularExpression>
+#include <QSharedPointer>
+#include <QFutureSynchronizer>
+#include <QTextBlock>
+#include <atomic>
+#include "LiteralSearcher.h"
+#include "PieceTable.h"
+
+class TextEditor;
+
+// Replaces every match of a literal or regular expression pattern. The
+// text is cut into chunks at line breaks and searched on the thread pool;
+// once every chunk is done the edits are applied from last to first as a
+// single undo step. A match may run up to 64K past the end of the chunk
+// it starts in; longer ones are only found within a chunk.
+class ReplaceAll : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Positions are document positions, or byte offsets in buffer mode
+    struct Replacement
+    {
+        qint64 position;
+        qint64 length;
+        QString text;
+    };
+
+    struct Pattern
+    {
+        LiteralSearcher literal;
+        QRegularExpression expression;
+        QString replacement;
+        bool regex;
+    };
+
+    explicit ReplaceAll(QObject *parent = nullptr);
+    ~ReplaceAll();
+
+    // The editor has to stay read-only until finished(), failed() or cancel()
+    void start(TextEditor *editor, const QString &pattern, const QString &replacement,
+               bool regex, Qt::CaseSensitivity cs);
+    void cancel();
+    bool isRunning() const { return running; }
+
+    static QString expandReplacement(const QString &replacement, const QRegularExpressionMatch &match);
+
+    // What start() and batch mode search with
+    static Pattern compile(const QString &pattern, const QString &replacement,
+                           bool regex, Qt::CaseSensitivity cs);
+    // End of the chunk of a table that starts at start: a few megabytes
+    // on, moved to the next line break
+    static qint64 chunkEnd(const PieceTable &table, qint64 start);
+    // Matches starting in [start, start + length) of a table, as byte
+    // offsets; they may end a little past the range
+    static QVector<Replacement> findInBytes(const Pattern &pattern, const PieceTable &table, qint64 start,
+                                            qint64 length, const std::atomic<bool> &cancelled);
+    // Drops the matches of the next chunk that overlap the end of the last
+    // one kept; matchedTo is where that one ended and is moved on
+    static void dropOverlaps(QVector<Replacement> *found, qint64 *matchedTo);
+
+signals:
+    void progress(qint64 done, qint64 total);
+    void finished(qint64 replacements);
+    // Nothing was replaced, e.g. because the piece table changed while
+    // it was searched
+    void failed(const QString &errorString);
+
+private slots:
+    void feedChunks();
+
+private:
+    void submit(int index, qint64 start, qint64 length, const QString &text);
+    void chunkDone(quint64 job, int index, qint64 length, const QVector<Replacement> &found);
+    void finish();
+
+    TextEditor *editor;
+    Pattern pattern;
+    bool running;
+    quint64 generation;
+    QSharedPointer<std::atomic<bool>> cancelled;
+
+    // Where extraction continues: the next block, or the next byte offset
+    // of the piece table snapshot in buffer mode
+    QTextBlock nextBlock;
+    QSharedPointer<const PieceTable> snapshot;
+    qint64 nextOffset;
+
+    int chunkCount;
+    int pendingChunks;
+    bool extracted;
+    qint64 totalSize;
+    qint64 doneSize;
+    QVector<QVector<Replacement>> results;
+    QFutureSynchronizer<void> tasks;
+};
+
+#endif // REPLACEALL_H
\ No newline at end of file
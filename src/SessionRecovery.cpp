@@ -0,0 +1,163 @@
+#include "SessionRecovery.h"
+#include "PieceTable.h"
+#include "TextDecoder.h"
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <algorithm>
+
+// Opens a journal and checks that its base file is still the one the
+// edits were made against. A journal starting with a full snapshot does
+// not need its base at all.
+static bool openJournal(QFile *file, QDataStream *in, SessionRecovery::Session *session,
+                        bool *baseChanged, QString *errorString)
+{
+    if (!file->open(QIODevice::ReadOnly)) {
+        *errorString = file->errorString();
+        return false;
+    }
+    in->setDevice(file);
+    if (!EditJournal::readHeader(*in, &session->header)) {
+        *errorString = QString("The journal is damaged");
+        return false;
+    }
+
+    const EditJournal::Header &header = session->header;
+    if (header.fileName.isEmpty()) {
+        *baseChanged = false;
+    } else {
+        const QFileInfo info(header.fileName);
+        *baseChanged = !info.isFile() || info.size() != header.baseSize
+                || info.lastModified().toMSecsSinceEpoch() != header.baseModified;
+    }
+    session->length = file->pos();
+    return true;
+}
+
+QList<SessionRecovery::Session> SessionRecovery::orphanedSessions()
+{
+    QList<Session> sessions;
+    const QDir dir(EditJournal::journalDirectory());
+    const QFileInfoList journals = dir.entryInfoList(QStringList() << "*.journal", QDir::Files);
+    for (const QFileInfo &info : journals) {
+        // A lock that can be taken belonged to a process that has exited;
+        // the lock's age alone says nothing, so age-based staleness is off
+        QLockFile lock(EditJournal::lockFileName(info.filePath()));
+        lock.setStaleLockTime(0);
+        if (!lock.tryLock(0))
+            continue;
+
+        Session session;
+        session.journalFileName = info.filePath();
+        session.lastModified = info.lastModified();
+        session.length = 0;
+
+        QFile file(info.filePath());
+        file.open(QIODevice::ReadOnly);
+        QDataStream in(&file);
+        if (EditJournal::readHeader(in, &session.header))
+            sessions.append(session);
+        else
+            QFile::remove(info.filePath());
+    }
+
+    std::sort(sessions.begin(), sessions.end(), [](const Session &a, const Session &b) {
+        return a.lastModified > b.lastModified;
+    });
+    return sessions;
+}
+
+void SessionRecovery::remove(const Session &session)
+{
+    QFile::remove(session.journalFileName);
+    QFile::remove(EditJournal::lockFileName(session.journalFileName));
+}
+
+bool SessionRecovery::replay(Session *session, PieceTable *table, QString *errorString)
+{
+    QFile file(session->journalFileName);
+    QDataStream in;
+    bool baseChanged;
+    if (!openJournal(&file, &in, session, &baseChanged, errorString))
+        return false;
+
+    // The file is mapped, so only the edited ranges are ever read
+    if (!session->header.fileName.isEmpty() && !baseChanged
+            && !table->mapFile(session->header.fileName)) {
+        *errorString = table->errorString();
+        return false;
+    }
+
+    qint64 position, removed;
+    QByteArray data;
+    bool first = true;
+    while (EditJournal::readRecord(in, &position, &removed, &data)) {
+        if (removed < 0) {
+            table->load(data);
+        } else if ((first && baseChanged) || position < 0 || position + removed > table->size()) {
+            break;
+        } else {
+            table->replace(position, removed, data);
+        }
+        first = false;
+        session->length = file.pos();
+    }
+    if (first && baseChanged) {
+        *errorString = QString("%1 was changed after the journal was written")
+                .arg(session->header.fileName);
+        return false;
+    }
+    return true;
+}
+
+bool SessionRecovery::replay(Session *session, QTextDocument *document, QString *errorString)
+{
+    QFile journal(session->journalFileName);
+    QDataStream in;
+    bool baseChanged;
+    if (!openJournal(&journal, &in, session, &baseChanged, errorString))
+        return false;
+
+    // Positions refer to the document as the loader built it, so the base
+    // text is decoded and inserted the same way
+    QTextCursor cursor(document);
+    if (!session->header.fileName.isEmpty() && !baseChanged) {
+        QFile file(session->header.fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            *errorString = file.errorString();
+            return false;
+        }
+        QString text;
+        if (!TextDecoder::decode(file.readAll(), &text, errorString))
+            return false;
+        cursor.insertText(text);
+    }
+
+    qint64 position, removed;
+    QByteArray data;
+    bool first = true;
+    while (EditJournal::readRecord(in, &position, &removed, &data)) {
+        const qint64 size = document->characterCount() - 1;
+        if (removed < 0) {
+            cursor.select(QTextCursor::Document);
+        } else if ((first && baseChanged) || position < 0 || position + removed > size) {
+            break;
+        } else {
+            cursor.setPosition(int(position));
+            cursor.setPosition(int(position + removed), QTextCursor::KeepAnchor);
+        }
+        cursor.insertText(QString::fromUtf8(data));
+        first = false;
+        session->length = journal.pos();
+    }
+    if (first && baseChanged) {
+        *errorString = QString("%1 was changed after the journal was written")
+                .arg(session->header.fileName);
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
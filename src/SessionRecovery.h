@@ -0,0 +1,35 @@
+#ifndef SESSIONRECOVERY_H
+#define SESSIONRECOVERY_H
+
+#include <QString>
+#include <QList>
+#include <QDateTime>
+#include "EditJournal.h"
+
+class PieceTable;
+class QTextDocument;
+
+// Finds autosave journals whose writer is gone and rebuilds documents
+// from them: the file on disk is opened as it was when journaling began
+// and the logged edits are applied on top, so the cost follows the edit
+// history, not the document size.
+class SessionRecovery
+{
+public:
+    struct Session
+    {
+        QString journalFileName;
+        EditJournal::Header header;
+        QDateTime lastModified;
+        qint64 length;  // where the last complete record ends
+    };
+
+    // Newest first; journals of running instances are left out
+    static QList<Session> orphanedSessions();
+    static void remove(const Session &session);
+
+    static bool replay(Session *session, PieceTable *table, QString *errorString);
+    static bool replay(Session *session, QTextDocument *document, QString *errorString);
+};
+
+#endif // SESSIONRECOVERY_H
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "SettingsStore.h"
+#include <QSettings>
+#include <QTimer>
+#include <QtConcurrent>
+
+// Writes within this many milliseconds of each other go out in one flush
+static const int FlushDelay = 1000;
+
+bool Preferences::operator==(const Preferences &other) const
+{
+    return author == other.author
+            && autoSave == other.autoSave
+            && autoSaveInterval == other.autoSaveInterval
+            && memoryBudget == other.memoryBudget
+            && showStatusBar == other.showStatusBar
+            && showToolBar == other.showToolBar
+            && fontFamily == other.fontFamily
+            && fontSize == other.fontSize
+            && backgroundColor == other.backgroundColor
+            && textColor == other.textColor
+            && wordWrap == other.wordWrap
+            && lineNumbers == other.lineNumbers
+            && showLatency == other.showLatency
+            && tabSize == other.tabSize;
+}
+
+SettingsStore::SettingsStore(QObject *parent)
+    : QObject(parent)
+    , flushTimer(nullptr)
+{
+    // One thread keeps the flushes in order
+    writer.setMaxThreadCount(1);
+
+    QSettings settings;
+    const QStringList keys = settings.allKeys();
+    for (const QString &key : keys)
+        values.insert(key, settings.value(key));
+    readPreferences();
+
+    flushTimer = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    flushTimer->setInterval(FlushDelay);
+    connect(flushTimer, &QTimer::timeout, this, &SettingsStore::flush);
+}
+
+SettingsStore::~SettingsStore()
+{
+    flush();
+    writer.waitForDone();
+}
+
+QVariant SettingsStore::value(const QString &key, const QVariant &defaultValue) const
+{
+    return values.value(key, defaultValue);
+}
+
+void SettingsStore::setValue(const QString &key, const QVariant &value)
+{
+    auto found = values.find(key);
+    if (found != values.end() && found.value() == value)
+        return;
+    values.insert(key, value);
+    pending.insert(key, value);
+    flushTimer->start();
+}
+
+void SettingsStore::setPreferences(const Preferences &preferences)
+{
+    if (preferences == current)
+        return;
+
+    setValue("general/author", preferences.author);
+    setValue("general/autoSave", preferences.autoSave);
+    setValue("general/autoSaveInterval", preferences.autoSaveInterval);
+    setValue("general/memoryBudget", preferences.memoryBudget);
+    setValue("general/showStatusBar", preferences.showStatusBar);
+    setValue("general/showToolBar", preferences.showToolBar);
+
+    setValue("editor/fontFamily", preferences.fontFamily);
+    setValue("editor/fontSize", preferences.fontSize);
+    setValue("editor/backgroundColor", preferences.backgroundColor);
+    setValue("editor/textColor", preferences.textColor);
+    setValue("editor/wordWrap", preferences.wordWrap);
+    setValue("editor/lineNumbers", preferences.lineNumbers);
+    setValue("editor/showLatency", preferences.showLatency);
+    setValue("editor/tabSize", preferences.tabSize);
+
+    current = preferences;
+    emit preferencesChanged();
+}
+
+void SettingsStore::flush()
+{
+    flushTimer->stop();
+    if (pending.isEmpty())
+        return;
+
+    // QSettings merges the changes into what is on disk, so values written
+    // by another instance meanwhile are kept
+    const QHash<QString, QVariant> changes = pending;
+    pending.clear();
+    QtConcurrent::run(&writer, [changes]() {
+        QSettings settings;
+        for (auto it = changes.constBegin(); it != changes.constEnd(); ++it)
+            settings.setValue(it.key(), it.value());
+        settings.sync();
+    });
+}
+
+void SettingsStore::readPreferences()
+{
+    const Preferences defaults;
+    current.author = value("general/author", defaults.author).toString();
+    current.autoSave = value("general/autoSave", defaults.autoSave).toBool();
+    current.autoSaveInterval = value("general/autoSaveInterval", defaults.autoSaveInterval).toInt();
+    current.memoryBudget = value("general/memoryBudget", defaults.memoryBudget).toInt();
+    current.showStatusBar = value("general/showStatusBar", defaults.showStatusBar).toBool();
+    current.showToolBar = value("general/showToolBar", defaults.showToolBar).toBool();
+
+    current.fontFamily = value("editor/fontFamily", defaults.fontFamily).toString();
+    current.fontSize = value("editor/fontSize", defaults.fontSize).toInt();
+    current.backgroundColor = value("editor/backgroundColor", defaults.backgroundColor).value<QColor>();
+    current.textColor = value("editor/textColor", defaults.textColor).value<QColor>();
+    current.wordWrap = value("editor/wordWrap", defaults.wordWrap).toBool();
+    current.lineNumbers = value("editor/lineNumbers", defaults.lineNumbers).toBool();
+    current.showLatency = value("editor/showLatency", defaults.showLatency).toBool();
+    current.tabSize = value("editor/tabSize", defaults.tabSize).toInt();
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#ifndef SETTINGSSTORE_H
+#define SETTINGSSTORE_H
+
+#include <QObject>
+#include <QColor>
+#include <QHash>
+#include <QString>
+#include <QThreadPool>
+#include <QVariant>
+
+class QTimer;
+
+// What the Preferences dialog edits, with its defaults
+struct Preferences
+{
+    // General
+    QString author;
+    bool autoSave = false;
+    int autoSaveInterval = 5;   // minutes
+    int memoryBudget = 1024;    // megabytes
+    bool showStatusBar = true;
+    bool showToolBar = true;
+
+    // Editor
+    QString fontFamily = QString("Arial");
+    int fontSize = 11;
+    QColor backgroundColor = QColor(Qt::white);
+    QColor textColor = QColor(Qt::black);
+    bool wordWrap = true;
+    bool lineNumbers = false;
+    bool showLatency = false;
+    int tabSize = 4;
+
+    bool operator==(const Preferences &other) const;
+    bool operator!=(const Preferences &other) const { return !(*this == other); }
+};
+
+// The application's settings, read once into memory. Reads never touch
+// the backing file; writes are collected and flushed together on a
+// writer thread a moment after the last one, and on destruction.
+class SettingsStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SettingsStore(QObject *parent = nullptr);
+    ~SettingsStore();
+
+    QVariant value(const QString &key, const QVariant &defaultValue = QVariant()) const;
+    void setValue(const QString &key, const QVariant &value);
+
+    const Preferences &preferences() const { return current; }
+    // Emits preferencesChanged() if anything differs
+    void setPreferences(const Preferences &preferences);
+
+public slots:
+    // Starts writing the pending changes now
+    void flush();
+
+signals:
+    void preferencesChanged();
+
+private:
+    void readPreferences();
+
+    QHash<QString, QVariant> values;
+    QHash<QString, QVariant> pending;
+    Preferences current;
+    QTimer *flushTimer;
+    QThreadPool writer;
+};
+
+#endif // SETTINGSSTORE_H
\ No newline at end of file
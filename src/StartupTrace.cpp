@@ -0,0 +1,134 @@
+#include "StartupTrace.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVector>
+#include <cstring>
+
+// Written to the working directory when --trace-startup names no file
+static const char *DefaultTraceFile = "startup-trace.json";
+
+namespace {
+
+struct Event
+{
+    const char *name;
+    char phase;     // 'X' for a phase, 'i' for a point in time
+    qint64 begin;
+    qint64 duration;
+};
+
+struct Trace
+{
+    bool active = false;
+    QString fileName;
+    QElapsedTimer clock;
+    QVector<Event> events;
+};
+
+}
+
+static Trace &trace()
+{
+    static Trace instance;
+    return instance;
+}
+
+StartupTrace::Scope::Scope(const char *name)
+    : name(name)
+    , begin(StartupTrace::now())
+{
+}
+
+StartupTrace::Scope::~Scope()
+{
+    StartupTrace::complete(name, begin);
+}
+
+void StartupTrace::start(int *argc, char **argv)
+{
+    static const char Option[] = "--trace-startup";
+    const size_t length = sizeof(Option) - 1;
+
+    int kept = 1;
+    for (int i = 1; i < *argc; ++i) {
+        const char *argument = argv[i];
+        if (std::strncmp(argument, Option, length) == 0
+                && (argument[length] == '\0' || argument[length] == '=')) {
+            trace().fileName = argument[length] == '='
+                    ? QString::fromLocal8Bit(argument + length + 1)
+                    : QString(DefaultTraceFile);
+            trace().active = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = nullptr;
+    *argc = kept;
+
+    if (trace().active) {
+        trace().clock.start();
+        trace().events.reserve(64);
+    }
+}
+
+bool StartupTrace::isActive()
+{
+    return trace().active;
+}
+
+qint64 StartupTrace::now()
+{
+    return trace().active ? trace().clock.nsecsElapsed() / 1000 : 0;
+}
+
+void StartupTrace::complete(const char *name, qint64 begin)
+{
+    if (trace().active)
+        trace().events.append({name, 'X', begin, now() - begin});
+}
+
+void StartupTrace::instant(const char *name)
+{
+    if (trace().active)
+        trace().events.append({name, 'i', now(), 0});
+}
+
+bool StartupTrace::finish()
+{
+    Trace &current = trace();
+    if (!current.active)
+        return false;
+    current.active = false;
+
+    // Everything happens on the GUI thread, so one track holds it all
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray events;
+    for (const Event &event : qAsConst(current.events)) {
+        QJsonObject object;
+        object["name"] = QString::fromLatin1(event.name);
+        object["cat"] = QString("startup");
+        object["ph"] = QString(QChar(event.phase));
+        object["ts"] = event.begin;
+        object["pid"] = pid;
+        object["tid"] = 1;
+        if (event.phase == 'X')
+            object["dur"] = event.duration;
+        else
+            object["s"] = QString("p");
+        events.append(object);
+    }
+    current.events.clear();
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = QString("ms");
+
+    QFile file(current.fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write(QJsonDocument(root).toJson(QJsonDocument::Compact)) >= 0;
+}
\ No newline at end of file
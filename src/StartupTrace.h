@@ -0,0 +1,42 @@
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+#include <QString>
+
+// Records the phases of startup as Chrome trace events, for
+// chrome://tracing or Perfetto. Nothing is recorded unless start() was
+// called, so the phases can stay marked in release builds; finish()
+// writes the file once the deferred startup work is done.
+class StartupTrace
+{
+public:
+    // Times the enclosing block as one phase
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name);
+        ~Scope();
+
+    private:
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        const char *name;
+        qint64 begin;
+    };
+
+    // Takes "--trace-startup" or "--trace-startup=FILE" out of the
+    // arguments and starts recording if it was there
+    static void start(int *argc, char **argv);
+    static bool isActive();
+
+    // Microseconds since start()
+    static qint64 now();
+    static void complete(const char *name, qint64 begin);
+    static void instant(const char *name);
+
+    // Writes the events recorded so far and stops recording
+    static bool finish();
+};
+
+#endif // STARTUPTRACE_H
\ No newline at end of file
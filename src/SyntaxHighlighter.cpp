@@ -0,0 +1,285 @@
+#include "SyntaxHighlighter.h"
+#include "FormatRunStore.h"
+#include <QTextDocument>
+#include <QTextLayout>
+#include <QSignalBlocker>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QtConcurrent>
+
+// Blocks an edit relexes before returning; the rest continues in batches
+static const int MaxSyncBlocks = 256;
+
+// Blocks handed to the thread pool at a time
+static const int BatchBlocks = 2048;
+
+// Longest a slice of applying formats may keep the GUI thread busy
+static const qint64 SliceMs = 4;
+
+// Highlighting with no tokens, used to clear the formats of a language
+// that was switched off
+class PlainLanguage : public SyntaxLanguage
+{
+public:
+    QString name() const override { return QString(); }
+
+    int highlightLine(const QString &, int, QVector<Token> *) const override { return 0; }
+};
+
+static QTextCharFormat foreground(const QColor &color, bool bold = false, bool italic = false)
+{
+    QTextCharFormat format;
+    format.setForeground(color);
+    if (bold)
+        format.setFontWeight(QFont::Bold);
+    format.setFontItalic(italic);
+    return format;
+}
+
+SyntaxHighlighter::SyntaxHighlighter(QTextDocument *document)
+    : QObject(document)
+    , document(document)
+    , lang(nullptr)
+    , formatted(false)
+    , dirtyBlock(-1)
+    , convergeTail(0)
+    , generation(0)
+    , scheduled(false)
+    , batchRunning(false)
+    , pendingIndex(0)
+    , pendingJob(0)
+{
+    formats.resize(SyntaxLanguage::KindCount);
+    formats[SyntaxLanguage::Keyword] = foreground(QColor(0, 0, 160), true);
+    formats[SyntaxLanguage::Type] = foreground(QColor(0, 110, 110));
+    formats[SyntaxLanguage::String] = foreground(QColor(160, 0, 0));
+    formats[SyntaxLanguage::Comment] = foreground(QColor(0, 128, 0), false, true);
+    formats[SyntaxLanguage::Number] = foreground(QColor(128, 0, 128));
+    formats[SyntaxLanguage::Preprocessor] = foreground(QColor(128, 80, 0));
+    formats[SyntaxLanguage::Key] = foreground(QColor(0, 0, 160));
+    formats[SyntaxLanguage::Constant] = foreground(QColor(128, 0, 128), true);
+    formats[SyntaxLanguage::Error] = foreground(QColor(200, 0, 0), true);
+    formats[SyntaxLanguage::Warning] = foreground(QColor(200, 120, 0), true);
+    formats[SyntaxLanguage::Info] = foreground(QColor(0, 110, 110));
+    formats[SyntaxLanguage::Timestamp] = foreground(Qt::darkGray);
+
+    connect(document, &QTextDocument::contentsChange, this, &SyntaxHighlighter::contentsChange);
+}
+
+SyntaxHighlighter::~SyntaxHighlighter()
+{
+    // The batch posts its result back to this object
+    batch.waitForFinished();
+}
+
+void SyntaxHighlighter::setLanguage(const SyntaxLanguage *language)
+{
+    if (language == lang)
+        return;
+
+    lang = language;
+    ++generation;
+    pending.clear();
+    if (!lang && !formatted) {
+        dirtyBlock = -1;
+        return;
+    }
+
+    // Everything is relexed; matching old states mean nothing now
+    formatted = lang != nullptr;
+    dirtyBlock = 0;
+    convergeTail = -1;
+    schedule();
+}
+
+void SyntaxHighlighter::contentsChange(int position, int charsRemoved, int charsAdded)
+{
+    Q_UNUSED(charsRemoved);
+    if (!lang)
+        return;
+
+    // The reported range can run past the end when the whole text is replaced
+    ++generation;
+    pending.clear();
+    const int end = qMin(position + charsAdded, document->characterCount() - 1);
+    markDirty(document->findBlock(position).blockNumber(), document->findBlock(end).blockNumber());
+
+    // The edited lines are redone right away so typing never waits on the
+    // rest of the document; a block still waiting for its first pass has no
+    // state to start from, so the pass in progress has to reach it first
+    QTextBlock block = document->findBlockByNumber(dirtyBlock);
+    const QTextBlock previous = block.previous();
+    if (!previous.isValid() || previous.userState() >= 0) {
+        QVector<LexedBlock> lexed;
+        int state = startState(block);
+        for (QTextBlock next = block; next.isValid() && lexed.size() < MaxSyncBlocks; next = next.next()) {
+            LexedBlock line;
+            state = line.state = lang->highlightLine(next.text(), state, &line.tokens);
+            lexed.append(line);
+            if (next.blockNumber() > document->blockCount() - 1 - convergeTail && next.userState() == state)
+                break;
+        }
+        apply(block, lexed, 0, -1);
+    }
+    schedule();
+}
+
+void SyntaxHighlighter::markDirty(int first, int last)
+{
+    const int tail = document->blockCount() - 1 - last;
+    if (dirtyBlock < 0) {
+        dirtyBlock = first;
+        convergeTail = tail;
+    } else {
+        dirtyBlock = qMin(dirtyBlock, first);
+        convergeTail = qMin(convergeTail, tail);
+    }
+}
+
+void SyntaxHighlighter::schedule()
+{
+    if (dirtyBlock < 0 || scheduled || batchRunning)
+        return;
+    scheduled = true;
+    QTimer::singleShot(0, this, &SyntaxHighlighter::submitBatch);
+}
+
+int SyntaxHighlighter::startState(const QTextBlock &block) const
+{
+    const QTextBlock previous = block.previous();
+    return previous.isValid() ? qMax(previous.userState(), 0) : 0;
+}
+
+int SyntaxHighlighter::pendingBlocks() const
+{
+    return dirtyBlock < 0 ? 0 : document->blockCount() - dirtyBlock;
+}
+
+const SyntaxLanguage *SyntaxHighlighter::lexer() const
+{
+    static const PlainLanguage plain;
+    return lang ? lang : &plain;
+}
+
+// Formats lexed[from...] starting at block, which must be dirtyBlock, and
+// advances dirtyBlock past them. Stops early when the states converge or
+// after sliceMs (never, if negative); returns the index it stopped at.
+int SyntaxHighlighter::apply(QTextBlock block, const QVector<LexedBlock> &lexed, int from, qint64 sliceMs)
+{
+    if (!block.isValid() || from >= lexed.size())
+        return from;
+
+    QElapsedTimer timer;
+    timer.start();
+    const int convergeAfter = document->blockCount() - 1 - convergeTail;
+    const int start = block.position();
+    int end = start;
+    int i = from;
+    while (i < lexed.size() && block.isValid()) {
+        const LexedBlock &line = lexed.at(i++);
+        QVector<QTextLayout::FormatRange> ranges;
+        ranges.reserve(line.tokens.size());
+        for (const SyntaxLanguage::Token &token : line.tokens)
+            ranges.append({token.start, token.length, formats.at(token.kind)});
+
+        // Formatting from the editor's format runs stays on top
+        for (const QTextLayout::FormatRange &range : block.layout()->formats()) {
+            if (range.format.hasProperty(FormatRunStore::RunProperty))
+                ranges.append(range);
+        }
+        block.layout()->setFormats(ranges);
+
+        const int oldState = block.userState();
+        block.setUserState(line.state);
+        end = block.position() + block.length();
+
+        const QTextBlock next = block.next();
+        if (!next.isValid() || (dirtyBlock > convergeAfter && oldState == line.state)) {
+            dirtyBlock = -1;
+            break;
+        }
+        ++dirtyBlock;
+        block = next;
+        if (sliceMs >= 0 && timer.elapsed() >= sliceMs)
+            break;
+    }
+
+    // Only the layout needs to know; blocking the document's signals keeps
+    // this from looking like an edit to the undo-less listeners (metrics,
+    // journal, search highlights) while the layout is still told directly
+    {
+        const QSignalBlocker blocker(document);
+        document->markContentsDirty(start, end - start);
+    }
+    return i;
+}
+
+void SyntaxHighlighter::submitBatch()
+{
+    scheduled = false;
+    if (dirtyBlock < 0 || batchRunning)
+        return;
+
+    // Copying the text is cheap next to lexing and formatting it
+    QTextBlock block = document->findBlockByNumber(dirtyBlock);
+    if (!block.isValid()) {
+        dirtyBlock = -1;
+        return;
+    }
+    const int state = startState(block);
+    QStringList lines;
+    for (; block.isValid() && lines.size() < BatchBlocks; block = block.next())
+        lines.append(block.text());
+
+    const SyntaxLanguage *language = lexer();
+    const quint64 job = generation;
+    const int first = dirtyBlock;
+    batchRunning = true;
+    batch = QtConcurrent::run([this, language, lines, state, job, first]() {
+        QVector<LexedBlock> lexed;
+        lexed.reserve(lines.size());
+        int current = state;
+        for (const QString &text : lines) {
+            LexedBlock line;
+            current = line.state = language->highlightLine(text, current, &line.tokens);
+            lexed.append(line);
+        }
+        QMetaObject::invokeMethod(this, [this, job, first, lexed]() {
+            batchDone(job, first, lexed);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void SyntaxHighlighter::batchDone(quint64 job, int first, const QVector<LexedBlock> &lexed)
+{
+    batchRunning = false;
+
+    // An edit or language change since moved dirtyBlock itself
+    if (job != generation || first != dirtyBlock) {
+        schedule();
+        return;
+    }
+
+    pending = lexed;
+    pendingIndex = 0;
+    pendingJob = job;
+    applyBatch();
+}
+
+void SyntaxHighlighter::applyBatch()
+{
+    if (pending.isEmpty() || pendingJob != generation) {
+        pending.clear();
+        schedule();
+        return;
+    }
+
+    pendingIndex = apply(document->findBlockByNumber(dirtyBlock), pending, pendingIndex, SliceMs);
+    if (dirtyBlock >= 0 && pendingIndex < pending.size()) {
+        QTimer::singleShot(0, this, &SyntaxHighlighter::applyBatch);
+        return;
+    }
+
+    pending.clear();
+    schedule();
+}
\ No newline at end of file
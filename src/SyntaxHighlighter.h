@@ -0,0 +1,75 @@
+#ifndef SYNTAXHIGHLIGHTER_H
+#define SYNTAXHIGHLIGHTER_H
+
+#include <QObject>
+#include <QTextBlock>
+#include <QTextCharFormat>
+#include <QFuture>
+#include <QVector>
+#include "SyntaxLanguage.h"
+
+class QTextDocument;
+
+// Highlights a document with a SyntaxLanguage. Each block keeps the lexer
+// state its line ended in as its userState(), so an edit relexes from the
+// changed block only until a block ends in the state it had before. The
+// edited blocks are done at once; longer runs are lexed on the thread pool
+// in batches and their formats applied in short slices on the GUI thread.
+class SyntaxHighlighter : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Becomes a child of the document and lives as long as it does
+    explicit SyntaxHighlighter(QTextDocument *document);
+    ~SyntaxHighlighter();
+
+    // nullptr turns highlighting off and clears the formats already set
+    void setLanguage(const SyntaxLanguage *language);
+    const SyntaxLanguage *language() const { return lang; }
+
+    // Blocks still waiting to be relexed
+    int pendingBlocks() const;
+
+private slots:
+    void contentsChange(int position, int charsRemoved, int charsAdded);
+    void submitBatch();
+    void applyBatch();
+
+private:
+    struct LexedBlock
+    {
+        QVector<SyntaxLanguage::Token> tokens;
+        int state;
+    };
+
+    void markDirty(int first, int last);
+    void schedule();
+    int startState(const QTextBlock &block) const;
+    int apply(QTextBlock block, const QVector<LexedBlock> &lexed, int from, qint64 sliceMs);
+    void batchDone(quint64 job, int first, const QVector<LexedBlock> &lexed);
+    const SyntaxLanguage *lexer() const;
+
+    QTextDocument *document;
+    const SyntaxLanguage *lang;
+    bool formatted;
+    QVector<QTextCharFormat> formats;
+
+    // Blocks from dirtyBlock on may be stale (-1 when none are). Edits
+    // after it do not move it; the end of the edited range is kept as its
+    // distance from the last block for the same reason, and past it a block
+    // ending in its old state means the rest is still right.
+    int dirtyBlock;
+    int convergeTail;
+
+    // Any edit bumps the generation, which drops results lexed before it
+    quint64 generation;
+    bool scheduled;
+    bool batchRunning;
+    QFuture<void> batch;
+    QVector<LexedBlock> pending;
+    int pendingIndex;
+    quint64 pendingJob;
+};
+
+#endif // SYNTAXHIGHLIGHTER_H
\ No newline at end of file
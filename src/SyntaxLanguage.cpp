@@ -0,0 +1,278 @@
+#include "SyntaxLanguage.h"
+#include <QFileInfo>
+#include <QStringList>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+// Sorted, so words can be looked up without building a QString per token
+static const char *const CppKeywords[] = {
+    "alignas", "alignof", "asm", "break", "case", "catch", "class", "co_await", "co_return",
+    "co_yield", "const", "const_cast", "consteval", "constexpr", "constinit", "continue",
+    "decltype", "default", "delete", "do", "dynamic_cast", "else", "enum", "explicit", "export",
+    "extern", "false", "final", "for", "friend", "goto", "if", "inline", "mutable", "namespace",
+    "new", "noexcept", "nullptr", "operator", "override", "private", "protected", "public",
+    "register", "reinterpret_cast", "return", "sizeof", "static", "static_assert", "static_cast",
+    "struct", "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef",
+    "typeid", "typename", "union", "using", "virtual", "volatile", "while"
+};
+
+static const char *const CppTypes[] = {
+    "auto", "bool", "char", "char16_t", "char32_t", "char8_t", "double", "float", "int", "long",
+    "qint16", "qint32", "qint64", "qint8", "qreal", "quint16", "quint32", "quint64", "quint8",
+    "short", "signed", "size_t", "uchar", "uint", "ulong", "unsigned", "ushort", "void", "wchar_t"
+};
+
+static const char *const LogErrors[] = { "CRITICAL", "ERROR", "FATAL", "SEVERE" };
+static const char *const LogWarnings[] = { "WARN", "WARNING" };
+static const char *const LogInfos[] = { "DEBUG", "INFO", "NOTICE", "TRACE" };
+
+template <size_t Size>
+static bool contains(const char *const (&words)[Size], const QChar *text, int length)
+{
+    // Compare as Latin-1; a non-Latin-1 character can never match
+    char word[32];
+    if (length >= int(sizeof(word)))
+        return false;
+    for (int i = 0; i < length; ++i) {
+        if (text[i].unicode() > 0x7F)
+            return false;
+        word[i] = char(text[i].unicode());
+    }
+    word[length] = '\0';
+    return std::binary_search(std::begin(words), std::end(words), word, [](const char *a, const char *b) {
+        return std::strcmp(a, b) < 0;
+    });
+}
+
+static bool isIdentifierStart(QChar ch)
+{
+    return ch.isLetter() || ch == QLatin1Char('_');
+}
+
+static bool isIdentifierPart(QChar ch)
+{
+    return ch.isLetterOrNumber() || ch == QLatin1Char('_');
+}
+
+// Index just past a quoted string starting at start, or the line's end
+static int skipString(const QString &text, int start)
+{
+    const QChar quote = text.at(start);
+    int i = start + 1;
+    while (i < text.size()) {
+        const QChar ch = text.at(i++);
+        if (ch == QLatin1Char('\\'))
+            ++i;
+        else if (ch == quote)
+            break;
+    }
+    return qMin(i, text.size());
+}
+
+static int skipNumber(const QString &text, int start)
+{
+    // Covers hex, exponents, digit separators and suffixes well enough
+    int i = start;
+    while (i < text.size()) {
+        const QChar ch = text.at(i);
+        if (ch.isLetterOrNumber() || ch == QLatin1Char('.') || ch == QLatin1Char('\''))
+            ++i;
+        else if ((ch == QLatin1Char('+') || ch == QLatin1Char('-'))
+                 && (text.at(i - 1) == QLatin1Char('e') || text.at(i - 1) == QLatin1Char('E')))
+            ++i;
+        else
+            break;
+    }
+    return i;
+}
+
+class CppLanguage : public SyntaxLanguage
+{
+public:
+    enum State { Normal = 0, InComment = 1 };
+
+    QString name() const override { return QStringLiteral("C++"); }
+
+    int highlightLine(const QString &text, int state, QVector<Token> *tokens) const override
+    {
+        const int length = text.size();
+        int i = 0;
+        if (state == InComment) {
+            const int end = text.indexOf(QLatin1String("*/"));
+            if (end < 0) {
+                tokens->append({0, length, Comment});
+                return InComment;
+            }
+            tokens->append({0, end + 2, Comment});
+            i = end + 2;
+        }
+
+        while (i < length && text.at(i).isSpace())
+            ++i;
+        if (i < length && text.at(i) == QLatin1Char('#')) {
+            // Directives run to a comment or the end of the line
+            int end = text.indexOf(QLatin1String("//"), i);
+            const int block = text.indexOf(QLatin1String("/*"), i);
+            if (block >= 0 && (end < 0 || block < end))
+                end = block;
+            if (end < 0)
+                end = length;
+            tokens->append({i, end - i, Preprocessor});
+            i = end;
+        }
+
+        while (i < length) {
+            const QChar ch = text.at(i);
+            const QChar next = i + 1 < length ? text.at(i + 1) : QChar();
+            if (ch == QLatin1Char('/') && next == QLatin1Char('/')) {
+                tokens->append({i, length - i, Comment});
+                break;
+            }
+            if (ch == QLatin1Char('/') && next == QLatin1Char('*')) {
+                const int end = text.indexOf(QLatin1String("*/"), i + 2);
+                if (end < 0) {
+                    tokens->append({i, length - i, Comment});
+                    return InComment;
+                }
+                tokens->append({i, end + 2 - i, Comment});
+                i = end + 2;
+            } else if (ch == QLatin1Char('"') || ch == QLatin1Char('\'')) {
+                const int end = skipString(text, i);
+                tokens->append({i, end - i, String});
+                i = end;
+            } else if (ch.isDigit() || (ch == QLatin1Char('.') && next.isDigit())) {
+                const int end = skipNumber(text, i);
+                tokens->append({i, end - i, Number});
+                i = end;
+            } else if (isIdentifierStart(ch)) {
+                int end = i + 1;
+                while (end < length && isIdentifierPart(text.at(end)))
+                    ++end;
+                if (contains(CppKeywords, text.constData() + i, end - i))
+                    tokens->append({i, end - i, Keyword});
+                else if (contains(CppTypes, text.constData() + i, end - i))
+                    tokens->append({i, end - i, Type});
+                i = end;
+            } else {
+                ++i;
+            }
+        }
+        return Normal;
+    }
+};
+
+class JsonLanguage : public SyntaxLanguage
+{
+public:
+    QString name() const override { return QStringLiteral("JSON"); }
+
+    int highlightLine(const QString &text, int state, QVector<Token> *tokens) const override
+    {
+        Q_UNUSED(state);
+        const int length = text.size();
+        int i = 0;
+        while (i < length) {
+            const QChar ch = text.at(i);
+            if (ch == QLatin1Char('"')) {
+                // A string followed by a colon is an object key
+                const int end = skipString(text, i);
+                int after = end;
+                while (after < length && text.at(after).isSpace())
+                    ++after;
+                const bool key = after < length && text.at(after) == QLatin1Char(':');
+                tokens->append({i, end - i, key ? Key : String});
+                i = end;
+            } else if (ch.isDigit() || ch == QLatin1Char('-')) {
+                const int end = skipNumber(text, i + 1);
+                tokens->append({i, end - i, Number});
+                i = end;
+            } else if (ch.isLetter()) {
+                int end = i + 1;
+                while (end < length && text.at(end).isLetter())
+                    ++end;
+                const QStringRef word = text.midRef(i, end - i);
+                if (word == QLatin1String("true") || word == QLatin1String("false")
+                        || word == QLatin1String("null"))
+                    tokens->append({i, end - i, Constant});
+                else
+                    tokens->append({i, end - i, Error});
+                i = end;
+            } else {
+                ++i;
+            }
+        }
+        return 0;
+    }
+};
+
+class LogLanguage : public SyntaxLanguage
+{
+public:
+    QString name() const override { return QStringLiteral("Log"); }
+
+    int highlightLine(const QString &text, int state, QVector<Token> *tokens) const override
+    {
+        Q_UNUSED(state);
+        const int length = text.size();
+
+        // A leading run of digits and date/time punctuation is the timestamp
+        int i = 0;
+        while (i < length && (text.at(i).isDigit() || QStringLiteral("-:.,/T ").contains(text.at(i))
+                              || (text.at(i) == QLatin1Char('Z') && i > 0)))
+            ++i;
+        while (i > 0 && text.at(i - 1) == QLatin1Char(' '))
+            --i;
+        if (i >= 8)
+            tokens->append({0, i, Timestamp});
+
+        // The first level word colours the rest of its token
+        bool levelSeen = false;
+        while (i < length) {
+            const QChar ch = text.at(i);
+            if (ch == QLatin1Char('"')) {
+                const int end = skipString(text, i);
+                tokens->append({i, end - i, String});
+                i = end;
+            } else if (ch.isLetter()) {
+                int end = i + 1;
+                while (end < length && isIdentifierPart(text.at(end)))
+                    ++end;
+                if (!levelSeen && end - i >= 4) {
+                    const QChar *word = text.constData() + i;
+                    if (contains(LogErrors, word, end - i)) {
+                        tokens->append({i, end - i, Error});
+                        levelSeen = true;
+                    } else if (contains(LogWarnings, word, end - i)) {
+                        tokens->append({i, end - i, Warning});
+                        levelSeen = true;
+                    } else if (contains(LogInfos, word, end - i)) {
+                        tokens->append({i, end - i, Info});
+                        levelSeen = true;
+                    }
+                }
+                i = end;
+            } else {
+                ++i;
+            }
+        }
+        return 0;
+    }
+};
+
+const SyntaxLanguage *SyntaxLanguage::forFileName(const QString &fileName)
+{
+    static const CppLanguage cpp;
+    static const JsonLanguage json;
+    static const LogLanguage log;
+
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    static const QStringList cppSuffixes = { "c", "cc", "cpp", "cxx", "h", "hh", "hpp", "hxx", "inl" };
+    if (cppSuffixes.contains(suffix))
+        return &cpp;
+    if (suffix == QLatin1String("json"))
+        return &json;
+    if (suffix == QLatin1String("log"))
+        return &log;
+    return nullptr;
+}
\ No newline at end of file
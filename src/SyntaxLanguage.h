@@ -0,0 +1,50 @@
+#ifndef SYNTAXLANGUAGE_H
+#define SYNTAXLANGUAGE_H
+
+#include <QString>
+#include <QVector>
+
+// Line lexer for one file format. A lexer sees one line at a time and
+// carries what it needs across lines (e.g. an open block comment) in an
+// integer state, so lines can be relexed independently and a pass can
+// stop once a line ends in the same state as before. Lexers keep no
+// mutable data and may be used from any thread.
+class SyntaxLanguage
+{
+public:
+    enum Kind {
+        Keyword,
+        Type,
+        String,
+        Comment,
+        Number,
+        Preprocessor,
+        Key,
+        Constant,
+        Error,
+        Warning,
+        Info,
+        Timestamp,
+        KindCount
+    };
+
+    struct Token
+    {
+        int start;
+        int length;
+        Kind kind;
+    };
+
+    virtual ~SyntaxLanguage() {}
+
+    virtual QString name() const = 0;
+
+    // Appends the tokens of one line, given the state the previous line
+    // ended in (0 for the first line), and returns this line's end state
+    virtual int highlightLine(const QString &text, int state, QVector<Token> *tokens) const = 0;
+
+    // Picked by file suffix; nullptr for plain text
+    static const SyntaxLanguage *forFileName(const QString &fileName);
+};
+
+#endif // SYNTAXLANGUAGE_H
\ No newline at end of file
@@ -0,0 +1,431 @@
+#include "TextDecoder.h"
+#include <QTextCodec>
+#include <QtAlgorithms>
+#include <QVector>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTDECODER_SSE2
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TEXTDECODER_AVX2
+#endif
+
+// Bytes looked at to tell the encoding of a file without a byte order mark
+static const int DetectionSize = 8 * 1024;
+
+// Bytes decoded per step when a whole buffer is decoded at once
+static const qint64 SliceSize = 1024 * 1024;
+
+// Length of the UTF-8 sequence a lead byte starts, 0 if it starts none
+static inline int sequenceLength(uchar lead)
+{
+    if (lead < 0x80)
+        return 1;
+    if (lead >= 0xC2 && lead <= 0xDF)
+        return 2;
+    if (lead >= 0xE0 && lead <= 0xEF)
+        return 3;
+    if (lead >= 0xF0 && lead <= 0xF4)
+        return 4;
+    return 0;
+}
+
+// Whether byte may follow lead at index 1 to 3 of a sequence. The range of
+// the second byte rules out overlong forms, surrogates and code points
+// above U+10FFFF.
+static inline bool isContinuation(uchar lead, int index, uchar byte)
+{
+    uchar lower = 0x80;
+    uchar upper = 0xBF;
+    if (index == 1) {
+        if (lead == 0xE0)
+            lower = 0xA0;
+        else if (lead == 0xED)
+            upper = 0x9F;
+        else if (lead == 0xF0)
+            lower = 0x90;
+        else if (lead == 0xF4)
+            upper = 0x8F;
+    }
+    return byte >= lower && byte <= upper;
+}
+
+// Whether the size bytes at src, fewer than a whole sequence, can begin one
+static bool isSequenceStart(const uchar *src, qint64 size)
+{
+    if (size <= 0 || sequenceLength(src[0]) <= size)
+        return false;
+    for (int k = 1; k < size; ++k) {
+        if (!isContinuation(src[0], k, src[k]))
+            return false;
+    }
+    return true;
+}
+
+#ifdef TEXTDECODER_AVX2
+__attribute__((target("avx2")))
+static qint64 widenAsciiAvx2(const uchar *src, qint64 size, ushort *dst, bool *stopped)
+{
+    qint64 i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 16),
+                            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+        const uint mask = uint(_mm256_movemask_epi8(bytes));
+        if (mask) {
+            *stopped = true;
+            return i + qCountTrailingZeroBits(mask);
+        }
+    }
+    *stopped = false;
+    return i;
+}
+
+static bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+// Copies the ASCII bytes at the start of src to dst and returns how many
+// there were. Whole vectors are stored, so dst needs room for size units.
+static qint64 widenAscii(const uchar *src, qint64 size, ushort *dst)
+{
+    qint64 i = 0;
+#ifdef TEXTDECODER_AVX2
+    if (hasAvx2()) {
+        bool stopped;
+        i = widenAsciiAvx2(src, size, dst, &stopped);
+        if (stopped)
+            return i;
+    }
+#endif
+#ifdef TEXTDECODER_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(bytes, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(bytes, zero));
+        const uint mask = uint(_mm_movemask_epi8(bytes));
+        if (mask)
+            return i + qCountTrailingZeroBits(mask);
+    }
+#else
+    for (; i + 8 <= size; i += 8) {
+        quint64 word;
+        std::memcpy(&word, src + i, sizeof(word));
+        if (word & Q_UINT64_C(0x8080808080808080))
+            break;
+        for (int k = 0; k < 8; ++k)
+            dst[i + k] = src[i + k];
+    }
+#endif
+    while (i < size && src[i] < 0x80) {
+        dst[i] = src[i];
+        ++i;
+    }
+    return i;
+}
+
+// Converts src to UTF-16 in dst until it ends or stops being valid UTF-8.
+// Returns the bytes read and sets *written to the units written; dst needs
+// room for size units, which UTF-8 never exceeds.
+static qint64 utf8ToUtf16(const uchar *src, qint64 size, ushort *dst, qint64 *written)
+{
+    qint64 i = 0;
+    qint64 j = 0;
+    while (i < size) {
+        const uchar lead = src[i];
+        if (lead < 0x80) {
+            const qint64 run = widenAscii(src + i, size - i, dst + j);
+            i += run;
+            j += run;
+            continue;
+        }
+
+        const int length = sequenceLength(lead);
+        if (length == 0 || i + length > size || !isContinuation(lead, 1, src[i + 1]))
+            break;
+        if (length == 2) {
+            dst[j++] = ushort(((lead & 0x1F) << 6) | (src[i + 1] & 0x3F));
+        } else if (!isContinuation(lead, 2, src[i + 2])) {
+            break;
+        } else if (length == 3) {
+            dst[j++] = ushort(((lead & 0x0F) << 12) | ((src[i + 1] & 0x3F) << 6) | (src[i + 2] & 0x3F));
+        } else if (!isContinuation(lead, 3, src[i + 3])) {
+            break;
+        } else {
+            const uint code = (uint(lead & 0x07) << 18) | (uint(src[i + 1] & 0x3F) << 12)
+                    | (uint(src[i + 2] & 0x3F) << 6) | uint(src[i + 3] & 0x3F);
+            dst[j++] = QChar::highSurrogate(code);
+            dst[j++] = QChar::lowSurrogate(code);
+        }
+        i += length;
+    }
+    *written = j;
+    return i;
+}
+
+TextDecoder::TextDecoder(bool legacy)
+    : mode(Undetected)
+    , lenient(false)
+    , byteOrderMark(false)
+    , codec(nullptr)
+    , pendingSize(0)
+    , offset(0)
+    , carriageReturn(false)
+{
+    if (legacy) {
+        mode = Codec;
+        codec = legacyCodec();
+        codecDecoder.reset(codec->makeDecoder());
+    }
+}
+
+TextDecoder::~TextDecoder()
+{
+}
+
+bool TextDecoder::decode(const char *data, qint64 size, QString *out)
+{
+    if (!error.isEmpty())
+        return false;
+    if (mode == Undetected) {
+        detect(data, size);
+        if (mode == Utf8 && byteOrderMark) {
+            data += 3;
+            size -= 3;
+            offset += 3;
+        }
+    }
+
+    const int from = out->size();
+    bool ok;
+    if (mode == Utf8) {
+        ok = decodeUtf8(reinterpret_cast<const uchar *>(data), size, out);
+    } else {
+        out->append(codecDecoder->toUnicode(data, int(size)));
+        offset += size;
+        ok = lenient || !codecDecoder->hasFailure();
+        if (!ok)
+            error = QString("Invalid %1 data").arg(encodingName());
+    }
+    normalizeLineBreaks(out, from);
+    return ok;
+}
+
+bool TextDecoder::finish()
+{
+    if (!error.isEmpty())
+        return false;
+    if (mode == Utf8 && pendingSize > 0 && !lenient)
+        return fail(offset - pendingSize);
+    return true;
+}
+
+QString TextDecoder::encodingName() const
+{
+    if (mode == Codec)
+        return QString::fromLatin1(codec->name());
+    return byteOrderMark ? QString("UTF-8 with BOM") : QString("UTF-8");
+}
+
+QByteArray TextDecoder::codecName() const
+{
+    return mode == Codec ? codec->name() : QByteArray("UTF-8");
+}
+
+bool TextDecoder::decode(const QByteArray &bytes, QString *text, QString *errorString)
+{
+    TextDecoder decoder;
+    if (decoder.decodeAll(bytes, text))
+        return true;
+    if (!decoder.canFallBack()) {
+        *errorString = decoder.errorString();
+        return false;
+    }
+    TextDecoder legacy(true);
+    if (legacy.decodeAll(bytes, text))
+        return true;
+    *errorString = legacy.errorString();
+    return false;
+}
+
+bool TextDecoder::decodeAll(const QByteArray &bytes, QString *text)
+{
+    text->clear();
+    for (qint64 done = 0; done < bytes.size(); done += SliceSize) {
+        if (!decode(bytes.constData() + done, qMin<qint64>(SliceSize, bytes.size() - done), text))
+            return false;
+    }
+    return finish();
+}
+
+QTextCodec *TextDecoder::legacyCodec()
+{
+    QTextCodec *codec = QTextCodec::codecForLocale();
+    if (codec->mibEnum() == 106)
+        codec = QTextCodec::codecForName("Windows-1252");
+    if (!codec)
+        codec = QTextCodec::codecForMib(4);
+    return codec;
+}
+
+void TextDecoder::detect(const char *data, qint64 size)
+{
+    const QByteArray head = QByteArray::fromRawData(data, int(qMin<qint64>(size, DetectionSize)));
+
+    // A byte order mark settles it
+    if (QTextCodec *marked = QTextCodec::codecForUtfText(head, nullptr)) {
+        byteOrderMark = true;
+        if (marked->mibEnum() == 106) {
+            mode = Utf8;
+        } else {
+            mode = Codec;
+            codec = marked;
+        }
+    } else {
+        // Mostly-ASCII UTF-16 has a zero in every other byte
+        qint64 evenZeros = 0;
+        qint64 oddZeros = 0;
+        for (int i = 0; i < head.size(); ++i) {
+            if (head.at(i) != '\0')
+                continue;
+            if (i % 2)
+                ++oddZeros;
+            else
+                ++evenZeros;
+        }
+        const qint64 pairs = head.size() / 2;
+        if (pairs >= 2 && oddZeros > pairs / 2 && evenZeros < oddZeros / 8) {
+            mode = Codec;
+            codec = QTextCodec::codecForName("UTF-16LE");
+        } else if (pairs >= 2 && evenZeros > pairs / 2 && oddZeros < evenZeros / 8) {
+            mode = Codec;
+            codec = QTextCodec::codecForName("UTF-16BE");
+        } else {
+            // Valid UTF-8 up to a sequence the sample cuts off is UTF-8
+            QVector<ushort> scratch(head.size());
+            qint64 written;
+            const uchar *bytes = reinterpret_cast<const uchar *>(head.constData());
+            const qint64 read = utf8ToUtf16(bytes, head.size(), scratch.data(), &written);
+            if (read == head.size() || isSequenceStart(bytes + read, head.size() - read)) {
+                mode = Utf8;
+            } else {
+                mode = Codec;
+                codec = legacyCodec();
+            }
+        }
+    }
+
+    if (mode == Codec)
+        codecDecoder.reset(codec->makeDecoder());
+}
+
+bool TextDecoder::decodeUtf8(const uchar *data, qint64 size, QString *out)
+{
+    // UTF-8 never takes more units than bytes; a sequence finished from
+    // the last chunk may add two units for a single byte
+    const int start = out->size();
+    out->resize(start + int(size) + 2);
+    ushort *dst = reinterpret_cast<ushort *>(out->data()) + start;
+
+    qint64 used = 0;
+    int written = 0;
+    if (pendingSize > 0 && !completePending(data, size, &used, dst, &written)) {
+        out->resize(start);
+        return false;
+    }
+
+    // Each invalid byte a lenient decoder skips takes one unit for itself
+    qint64 read = used;
+    for (;;) {
+        qint64 units;
+        read += utf8ToUtf16(data + read, size - read, dst + written, &units);
+        written += int(units);
+        if (!lenient || read == size || isSequenceStart(data + read, size - read))
+            break;
+        dst[written++] = QChar::ReplacementCharacter;
+        ++read;
+    }
+    out->resize(start + written);
+
+    if (read < size) {
+        if (!isSequenceStart(data + read, size - read))
+            return fail(offset + read);
+        pendingSize = int(size - read);
+        std::memcpy(pending, data + read, size_t(pendingSize));
+    }
+    offset += size;
+    return true;
+}
+
+bool TextDecoder::completePending(const uchar *data, qint64 size, qint64 *used, ushort *dst, int *written)
+{
+    const int length = sequenceLength(pending[0]);
+    const int needed = length - pendingSize;
+    const int available = int(qMin<qint64>(needed, size));
+    for (int k = 0; k < available; ++k) {
+        if (!isContinuation(pending[0], pendingSize + k, data[k])) {
+            if (!lenient)
+                return fail(offset - pendingSize);
+
+            // The cut-off sequence is replaced; data[k] may start another
+            *dst = QChar::ReplacementCharacter;
+            *written = 1;
+            *used = k;
+            pendingSize = 0;
+            return true;
+        }
+        pending[pendingSize + k] = data[k];
+    }
+    *used = available;
+    if (available < needed) {
+        pendingSize += available;
+        return true;
+    }
+
+    qint64 units;
+    utf8ToUtf16(pending, length, dst, &units);
+    *written = int(units);
+    pendingSize = 0;
+    return true;
+}
+
+void TextDecoder::normalizeLineBreaks(QString *out, int from)
+{
+    int i = from;
+    if (!carriageReturn) {
+        i = out->indexOf(QLatin1Char('\r'), from);
+        if (i < 0)
+            return;
+    }
+
+    // "\r\n" and a lone "\r" both become "\n", in place
+    QChar *text = out->data();
+    const int size = out->size();
+    int kept = i;
+    for (; i < size; ++i) {
+        const QChar ch = text[i];
+        if (carriageReturn && ch == QLatin1Char('\n')) {
+            carriageReturn = false;
+            continue;
+        }
+        carriageReturn = ch == QLatin1Char('\r');
+        text[kept++] = carriageReturn ? QChar(QLatin1Char('\n')) : ch;
+    }
+    out->resize(kept);
+}
+
+bool TextDecoder::fail(qint64 at)
+{
+    error = QString("Invalid UTF-8 at byte %1").arg(at);
+    return false;
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef TEXTDECODER_H
+#define TEXTDECODER_H
+
+#include <QString>
+#include <QByteArray>
+#include <QScopedPointer>
+
+class QTextCodec;
+class QTextDecoder;
+
+// Decodes a file to the UTF-16 the editor holds, a chunk at a time. The
+// encoding comes from a byte order mark, or else from the first chunk:
+// UTF-16 shows in its zero bytes, valid UTF-8 is taken as UTF-8, and
+// anything else as the locale's 8-bit codec (Windows-1252 where the
+// locale is UTF-8). UTF-8 is validated and converted in one pass, with
+// ASCII runs widened a vector at a time; invalid UTF-8 stops decoding at
+// its offset instead of turning into replacement characters, unless the
+// decoder was made lenient. A file that only looked like UTF-8 in its
+// first chunk can then be decoded again as the 8-bit codec. Line breaks
+// come out as "\n" whatever the file used.
+class TextDecoder
+{
+public:
+    // A legacy decoder skips detection and takes the locale's 8-bit codec
+    explicit TextDecoder(bool legacy = false);
+    ~TextDecoder();
+
+    // A lenient decoder turns invalid input into replacement characters
+    // and goes on, for text that is only shown, never saved back
+    void setLenient(bool lenient) { this->lenient = lenient; }
+
+    // Appends the text of the next size bytes of the file to out; false
+    // once the input is invalid
+    bool decode(const char *data, qint64 size, QString *out);
+    // The input ended; false if it ended inside a character
+    bool finish();
+
+    QString encodingName() const;
+    QString errorString() const { return error; }
+    // The codec to write the text back with, and whether the input began
+    // with a byte order mark; meaningful once the first chunk is decoded
+    QByteArray codecName() const;
+    bool hasByteOrderMark() const { return byteOrderMark; }
+
+    // UTF-8 was guessed rather than marked, so after a failure the input
+    // is worth decoding again, from its start, with a legacy decoder
+    bool canFallBack() const { return mode == Utf8 && !byteOrderMark; }
+
+    // A whole file at once, falling back to the 8-bit codec like a loader
+    static bool decode(const QByteArray &bytes, QString *text, QString *errorString);
+
+private:
+    enum Mode { Undetected, Utf8, Codec };
+
+    TextDecoder(const TextDecoder &) = delete;
+    TextDecoder &operator=(const TextDecoder &) = delete;
+
+    static QTextCodec *legacyCodec();
+    void detect(const char *data, qint64 size);
+    bool decodeAll(const QByteArray &bytes, QString *text);
+    bool decodeUtf8(const uchar *data, qint64 size, QString *out);
+    bool completePending(const uchar *data, qint64 size, qint64 *used, ushort *dst, int *written);
+    void normalizeLineBreaks(QString *out, int from);
+    bool fail(qint64 offset);
+
+    Mode mode;
+    bool lenient;
+    bool byteOrderMark;
+    QTextCodec *codec;
+    QScopedPointer<QTextDecoder> codecDecoder;
+    // The start of a UTF-8 sequence cut off by the end of the last chunk
+    uchar pending[4];
+    int pendingSize;
+    // Bytes of input consumed before the current chunk
+    qint64 offset;
+    // The last chunk ended in "\r", which a leading "\n" belongs to
+    bool carriageReturn;
+    QString error;
+};
+
+#endif // TEXTDECODER_H
\ No newline at end of file
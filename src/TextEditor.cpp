@@ -1,13 +1,230 @@
 #include "TextEditor.h"
+#include "LineNumberArea.h"
+#include "LatencyMonitor.h"
+#include "SyntaxHighlighter.h"
+#include "SettingsStore.h"
 #include <QContextMenuEvent>
 #include <QMenu>
 #include <QFontDialog>
 #include <QColorDialog>
 #include <QTextCursor>
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QAbstractTextDocumentLayout>
+#include <QScrollBar>
+#include <QKeyEvent>
+#include <QInputMethodEvent>
+#include <QDropEvent>
+#include <QMimeData>
+#include <QResizeEvent>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QSignalBlocker>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QTextCodec>
+#include <QtConcurrent>
+#include <algorithm>
+#include <climits>
+
+// Lines decoded above and below the viewport in buffer mode
+static const int WindowMarginLines = 100;
+
+// How far to look for a line break before cutting a line
+static const qint64 MaxLineScan = 64 * 1024;
+
+// Most bytes decoded into one window, which only long lines come near
+static const qint64 MaxWindowBytes = 2 * 1024 * 1024;
+
+// Lines longer than this, in characters, are laid out in segments
+static const int LongLineLength = 16 * 1024;
+
+// Characters per segment of a long line
+static const int SegmentLength = 4096;
+
+// Space left and right of the line numbers
+static const int GutterPadding = 4;
+
+// Pasted text this long, in characters, is inserted a chunk at a time
+static const int LargePasteThreshold = 4 * 1024 * 1024;
+
+// Characters inserted per call while pasting
+static const int PasteChunkSize = 64 * 1024;
+
+// Longest a slice of pasting may keep the GUI thread busy
+static const qint64 PasteSliceMs = 16;
 
 TextEditor::TextEditor(QWidget *parent)
     : QTextEdit(parent)
+    , history(nullptr)
+    , monitor(nullptr)
+    , windowStart(0)
+    , windowEnd(0)
+    , windowFirstLine(0)
+    , averageLineLength(0)
+    , recenterPending(false)
+    , lineScrollBar(nullptr)
+    , resegmentPending(false)
+    , crlfWindow(false)
+    , lockedBuffer(false)
+    , indexReady(false)
+    , pendingLine(-1)
+    , indexedRevision(0)
+    , indexWatcher(nullptr)
+    , indexCancelled(false)
+    , lineNumberArea(nullptr)
+    , showLineNumbers(false)
+    , lineNumberDigits(1)
+    , digitWidth(0)
+    , highlightCount(0)
+    , pasteOffset(-1)
+    , pasteStart(0)
+    , pasteOpen(false)
+    , pasteHadFocus(false)
+    , pasteTimer(nullptr)
+{
+    // Undo is kept by the editor so that it can bound its memory
+    history = new EditHistory(document());
+
+    // Format runs follow every edit and are drawn for what is on screen;
+    // the history reads the runs of removed text before they are dropped
+    formatRuns.reset(document()->characterCount());
+    history->setFormatRuns(&formatRuns);
+    connect(document(), &QTextDocument::contentsChange, this, &TextEditor::shiftFormatRuns);
+    connect(document(), &QTextDocument::contentsChange, this, &TextEditor::shiftSegmentBreaks);
+    connect(document(), &QTextDocument::contentsChange, this, &TextEditor::shiftReturnBreaks);
+    connect(this, &QTextEdit::cursorPositionChanged, this, [this]() {
+        if (formatRuns.hasFormats())
+            currentCharFormatChanged(currentCharFormat());
+    });
+
+    // Connect to format changes
+    connect(this, &QTextEdit::currentCharFormatChanged,
+            this, &TextEditor::currentCharFormatChanged);
+
+    // In buffer mode the document only holds a window of lines, so a
+    // separate scroll bar covers the whole file
+    lineScrollBar = new QScrollBar(Qt::Vertical, this);
+    lineScrollBar->hide();
+    connect(lineScrollBar, &QScrollBar::valueChanged, this, &TextEditor::scrollToLine);
+
+    // Move the buffer window when scrolling reaches its edges
+    connect(verticalScrollBar(), &QScrollBar::valueChanged,
+            this, &TextEditor::checkWindowBounds);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged,
+            this, &TextEditor::updateLineScrollBar);
+
+    // Find highlights only cover what is on screen
+    connect(verticalScrollBar(), &QScrollBar::valueChanged,
+            this, &TextEditor::updateSearchHighlights);
+    connect(this, &QTextEdit::textChanged, this, &TextEditor::updateSearchHighlights);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged,
+            this, &TextEditor::updateFormatRuns);
+    connect(this, &QTextEdit::textChanged, this, &TextEditor::updateFormatRuns);
+
+    // Set default font
+    QFont font("Arial", 11);
+    setFont(font);
+
+    // The gutter repaints with the viewport; its width follows the line count
+    lineNumberArea = new LineNumberArea(this);
+    lineNumberArea->hide();
+    connect(verticalScrollBar(), &QScrollBar::valueChanged,
+            lineNumberArea, QOverload<>::of(&QWidget::update));
+    connect(this, &QTextEdit::textChanged, lineNumberArea, QOverload<>::of(&QWidget::update));
+    connect(document(), &QTextDocument::blockCountChanged, this, &TextEditor::updateLineNumberWidth);
+    updateDigitWidth();
+
+    pasteTimer = new QTimer(this);
+    pasteTimer->setSingleShot(true);
+    connect(pasteTimer, &QTimer::timeout, this, &TextEditor::pasteChunk);
+}
+
+TextEditor::~TextEditor()
+{
+    cancelLineIndex();
+}
+
+void TextEditor::openBuffer(PieceTable *table, bool locked)
+{
+    cancelLineIndex();
+    buffer.reset(table);
+    lockedBuffer = locked;
+    if (locked)
+        setReadOnly(true);
+    indexReady = false;
+    pendingLine = -1;
+    averageLineLength = 0;
+
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    lineScrollBar->show();
+    updateViewportMargins();
+
+    // Only the first screen is decoded now; lines are indexed in the background
+    loadWindow(0, 0);
+    buffer->setModified(false);
+    startLineIndex();
+}
+
+void TextEditor::closeBuffer()
+{
+    cancelLineIndex();
+    buffer.reset();
+    lineIndex = LineIndex();
+    indexReady = false;
+    pendingLine = -1;
+    windowStart = 0;
+    windowEnd = 0;
+    windowFirstLine = 0;
+    segmentBreaks.clear();
+    crlfBreaks.clear();
+    crBreaks.clear();
+    crlfWindow = false;
+    lockedBuffer = false;
+
+    lineScrollBar->hide();
+    setVerticalScrollBarPolicy(Qt::ScrollBarAsNeeded);
+    updateViewportMargins();
+}
+
+PieceTable *TextEditor::takeBuffer()
+{
+    // The caller owns the table from here on; the editor is left empty
+    commitWindow();
+    PieceTable *table = buffer.take();
+    closeBuffer();
+    clear();
+    return table;
+}
+
+void TextEditor::commitWindow()
 {
+    if (!buffer || lockedBuffer || !document()->isModified())
+        return;
+
+    const QByteArray bytes = windowText(true).toUtf8();
+    const qint64 oldLength = windowEnd - windowStart;
+    const qint64 oldNewlines = LineIndex::countNewlines(*buffer, windowStart, oldLength);
+    buffer->replace(windowStart, oldLength, bytes);
+    windowEnd = windowStart + bytes.size();
+    document()->setModified(false);
+
+    // A build still in progress notices the new revision and starts over
+    if (indexReady)
+        lineIndex.update(*buffer, windowStart, oldLength, oldNewlines, bytes.size());
+}
+
+bool TextEditor::isModified() const
+{
+    if (buffer)
+        return buffer->isModified() || document()->isModified();
+    return document()->isModified();
+}
+
+void TextEditor::showWelcomeText()
+{
+    // Like a window load, the sample text is not an edit to undo
+    history->setEnabled(false);
     setPlainText("Welcome to Qt Learning Application!\n\n"
                  "This is a complete Qt desktop application example that demonstrates:\n\n"
                  "• Main window with menus and toolbars\n"
@@ -21,14 +238,201 @@ TextEditor::TextEditor(QWidget *parent)
                  "• Rich text formatting\n\n"
                  "Try exploring the menus and toolbars to learn Qt features!\n\n"
                  "Right-click in this text area to see the context menu with formatting options.");
+    history->setEnabled(true);
+    setModified(false);
+}
 
-    // Connect to format changes
-    connect(this, &QTextEdit::currentCharFormatChanged,
-            this, &TextEditor::currentCharFormatChanged);
+void TextEditor::setModified(bool modified)
+{
+    document()->setModified(modified);
+    if (!modified)
+        history->setClean();
+    if (buffer)
+        buffer->setModified(modified);
+}
 
-    // Set default font
-    QFont font("Arial", 11);
-    setFont(font);
+qint64 TextEditor::cursorLine() const
+{
+    return lineOfBlock(textCursor().block());
+}
+
+int TextEditor::cursorColumn() const
+{
+    const QTextCursor cursor = textCursor();
+    QTextBlock block = cursor.block();
+    if (!isSegmentBreak(block.position() - 1) && !isSegmentBreak(block.position() + block.length() - 1))
+        return cursor.columnNumber();
+
+    // A segmented line counts from the start of its first segment
+    int column = cursor.positionInBlock();
+    while (isSegmentBreak(block.position() - 1)) {
+        block = block.previous();
+        column += block.length() - 1;
+    }
+    return column;
+}
+
+qint64 TextEditor::lineCount() const
+{
+    if (!buffer)
+        return document()->blockCount();
+    return indexReady ? lineIndex.lineCount() : -1;
+}
+
+void TextEditor::goToLine(qint64 line)
+{
+    if (!buffer) {
+        QTextBlock block = document()->findBlockByNumber(int(line));
+        if (block.isValid())
+            setTextCursor(QTextCursor(block));
+        return;
+    }
+
+    // Jumping needs exact offsets; wait for the index instead of scanning
+    if (!indexReady) {
+        pendingLine = line;
+        return;
+    }
+
+    line = qBound<qint64>(0, line, lineIndex.lineCount() - 1);
+    scrollToLine(int(line));
+    QTextBlock block = blockOfLine(line - windowFirstLine);
+    if (block.isValid())
+        setTextCursor(QTextCursor(block));
+}
+
+bool TextEditor::findText(const LiteralSearcher &searcher, bool backward)
+{
+    if (searcher.isEmpty())
+        return false;
+    if (buffer)
+        return findInBuffer(searcher, backward);
+
+    const QTextCursor cursor = textCursor();
+    QTextBlock block = document()->findBlock(backward ? cursor.selectionStart() : cursor.selectionEnd());
+    qint64 from = (backward ? cursor.selectionStart() - 1 : cursor.selectionEnd()) - block.position();
+
+    // Walk the blocks once around, coming back to the start block last
+    for (int visited = 0; visited <= document()->blockCount(); ++visited) {
+        const QString text = block.text();
+        const qint64 found = backward ? searcher.lastIndexIn(text.constData(), text.size(), from)
+                                      : searcher.indexIn(text.constData(), text.size(), from);
+        if (found >= 0) {
+            QTextCursor match(document());
+            match.setPosition(block.position() + int(found));
+            match.setPosition(block.position() + int(found) + searcher.length(), QTextCursor::KeepAnchor);
+            setTextCursor(match);
+            return true;
+        }
+
+        if (backward) {
+            block = block.previous().isValid() ? block.previous() : document()->lastBlock();
+            from = block.length();
+        } else {
+            block = block.next().isValid() ? block.next() : document()->begin();
+            from = 0;
+        }
+    }
+    return false;
+}
+
+bool TextEditor::findText(const QRegularExpression &expression, bool backward)
+{
+    if (expression.pattern().isEmpty() || !expression.isValid())
+        return false;
+    if (buffer)
+        return findInBuffer(expression, backward);
+
+    QTextDocument::FindFlags flags;
+    if (backward)
+        flags |= QTextDocument::FindBackward;
+    QTextCursor found = document()->find(expression, textCursor(), flags);
+    if (found.isNull()) {
+        QTextCursor start(document());
+        if (backward)
+            start.movePosition(QTextCursor::End);
+        found = document()->find(expression, start, flags);
+    }
+
+    if (found.isNull())
+        return false;
+    setTextCursor(found);
+    return true;
+}
+
+void TextEditor::setSearchHighlight(const LiteralSearcher &searcher)
+{
+    highlightSearcher = searcher;
+    highlightExpression = QRegularExpression();
+    updateSearchHighlights();
+}
+
+void TextEditor::setSearchHighlight(const QRegularExpression &expression)
+{
+    highlightSearcher = LiteralSearcher();
+    highlightExpression = expression.isValid() ? expression : QRegularExpression();
+    updateSearchHighlights();
+}
+
+void TextEditor::reloadBuffer()
+{
+    if (!buffer)
+        return;
+
+    indexReady = false;
+    loadWindow(lineStartAt(qMin(windowStart, buffer->size())), windowFirstLine);
+    startLineIndex();
+}
+
+void TextEditor::undo()
+{
+    // The document must stay put while it is being saved
+    if (isReadOnly())
+        return;
+
+    // Edits inside the window are undone by the edit history, older ones
+    // by the piece table
+    if (buffer && !document()->isModified() && !history->canUndo()) {
+        if (buffer->canUndo())
+            stepBufferHistory(false);
+        return;
+    }
+
+    const int position = history->undo();
+    if (position >= 0) {
+        QTextCursor cursor = textCursor();
+        cursor.setPosition(position);
+        setTextCursor(cursor);
+        updateFormatRuns();
+    }
+}
+
+void TextEditor::redo()
+{
+    if (isReadOnly())
+        return;
+
+    if (buffer && !document()->isModified() && !history->canRedo()) {
+        if (buffer->canRedo())
+            stepBufferHistory(true);
+        return;
+    }
+
+    const int position = history->redo();
+    if (position >= 0) {
+        QTextCursor cursor = textCursor();
+        cursor.setPosition(position);
+        setTextCursor(cursor);
+        updateFormatRuns();
+    }
+}
+
+void TextEditor::cut()
+{
+    const QTextCursor cursor = textCursor();
+    history->prepare(cursor.selectionStart(), cursor.selectionEnd());
+    QTextEdit::cut();
+    history->release();
 }
 
 void TextEditor::setFontBold(bool bold)
@@ -97,6 +501,20 @@ void TextEditor::changeColor()
 void TextEditor::contextMenuEvent(QContextMenuEvent *event)
 {
     QMenu *menu = createStandardContextMenu();
+
+    // The standard undo and redo act on the document's own stack, which
+    // is off; the other actions only touch the selection
+    for (QAction *action : menu->actions()) {
+        if (action->objectName() == QLatin1String("edit-undo")) {
+            action->disconnect();
+            action->setEnabled(!isReadOnly() && (history->canUndo() || (buffer && buffer->canUndo())));
+            connect(action, &QAction::triggered, this, &TextEditor::undo);
+        } else if (action->objectName() == QLatin1String("edit-redo")) {
+            action->disconnect();
+            action->setEnabled(!isReadOnly() && (history->canRedo() || (buffer && buffer->canRedo())));
+            connect(action, &QAction::triggered, this, &TextEditor::redo);
+        }
+    }
     
     menu->addSeparator();
     
@@ -108,7 +526,7 @@ void TextEditor::contextMenuEvent(QContextMenuEvent *event)
     
     menu->addSeparator();
     
-    QTextCharFormat format = currentCharFormat();
+    QTextCharFormat format = cursorFormat();
     
     QAction *boldAction = menu->addAction("Bold");
     boldAction->setCheckable(true);
@@ -125,12 +543,282 @@ void TextEditor::contextMenuEvent(QContextMenuEvent *event)
     underlineAction->setChecked(format.fontUnderline());
     connect(underlineAction, &QAction::toggled, this, &TextEditor::setFontUnderline);
     
+    const QTextCursor cursor = textCursor();
+    history->prepare(cursor.selectionStart(), cursor.selectionEnd());
     menu->exec(event->globalPos());
+    history->release();
     delete menu;
 }
 
-void TextEditor::currentCharFormatChanged(const QTextCharFormat &format)
+void TextEditor::keyPressEvent(QKeyEvent *event)
+{
+    // Timed until the next paint, if the key changed anything to paint
+    const qint64 start = monitor ? monitor->timestamp() : 0;
+    const int revision = document()->revision();
+    const QTextCursor before = textCursor();
+
+    // The document's own shortcuts would go to its disabled undo stack
+    if (event->matches(QKeySequence::Undo)) {
+        undo();
+    } else if (event->matches(QKeySequence::Redo)) {
+        redo();
+    } else {
+        skipSegmentBreak(event);
+
+        // A keystroke edits the selection or the characters next to it
+        history->prepare(before.selectionStart(), before.selectionEnd(), true);
+        QTextEdit::keyPressEvent(event);
+        history->release();
+    }
+
+    if (monitor && (document()->revision() != revision || textCursor() != before))
+        monitor->keyPressed(start, event->key(), event->modifiers(), event->text(), pendingWork());
+}
+
+void TextEditor::skipSegmentBreak(QKeyEvent *event)
+{
+    if (segmentBreaks.isEmpty() || (event->modifiers() & (Qt::ControlModifier | Qt::AltModifier)))
+        return;
+
+    // Both sides of a segment break are the same place in the text, so
+    // moving or deleting across one starts from its far side
+    QTextCursor cursor = textCursor();
+    const int position = cursor.position();
+    const bool extend = event->modifiers() & Qt::ShiftModifier;
+    const bool moving = extend || !cursor.hasSelection();
+    int target = -1;
+    switch (event->key()) {
+    case Qt::Key_Left:
+        if (moving && isSegmentBreak(position - 1))
+            target = position - 1;
+        break;
+    case Qt::Key_Right:
+        if (moving && isSegmentBreak(position))
+            target = position + 1;
+        break;
+    case Qt::Key_Backspace:
+        if (!cursor.hasSelection() && isSegmentBreak(position - 1))
+            target = position - 1;
+        break;
+    case Qt::Key_Delete:
+        if (!cursor.hasSelection() && isSegmentBreak(position))
+            target = position + 1;
+        break;
+    default:
+        break;
+    }
+    if (target < 0)
+        return;
+
+    cursor.setPosition(target, extend ? QTextCursor::KeepAnchor : QTextCursor::MoveAnchor);
+    setTextCursor(cursor);
+}
+
+QMimeData *TextEditor::createMimeDataFromSelection() const
+{
+    // Segment breaks are left out of what is copied or dragged
+    const QTextCursor cursor = textCursor();
+    const int start = cursor.selectionStart();
+    const int end = cursor.selectionEnd();
+    if (breaksBefore(end) == breaksBefore(start))
+        return QTextEdit::createMimeDataFromSelection();
+
+    const int from = start - breaksBefore(start);
+    QMimeData *data = new QMimeData;
+    data->setText(windowText().mid(from, end - breaksBefore(end) - from));
+    return data;
+}
+
+void TextEditor::paintEvent(QPaintEvent *event)
+{
+    QTextEdit::paintEvent(event);
+    if (monitor)
+        monitor->painted();
+}
+
+PendingWork TextEditor::pendingWork() const
+{
+    PendingWork work;
+    if (isPasting()) {
+        work.pasteDone = pasteOffset;
+        work.pasteTotal = pasteText.size();
+    }
+    work.indexing = indexWatcher && indexWatcher->isRunning();
+    if (const SyntaxHighlighter *highlighter = document()->findChild<SyntaxHighlighter *>())
+        work.highlightBlocks = highlighter->pendingBlocks();
+    work.searchHighlights = highlightCount;
+    work.formatRuns = formatRuns.hasFormats() ? formatRuns.runCount() : 0;
+    work.blocks = document()->blockCount();
+    work.characters = document()->characterCount();
+    if (buffer) {
+        work.bufferBytes = buffer->size();
+        work.bufferPieces = buffer->pieceCount();
+    }
+    return work;
+}
+
+void TextEditor::inputMethodEvent(QInputMethodEvent *event)
+{
+    // Committed text replaces the selection and, for some input methods,
+    // characters around the cursor
+    const QTextCursor cursor = textCursor();
+    const int from = cursor.position() + event->replacementStart();
+    history->prepare(qMin(cursor.selectionStart(), from),
+                     qMax(cursor.selectionEnd(), from + event->replacementLength()));
+    QTextEdit::inputMethodEvent(event);
+    history->release();
+}
+
+void TextEditor::dropEvent(QDropEvent *event)
+{
+    // A move removes the dragged selection and inserts at the drop point
+    const QTextCursor cursor = textCursor();
+    const int drop = cursorForPosition(event->pos()).position();
+    history->prepare(qMin(cursor.selectionStart(), drop), qMax(cursor.selectionEnd(), drop));
+    QTextEdit::dropEvent(event);
+    history->release();
+}
+
+void TextEditor::insertFromMimeData(const QMimeData *source)
+{
+    if (isReadOnly() || isPasting())
+        return;
+
+    // Text this large is inserted in chunks, or straight into the piece
+    // table in buffer mode; rich text is taken as plain text, since parsing
+    // it would stall the window as long as inserting it at once
+    if (source->hasText()) {
+        const QString text = source->text();
+        if (text.size() >= LargePasteThreshold) {
+            startPaste(text);
+            return;
+        }
+    }
+
+    // Pastes from a key press or the context menu are already prepared
+    const bool prepared = history->isPrepared();
+    if (!prepared) {
+        const QTextCursor cursor = textCursor();
+        history->prepare(cursor.selectionStart(), cursor.selectionEnd());
+    }
+    QTextEdit::insertFromMimeData(source);
+    if (!prepared)
+        history->release();
+}
+
+void TextEditor::startPaste(const QString &text)
+{
+    // The piece table takes any amount of text as a single piece
+    if (buffer) {
+        commitWindow();
+        const QTextCursor cursor = textCursor();
+        const qint64 start = byteOffsetOf(cursor.selectionStart());
+        const qint64 end = byteOffsetOf(cursor.selectionEnd());
+
+        // Pasted lines end like the lines around them
+        QString pasted = text;
+        if (crlfWindow)
+            pasted.replace(QLatin1String("\r\n"), QLatin1String("\n")).replace(QLatin1Char('\n'), QLatin1String("\r\n"));
+        buffer->replace(start, end - start, pasted.toUtf8());
+        reloadBuffer();
+        return;
+    }
+
+    pasteText = text;
+    pasteOffset = 0;
+    pasteOpen = false;
+
+    // The layout is stale until the edit block closes, so nothing may
+    // paint, click or type into the editor meanwhile
+    pasteHadFocus = hasFocus();
+    viewport()->setUpdatesEnabled(false);
+    setEnabled(false);
+    emit pasteStarted();
+    pasteTimer->start(0);
+}
+
+void TextEditor::pasteChunk()
+{
+    if (!pasteOpen) {
+        pasteCursor = textCursor();
+        history->beginBulk(pasteCursor.selectionStart(), pasteCursor.selectionEnd());
+        pasteCursor.beginEditBlock();
+        pasteReplaced = pasteCursor.selectedText();
+        pasteCursor.removeSelectedText();
+        pasteStart = pasteCursor.position();
+        pasteFormat = pasteCursor.charFormat();
+        pasteOpen = true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while (pasteOffset < pasteText.size() && timer.elapsed() < PasteSliceMs) {
+        int length = qMin(PasteChunkSize, pasteText.size() - pasteOffset);
+
+        // Surrogate pairs and CRLF line breaks stay in one chunk
+        const QChar last = pasteText.at(pasteOffset + length - 1);
+        if (pasteOffset + length < pasteText.size() && (last.isHighSurrogate() || last == QLatin1Char('\r')))
+            ++length;
+        pasteCursor.insertText(pasteText.mid(pasteOffset, length));
+        pasteOffset += length;
+    }
+
+    emit pasteProgress(pasteOffset, pasteText.size());
+    if (pasteOffset < pasteText.size())
+        pasteTimer->start(0);
+    else
+        finishPaste();
+}
+
+void TextEditor::finishPaste()
 {
+    // Closing the block lays out the whole paste at once. The history takes
+    // it from the text in hand rather than reading it back, and a cancelled
+    // paste left nothing to record.
+    if (pasteOpen) {
+        pasteCursor.endEditBlock();
+        if (pasteOffset == pasteText.size())
+            history->endBulk(pasteStart, pasteCursor.position() - pasteStart, pasteText, pasteFormat);
+        else
+            history->cancelBulk();
+        setTextCursor(pasteCursor);
+    }
+
+    pasteText.clear();
+    pasteFormat = QTextCharFormat();
+    pasteReplaced.clear();
+    pasteOffset = -1;
+    pasteOpen = false;
+    pasteCursor = QTextCursor();
+
+    viewport()->setUpdatesEnabled(true);
+    setEnabled(true);
+    if (pasteHadFocus)
+        setFocus();
+    ensureCursorVisible();
+    emit pasteFinished();
+}
+
+void TextEditor::cancelPaste()
+{
+    if (!isPasting())
+        return;
+
+    // Still inside the edit block, so the document never shows the paste
+    // and the history sees no change at all
+    pasteTimer->stop();
+    if (pasteOpen) {
+        pasteCursor.setPosition(pasteStart, QTextCursor::KeepAnchor);
+        pasteCursor.insertText(pasteReplaced);
+        pasteCursor.setPosition(pasteStart);
+        pasteCursor.setPosition(pasteStart + pasteReplaced.size(), QTextCursor::KeepAnchor);
+    }
+    finishPaste();
+}
+
+void TextEditor::currentCharFormatChanged(const QTextCharFormat &)
+{
+    const QTextCharFormat format = cursorFormat();
     emit fontChanged(format.font());
     emit colorChanged(format.foreground().color());
 }
@@ -141,6 +829,923 @@ void TextEditor::mergeFormatOnWordOrSelection(const QTextCharFormat &format)
     if (!cursor.hasSelection())
         cursor.select(QTextCursor::WordUnderCursor);
     
-    cursor.mergeCharFormat(format);
-    mergeCurrentCharFormat(format);
+    // Any selection costs a few tree operations here; the document only
+    // keeps the format that new typing gets
+    const QVector<QTextLayout::FormatRange> before =
+            formatRuns.ranges(cursor.selectionStart(), cursor.selectionEnd());
+    formatRuns.merge(cursor.selectionStart(), cursor.selectionEnd(), format);
+    history->recordRuns(cursor.selectionStart(), cursor.selectionEnd(), before);
+    if (!textCursor().hasSelection()) {
+        history->prepare(cursor.selectionStart(), cursor.selectionEnd());
+        mergeCurrentCharFormat(format);
+        history->release();
+    }
+    updateFormatRuns();
+    currentCharFormatChanged(currentCharFormat());
+}
+
+QTextCharFormat TextEditor::cursorFormat() const
+{
+    // Like the document, report the format of the character before the cursor
+    const QTextCursor cursor = textCursor();
+    const int position = cursor.hasSelection() ? cursor.selectionStart() : qMax(0, cursor.position() - 1);
+    QTextCharFormat format = currentCharFormat();
+    format.merge(formatRuns.formatAt(position));
+    return format;
+}
+
+QVector<QTextLayout::FormatRange> TextEditor::formatRanges() const
+{
+    if (!formatRuns.hasFormats())
+        return QVector<QTextLayout::FormatRange>();
+    return formatRuns.ranges(0, formatRuns.length());
+}
+
+void TextEditor::setFormatRanges(const QVector<QTextLayout::FormatRange> &ranges)
+{
+    formatRuns.reset(document()->characterCount());
+    for (QTextLayout::FormatRange range : ranges) {
+        range.format.clearProperty(FormatRunStore::RunProperty);
+        formatRuns.merge(range.start, range.start + range.length, range.format);
+    }
+    updateFormatRuns();
+}
+
+void TextEditor::updateFormatRuns()
+{
+    if (!formatRuns.hasFormats())
+        return;
+
+    // Blocks scrolled into view pick up the runs set while they were not;
+    // the other formats of a block (syntax highlighting) stay underneath
+    const QTextBlock first = cursorForPosition(QPoint(0, 0)).block();
+    const QTextBlock last = cursorForPosition(QPoint(viewport()->width(), viewport()->height())).block();
+    for (QTextBlock block = first; block.isValid(); block = block.next()) {
+        const QVector<QTextLayout::FormatRange> runs =
+                formatRuns.ranges(block.position(), block.position() + block.length() - 1);
+        QVector<QTextLayout::FormatRange> ranges;
+        QVector<QTextLayout::FormatRange> shown;
+        for (const QTextLayout::FormatRange &range : block.layout()->formats()) {
+            if (range.format.hasProperty(FormatRunStore::RunProperty))
+                shown.append(range);
+            else
+                ranges.append(range);
+        }
+        if (shown != runs) {
+            block.layout()->setFormats(ranges + runs);
+            const QSignalBlocker blocker(document());
+            document()->markContentsDirty(block.position(), block.length());
+        }
+        if (block == last)
+            break;
+    }
+}
+
+void TextEditor::shiftFormatRuns(int position, int charsRemoved, int charsAdded)
+{
+    formatRuns.update(position, charsRemoved, charsAdded);
+
+    // Replacing all of the text may count the final paragraph separator
+    if (formatRuns.length() != document()->characterCount())
+        formatRuns.reset(document()->characterCount());
+}
+
+// Breaks after an edit move with it and breaks inside it are gone, unless
+// the range was only rewritten in place; true if any was lost
+static bool shiftBreaks(QVector<int> *breaks, const QTextDocument *document,
+                        int position, int charsRemoved, int charsAdded)
+{
+    const int end = position + charsRemoved;
+    const int delta = charsAdded - charsRemoved;
+    bool lost = false;
+    int kept = int(std::lower_bound(breaks->begin(), breaks->end(), position) - breaks->begin());
+    for (int i = kept; i < breaks->size(); ++i) {
+        int at = breaks->at(i);
+        if (at >= end) {
+            at += delta;
+        } else if (delta != 0 || document->characterAt(at) != QChar::ParagraphSeparator) {
+            lost = true;
+            continue;
+        }
+        (*breaks)[kept++] = at;
+    }
+    breaks->resize(kept);
+    return lost;
+}
+
+void TextEditor::shiftSegmentBreaks(int position, int charsRemoved, int charsAdded)
+{
+    if (segmentBreaks.isEmpty())
+        return;
+
+    const bool lost = shiftBreaks(&segmentBreaks, document(), position, charsRemoved, charsAdded);
+
+    // The window history would put a lost break back as a line break, so
+    // the edit goes to the piece table, which never saw the break
+    if (lost && buffer && !resegmentPending) {
+        resegmentPending = true;
+        QTimer::singleShot(0, this, &TextEditor::resegmentWindow);
+    }
+}
+
+void TextEditor::shiftReturnBreaks(int position, int charsRemoved, int charsAdded)
+{
+    shiftBreaks(&crlfBreaks, document(), position, charsRemoved, charsAdded);
+    shiftBreaks(&crBreaks, document(), position, charsRemoved, charsAdded);
+    if (!crlfWindow || charsAdded == 0)
+        return;
+
+    // Line breaks typed or pasted into the window take its line ending
+    QTextCursor cursor(document());
+    cursor.setPosition(position);
+    cursor.setPosition(qMin(position + charsAdded, document()->characterCount() - 1), QTextCursor::KeepAnchor);
+    const QString text = cursor.selectedText();
+    for (int i = text.indexOf(QChar::ParagraphSeparator); i >= 0;
+         i = text.indexOf(QChar::ParagraphSeparator, i + 1)) {
+        const int at = position + i;
+        if (isSegmentBreak(at) || std::binary_search(crBreaks.begin(), crBreaks.end(), at))
+            continue;
+        const auto it = std::lower_bound(crlfBreaks.begin(), crlfBreaks.end(), at);
+        if (it == crlfBreaks.end() || *it != at)
+            crlfBreaks.insert(it, at);
+    }
+}
+
+void TextEditor::resegmentWindow()
+{
+    resegmentPending = false;
+    if (!buffer)
+        return;
+
+    // A paste in progress still holds an open edit block on the window
+    if (isPasting()) {
+        resegmentPending = true;
+        QTimer::singleShot(PasteSliceMs, this, &TextEditor::resegmentWindow);
+        return;
+    }
+
+    const qint64 offset = byteOffsetOf(textCursor().position());
+    commitWindow();
+    loadWindow(windowStart, windowFirstLine);
+
+    QTextCursor cursor(document());
+    cursor.setPosition(positionOf(qMin(offset, windowEnd)));
+    setTextCursor(cursor);
+}
+
+void TextEditor::resizeEvent(QResizeEvent *event)
+{
+    QTextEdit::resizeEvent(event);
+    updateSearchHighlights();
+    updateFormatRuns();
+
+    const QRect rect = contentsRect();
+    const int width = lineScrollBar->sizeHint().width();
+    lineScrollBar->setGeometry(rect.right() - width + 1, rect.top(), width, rect.height());
+    lineNumberArea->setGeometry(rect.left(), rect.top(), lineNumberAreaWidth(), rect.height());
+    lineNumberArea->update();
+}
+
+void TextEditor::changeEvent(QEvent *event)
+{
+    QTextEdit::changeEvent(event);
+    if (event->type() == QEvent::FontChange)
+        updateDigitWidth();
+}
+
+void TextEditor::setLineNumbersVisible(bool visible)
+{
+    showLineNumbers = visible;
+    lineNumberArea->setVisible(visible);
+    updateLineNumberWidth();
+    updateViewportMargins();
+}
+
+void TextEditor::setPreferences(const Preferences &preferences)
+{
+    if (showLineNumbers != preferences.lineNumbers)
+        setLineNumbersVisible(preferences.lineNumbers);
+
+    const QFont editorFont(preferences.fontFamily, preferences.fontSize);
+    if (font() != editorFont)
+        setFont(editorFont);
+
+    QPalette colors = palette();
+    if (colors.color(QPalette::Base) != preferences.backgroundColor
+            || colors.color(QPalette::Text) != preferences.textColor) {
+        colors.setColor(QPalette::Base, preferences.backgroundColor);
+        colors.setColor(QPalette::Text, preferences.textColor);
+        setPalette(colors);
+    }
+
+    const LineWrapMode wrapMode = preferences.wordWrap ? WidgetWidth : NoWrap;
+    if (lineWrapMode() != wrapMode)
+        setLineWrapMode(wrapMode);
+
+    const qreal tabStop = preferences.tabSize * QFontMetricsF(font()).horizontalAdvance(QLatin1Char(' '));
+    if (!qFuzzyCompare(tabStopDistance(), tabStop))
+        setTabStopDistance(tabStop);
+}
+
+int TextEditor::lineNumberAreaWidth() const
+{
+    if (!showLineNumbers)
+        return 0;
+    return 2 * GutterPadding + lineNumberDigits * digitWidth;
+}
+
+void TextEditor::updateLineNumberWidth()
+{
+    // Until the index is done the window's end is the best known line count
+    qint64 lines = document()->blockCount() - segmentBreaks.size();
+    if (buffer)
+        lines = qMax(windowFirstLine + lines, indexReady ? lineIndex.lineCount() : 0);
+
+    int digits = 1;
+    for (qint64 n = lines; n >= 10; n /= 10)
+        ++digits;
+    if (digits != lineNumberDigits) {
+        lineNumberDigits = digits;
+        updateViewportMargins();
+    }
+}
+
+void TextEditor::updateDigitWidth()
+{
+    // Digits are usually equally wide, but take the widest to be safe
+    const QFontMetrics metrics = fontMetrics();
+    digitWidth = 0;
+    for (char digit = '0'; digit <= '9'; ++digit)
+        digitWidth = qMax(digitWidth, metrics.horizontalAdvance(QLatin1Char(digit)));
+    if (lineNumberArea)
+        updateViewportMargins();
+}
+
+QTextBlock TextEditor::firstVisibleBlock() const
+{
+    // Blocks are laid out top to bottom, so a binary search over their
+    // positions avoids hit testing; blocks not laid out yet have no height
+    const qreal top = verticalScrollBar()->value();
+    QAbstractTextDocumentLayout *layout = document()->documentLayout();
+    int low = 0;
+    int high = document()->blockCount() - 1;
+    while (low < high) {
+        const int middle = (low + high + 1) / 2;
+        const QRectF rect = layout->blockBoundingRect(document()->findBlockByNumber(middle));
+        if (rect.height() > 0 && rect.top() <= top)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return document()->findBlockByNumber(low);
+}
+
+void TextEditor::paintLineNumbers(QPaintEvent *event)
+{
+    QPainter painter(lineNumberArea);
+    painter.fillRect(event->rect(), palette().color(QPalette::Window));
+    painter.setPen(palette().color(QPalette::Dark));
+    painter.setFont(font());
+
+    const int offset = verticalScrollBar()->value();
+    const int width = lineNumberArea->width() - GutterPadding;
+    QAbstractTextDocumentLayout *layout = document()->documentLayout();
+    // A continuation segment at the top already belongs to its line
+    QTextBlock block = firstVisibleBlock();
+    qint64 line = lineOfBlock(block) - (isSegmentBreak(block.position() - 1) ? 0 : 1);
+    for (; block.isValid(); block = block.next()) {
+        // Only the first segment of a long line is numbered
+        const bool segment = isSegmentBreak(block.position() - 1);
+        if (!segment)
+            ++line;
+
+        const QRectF rect = layout->blockBoundingRect(block);
+        const int top = qRound(rect.top()) - offset;
+        if (top > event->rect().bottom())
+            break;
+        if (segment || !block.isVisible() || top + rect.height() < event->rect().top())
+            continue;
+
+        const int height = block.layout()->lineCount() > 0
+                ? qRound(block.layout()->lineAt(0).height()) : fontMetrics().height();
+        painter.drawText(0, top, width, height, Qt::AlignRight | Qt::AlignVCenter,
+                         QString::number(line + 1));
+    }
+}
+
+void TextEditor::checkWindowBounds()
+{
+    if (!buffer || recenterPending)
+        return;
+
+    QScrollBar *bar = verticalScrollBar();
+    bool atTop = bar->value() == bar->minimum() && windowStart > 0;
+    bool atBottom = bar->value() == bar->maximum() && windowEnd < buffer->size();
+    if (atTop || atBottom) {
+        // Defer the reload so we never replace the text mid-scroll
+        recenterPending = true;
+        QTimer::singleShot(0, this, &TextEditor::recenterWindow);
+    }
+}
+
+void TextEditor::recenterWindow()
+{
+    recenterPending = false;
+    if (!buffer)
+        return;
+
+    // Keep the line at the top of the viewport in place while the window moves
+    QTextCursor top = cursorForPosition(QPoint(0, 0));
+    const qint64 anchorLine = lineOfBlock(top.block());
+    top.movePosition(QTextCursor::StartOfBlock);
+    const qint64 anchor = byteOffsetOf(top.position());
+
+    commitWindow();
+    int walked = 0;
+    const qint64 start = walkLinesBack(anchor, WindowMarginLines, &walked);
+    loadWindow(start, indexReady ? lineIndex.lineAt(*buffer, start) : anchorLine - walked);
+
+    // The anchor may be a segment in the middle of a line
+    const QTextBlock block = document()->findBlock(positionOf(anchor));
+    setTextCursor(QTextCursor(block));
+    scrollToBlock(block.blockNumber());
+}
+
+void TextEditor::scrollToLine(int line)
+{
+    if (!buffer)
+        return;
+
+    // Stay inside the loaded window when it already covers the target
+    const qint64 relative = line - windowFirstLine;
+    const int windowLines = document()->blockCount() - segmentBreaks.size();
+    const bool covered = relative >= 0 && relative < windowLines
+            && (relative + visibleLineCount() <= windowLines || windowEnd == buffer->size());
+    if (covered) {
+        scrollToBlock(blockOfLine(relative).blockNumber());
+        return;
+    }
+
+    commitWindow();
+    loadWindowAtLine(qMax<qint64>(0, line - WindowMarginLines));
+    scrollToBlock(blockOfLine(qMax<qint64>(0, line - windowFirstLine)).blockNumber());
+}
+
+void TextEditor::updateLineScrollBar()
+{
+    if (!buffer)
+        return;
+
+    // Until the index is ready the total is estimated from the lines seen so far
+    qint64 total = lineIndex.lineCount();
+    if (!indexReady) {
+        total = qMax<qint64>(windowFirstLine + document()->blockCount() - segmentBreaks.size(),
+                             buffer->size() / qMax<qint64>(1, averageLineLength));
+    }
+
+    const qint64 top = lineOfBlock(cursorForPosition(QPoint(0, 0)).block());
+    const QSignalBlocker blocker(lineScrollBar);
+    lineScrollBar->setRange(0, int(qBound<qint64>(0, total - 1, INT_MAX)));
+    lineScrollBar->setPageStep(visibleLineCount());
+    lineScrollBar->setValue(int(qMin<qint64>(top, INT_MAX)));
+}
+
+void TextEditor::lineIndexFinished()
+{
+    if (!buffer || !indexWatcher)
+        return;
+
+    const LineIndex result = indexWatcher->result();
+    indexWatcher->deleteLater();
+    indexWatcher = nullptr;
+
+    // The table changed while we were scanning a snapshot of it
+    if (indexedRevision != buffer->revision()) {
+        startLineIndex();
+        return;
+    }
+
+    lineIndex = result;
+    indexReady = true;
+    windowFirstLine = lineIndex.lineAt(*buffer, windowStart);
+    updateLineScrollBar();
+    updateLineNumberWidth();
+    emit lineIndexReady(lineIndex.lineCount());
+
+    if (pendingLine >= 0) {
+        const qint64 line = pendingLine;
+        pendingLine = -1;
+        goToLine(line);
+    }
+}
+
+void TextEditor::updateSearchHighlights()
+{
+    const bool useExpression = !highlightExpression.pattern().isEmpty();
+    if (highlightSearcher.isEmpty() && !useExpression) {
+        if (highlightCount > 0)
+            setExtraSelections(QList<QTextEdit::ExtraSelection>());
+        highlightCount = 0;
+        return;
+    }
+
+    QTextCharFormat format;
+    format.setBackground(QColor(255, 230, 100));
+
+    QList<QTextEdit::ExtraSelection> selections;
+    auto addSelection = [&](const QTextBlock &block, int position, int length) {
+        QTextEdit::ExtraSelection selection;
+        selection.format = format;
+        selection.cursor = QTextCursor(document());
+        selection.cursor.setPosition(block.position() + position);
+        selection.cursor.setPosition(block.position() + position + length, QTextCursor::KeepAnchor);
+        selections.append(selection);
+    };
+
+    const QTextBlock first = cursorForPosition(QPoint(0, 0)).block();
+    const QTextBlock last = cursorForPosition(QPoint(viewport()->width(), viewport()->height())).block();
+    for (QTextBlock block = first; block.isValid(); block = block.next()) {
+        const QString text = block.text();
+        if (useExpression) {
+            QRegularExpressionMatchIterator matches = highlightExpression.globalMatch(text);
+            while (matches.hasNext()) {
+                const QRegularExpressionMatch match = matches.next();
+                if (match.capturedLength() > 0)
+                    addSelection(block, match.capturedStart(), match.capturedLength());
+            }
+        } else {
+            const int length = highlightSearcher.length();
+            qint64 found = highlightSearcher.indexIn(text.constData(), text.size());
+            while (found >= 0) {
+                addSelection(block, int(found), length);
+                found = highlightSearcher.indexIn(text.constData(), text.size(), found + length);
+            }
+        }
+        if (block == last)
+            break;
+    }
+    setExtraSelections(selections);
+    highlightCount = selections.size();
+}
+
+void TextEditor::loadWindow(qint64 start, qint64 firstLine)
+{
+    windowStart = start;
+    windowFirstLine = firstLine;
+
+    const int lines = visibleLineCount() + 2 * WindowMarginLines;
+    windowEnd = start;
+    for (int i = 0; i < lines && windowEnd < buffer->size() && windowEnd - start < MaxWindowBytes; ++i)
+        windowEnd = lineEndAfter(windowEnd);
+
+    // Edits to the old window were committed to the piece table, whose
+    // history takes over from here
+    QVector<int> breaks;
+    QVector<int> crlf;
+    QVector<int> cr;
+    // Decoded with a state, so that invalid bytes are counted rather than
+    // only turned into replacement characters; a byte order mark is kept
+    // as text like every other byte of the window
+    const QByteArray bytes = buffer->read(windowStart, windowEnd - windowStart);
+    QTextCodec::ConverterState state(QTextCodec::IgnoreHeader);
+    const QString decoded = QTextCodec::codecForName("UTF-8")->toUnicode(bytes.constData(), bytes.size(), &state);
+    if ((state.invalidChars > 0 || state.remainingChars > 0) && !lockedBuffer) {
+        lockedBuffer = true;
+        setReadOnly(true);
+        emit invalidText();
+    }
+    const QString text = segmentLines(foldReturns(decoded, &crlf, &cr), &breaks);
+
+    // The folded returns are kept by document position, past the segment
+    // breaks in front of them
+    for (QVector<int> *returns : {&crlf, &cr}) {
+        int passed = 0;
+        for (int &at : *returns) {
+            while (passed < breaks.size() && breaks.at(passed) < at + passed)
+                ++passed;
+            at += passed;
+        }
+    }
+
+    history->setEnabled(false);
+    segmentBreaks.clear();
+    crlfBreaks.clear();
+    crBreaks.clear();
+    crlfWindow = false;
+    setPlainText(text);
+    segmentBreaks = breaks;
+    crlfBreaks = crlf;
+    crBreaks = cr;
+    crlfWindow = crlf.size() > decoded.count(QLatin1Char('\n')) - crlf.size();
+    history->setEnabled(true);
+    document()->setModified(false);
+
+    if (averageLineLength == 0 && windowEnd > windowStart) {
+        const int windowLines = document()->blockCount() - segmentBreaks.size();
+        averageLineLength = qMax<qint64>(1, (windowEnd - windowStart) / windowLines);
+    }
+    updateLineScrollBar();
+    updateLineNumberWidth();
+}
+
+void TextEditor::loadWindowAtLine(qint64 line)
+{
+    qint64 start = lineOffset(line);
+    qint64 firstLine = line;
+
+    // An estimated offset may land past the end; show the last lines instead
+    if (!indexReady && start >= buffer->size() && start > 0) {
+        int walked = 0;
+        start = walkLinesBack(lineStartAt(buffer->size() - 1), visibleLineCount(), &walked);
+        firstLine = qMax<qint64>(0, buffer->size() / qMax<qint64>(1, averageLineLength) - walked);
+    }
+    loadWindow(start, firstLine);
+}
+
+void TextEditor::scrollToBlock(int blockNumber)
+{
+    QTextBlock block = document()->findBlockByNumber(blockNumber);
+    if (!block.isValid())
+        return;
+    QRectF rect = document()->documentLayout()->blockBoundingRect(block);
+    verticalScrollBar()->setValue(qRound(rect.top()));
+}
+
+void TextEditor::stepBufferHistory(bool forward)
+{
+    const PieceTable::Edit edit = forward ? buffer->nextRedo() : buffer->nextUndo();
+    const qint64 oldNewlines = LineIndex::countNewlines(*buffer, edit.position, edit.removed);
+    if (forward)
+        buffer->redo();
+    else
+        buffer->undo();
+
+    if (indexReady) {
+        lineIndex.update(*buffer, edit.position, edit.removed, oldNewlines, edit.inserted);
+        loadWindowAtLine(qMax<qint64>(0, lineIndex.lineAt(*buffer, edit.position) - WindowMarginLines));
+    } else {
+        loadWindow(lineStartAt(qMin(windowStart, buffer->size())), windowFirstLine);
+    }
+}
+
+bool TextEditor::findInBuffer(const LiteralSearcher &searcher, bool backward)
+{
+    // Search the bytes of the whole file rather than the decoded window
+    commitWindow();
+    const QTextCursor cursor = textCursor();
+    qint64 found;
+    if (backward) {
+        found = searcher.lastIndexIn(*buffer, byteOffsetOf(cursor.selectionStart()) - 1);
+        if (found < 0)
+            found = searcher.lastIndexIn(*buffer, buffer->size());
+    } else {
+        found = searcher.indexIn(*buffer, byteOffsetOf(cursor.selectionEnd()));
+        if (found < 0)
+            found = searcher.indexIn(*buffer, 0);
+    }
+
+    if (found < 0)
+        return false;
+    selectBufferRange(found, searcher.byteLength());
+    return true;
+}
+
+bool TextEditor::findInBuffer(const QRegularExpression &expression, bool backward)
+{
+    commitWindow();
+    const QTextCursor cursor = textCursor();
+    const qint64 from = byteOffsetOf(backward ? cursor.selectionStart() : cursor.selectionEnd());
+    qint64 offset = -1;
+    qint64 length = 0;
+    if (!searchBuffer(expression, from, backward, &offset, &length)
+            && !searchBuffer(expression, backward ? buffer->size() : 0, backward, &offset, &length))
+        return false;
+
+    selectBufferRange(offset, length);
+    return true;
+}
+
+bool TextEditor::searchBuffer(const QRegularExpression &expression, qint64 from, bool backward,
+                              qint64 *offset, qint64 *length) const
+{
+    // Decode whole lines a few megabytes at a time. Each window reads on a
+    // little so that matches may run past its end; only those starting in
+    // it count, the rest are found by the next window.
+    const qint64 windowSize = 4 * 1024 * 1024;
+    const qint64 overlap = 64 * 1024;
+    auto readPast = [&](qint64 start, qint64 end, int *owned) {
+        const qint64 past = end < buffer->size() ? lineEndAfter(qMin(buffer->size(), end + overlap) - 1) : end;
+        const QString text = QString::fromUtf8(buffer->read(start, end - start));
+        if (owned)
+            *owned = text.size();
+        return text + QString::fromUtf8(buffer->read(end, past - end));
+    };
+    auto report = [&](qint64 start, const QString &text, const QRegularExpressionMatch &match) {
+        *offset = start + text.left(match.capturedStart()).toUtf8().size();
+        *length = match.captured().toUtf8().size();
+    };
+
+    if (!backward) {
+        qint64 start = lineStartAt(from);
+        while (start < buffer->size()) {
+            const qint64 end = lineEndAfter(qMin(buffer->size(), start + windowSize) - 1);
+            int owned;
+            const QString text = readPast(start, end, &owned);
+            const int skip = QString::fromUtf8(buffer->read(start, qMax<qint64>(0, from - start))).size();
+            const QRegularExpressionMatch match = expression.match(text, skip);
+            if (match.hasMatch() && (match.capturedStart() < owned || end == buffer->size())) {
+                report(start, text, match);
+                return true;
+            }
+            start = end;
+        }
+        return false;
+    }
+
+    qint64 end = lineEndAfter(qMax<qint64>(0, from - 1));
+    while (end > 0) {
+        const qint64 start = lineStartAt(qMax<qint64>(0, end - windowSize));
+        const QString text = readPast(start, end, nullptr);
+        const int limit = QString::fromUtf8(buffer->read(start, qMin(from, end) - start)).size();
+
+        // Keep the last match that starts before the limit
+        QRegularExpressionMatch last;
+        QRegularExpressionMatchIterator matches = expression.globalMatch(text);
+        while (matches.hasNext()) {
+            const QRegularExpressionMatch match = matches.next();
+            if (match.capturedStart() >= limit)
+                break;
+            last = match;
+        }
+        if (last.hasMatch()) {
+            report(start, text, last);
+            return true;
+        }
+        end = start;
+    }
+    return false;
+}
+
+void TextEditor::selectBufferRange(qint64 offset, qint64 length)
+{
+    if (offset < windowStart || offset + length > windowEnd) {
+        int walked = 0;
+        const qint64 start = walkLinesBack(lineStartAt(offset), WindowMarginLines, &walked);
+        const qint64 firstLine = indexReady ? lineIndex.lineAt(*buffer, start)
+                                            : start / qMax<qint64>(1, averageLineLength);
+        loadWindow(start, firstLine);
+    }
+
+    QTextCursor cursor(document());
+    cursor.setPosition(positionOf(offset));
+    cursor.setPosition(positionOf(offset + length), QTextCursor::KeepAnchor);
+    setTextCursor(cursor);
+}
+
+void TextEditor::startLineIndex()
+{
+    cancelLineIndex();
+    indexCancelled = false;
+    indexedRevision = buffer->revision();
+
+    const PieceTable snapshot = buffer->snapshot();
+    const std::atomic<bool> *cancelled = &indexCancelled;
+    indexWatcher = new QFutureWatcher<LineIndex>(this);
+    connect(indexWatcher, &QFutureWatcherBase::finished, this, &TextEditor::lineIndexFinished);
+    indexWatcher->setFuture(QtConcurrent::run([snapshot, cancelled]() {
+        return LineIndex::build(snapshot, cancelled);
+    }));
+}
+
+void TextEditor::cancelLineIndex()
+{
+    if (!indexWatcher)
+        return;
+
+    indexCancelled = true;
+    indexWatcher->disconnect(this);
+    indexWatcher->waitForFinished();
+    indexWatcher->deleteLater();
+    indexWatcher = nullptr;
+}
+
+void TextEditor::updateViewportMargins()
+{
+    setViewportMargins(lineNumberAreaWidth(), 0, buffer ? lineScrollBar->sizeHint().width() : 0, 0);
+
+    const QRect rect = contentsRect();
+    lineNumberArea->setGeometry(rect.left(), rect.top(), lineNumberAreaWidth(), rect.height());
+}
+
+int TextEditor::visibleLineCount() const
+{
+    return qMax(1, viewport()->height() / qMax(1, fontMetrics().lineSpacing()));
+}
+
+qint64 TextEditor::lineOffset(qint64 line) const
+{
+    if (indexReady)
+        return lineIndex.lineOffset(*buffer, line);
+
+    // Without an index, estimate from the average line length and snap to
+    // the next line start
+    const qint64 estimate = qMin(buffer->size(), line * qMax<qint64>(1, averageLineLength));
+    return estimate == 0 ? 0 : lineEndAfter(estimate - 1);
+}
+
+qint64 TextEditor::lineStartAt(qint64 offset) const
+{
+    if (offset <= 0)
+        return 0;
+
+    const qint64 newline = buffer->lastIndexOf('\n', offset, MaxLineScan);
+    if (newline >= 0)
+        return newline + 1;
+
+    // No line break nearby: cut on a UTF-8 character boundary instead
+    qint64 start = qMax<qint64>(0, offset - MaxLineScan);
+    while (start > 0 && (buffer->read(start, 1).at(0) & 0xC0) == 0x80)
+        --start;
+    return start;
+}
+
+qint64 TextEditor::lineEndAfter(qint64 offset) const
+{
+    if (offset >= buffer->size())
+        return buffer->size();
+
+    const qint64 newline = buffer->indexOf('\n', offset, MaxLineScan);
+    if (newline >= 0)
+        return newline + 1;
+
+    qint64 end = qMin(buffer->size(), offset + MaxLineScan);
+    while (end < buffer->size() && (buffer->read(end, 1).at(0) & 0xC0) == 0x80)
+        --end;
+    return end;
+}
+
+qint64 TextEditor::walkLinesBack(qint64 offset, int count, int *walked) const
+{
+    qint64 start = offset;
+    int steps = 0;
+    while (steps < count && start > 0 && offset - start < MaxWindowBytes / 2) {
+        start = lineStartAt(start - 1);
+        ++steps;
+    }
+    if (walked)
+        *walked = steps;
+    return start;
+}
+
+qint64 TextEditor::byteOffsetOf(int position) const
+{
+    // Every "\r\n" in front is a byte longer than the break it became
+    const int returns = int(std::lower_bound(crlfBreaks.begin(), crlfBreaks.end(), position)
+                            - crlfBreaks.begin());
+    return windowStart + windowText().left(position - breaksBefore(position)).toUtf8().size() + returns;
+}
+
+int TextEditor::positionOf(qint64 offset) const
+{
+    const QString text = QString::fromUtf8(buffer->read(windowStart, offset - windowStart));
+    const int textOffset = text.size() - text.count(QLatin1String("\r\n"));
+
+    // Each break at or before the position found so far pushes it one on
+    int position = textOffset;
+    for (int at : segmentBreaks) {
+        if (at >= position)
+            break;
+        ++position;
+    }
+    return position;
+}
+
+int TextEditor::breaksBefore(int position) const
+{
+    return int(std::lower_bound(segmentBreaks.begin(), segmentBreaks.end(), position)
+               - segmentBreaks.begin());
+}
+
+bool TextEditor::isSegmentBreak(int position) const
+{
+    return !segmentBreaks.isEmpty()
+            && std::binary_search(segmentBreaks.begin(), segmentBreaks.end(), position);
+}
+
+qint64 TextEditor::lineOfBlock(const QTextBlock &block) const
+{
+    return windowFirstLine + block.blockNumber() - breaksBefore(block.position());
+}
+
+QTextBlock TextEditor::blockOfLine(qint64 line) const
+{
+    if (segmentBreaks.isEmpty())
+        return document()->findBlockByNumber(int(line));
+
+    // The first block whose line is at least line; lines only grow with
+    // the block number
+    int low = 0;
+    int high = document()->blockCount() - 1;
+    while (low < high) {
+        const int middle = (low + high) / 2;
+        if (lineOfBlock(document()->findBlockByNumber(middle)) - windowFirstLine < line)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return document()->findBlockByNumber(low);
+}
+
+QString TextEditor::segmentLines(const QString &text, QVector<int> *breaks)
+{
+    breaks->clear();
+    QString shown;
+    int copied = 0;
+    int lineStart = 0;
+    while (lineStart < text.size()) {
+        int lineEnd = text.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd < 0)
+            lineEnd = text.size();
+
+        // Never between the two halves of a surrogate pair
+        if (lineEnd - lineStart > LongLineLength) {
+            if (shown.isEmpty())
+                shown.reserve(text.size() + text.size() / SegmentLength + 1);
+            for (int cut = lineStart + SegmentLength; cut < lineEnd; cut += SegmentLength) {
+                if (text.at(cut - 1).isHighSurrogate())
+                    --cut;
+                shown.append(text.midRef(copied, cut - copied));
+                breaks->append(shown.size());
+                shown.append(QLatin1Char('\n'));
+                copied = cut;
+            }
+        }
+        lineStart = lineEnd + 1;
+    }
+
+    if (breaks->isEmpty())
+        return text;
+    shown.append(text.midRef(copied));
+    return shown;
+}
+
+QString TextEditor::foldReturns(const QString &text, QVector<int> *crlf, QVector<int> *cr)
+{
+    crlf->clear();
+    cr->clear();
+    if (!text.contains(QLatin1Char('\r')))
+        return text;
+
+    // Both become '\n'; where they were is recorded by offset in the result
+    QString folded;
+    folded.reserve(text.size());
+    int copied = 0;
+    for (int i = text.indexOf(QLatin1Char('\r')); i >= 0; i = text.indexOf(QLatin1Char('\r'), i + 1)) {
+        folded.append(text.midRef(copied, i - copied));
+        const bool pair = i + 1 < text.size() && text.at(i + 1) == QLatin1Char('\n');
+        (pair ? crlf : cr)->append(folded.size());
+        folded.append(QLatin1Char('\n'));
+        copied = pair ? i + 2 : i + 1;
+    }
+    folded.append(text.midRef(copied));
+    return folded;
+}
+
+QString TextEditor::windowText(bool withReturns) const
+{
+    // toPlainText() would also turn non-breaking spaces into spaces
+    QString text = document()->toRawText();
+
+    // Segment breaks are only there for the layout
+    if (!segmentBreaks.isEmpty()) {
+        QChar *data = text.data();
+        int kept = segmentBreaks.first();
+        for (int i = 0; i < segmentBreaks.size(); ++i) {
+            const int from = segmentBreaks.at(i) + 1;
+            const int to = i + 1 < segmentBreaks.size() ? segmentBreaks.at(i + 1) : text.size();
+            std::copy(data + from, data + to, data + kept);
+            kept += to - from;
+        }
+        text.truncate(kept);
+    }
+
+    text.replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    text.replace(QChar::LineSeparator, QLatin1Char('\n'));
+    if (!withReturns || (crlfBreaks.isEmpty() && crBreaks.isEmpty()))
+        return text;
+
+    // The line endings go back the way the bytes had them
+    for (int at : crBreaks)
+        text[at - breaksBefore(at)] = QLatin1Char('\r');
+    QString restored;
+    restored.reserve(text.size() + crlfBreaks.size());
+    int copied = 0;
+    for (int at : crlfBreaks) {
+        const int offset = at - breaksBefore(at);
+        restored.append(text.midRef(copied, offset - copied));
+        restored.append(QLatin1Char('\r'));
+        copied = offset;
+    }
+    restored.append(text.midRef(copied));
+    return restored;
 }
\ No newline at end of file
@@ -7,6 +7,22 @@
 #include <QTextCharFormat>
 #include <QFont>
 #include <QColor>
+#include <QScopedPointer>
+#include <QFutureWatcher>
+#include <QScrollBar>
+#include <QRegularExpression>
+#include <atomic>
+#include "PieceTable.h"
+#include "LineIndex.h"
+#include "LiteralSearcher.h"
+#include "EditHistory.h"
+#include "FormatRunStore.h"
+
+class LineNumberArea;
+class LatencyMonitor;
+struct PendingWork;
+struct Preferences;
+class QTimer;
 
 class TextEditor : public QTextEdit
 {
@@ -14,8 +30,86 @@ class TextEditor : public QTextEdit
 
 public:
     explicit TextEditor(QWidget *parent = nullptr);
+    ~TextEditor();
+
+    // Large documents live in a piece table; only the lines around the
+    // viewport are decoded into the QTextDocument at a time
+    void openBuffer(PieceTable *table, bool locked = false);
+    void closeBuffer();
+    PieceTable *takeBuffer();
+    bool hasBuffer() const { return !buffer.isNull(); }
+    // Windows are decoded as UTF-8, and an edit writes the whole window
+    // back; a buffer that is not valid UTF-8 would come back with its bad
+    // bytes turned into replacement characters, so it is only shown. The
+    // first window found invalid locks it and emits invalidText().
+    bool isBufferLocked() const { return lockedBuffer; }
+    PieceTable *pieceTable() const { return buffer.data(); }
+    void commitWindow();
+
+    bool isModified() const;
+    void setModified(bool modified);
+
+    // Line numbers, font, colours, wrapping and tab width; only what
+    // differs is set, as a new font or wrap mode lays out the whole
+    // document again
+    void setPreferences(const Preferences &preferences);
+
+    // New editors start empty; the window fills in the sample text once
+    // it has been drawn
+    void showWelcomeText();
+
+    // Replaces the document's undo stack; code that edits the document
+    // directly should prepare() the range it changes first
+    EditHistory *editHistory() const { return history; }
+
+    // Very large pastes go in a chunk per event loop iteration inside one
+    // edit block, so the layout happens once at the end and the undo entry
+    // is built from the pasted text; a cancelled paste leaves the document
+    // as it was
+    bool isPasting() const { return pasteOffset >= 0; }
+    void cancelPaste();
+
+    // Key presses are timed to the paint that shows them; nullptr stops it
+    void setLatencyMonitor(LatencyMonitor *latencyMonitor) { monitor = latencyMonitor; }
+    // Counts of what is still queued or running for this editor, for slow
+    // event reports
+    PendingWork pendingWork() const;
+
+    // The format runs over the whole document, to keep them while it is
+    // spilled; in buffer mode they only cover the loaded window
+    QVector<QTextLayout::FormatRange> formatRanges() const;
+    void setFormatRanges(const QVector<QTextLayout::FormatRange> &ranges);
+
+    // Line numbers are zero-based and refer to the whole document, not
+    // just the loaded window; lineCount() is -1 while still indexing
+    qint64 cursorLine() const;
+    int cursorColumn() const;
+    qint64 lineCount() const;
+    bool isLineIndexReady() const { return indexReady; }
+    void goToLine(qint64 line);
+
+    // Selects the next match after the selection (or the previous one
+    // before it), wrapping around the document
+    bool findText(const LiteralSearcher &searcher, bool backward = false);
+    bool findText(const QRegularExpression &expression, bool backward = false);
+    void setSearchHighlight(const LiteralSearcher &searcher);
+    void setSearchHighlight(const QRegularExpression &expression);
+
+    // Call after changing pieceTable() directly; reloads the window and
+    // reindexes the lines
+    void reloadBuffer();
+
+    // The gutter only paints the blocks on screen, and only changes width
+    // when the number of digits in the line count does
+    void setLineNumbersVisible(bool visible);
+    bool lineNumbersVisible() const { return showLineNumbers; }
+    int lineNumberAreaWidth() const;
+    void paintLineNumbers(QPaintEvent *event);
 
 public slots:
+    void undo();
+    void redo();
+    void cut();
     void setFontBold(bool bold);
     void setFontItalic(bool italic);
     void setFontUnderline(bool underline);
@@ -27,16 +121,133 @@ public slots:
 
 protected:
     void contextMenuEvent(QContextMenuEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
+    void inputMethodEvent(QInputMethodEvent *event) override;
+    void dropEvent(QDropEvent *event) override;
+    void insertFromMimeData(const QMimeData *source) override;
+    QMimeData *createMimeDataFromSelection() const override;
+    void resizeEvent(QResizeEvent *event) override;
+    void changeEvent(QEvent *event) override;
 
 private slots:
     void currentCharFormatChanged(const QTextCharFormat &format);
+    void checkWindowBounds();
+    void recenterWindow();
+    void scrollToLine(int line);
+    void updateLineScrollBar();
+    void lineIndexFinished();
+    void updateSearchHighlights();
+    void updateLineNumberWidth();
+    void updateFormatRuns();
+    void shiftFormatRuns(int position, int charsRemoved, int charsAdded);
+    void shiftSegmentBreaks(int position, int charsRemoved, int charsAdded);
+    void shiftReturnBreaks(int position, int charsRemoved, int charsAdded);
+    void resegmentWindow();
+    void pasteChunk();
 
 private:
     void mergeFormatOnWordOrSelection(const QTextCharFormat &format);
+    QTextCharFormat cursorFormat() const;
+    void loadWindow(qint64 start, qint64 firstLine);
+    void loadWindowAtLine(qint64 line);
+    void scrollToBlock(int blockNumber);
+    void stepBufferHistory(bool forward);
+    void skipSegmentBreak(QKeyEvent *event);
+    void startPaste(const QString &text);
+    void finishPaste();
+    bool findInBuffer(const LiteralSearcher &searcher, bool backward);
+    bool findInBuffer(const QRegularExpression &expression, bool backward);
+    bool searchBuffer(const QRegularExpression &expression, qint64 from, bool backward,
+                      qint64 *offset, qint64 *length) const;
+    void selectBufferRange(qint64 offset, qint64 length);
+    void startLineIndex();
+    void cancelLineIndex();
+    void updateViewportMargins();
+    void updateDigitWidth();
+    QTextBlock firstVisibleBlock() const;
+    int visibleLineCount() const;
+    qint64 lineOffset(qint64 line) const;
+    qint64 lineStartAt(qint64 offset) const;
+    qint64 lineEndAfter(qint64 offset) const;
+    qint64 walkLinesBack(qint64 offset, int count, int *walked) const;
+    qint64 byteOffsetOf(int position) const;
+    int positionOf(qint64 offset) const;
+    int breaksBefore(int position) const;
+    bool isSegmentBreak(int position) const;
+    qint64 lineOfBlock(const QTextBlock &block) const;
+    QTextBlock blockOfLine(qint64 line) const;
+    static QString segmentLines(const QString &text, QVector<int> *breaks);
+    static QString foldReturns(const QString &text, QVector<int> *crlf, QVector<int> *cr);
+    QString windowText(bool withReturns = false) const;
+
+    EditHistory *history;
+    LatencyMonitor *monitor;
+
+    QScopedPointer<PieceTable> buffer;
+    qint64 windowStart;
+    qint64 windowEnd;
+    qint64 windowFirstLine;
+    qint64 averageLineLength;
+    bool recenterPending;
+    QScrollBar *lineScrollBar;
+
+    // Lines too long to lay out as one block are cut into segments in the
+    // window; these are the document positions of the block breaks that
+    // cut them, which are not part of the text
+    QVector<int> segmentBreaks;
+    bool resegmentPending;
+
+    // QTextCursor turns "\r\n" and a lone '\r' into one block break, so
+    // these are the document positions of the breaks that stood for them
+    // in the window's bytes. Breaks typed into a window whose lines mostly
+    // end in "\r\n" get one as well.
+    QVector<int> crlfBreaks;
+    QVector<int> crBreaks;
+    bool crlfWindow;
+    bool lockedBuffer;
+
+    LineIndex lineIndex;
+    bool indexReady;
+    qint64 pendingLine;
+    quint64 indexedRevision;
+    QFutureWatcher<LineIndex> *indexWatcher;
+    std::atomic<bool> indexCancelled;
+
+    LineNumberArea *lineNumberArea;
+    bool showLineNumbers;
+    int lineNumberDigits;
+    int digitWidth;
+
+    LiteralSearcher highlightSearcher;
+    QRegularExpression highlightExpression;
+    // Size of the extra selections, which are copied out on every read
+    int highlightCount;
+
+    // Formatting from the format actions; it is drawn as layout formats on
+    // the blocks on screen and never stored in the document
+    FormatRunStore formatRuns;
+
+    // pasteOffset is -1 unless a paste is running; the edit block is only
+    // open once the first chunk went in
+    QString pasteText;
+    QString pasteReplaced;
+    int pasteOffset;
+    int pasteStart;
+    bool pasteOpen;
+    bool pasteHadFocus;
+    QTextCursor pasteCursor;
+    QTextCharFormat pasteFormat;
+    QTimer *pasteTimer;
 
 signals:
     void fontChanged(const QFont &font);
     void colorChanged(const QColor &color);
+    void lineIndexReady(qint64 lines);
+    void pasteStarted();
+    void pasteProgress(qint64 done, qint64 total);
+    void pasteFinished();
+    void invalidText();
 };
 
 #endif // TEXTEDITOR_H
\ No newline at end of file
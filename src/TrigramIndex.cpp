@@ -0,0 +1,548 @@
+#include "TrigramIndex.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Larger files are listed but not indexed, and are always candidates
+static const qint64 MaxIndexedFileSize = 16 * 1024 * 1024;
+
+// Changed files read in parallel before the index is updated
+static const int UpdateBatch = 256;
+
+// Bytes checked for a NUL to tell binary files apart
+static const int BinaryProbe = 8192;
+
+static const quint32 IndexMagic = 0x54524731; // "TRG1"
+static const quint32 IndexVersion = 1;
+
+static inline quint32 foldByte(uchar byte)
+{
+    return byte >= 'A' && byte <= 'Z' ? quint32(byte + ('a' - 'A')) : quint32(byte);
+}
+
+static inline quint32 trigramAt(const char *data)
+{
+    return foldByte(uchar(data[0])) << 16 | foldByte(uchar(data[1])) << 8 | foldByte(uchar(data[2]));
+}
+
+// Sorted distinct trigrams of a file; none for binary or oversized files
+static QVector<quint32> fileTrigrams(const QString &fileName)
+{
+    QVector<quint32> result;
+    QFile file(fileName);
+    if (file.size() > MaxIndexedFileSize || !file.open(QIODevice::ReadOnly))
+        return result;
+    const QByteArray data = file.readAll();
+    if (std::memchr(data.constData(), 0, size_t(qMin(data.size(), BinaryProbe))))
+        return result;
+
+    // One bit per possible trigram to drop duplicates; only the bits that
+    // were set are cleared again, so the table is reused cheaply
+    thread_local std::vector<quint64> seen(size_t(1) << 18);
+    const char *bytes = data.constData();
+    for (int i = 0; i + 3 <= data.size(); ++i) {
+        const quint32 trigram = trigramAt(bytes + i);
+        quint64 &word = seen[trigram >> 6];
+        const quint64 bit = quint64(1) << (trigram & 63);
+        if (!(word & bit)) {
+            word |= bit;
+            result.append(trigram);
+        }
+    }
+    for (quint32 trigram : qAsConst(result))
+        seen[trigram >> 6] = 0;
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+static QVector<quint32> intersect(const QVector<quint32> &a, const QVector<quint32> &b)
+{
+    QVector<quint32> result;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+    return result;
+}
+
+TrigramIndex::TrigramIndex(QObject *parent)
+    : QObject(parent)
+    , updating(false)
+    , loaded(false)
+    , fullRefreshQueued(false)
+    , currentGeneration(0)
+    , removedFiles(0)
+{
+}
+
+TrigramIndex::~TrigramIndex()
+{
+    ++currentGeneration;
+    future.waitForFinished();
+}
+
+void TrigramIndex::setRoot(const QString &root)
+{
+    // Stop any update of the previous workspace before dropping its data
+    ++currentGeneration;
+    future.waitForFinished();
+    updating = false;
+
+    {
+        QWriteLocker locker(&lock);
+        files.clear();
+        fileIds.clear();
+        postings.clear();
+        removedFiles = 0;
+    }
+    rootPath = root;
+    loaded = false;
+    fullRefreshQueued = false;
+    queuedFiles.clear();
+
+    if (!rootPath.isEmpty())
+        refresh();
+}
+
+void TrigramIndex::refresh()
+{
+    if (rootPath.isEmpty())
+        return;
+    fullRefreshQueued = true;
+    queuedFiles.clear();
+    start();
+}
+
+void TrigramIndex::refresh(const QStringList &fileNames)
+{
+    if (rootPath.isEmpty())
+        return;
+    for (const QString &fileName : fileNames) {
+        if (fileName.startsWith(rootPath + QLatin1Char('/'))
+                && !fileName.mid(rootPath.size()).contains(QLatin1String("/.")))
+            queuedFiles.insert(fileName);
+    }
+    start();
+}
+
+void TrigramIndex::start()
+{
+    // A running update picks the queued work up when it finishes
+    if (updating || (!fullRefreshQueued && queuedFiles.isEmpty()))
+        return;
+
+    const QStringList only = fullRefreshQueued ? QStringList() : queuedFiles.values();
+    const bool loadSaved = !loaded;
+    fullRefreshQueued = false;
+    queuedFiles.clear();
+    loaded = true;
+    updating = true;
+
+    const quint64 generation = ++currentGeneration;
+    const QString root = rootPath;
+    future = QtConcurrent::run([this, generation, root, only, loadSaved]() {
+        update(generation, root, only, loadSaved);
+    });
+}
+
+void TrigramIndex::update(quint64 generation, const QString &root, const QStringList &only, bool loadSaved)
+{
+    if (loadSaved && load(root)) {
+        const int count = files.size() - removedFiles;
+        QMetaObject::invokeMethod(this, [this, generation, count]() {
+            if (generation == currentGeneration)
+                emit updated(count);
+        }, Qt::QueuedConnection);
+    }
+
+    // List the workspace, leaving out hidden files and directories
+    QStringList paths = only;
+    if (only.isEmpty()) {
+        QDirIterator it(root, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            if (generation != currentGeneration)
+                return;
+            const QString path = it.next();
+            if (!path.mid(root.size()).contains(QLatin1String("/.")))
+                paths.append(path);
+        }
+    } else {
+        // A directory stands for the files under it
+        for (const QString &dir : only) {
+            if (!QFileInfo(dir).isDir())
+                continue;
+            QDirIterator it(dir, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                const QString path = it.next();
+                if (!path.mid(root.size()).contains(QLatin1String("/.")))
+                    paths.append(path);
+            }
+        }
+    }
+
+    // Compare sizes and modification times with what was indexed
+    struct Stat
+    {
+        QString path;
+        qint64 size;
+        qint64 modified;
+    };
+    QVector<Stat> changed;
+    QVector<int> stale;
+    QSet<QString> present;
+    for (const QString &path : qAsConst(paths)) {
+        const QFileInfo info(path);
+        const bool exists = info.isFile();
+        const qint64 modified = exists ? info.lastModified().toMSecsSinceEpoch() : 0;
+
+        QReadLocker locker(&lock);
+        const int id = fileIds.value(path, -1);
+        if (!exists) {
+            if (id >= 0) {
+                stale.append(id);
+            } else if (!info.exists()) {
+                // A removed directory takes every file under it along
+                const QString prefix = path + QLatin1Char('/');
+                for (auto it = fileIds.constBegin(); it != fileIds.constEnd(); ++it) {
+                    if (it.key().startsWith(prefix))
+                        stale.append(it.value());
+                }
+            }
+            continue;
+        }
+        present.insert(path);
+        if (id >= 0 && files.at(id).size == info.size() && files.at(id).modified == modified)
+            continue;
+        if (id >= 0)
+            stale.append(id);
+        changed.append({path, info.size(), modified});
+    }
+
+    if (only.isEmpty()) {
+        QReadLocker locker(&lock);
+        for (auto it = fileIds.constBegin(); it != fileIds.constEnd(); ++it) {
+            if (!present.contains(it.key()))
+                stale.append(it.value());
+        }
+    }
+
+    if (!stale.isEmpty())
+        removeFiles(stale);
+
+    // Read changed files in parallel batches; each batch becomes visible
+    // to queries as soon as it is merged
+    for (int first = 0; first < changed.size(); first += UpdateBatch) {
+        if (generation != currentGeneration)
+            return;
+
+        const int count = qMin(UpdateBatch, changed.size() - first);
+        QStringList batch;
+        for (int i = first; i < first + count; ++i)
+            batch.append(changed.at(i).path);
+        const QList<QVector<quint32>> trigrams = QtConcurrent::blockingMapped(batch, fileTrigrams);
+
+        {
+            QWriteLocker locker(&lock);
+            for (int i = 0; i < count; ++i) {
+                const Stat &stat = changed.at(first + i);
+                const quint32 id = quint32(files.size());
+                files.append({stat.path, stat.size, stat.modified});
+                fileIds.insert(stat.path, int(id));
+                for (quint32 trigram : trigrams.at(i))
+                    postings[trigram].append(id);
+            }
+        }
+
+        const int done = first + count;
+        const int total = changed.size();
+        QMetaObject::invokeMethod(this, [this, generation, done, total]() {
+            if (generation == currentGeneration)
+                emit progress(done, total);
+        }, Qt::QueuedConnection);
+    }
+
+    if (!stale.isEmpty() || !changed.isEmpty()) {
+        compact();
+        save(root);
+    }
+
+    QMetaObject::invokeMethod(this, [this, generation]() {
+        updateFinished(generation);
+    }, Qt::QueuedConnection);
+}
+
+void TrigramIndex::updateFinished(quint64 generation)
+{
+    if (generation != currentGeneration)
+        return;
+
+    updating = false;
+    int count;
+    {
+        QReadLocker locker(&lock);
+        count = files.size() - removedFiles;
+    }
+    emit updated(count);
+    start();
+}
+
+void TrigramIndex::removeFiles(const QVector<int> &ids)
+{
+    QWriteLocker locker(&lock);
+    std::vector<bool> removed(size_t(files.size()), false);
+    for (int id : ids) {
+        if (files.at(id).path.isEmpty())
+            continue;
+        fileIds.remove(files.at(id).path);
+        files[id].path.clear();
+        removed[size_t(id)] = true;
+        ++removedFiles;
+    }
+
+    for (auto it = postings.begin(); it != postings.end();) {
+        QVector<quint32> &list = it.value();
+        list.erase(std::remove_if(list.begin(), list.end(), [&removed](quint32 id) {
+            return removed[id];
+        }), list.end());
+        if (list.isEmpty())
+            it = postings.erase(it);
+        else
+            ++it;
+    }
+}
+
+void TrigramIndex::compact()
+{
+    QWriteLocker locker(&lock);
+    if (removedFiles <= files.size() / 4)
+        return;
+
+    // Renumber the live files; the order is kept, so lists stay sorted
+    QVector<quint32> newIds(files.size());
+    QVector<FileEntry> live;
+    live.reserve(files.size() - removedFiles);
+    for (int id = 0; id < files.size(); ++id) {
+        newIds[id] = quint32(live.size());
+        if (!files.at(id).path.isEmpty())
+            live.append(files.at(id));
+    }
+    for (QVector<quint32> &list : postings) {
+        for (quint32 &id : list)
+            id = newIds.at(int(id));
+    }
+
+    files = live;
+    fileIds.clear();
+    for (int id = 0; id < files.size(); ++id)
+        fileIds.insert(files.at(id).path, id);
+    removedFiles = 0;
+}
+
+QStringList TrigramIndex::candidates(const QList<QByteArray> &literals) const
+{
+    QReadLocker locker(&lock);
+
+    // Gather the posting list of every trigram and intersect the shortest first
+    QVector<const QVector<quint32> *> lists;
+    bool missing = false;
+    for (const QByteArray &literal : literals) {
+        for (int i = 0; i + 3 <= literal.size() && !missing; ++i) {
+            const auto it = postings.constFind(trigramAt(literal.constData() + i));
+            if (it == postings.constEnd())
+                missing = true;
+            else
+                lists.append(&it.value());
+        }
+    }
+
+    QStringList result;
+    if (lists.isEmpty() && !missing) {
+        for (const FileEntry &entry : files) {
+            if (!entry.path.isEmpty())
+                result.append(entry.path);
+        }
+        return result;
+    }
+
+    if (!missing) {
+        std::sort(lists.begin(), lists.end(), [](const QVector<quint32> *a, const QVector<quint32> *b) {
+            return a->size() < b->size();
+        });
+        QVector<quint32> ids = *lists.first();
+        for (int i = 1; i < lists.size() && !ids.isEmpty(); ++i)
+            ids = intersect(ids, *lists.at(i));
+
+        for (quint32 id : qAsConst(ids)) {
+            if (!files.at(int(id)).path.isEmpty())
+                result.append(files.at(int(id)).path);
+        }
+    }
+
+    // Files too large to index have no trigrams, so they always have to be read
+    for (const FileEntry &entry : files) {
+        if (!entry.path.isEmpty() && entry.size > MaxIndexedFileSize)
+            result.append(entry.path);
+    }
+    return result;
+}
+
+QList<QByteArray> TrigramIndex::requiredLiterals(const QString &pattern)
+{
+    // Collect runs of plain characters that every match must contain.
+    // Groups and character classes are skipped, anything optional ends a
+    // run, and a top-level alternation means nothing is required.
+    QList<QByteArray> literals;
+    QString run;
+    auto flush = [&]() {
+        if (run.size() >= 3)
+            literals.append(run.toUtf8());
+        run.clear();
+    };
+    auto optionalAt = [&pattern](int i) {
+        if (i >= pattern.size())
+            return false;
+        const QChar ch = pattern.at(i);
+        return ch == QLatin1Char('*') || ch == QLatin1Char('?') || ch == QLatin1Char('{');
+    };
+    auto skipTo = [&pattern](int i, QChar open, QChar close) {
+        int depth = 0;
+        for (; i < pattern.size(); ++i) {
+            const QChar ch = pattern.at(i);
+            if (ch == QLatin1Char('\\'))
+                ++i;
+            else if (ch == open && open != close)
+                ++depth;
+            else if (ch == close && --depth <= 0)
+                return i;
+        }
+        return i;
+    };
+
+    for (int i = 0; i < pattern.size(); ++i) {
+        const QChar ch = pattern.at(i);
+        if (ch == QLatin1Char('\\')) {
+            if (++i >= pattern.size())
+                break;
+            const QChar escaped = pattern.at(i);
+            if (escaped.isLetterOrNumber() || optionalAt(i + 1))
+                flush();
+            else
+                run += escaped;
+            continue;
+        }
+
+        switch (ch.unicode()) {
+        case '|':
+            return QList<QByteArray>();
+        case '[':
+            flush();
+            // A ']' right after the opening bracket is part of the class
+            i = skipTo(i + (pattern.mid(i + 1, 1) == QLatin1String("]") ? 2 : 1),
+                       QLatin1Char(']'), QLatin1Char(']'));
+            break;
+        case '(':
+            flush();
+            i = skipTo(i, QLatin1Char('('), QLatin1Char(')'));
+            break;
+        case '{':
+            flush();
+            i = skipTo(i, QLatin1Char('{'), QLatin1Char('}'));
+            break;
+        case '.': case '^': case '$': case '*': case '+': case '?': case ')': case ']': case '}':
+            flush();
+            break;
+        default:
+            if (optionalAt(i + 1))
+                flush();
+            else
+                run += ch;
+        }
+    }
+    flush();
+    return literals;
+}
+
+QString TrigramIndex::indexFileName(const QString &root)
+{
+    const QByteArray hash = QCryptographicHash::hash(root.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + QLatin1String("/trigrams/") + QString::fromLatin1(hash) + QLatin1String(".idx");
+}
+
+bool TrigramIndex::load(const QString &root)
+{
+    QFile file(indexFileName(root));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version;
+    QString savedRoot;
+    in >> magic >> version;
+    if (magic != IndexMagic || version != IndexVersion)
+        return false;
+    in >> savedRoot;
+    if (savedRoot != root)
+        return false;
+
+    qint32 fileCount;
+    in >> fileCount;
+    QVector<FileEntry> savedFiles;
+    savedFiles.reserve(fileCount);
+    for (qint32 i = 0; i < fileCount && in.status() == QDataStream::Ok; ++i) {
+        FileEntry entry;
+        in >> entry.path >> entry.size >> entry.modified;
+        savedFiles.append(entry);
+    }
+
+    qint32 listCount;
+    in >> listCount;
+    QHash<quint32, QVector<quint32>> savedPostings;
+    savedPostings.reserve(listCount);
+    for (qint32 i = 0; i < listCount && in.status() == QDataStream::Ok; ++i) {
+        quint32 trigram;
+        QVector<quint32> list;
+        in >> trigram >> list;
+        savedPostings.insert(trigram, list);
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    QWriteLocker locker(&lock);
+    files = savedFiles;
+    postings = savedPostings;
+    fileIds.clear();
+    removedFiles = 0;
+    for (int id = 0; id < files.size(); ++id)
+        fileIds.insert(files.at(id).path, id);
+    return true;
+}
+
+void TrigramIndex::save(const QString &root) const
+{
+    const QString fileName = indexFileName(root);
+    QDir().mkpath(QFileInfo(fileName).path());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+
+    // Removed files are written as empty entries so the ids stay valid
+    QDataStream out(&file);
+    QReadLocker locker(&lock);
+    out << IndexMagic << IndexVersion << root;
+    out << qint32(files.size());
+    for (const FileEntry &entry : files)
+        out << entry.path << entry.size << entry.modified;
+    out << qint32(postings.size());
+    for (auto it = postings.constBegin(); it != postings.constEnd(); ++it)
+        out << it.key() << it.value();
+    file.commit();
+}
\ No newline at end of file
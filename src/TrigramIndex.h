@@ -0,0 +1,84 @@
+#ifndef TRIGRAMINDEX_H
+#define TRIGRAMINDEX_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QByteArray>
+#include <QReadWriteLock>
+#include <QFuture>
+#include <atomic>
+
+// Maps every three-byte sequence (ASCII letters folded to lower case) to
+// the workspace files containing it. A query only has to open the files
+// holding all trigrams of its literal parts. The index is kept in the
+// cache directory and brought up to date incrementally on worker threads:
+// only files whose size or modification time changed are read again.
+class TrigramIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TrigramIndex(QObject *parent = nullptr);
+    ~TrigramIndex();
+
+    void setRoot(const QString &root);
+    QString root() const { return rootPath; }
+    bool isUpdating() const { return updating; }
+
+    // Rescans the workspace, or just the given files, in the background. A
+    // directory in the list stands for every file under it, and one that
+    // is gone drops all of them from the index.
+    void refresh();
+    void refresh(const QStringList &fileNames);
+
+    // Files that may contain every one of the given literals; all files
+    // when none of them is long enough to narrow the search. Files too
+    // large to index are always included. Thread-safe.
+    QStringList candidates(const QList<QByteArray> &literals) const;
+
+    // Literal substrings that any match of the expression must contain
+    static QList<QByteArray> requiredLiterals(const QString &pattern);
+
+signals:
+    void progress(int filesDone, int filesTotal);
+    void updated(int fileCount);
+
+private:
+    struct FileEntry
+    {
+        QString path;
+        qint64 size;
+        qint64 modified;
+    };
+
+    void start();
+    void update(quint64 generation, const QString &root, const QStringList &only, bool loadSaved);
+    void updateFinished(quint64 generation);
+    void removeFiles(const QVector<int> &ids);
+    bool load(const QString &root);
+    void save(const QString &root) const;
+    void compact();
+    static QString indexFileName(const QString &root);
+
+    QString rootPath;
+    bool updating;
+    bool loaded;
+    bool fullRefreshQueued;
+    QSet<QString> queuedFiles;
+    QFuture<void> future;
+    std::atomic<quint64> currentGeneration;
+
+    // File ids index files; removed files leave an empty path behind until
+    // the index is compacted. Posting lists hold sorted file ids.
+    mutable QReadWriteLock lock;
+    QVector<FileEntry> files;
+    QHash<QString, int> fileIds;
+    QHash<quint32, QVector<quint32>> postings;
+    int removedFiles;
+};
+
+#endif // TRIGRAMINDEX_H
\ No newline at end of file
@@ -1,20 +1,70 @@
 #include <QApplication>
+#include <QCoreApplication>
 #include <QStyleFactory>
 #include <QDir>
+#include <QFileInfo>
+#include <QMessageBox>
 #include "MainWindow.h"
+#include "SessionRecovery.h"
+#include "StartupTrace.h"
+#include "BatchRunner.h"
 
 int main(int argc, char *argv[])
 {
+    // --batch finds or replaces in files without a window, or a display
+    if (BatchRunner::isRequested(argc, argv)) {
+        QCoreApplication app(argc, argv);
+        app.setApplicationName("Qt Learning Application");
+        app.setApplicationVersion("1.0.0");
+        return BatchRunner().run(app.arguments());
+    }
+
+    // --trace-startup writes the phases up to the first paint, and the
+    // work deferred past it, as a Chrome trace
+    StartupTrace::start(&argc, argv);
+
+    const qint64 applicationStart = StartupTrace::now();
     QApplication app(argc, argv);
+    StartupTrace::complete("QApplication", applicationStart);
     
     // Set application properties
     app.setApplicationName("Qt Learning Application");
     app.setApplicationVersion("1.0.0");
     app.setOrganizationName("Qt Learning");
     
-    // Create and show main window
+    // Create main window
+    const qint64 windowStart = StartupTrace::now();
     MainWindow window;
-    window.show();
+    StartupTrace::complete("MainWindow", windowStart);
+
+    // Journals left behind by a session that did not exit normally are
+    // offered before the window is shown; the newest one is restored
+    const qint64 recoveryStart = StartupTrace::now();
+    const QList<SessionRecovery::Session> sessions = SessionRecovery::orphanedSessions();
+    StartupTrace::complete("orphanedSessions", recoveryStart);
+    if (!sessions.isEmpty()) {
+        const SessionRecovery::Session &session = sessions.first();
+        const QString name = session.header.fileName.isEmpty()
+                ? QString("an untitled document")
+                : QFileInfo(session.header.fileName).fileName();
+        QMessageBox::StandardButton ret;
+        ret = QMessageBox::question(nullptr, "Qt Learning Application",
+                                    QString("The application did not exit normally.\n"
+                                            "Unsaved changes to %1 from %2 were found.\n"
+                                            "Do you want to recover them?")
+                                    .arg(name)
+                                    .arg(session.lastModified.toString(Qt::DefaultLocaleShortDate)),
+                                    QMessageBox::Yes | QMessageBox::Discard | QMessageBox::Ignore);
+        if (ret == QMessageBox::Yes)
+            window.recoverSession(session);
+        else if (ret == QMessageBox::Discard)
+            SessionRecovery::remove(session);
+    }
+
+    {
+        StartupTrace::Scope scope("show");
+        window.show();
+    }
     
     return app.exec();
 }
\ No newline at end of file